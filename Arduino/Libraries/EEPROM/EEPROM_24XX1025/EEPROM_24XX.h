@@ -0,0 +1,912 @@
+#ifndef _24XX_H
+#define _24XX_H
+
+#include <I2C16.h>
+#include <Arduino.h>
+#include <inttypes.h>
+
+/*
+ * Microchip 24XX1025 (and 24XX128 - 24XX512) I2C EEPROM driver for Arduino
+ * Tested with: Arduino Uno R3, Microchip 24LC1025 (5 V, 400 kHz I2C)
+ * Should work with: all Arduino compatible boards, 24XX1025 models
+ *
+ * Written by Thomas Backman <serenity@exscape.org>, August 2012
+ *
+ * Uses a modified version of Wayne Truchsess' I2C Master library:
+ * http://dsscircuits.com/articles/arduino-i2c-master-library.html
+ * Changes were made to support 16-bit addresses and acknowledge polling.
+ * The unmodified version WILL NOT WORK with this code!
+ *
+ * License: MIT/BSD. Basically, do whatever you want, but credit me. Don't say you wrote this.
+ * You CAN modify the code (and spread the modifications) IF you credit me for the original
+ * code, AND add a note that you've changed it.
+ */
+
+/*
+ * The driver is a template on the chip's geometry, so that every size, page and
+ * block calculation is done at compile time (and page arithmetic is shifts and masks):
+ *   capacity  - in bytes
+ *   pageSize  - the most one write can program (at most 128, and a power of two)
+ *   blockBit  - where the block select bit(s) go in the device address, for chips
+ *               larger than the 64 kiB a 16-bit address reaches
+ * The typedefs at the end cover the common parts; all have 16-bit word addresses.
+ */
+
+// Part grades, i.e. the fastest bus speed each supports; see the constructor
+#define EEPROM_24AA 400000UL // 24AA1025; only 100 kHz below 2.5 V!
+#define EEPROM_24LC 400000UL // 24LC1025
+#define EEPROM_24FC 1000000UL // 24FC1025
+
+// The most segments writev() takes at once
+#define EEPROM_MAX_SEGMENTS 8
+
+// The longest waitForWrite() waits for a write cycle, in microseconds: four times the
+// 5 ms the datasheets give, so that a chip that never answers can't hang the sketch
+#define EEPROM_WRITE_TIMEOUT 20000UL
+
+// cache_page_t.page of an unused cache page
+#define EEPROM_NO_PAGE 0xffff
+
+// Write cycle statistics; see getWriteStats()
+typedef struct {
+  uint32_t writes; // page (or byte) writes
+  uint32_t polls; // acknowledge polls, i.e. bus transactions spent waiting
+  uint16_t average; // write cycle time in microseconds: a moving average, and the extremes
+  uint16_t min;
+  uint16_t max;
+} eeprom_write_stats_t;
+
+// The byte order of numbers in the EEPROM, for readArray() and friends. Change it
+// to EEPROM_BIG_ENDIAN to share data with something big endian; numbers are then
+// swapped as they're read and written (with eeprom_swap(), below).
+#define EEPROM_LITTLE_ENDIAN 0
+#define EEPROM_BIG_ENDIAN 1
+#ifndef EEPROM_BYTE_ORDER
+#define EEPROM_BYTE_ORDER EEPROM_LITTLE_ENDIAN
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define EEPROM_NATIVE_ORDER EEPROM_BIG_ENDIAN
+#else
+#define EEPROM_NATIVE_ORDER EEPROM_LITTLE_ENDIAN // AVR, ARM, x86
+#endif
+
+// Reverses the bytes of a number. For a struct, this would reverse the whole thing,
+// so if the byte orders differ, structs need an overload that swaps each member:
+//   void eeprom_swap(calibration_t &c) { eeprom_swap(c.offset); eeprom_swap(c.gain); }
+template <typename T>
+inline void eeprom_swap(T &value) {
+  byte *p = (byte *)&value;
+  for (uint8_t i = 0; i < sizeof(T) / 2; i++) {
+    byte t = p[i];
+    p[i] = p[sizeof(T) - 1 - i];
+    p[sizeof(T) - 1 - i] = t;
+  }
+}
+
+#define EEPROM_24XX_TEMPLATE template <uint32_t capacity, uint8_t pageSize, uint8_t blockBit>
+#define EEPROM_24XX_CLASS EEPROM_24XX<capacity, pageSize, blockBit>
+
+EEPROM_24XX_TEMPLATE
+class EEPROM_24XX {
+public:
+  // One page of the read cache; see setCache()
+  typedef struct {
+    uint16_t page; // address / pageSize, or EEPROM_NO_PAGE
+    uint16_t lastUse;
+    byte data[pageSize];
+  } cache_page_t;
+
+  // _bus is the bus the chip is on: the hardware TWI (I2c16), or e.g. a SoftI2C16
+  EEPROM_24XX(byte A0, byte A1, uint32_t grade = EEPROM_24LC, I2C16Bus &_bus = I2c16) : bus(_bus)
+  {
+    init(A0, A1, 0, grade);
+  }
+
+  // For the parts without a block select bit, whose A2 pin is a third address pin, so
+  // that up to 8 can share a bus (a 24XX1025 ignores A2; its A2 pin must be tied high)
+  EEPROM_24XX(byte A0, byte A1, byte A2, uint32_t grade, I2C16Bus &_bus = I2c16) : bus(_bus)
+  {
+    init(A0, A1, A2, grade);
+  }
+
+  uint32_t getPosition(void) { return curpos; }
+  boolean setPosition(uint32_t pos) {
+    if (pos < capacity) {
+      curpos = pos; /* eeprom_pos is UNCHANGED! */
+      return true;
+    }
+    else
+      return false;
+  }
+
+  uint32_t read(const void *data, uint32_t bytesToRead); // reads from curpos
+  uint32_t read(uint32_t fulladdr, const void *data, uint32_t bytesToRead);
+
+  // These all read at the current position (use setPosition())
+  byte readByte(void);
+  float readFloat(void);
+  uint32_t readUInt(void);
+  int32_t readInt(void);
+
+  uint32_t write(const void *data, uint32_t bytesToWrite); // writes at curpos
+  uint32_t write(uint32_t fulladdr, const void *data, uint32_t bytesToWrite);
+
+  // These all write at the current position (use setPosition())
+  boolean writeByte(byte data);
+  boolean writeFloat(float data);
+  boolean writeUInt(uint32_t data);
+  boolean writeInt(int32_t data);
+
+  // Read/write count values of any type (numbers, or structs of them) in as few
+  // transactions as possible, in EEPROM_BYTE_ORDER; return the number of whole values
+  // transferred
+  template <typename T> uint16_t readArray(T *values, uint16_t count) { return readArray(curpos, values, count); }
+  template <typename T> uint16_t readArray(uint32_t fulladdr, T *values, uint16_t count);
+  template <typename T> uint16_t writeArray(const T *values, uint16_t count) { return writeArray(curpos, values, count); }
+  template <typename T> uint16_t writeArray(uint32_t fulladdr, const T *values, uint16_t count);
+
+  // The same, for a single value; return true on success
+  template <typename T> boolean readStruct(T &value) { return readArray(curpos, &value, 1) == 1; }
+  template <typename T> boolean readStruct(uint32_t fulladdr, T &value) { return readArray(fulladdr, &value, 1) == 1; }
+  template <typename T> boolean writeStruct(const T &value) { return writeArray(curpos, &value, 1) == 1; }
+  template <typename T> boolean writeStruct(uint32_t fulladdr, const T &value) { return writeArray(fulladdr, &value, 1) == 1; }
+
+  // Writes the segments back to back, as if they were one buffer, e.g. a record
+  // header and its payload; each page is still programmed only once
+  uint32_t writev(const i2c16_segment_t *segments, uint8_t numberSegments); // writes at curpos
+  uint32_t writev(uint32_t fulladdr, const i2c16_segment_t *segments, uint8_t numberSegments);
+
+  // Caches whole pages read, in pages[0 .. numPages - 1] (pageSize + 4 bytes each), and
+  // serves reads from them when it can; the least recently used page is replaced.
+  // Writes update the cache. setCache(NULL, 0) turns it off.
+  void setCache(cache_page_t *pages, uint8_t numPages);
+  uint32_t getCacheHits(void) { return cacheHits; }
+  uint32_t getCacheMisses(void) { return cacheMisses; }
+
+  // While a write is being programmed, the bus and CPU are left alone for most of the
+  // expected time; if set, idle() is called over and over meanwhile. It may use the
+  // bus, for other devices (but mustn't take much longer than a ms per call).
+  void setIdleCallback(void (*_idle)(void)) { idle = _idle; }
+  const eeprom_write_stats_t &getWriteStats(void) { return writeStats; }
+  void resetWriteStats(void);
+
+private:
+  // Page writes are at most 255 bytes, and page arithmetic is cheap only for powers of two
+  typedef char pageSizeCheck[(pageSize <= 128 && (pageSize & (pageSize - 1)) == 0) ? 1 : -1];
+  // One block select bit, i.e. at most two blocks, which is all readChunk() handles
+  typedef char capacityCheck[(capacity <= 131072UL) ? 1 : -1];
+
+  void init(byte A0, byte A1, byte A2, uint32_t grade)
+  {
+    // Set the bus to the fastest the part can do (or the bus, if slower).
+    // I2c16 may not have been constructed yet, if we're a global in another file, so it
+    // can't be called through bus (i.e. its vtable) here; calls on the object itself
+    // don't need one. (Other buses must be declared before us.)
+    if (&bus == &I2c16) {
+      I2c16.begin();
+      I2c16.setClock(grade);
+    }
+    else {
+      bus.begin();
+      bus.setClock(grade);
+    }
+    curpos = 0;
+    eeprom_pos = 0xffffffff;
+    cache = NULL;
+    cachePages = 0;
+    idle = NULL;
+    writeStats.average = 0; // unknown until the first write
+    resetWriteStats();
+    devaddr = 0x50 /* 1010 binary (shifted left), see datasheet */ | (A1 << 1) | (A0 << 0);
+    if (blockBit == 0)
+      devaddr |= A2 << 2;
+  }
+
+  I2C16Bus &bus;
+  uint8_t  devaddr;
+  uint32_t curpos; // 16 bits only covers half of 128 kiB, we need 17 bits... so 32 it is
+  uint32_t eeprom_pos; // a "copy" of the EEPROMs *INTERNAL* counter
+
+  cache_page_t *cache;
+  uint8_t cachePages;
+  uint16_t cacheClock; // for lastUse
+  uint32_t cacheHits;
+  uint32_t cacheMisses;
+
+  void (*idle)(void);
+  eeprom_write_stats_t writeStats;
+
+  uint8_t writeSinglePage(uint32_t fulladdr, const void *data, uint8_t bytesToWrite); // never spans multiple pages
+  uint8_t writeSinglePage(uint32_t fulladdr, const i2c16_segment_t *segments, uint8_t numberSegments);
+  uint8_t readChunk(uint32_t fulladdr, const void *data, uint8_t bytesToRead);  // reads a small chunk
+  uint8_t writeChunk(uint32_t fulladdr, const void *data, uint8_t byteToWrite); // writes a small chunk
+  boolean waitForWrite(uint8_t address); // false if write protected, on a bus error, or a timeout
+
+  uint32_t readCached(uint32_t fulladdr, const void *data, uint32_t bytesToRead);
+  cache_page_t *cachedPage(uint16_t page, boolean load);
+  void cacheTouch(cache_page_t *p);
+  void cacheWrite(uint32_t fulladdr, const i2c16_segment_t *segments, uint8_t numberSegments);
+  void cacheInvalidate(uint32_t fulladdr);
+};
+
+
+// Helpers for the implementation below; #undef'd at the end
+#define DEVICE_SIZE capacity
+#define PAGE_SIZE pageSize
+
+// The bytes a 16-bit address reaches, i.e. the size of a block
+#define BLOCK_SIZE ((capacity > 65536UL) ? 65536UL : capacity)
+
+// Finds the block number (0 or 1) from a 17-bit address
+#define BLOCKNUM(addr) ((capacity > 65536UL) ? (uint8_t)((addr) >> 16) : 0)
+
+// Converts a "full" 17-bit address to the 16-bit page address used by the EEPROM
+// The block number (above) is also required, of course, but is sent separately
+// in the device address byte.
+#define TO_PAGEADDR(addr) ((uint16_t)((addr) & 0xffff))
+
+// Undoes the previous two. (Better safe than sorry re: parenthesis and casts, doesn't cost anything!)
+#define TO_FULLADDR(block, page) (((uint32_t)(((uint32_t)block) << 16)) | (((uint32_t)(page))))
+
+// The device address for a block
+#define DEVADDR(block) ((uint8_t)(devaddr | ((block) << blockBit)))
+
+// Private method
+EEPROM_24XX_TEMPLATE
+uint8_t EEPROM_24XX_CLASS::readChunk(uint32_t fulladdr, const void *data, uint8_t bytesToRead) {
+  if (bytesToRead == 0 || fulladdr >= DEVICE_SIZE)
+    return 0;
+  if (fulladdr + bytesToRead > DEVICE_SIZE)
+    bytesToRead = DEVICE_SIZE - fulladdr;
+
+  uint8_t err = 0;
+  if (DEVICE_SIZE > BLOCK_SIZE && fulladdr < BLOCK_SIZE && fulladdr + bytesToRead > BLOCK_SIZE) {
+    // This read crosses the "block boundary" and cannot be sequentially read
+    // by the EEPROM itself
+
+    // Read part 1 (from the first block)
+    err = bus.read(DEVADDR(0), fulladdr /* always 16-bit */, BLOCK_SIZE - fulladdr, (byte *)data);
+    if (err) {
+      eeprom_pos = 0xffffffff;
+      return 0;
+    }
+
+    // Read part 2 (from the second block)
+    err = bus.read(DEVADDR(1), 0, bytesToRead - (BLOCK_SIZE - fulladdr), (byte *)data + (uint16_t)((BLOCK_SIZE - fulladdr)));
+    if (err) {
+      eeprom_pos = 0xffffffff;
+      curpos += (BLOCK_SIZE - fulladdr); // move the cursor forward the amount we read successfully
+      if (curpos >= DEVICE_SIZE)
+        curpos %= DEVICE_SIZE;
+      return (uint8_t)(BLOCK_SIZE - fulladdr); // num bytes read previously
+    }
+    else {
+      eeprom_pos = TO_FULLADDR(1, bytesToRead - (BLOCK_SIZE - fulladdr));
+      curpos += bytesToRead;
+      if (curpos >= DEVICE_SIZE)
+        curpos %= DEVICE_SIZE;
+      return bytesToRead;
+    }
+  }
+  else {
+    // Doesn't cross the block border, so we can do this in one read
+    uint8_t block = BLOCKNUM(fulladdr);
+    err = bus.read(DEVADDR(block), TO_PAGEADDR(fulladdr), bytesToRead, (byte *)data);
+    if (err) {
+      eeprom_pos = 0xffffffff;
+      return 0;
+    }
+    else {
+      eeprom_pos += bytesToRead;
+      curpos += bytesToRead;
+      if (curpos >= DEVICE_SIZE)
+        curpos %= DEVICE_SIZE;
+      return bytesToRead;
+    }
+  }
+}
+
+// Private method
+EEPROM_24XX_TEMPLATE
+uint8_t EEPROM_24XX_CLASS::writeSinglePage(uint32_t fulladdr, const void *data, uint8_t bytesToWrite) {
+  i2c16_segment_t segment = { (const uint8_t *)data, bytesToWrite };
+  return writeSinglePage(fulladdr, &segment, 1);
+}
+
+// Private method
+EEPROM_24XX_TEMPLATE
+uint8_t EEPROM_24XX_CLASS::writeSinglePage(uint32_t fulladdr, const i2c16_segment_t *segments, uint8_t numberSegments) {
+  // Writes 1 - PAGE_SIZE bytes, but only *within a single page*. Never crosses a page/block border.
+  // Enforcing this is up to the caller.
+  uint16_t bytesToWrite = 0;
+  for (uint8_t i = 0; i < numberSegments; i++)
+    bytesToWrite += segments[i].length;
+  if (bytesToWrite == 0 || bytesToWrite > PAGE_SIZE)
+    return 0;
+
+  uint8_t ret = bus.write(DEVADDR(BLOCKNUM(fulladdr)), TO_PAGEADDR(fulladdr), segments, numberSegments);
+  if (ret != 0) {
+    // We can't be sure what the internal counter is now, since it looks like the write failed.
+    // Nor what's on the page.
+    eeprom_pos = 0xffffffff;
+    cacheInvalidate(fulladdr);
+    return 0;
+  }
+  else {
+    // Try to keep track of the internal counter
+    eeprom_pos += bytesToWrite;
+    curpos += bytesToWrite;
+    if (curpos >= DEVICE_SIZE)
+      curpos %= DEVICE_SIZE;
+  }
+
+  if (!waitForWrite(DEVADDR(BLOCKNUM(fulladdr)))) {
+    cacheInvalidate(fulladdr);
+    return 0;
+  }
+
+  cacheWrite(fulladdr, segments, numberSegments);
+  return bytesToWrite;
+}
+
+// Private method
+EEPROM_24XX_TEMPLATE
+boolean EEPROM_24XX_CLASS::waitForWrite(uint8_t address) {
+  // Waits for the EEPROM to finish a write (just sent). To do so, we use acknowledge polling,
+  // a technique described in the datasheet. We send a START condition and the device address
+  // byte, and see if the device acknowledges (pulls SDA low) or not.
+  // Rather than poll all through the write cycle (3-5 ms), keeping the bus busy, we
+  // learn how long it usually takes, leave the bus alone for most of that, and only
+  // then poll until it's done.
+  uint32_t start = micros(); // the write cycle starts at the STOP condition, i.e. now
+
+  writeStats.polls++;
+  uint8_t status = bus.acknowledgePoll(address);
+  if (status == I2C16_POLL_ACK) {
+    // The device answered at once, rather than some ms later. This most likely means
+    // that the device is write protected, as it will acknowledge new commands at once
+    // when write protect is active.
+    Serial.println("WARNING: EEPROM appears to be write protected!");
+    return false;
+  }
+  if (status != I2C16_POLL_BUSY) {
+    Serial.println("WARNING: EEPROM bus error while waiting for a write!");
+    return false;
+  }
+
+  // Other devices may use the bus meanwhile (this one won't answer anyway)
+  uint32_t quiet = writeStats.average - writeStats.average / 8;
+  while (micros() - start < quiet) {
+    if (idle != NULL)
+      idle();
+  }
+
+  do {
+    if (micros() - start > EEPROM_WRITE_TIMEOUT) {
+      Serial.println("WARNING: EEPROM write never finished!");
+      return false;
+    }
+    writeStats.polls++;
+    status = bus.acknowledgePoll(address);
+    if (status == I2C16_POLL_BUSY)
+      delayMicroseconds(20);
+  } while (status == I2C16_POLL_BUSY);
+  if (status != I2C16_POLL_ACK) {
+    Serial.println("WARNING: EEPROM bus error while waiting for a write!");
+    return false;
+  }
+
+  uint32_t t = micros() - start;
+  uint16_t cycle = (t > 0xffff) ? 0xffff : t;
+  writeStats.writes++;
+  if (cycle < writeStats.min)
+    writeStats.min = cycle;
+  if (cycle > writeStats.max)
+    writeStats.max = cycle;
+  // A moving average, over the last 8 or so writes; if the write was done before we
+  // even looked, this drifts down until we look early enough
+  if (writeStats.average == 0)
+    writeStats.average = cycle;
+  else
+    writeStats.average += ((int32_t)cycle - (int32_t)writeStats.average) / 8;
+
+  return true;
+}
+
+EEPROM_24XX_TEMPLATE
+void EEPROM_24XX_CLASS::resetWriteStats(void) {
+  writeStats.writes = 0;
+  writeStats.polls = 0;
+  writeStats.min = 0xffff;
+  writeStats.max = 0;
+  // average is kept, since it's what waitForWrite() goes by
+}
+
+// Private method
+EEPROM_24XX_TEMPLATE
+uint8_t EEPROM_24XX_CLASS::writeChunk(uint32_t fulladdr, const void *data, uint8_t bytesToWrite) {
+  // Used to turn 1-PAGE_SIZE byte writes into full page writes (i.e. turn them into proper single-page writes)
+  if (bytesToWrite == 0 || bytesToWrite > PAGE_SIZE || fulladdr >= DEVICE_SIZE)
+    return 0;
+
+  if (fulladdr + bytesToWrite > DEVICE_SIZE)
+    bytesToWrite = DEVICE_SIZE - fulladdr;
+
+  // Calculate the 16-bit address, and the page number of the first and second (if applicable)
+  // blocks we're going to write to.
+  uint32_t pageaddr = TO_PAGEADDR(fulladdr);
+  uint8_t firstBlock = BLOCKNUM(fulladdr);
+  uint8_t secondBlock = BLOCKNUM(fulladdr + bytesToWrite - 1);
+
+  // These page numbers are *relative to the block number*, i.e. firstPage = 0 may mean at byte 0 or byte BLOCK_SIZE
+  // depending on firstBlock above. Same goes for secondPage/secondBlock of course.
+  uint16_t firstPage = pageaddr / PAGE_SIZE; // pageaddr is already relative to block!
+  uint16_t secondPage = (TO_PAGEADDR(pageaddr + bytesToWrite - 1))/PAGE_SIZE;
+
+  if (firstPage == secondPage && firstBlock == secondBlock) {
+    // Data doesn't "cross the border" between pages. Easy!
+    return writeSinglePage(fulladdr, data, bytesToWrite);
+  }
+  else {
+    // The data spans two pages, e.g. begins at address 120 and is 12 bytes long, which would make it go
+    // past the edge of this page (addresses 0 - 127) and onto the next.
+    // We need to split this write manually.
+
+    uint8_t bytesInFirstPage = ((firstPage + 1) * PAGE_SIZE) - pageaddr;
+    uint8_t bytesInSecondPage = bytesToWrite - bytesInFirstPage;
+
+    uint8_t ret = 0;
+
+    // Write the data that belongs to the first page
+    if ((ret = writeSinglePage(TO_FULLADDR(firstBlock, pageaddr), data, bytesInFirstPage))
+      != bytesInFirstPage)
+    {
+      return ret;
+    }
+
+    // Write the data that belongs to the second page
+    if ((ret = writeSinglePage(TO_FULLADDR(secondBlock, secondPage * PAGE_SIZE), (const void*)((byte *)data + bytesInFirstPage), bytesInSecondPage))
+      != bytesInSecondPage)
+    {
+      return bytesInFirstPage + ret;
+    }
+  }
+
+  return bytesToWrite;
+}
+
+EEPROM_24XX_TEMPLATE
+byte EEPROM_24XX_CLASS::readByte(void) {
+  // Reads a byte from the current position and returns it
+  byte data = 0; // stays 0 if the read fails
+
+  if (cache != NULL) {
+    read(curpos, &data, 1);
+    return data;
+  }
+
+  if (eeprom_pos != curpos) {
+    // If the EEPROM internal position counter has (or might have) changed,
+    // do a "full" read, where we sent the 16-byte address.
+    bus.read(DEVADDR(BLOCKNUM(curpos)), TO_PAGEADDR(curpos), 1, &data);
+    eeprom_pos = curpos;
+  }
+  else {
+    // If we know that the internal counter is correct, don't send the address, but
+    // rely on the EEPROM logic to return the "next" byte properly. This saves
+    // overhead and time.
+    bus.read(DEVADDR(BLOCKNUM(curpos)), 1, &data);
+  }
+
+  curpos++;
+  eeprom_pos++;
+  if (eeprom_pos == BLOCK_SIZE) {
+    // Seems to wrap here. The datasheet could be read as if this were 17-bit, but I don't think it is.
+    eeprom_pos = 0;
+  }
+  if (curpos >= DEVICE_SIZE) {
+    // Wrap around if we overflow the device capacity.
+    curpos %= DEVICE_SIZE;
+    eeprom_pos = 0xffffffff;
+  }
+
+  return data;
+}
+
+EEPROM_24XX_TEMPLATE
+uint32_t EEPROM_24XX_CLASS::read(const void *data, uint32_t bytesToRead) {
+  return read(curpos, data, bytesToRead);
+}
+
+EEPROM_24XX_TEMPLATE
+uint32_t EEPROM_24XX_CLASS::read(uint32_t fulladdr, const void *data, uint32_t bytesToRead) {
+  if (bytesToRead == 0)
+    return 0;
+  if (cache != NULL)
+    return readCached(fulladdr, data, bytesToRead);
+  if (bytesToRead <= 255)
+    return readChunk(fulladdr, data, bytesToRead); // can be handled without this function
+  if (fulladdr >= DEVICE_SIZE)
+    return 0;
+  if (fulladdr + bytesToRead >= DEVICE_SIZE)
+    bytesToRead = DEVICE_SIZE - fulladdr; // constrain read size to end of device
+
+  const uint32_t chunksize = 240; // bytes to read per chunk. Must be smaller than 255.
+
+  // If we get here, we have a >255 byte read that is now constrained to a valid range.
+  uint32_t bytesRead = 0;
+  uint32_t t = 0;
+
+  while (bytesRead < bytesToRead) {
+    t = readChunk(fulladdr + bytesRead, (const void*)((byte *)data + bytesRead), min(chunksize, bytesToRead - bytesRead));
+    if (t == min(chunksize, bytesToRead - bytesRead))
+      bytesRead += t;
+    else
+      return bytesRead; // Failure!
+  }
+
+  return bytesRead;
+}
+
+EEPROM_24XX_TEMPLATE
+boolean EEPROM_24XX_CLASS::writeByte(byte data) {
+  // Writes a byte to the EEPROM.
+  // WARNING: writing a single byte still uses a full page write,
+  // so writing 128 sequential bytes instead of 1 page write
+  // will use 128 times as many of the chip's limited lifetime writes!!
+  // In otherwords: ONLY USE THIS if you *really* only need to write ONE byte.
+  // Even for just *TWO* bytes, write([pos,] data, bytesToWrite) is "twice as good"!
+  // In short: writeBlock for 128 bytes will use 1 page "life" each on 1 or 2 pages.
+  // writeByte 128 times will use 128 page "lives", spread over 1 or 2 pages.
+
+  // Find which block the byte is in, based on the full (17-bit) address.
+  // We can only supply 16 bits to the EEPROM, plus a separate "block select" bit.
+  uint8_t block = BLOCKNUM(curpos);
+  uint32_t fulladdr = curpos;
+
+  uint8_t ret = bus.write(DEVADDR(block), TO_PAGEADDR(curpos), data);
+  if (ret != 0) {
+    // Looks like something failed. Reset the EEPROM counter "copy", since we're no longer
+    // sure what it ACTUALLY is.
+    eeprom_pos = 0xffffffff;
+    cacheInvalidate(fulladdr);
+    return false;
+  }
+
+  curpos++;
+  eeprom_pos = curpos; // We changed the internal counter when we wrote the address just above.
+  if (curpos >= DEVICE_SIZE) {
+    // Wrap around if we overflow the device capacity.
+    curpos %= DEVICE_SIZE;
+    eeprom_pos = 0xffffffff; // Not sure what the internal counter does. It PROBABLY resets to 0, but...
+  }
+
+  if (!waitForWrite(DEVADDR(block))) {
+    cacheInvalidate(fulladdr);
+    return 0;
+  }
+
+  i2c16_segment_t segment = { &data, 1 };
+  cacheWrite(fulladdr, &segment, 1);
+  return true; // success
+}
+
+EEPROM_24XX_TEMPLATE
+uint32_t EEPROM_24XX_CLASS::write(const void *data, uint32_t bytesToWrite) {
+  return write(curpos, data, bytesToWrite);
+}
+
+EEPROM_24XX_TEMPLATE
+uint32_t EEPROM_24XX_CLASS::write(uint32_t fulladdr, const void *data, uint32_t bytesToWrite) {
+  // Uses writeChunk to allow any-sized writes, not just <PAGE_SIZE bytes
+
+  if (bytesToWrite == 0)
+    return 0;
+  if (bytesToWrite <= PAGE_SIZE)
+    return writeChunk(fulladdr, data, bytesToWrite);
+  if (fulladdr >= DEVICE_SIZE)
+    return 0;
+  if (fulladdr + bytesToWrite >= DEVICE_SIZE)
+    bytesToWrite = DEVICE_SIZE - fulladdr; // constrain read size to end of device
+
+  // If we get here, we have a >PAGE_SIZE byte write that is now constrained to a valid range.
+  // Write up to the end of each page, so that every page is programmed only once, even
+  // if the write doesn't start at a page boundary.
+  uint32_t bytesWritten = 0;
+  uint32_t t = 0;
+
+  while (bytesWritten < bytesToWrite) {
+    uint8_t n = min(PAGE_SIZE - (fulladdr + bytesWritten) % PAGE_SIZE, bytesToWrite - bytesWritten);
+    t = writeChunk(fulladdr + bytesWritten, (const void*)((byte *)data + bytesWritten), n);
+    if (t == n)
+      bytesWritten += t;
+    else
+      return bytesWritten; //Failure!
+  }
+
+  return bytesWritten;
+}
+
+EEPROM_24XX_TEMPLATE
+uint32_t EEPROM_24XX_CLASS::writev(const i2c16_segment_t *segments, uint8_t numberSegments) {
+  return writev(curpos, segments, numberSegments);
+}
+
+EEPROM_24XX_TEMPLATE
+uint32_t EEPROM_24XX_CLASS::writev(uint32_t fulladdr, const i2c16_segment_t *segments, uint8_t numberSegments) {
+  // Gathers as much of the segments as fits in each page into one page write.
+  // A segment contributes at most one piece to each page, so a page never needs
+  // more than numberSegments pieces.
+  if (numberSegments > EEPROM_MAX_SEGMENTS || fulladdr >= DEVICE_SIZE)
+    return 0;
+
+  i2c16_segment_t page[EEPROM_MAX_SEGMENTS];
+  uint32_t bytesWritten = 0;
+  uint8_t seg = 0; // the segment, and the offset into it, where the next page starts
+  uint8_t offset = 0;
+
+  while (seg < numberSegments && fulladdr + bytesWritten < DEVICE_SIZE) {
+    uint32_t addr = fulladdr + bytesWritten;
+    uint8_t room = PAGE_SIZE - (addr % PAGE_SIZE); // pages never cross the block border, or the end
+    uint8_t pieces = 0;
+    uint8_t bytes = 0;
+
+    while (seg < numberSegments && bytes < room) {
+      uint8_t n = min(segments[seg].length - offset, room - bytes);
+      if (n > 0) {
+        page[pieces].data = segments[seg].data + offset;
+        page[pieces].length = n;
+        pieces++;
+        bytes += n;
+        offset += n;
+      }
+      if (offset == segments[seg].length) {
+        seg++;
+        offset = 0;
+      }
+    }
+
+    if (bytes == 0)
+      break; // only empty segments left
+    if (writeSinglePage(addr, page, pieces) != bytes)
+      return bytesWritten; // Failure!
+    bytesWritten += bytes;
+  }
+
+  return bytesWritten;
+}
+
+//
+// The read cache
+//
+
+EEPROM_24XX_TEMPLATE
+void EEPROM_24XX_CLASS::setCache(cache_page_t *pages, uint8_t numPages) {
+  cache = (numPages > 0) ? pages : NULL;
+  cachePages = numPages;
+  cacheClock = 0;
+  cacheHits = 0;
+  cacheMisses = 0;
+  for (uint8_t i = 0; i < cachePages; i++)
+    cache[i].page = EEPROM_NO_PAGE;
+}
+
+// Private method
+EEPROM_24XX_TEMPLATE
+typename EEPROM_24XX_CLASS::cache_page_t *EEPROM_24XX_CLASS::cachedPage(uint16_t page, boolean load) {
+  // Finds a page in the cache; if it's not there and load is true, reads it in place
+  // of the least recently used one. Returns NULL if it's not there (or couldn't be read).
+  cache_page_t *victim = &cache[0];
+  for (uint8_t i = 0; i < cachePages; i++) {
+    if (cache[i].page == page) {
+      if (load) {
+        cacheHits++;
+        cacheTouch(&cache[i]);
+      }
+      return &cache[i];
+    }
+    if (cache[i].page == EEPROM_NO_PAGE || (victim->page != EEPROM_NO_PAGE && cache[i].lastUse < victim->lastUse))
+      victim = &cache[i];
+  }
+  if (!load)
+    return NULL;
+
+  cacheMisses++;
+  uint32_t savedpos = curpos; // readChunk() moves it, but this read is ours, not the caller's
+  victim->page = EEPROM_NO_PAGE;
+  if (readChunk((uint32_t)page * PAGE_SIZE, victim->data, PAGE_SIZE) != PAGE_SIZE) {
+    curpos = savedpos;
+    return NULL;
+  }
+  curpos = savedpos;
+  victim->page = page;
+  cacheTouch(victim);
+  return victim;
+}
+
+// Private method
+EEPROM_24XX_TEMPLATE
+void EEPROM_24XX_CLASS::cacheTouch(cache_page_t *p) {
+  // Marks a page as the most recently used
+  if (++cacheClock == 0) {
+    // Wrapped around; start the count over, forgetting the order for once
+    for (uint8_t i = 0; i < cachePages; i++)
+      cache[i].lastUse = 0;
+    cacheClock = 1;
+  }
+  p->lastUse = cacheClock;
+}
+
+// Private method
+EEPROM_24XX_TEMPLATE
+uint32_t EEPROM_24XX_CLASS::readCached(uint32_t fulladdr, const void *data, uint32_t bytesToRead) {
+  if (fulladdr >= DEVICE_SIZE)
+    return 0;
+  if (fulladdr + bytesToRead > DEVICE_SIZE)
+    bytesToRead = DEVICE_SIZE - fulladdr;
+
+  uint32_t bytesRead = 0;
+  while (bytesRead < bytesToRead) {
+    uint32_t addr = fulladdr + bytesRead;
+    cache_page_t *p = cachedPage(addr / PAGE_SIZE, true);
+    if (p == NULL)
+      break; // Failure!
+    uint8_t offset = addr % PAGE_SIZE;
+    uint8_t n = min((uint32_t)PAGE_SIZE - offset, bytesToRead - bytesRead);
+    memcpy((byte *)data + bytesRead, p->data + offset, n);
+    bytesRead += n;
+  }
+
+  // As for uncached reads
+  curpos = (curpos + bytesRead) % DEVICE_SIZE;
+  return bytesRead;
+}
+
+// Private method
+EEPROM_24XX_TEMPLATE
+void EEPROM_24XX_CLASS::cacheWrite(uint32_t fulladdr, const i2c16_segment_t *segments, uint8_t numberSegments) {
+  // Updates the cached copy (if any) of a page just written. Never crosses a page border.
+  if (cache == NULL)
+    return;
+  cache_page_t *p = cachedPage(fulladdr / PAGE_SIZE, false);
+  if (p == NULL)
+    return;
+  uint8_t offset = fulladdr % PAGE_SIZE;
+  for (uint8_t i = 0; i < numberSegments; i++) {
+    memcpy(p->data + offset, segments[i].data, segments[i].length);
+    offset += segments[i].length;
+  }
+}
+
+// Private method
+EEPROM_24XX_TEMPLATE
+void EEPROM_24XX_CLASS::cacheInvalidate(uint32_t fulladdr) {
+  if (cache == NULL)
+    return;
+  cache_page_t *p = cachedPage(fulladdr / PAGE_SIZE, false);
+  if (p != NULL)
+    p->page = EEPROM_NO_PAGE;
+}
+
+//
+// Helper functions for reading/writing other forms of data (floats and ints)
+//
+
+EEPROM_24XX_TEMPLATE
+float EEPROM_24XX_CLASS::readFloat(void) {
+  float data;
+  if (readStruct(curpos, data))
+    return data;
+  else
+    return NAN;
+}
+
+EEPROM_24XX_TEMPLATE
+boolean EEPROM_24XX_CLASS::writeFloat(float data) {
+  if (writeStruct(curpos, data))
+    return true;
+  else
+    return false;
+}
+
+EEPROM_24XX_TEMPLATE
+uint32_t EEPROM_24XX_CLASS::readUInt(void) {
+  uint32_t data;
+  if (readStruct(curpos, data))
+    return data;
+  else
+    return 0;
+}
+
+EEPROM_24XX_TEMPLATE
+boolean EEPROM_24XX_CLASS::writeUInt(uint32_t data) {
+  if (writeStruct(curpos, data))
+    return true;
+  else
+    return false;
+}
+
+EEPROM_24XX_TEMPLATE
+int32_t EEPROM_24XX_CLASS::readInt(void) {
+  int32_t data;
+  if (readStruct(curpos, data))
+    return data;
+  else
+    return 0;
+}
+
+EEPROM_24XX_TEMPLATE
+boolean EEPROM_24XX_CLASS::writeInt(int32_t data) {
+  if (writeStruct(curpos, data))
+    return true;
+  else
+    return false;
+}
+
+EEPROM_24XX_TEMPLATE
+template <typename T>
+uint16_t EEPROM_24XX_CLASS::readArray(uint32_t fulladdr, T *values, uint16_t count) {
+  // One read() does it, i.e. a transaction per 240 bytes
+  uint16_t n = read(fulladdr, values, (uint32_t)count * sizeof(T)) / sizeof(T);
+  if (EEPROM_BYTE_ORDER != EEPROM_NATIVE_ORDER) {
+    for (uint16_t i = 0; i < n; i++)
+      eeprom_swap(values[i]);
+  }
+  return n;
+}
+
+EEPROM_24XX_TEMPLATE
+template <typename T>
+uint16_t EEPROM_24XX_CLASS::writeArray(uint32_t fulladdr, const T *values, uint16_t count) {
+  if (EEPROM_BYTE_ORDER == EEPROM_NATIVE_ORDER) {
+    // One write() does it, i.e. one page write per page
+    return write(fulladdr, values, (uint32_t)count * sizeof(T)) / sizeof(T);
+  }
+
+  // The values must be swapped, and they're not ours to change, so swap them into a
+  // buffer, one page at a time
+  byte buf[PAGE_SIZE];
+  uint32_t bytesToWrite = (uint32_t)count * sizeof(T);
+  if (fulladdr >= DEVICE_SIZE)
+    return 0;
+  if (fulladdr + bytesToWrite > DEVICE_SIZE)
+    bytesToWrite = DEVICE_SIZE - fulladdr;
+
+  T value;
+  uint16_t next = 0; // the next value to swap into value
+  uint8_t used = sizeof(T); // bytes of value already copied to buf
+  uint32_t bytesWritten = 0;
+  while (bytesWritten < bytesToWrite) {
+    uint8_t n = min(PAGE_SIZE - (fulladdr + bytesWritten) % PAGE_SIZE, bytesToWrite - bytesWritten);
+    for (uint8_t i = 0; i < n; i++) {
+      if (used == sizeof(T)) {
+        value = values[next++];
+        eeprom_swap(value);
+        used = 0;
+      }
+      buf[i] = ((byte *)&value)[used++];
+    }
+    if (writeChunk(fulladdr + bytesWritten, buf, n) != n)
+      break; // Failure!
+    bytesWritten += n;
+  }
+  return bytesWritten / sizeof(T);
+}
+
+#undef DEVICE_SIZE
+#undef PAGE_SIZE
+#undef BLOCK_SIZE
+#undef BLOCKNUM
+#undef TO_PAGEADDR
+#undef TO_FULLADDR
+#undef DEVADDR
+#undef EEPROM_24XX_TEMPLATE
+#undef EEPROM_24XX_CLASS
+
+typedef EEPROM_24XX<131072UL, 128, 2> EEPROM_24XX1025; // the block select bit replaces A2
+typedef EEPROM_24XX<65536UL, 128, 0> EEPROM_24XX512;
+typedef EEPROM_24XX<32768UL, 64, 0> EEPROM_24XX256;
+typedef EEPROM_24XX<16384UL, 64, 0> EEPROM_24XX128;
+
+#endif
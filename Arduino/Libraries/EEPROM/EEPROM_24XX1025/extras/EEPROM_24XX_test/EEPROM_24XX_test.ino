@@ -0,0 +1,400 @@
+// Exercises EEPROM_24XX against MockBus, on the simulator, and prints what happened, a
+// line per measurement: the test's name, then name=value pairs. test_eeprom24xx.py
+// runs it and checks the numbers.
+
+#include <I2C16.h>
+#include <EEPROM_24XX1025.h>
+#include "MockBus.h"
+
+MockBus bus(131072UL, 128, 2);
+EEPROM_24XX1025 eeprom(0, 0, EEPROM_24LC, bus);
+
+// The smaller parts, each on a bus of its own
+MockBus bus512(65536UL, 128, 0);
+EEPROM_24XX512 eeprom512(0, 0, EEPROM_24LC, bus512);
+MockBus bus256(32768UL, 64, 0);
+EEPROM_24XX256 eeprom256(0, 0, EEPROM_24LC, bus256);
+MockBus bus128(16384UL, 64, 0);
+EEPROM_24XX128 eeprom128(0, 0, EEPROM_24LC, bus128);
+
+// Geometries the template must refuse to compile; test_eeprom24xx.py builds with each
+#define BAD_GEOMETRY 0
+#if BAD_GEOMETRY == 1
+EEPROM_24XX<262144UL, 128, 2> tooLarge(0, 0, EEPROM_24LC, bus); // capacityCheck
+#elif BAD_GEOMETRY == 2
+EEPROM_24XX<65536UL, 96, 0> oddPage(0, 0, EEPROM_24LC, bus); // pageSizeCheck
+#endif
+
+byte buf[256];
+
+// A struct for writeStruct(), and how to swap its byte order (member by member)
+typedef struct {
+  int32_t offset;
+  float gain;
+  uint16_t flags;
+  uint16_t spare;
+} calibration_t;
+
+void eeprom_swap(calibration_t &c) {
+  eeprom_swap(c.offset);
+  eeprom_swap(c.gain);
+  eeprom_swap(c.flags);
+  eeprom_swap(c.spare);
+}
+
+void fill(byte *data, uint16_t length, byte seed) {
+  for (uint16_t i = 0; i < length; i++)
+    data[i] = seed + i * 7;
+}
+
+void result(const char *test) {
+  Serial.print(test);
+}
+
+void value(const char *name, uint32_t v) {
+  Serial.print(' ');
+  Serial.print(name);
+  Serial.print('=');
+  Serial.print(v);
+}
+
+void end() {
+  Serial.println();
+  Serial.flush();
+}
+
+// Page writes against a write cycle of tWC us: the time waitForWrite() measures, its
+// average, and the polls each write took
+void writeCycles(const char *test, uint16_t tWC, uint8_t n) {
+  bus.writeCycle = tWC;
+  for (uint8_t i = 0; i < n; i++) {
+    uint32_t addr = (uint32_t)i * 128;
+    fill(buf, 128, i);
+    uint32_t polls = eeprom.getWriteStats().polls;
+    uint32_t written = eeprom.write(addr, buf, 128);
+    const eeprom_write_stats_t &stats = eeprom.getWriteStats();
+    result(test);
+    value("write", i);
+    value("written", written);
+    value("ok", memcmp(bus.memory + addr, buf, 128) == 0);
+    value("average", stats.average);
+    value("polls", stats.polls - polls);
+    end();
+  }
+}
+
+// A write that goes wrong while waiting for the write cycle: what write() returns, and
+// how long it took
+void failedWrite(const char *test) {
+  fill(buf, 16, 0x40);
+  uint32_t start = micros();
+  uint32_t written = eeprom.write(0x1000, buf, 16);
+  uint32_t t = micros() - start;
+  result(test);
+  value("written", written);
+  value("us", t);
+  end();
+}
+
+// Writes and reads at the edges of a chip's pages, block and capacity; each line is
+// what a call returned, and whether the chip (or buffer) then held the right data
+template <class E> void geometry(const char *test, E &e, MockBus &b, uint32_t capacity, uint8_t pageSize) {
+  static byte readBack[300];
+  b.writeCycle = 3000;
+
+  // Across a page boundary, and so two page writes
+  uint32_t addr = 3 * pageSize - 5;
+  fill(buf, 10, 0x11);
+  uint32_t writes = b.writes;
+  result(test);
+  value("straddle", e.write(addr, buf, 10));
+  value("ok", memcmp(b.memory + addr, buf, 10) == 0);
+  value("writes", b.writes - writes);
+  end();
+
+  // More than a page, running off the end: cut short at the end
+  addr = capacity - 100;
+  fill(buf, 200, 0x22);
+  result(test);
+  value("end", e.write(addr, buf, 200));
+  value("ok", memcmp(b.memory + addr, buf, 100) == 0);
+  end();
+
+  // At and past the end: nothing
+  result(test);
+  value("at", e.write(capacity, buf, 200));
+  value("past", e.write(capacity + 5, buf, 200));
+  value("small", e.write(capacity, buf, 16));
+  value("readat", e.read(capacity, readBack, 300));
+  end();
+
+  // A read longer than a chunk, from near the end, and across the 24XX1025's block
+  // boundary where there is one
+  addr = (capacity > 65536UL) ? 65536UL - 150 : capacity - 300;
+  for (uint16_t i = 0; i < 300; i++)
+    b.memory[addr + i] = i * 13;
+  memset(readBack, 0, sizeof(readBack));
+  result(test);
+  value("long", e.read(addr, readBack, 300));
+  value("ok", memcmp(b.memory + addr, readBack, 300) == 0);
+  end();
+}
+
+//
+// The read cache
+//
+
+eeprom_cache_page_t cache[4];
+uint32_t lookups; // pages the reads touched, i.e. cache hits + misses
+
+// Reads length bytes at addr (through the cache); true if they're what the chip holds
+boolean cachedRead(uint32_t addr, uint8_t length) {
+  static byte data[128];
+  lookups += (addr / 128 != (addr + length - 1) / 128) ? 2 : 1;
+  return eeprom.read(addr, data, length) == length && memcmp(data, bus.memory + addr, length) == 0;
+}
+
+void startCache() {
+  eeprom.setCache(cache, 4);
+  bus.clearCounts();
+  lookups = 0;
+}
+
+void cacheResult(const char *test, boolean ok) {
+  result(test);
+  value("ok", ok);
+  value("lookups", lookups);
+  value("hits", eeprom.getCacheHits());
+  value("misses", eeprom.getCacheMisses());
+  value("reads", bus.reads);
+  end();
+}
+
+// Random 16-byte reads within the first numPages pages
+void cacheRandom(const char *test, uint8_t numPages, uint16_t n) {
+  startCache();
+  boolean ok = true;
+  for (uint16_t i = 0; i < n; i++)
+    ok &= cachedRead(random(numPages * 128 - 16), 16);
+  cacheResult(test, ok);
+}
+
+// 16-byte reads every stride bytes through numPages pages, twice over
+void cacheStride(const char *test, uint16_t stride, uint8_t numPages) {
+  startCache();
+  boolean ok = true;
+  for (uint8_t pass = 0; pass < 2; pass++) {
+    for (uint32_t addr = 0; addr < numPages * 128UL; addr += stride)
+      ok &= cachedRead(addr, 16);
+  }
+  cacheResult(test, ok);
+}
+
+void cacheTests() {
+  bus.writeCycle = 3000;
+  for (uint32_t i = 0; i < 16 * 128UL; i++)
+    bus.memory[i] = i * 31 + (i >> 7);
+
+  cacheRandom("cacherandom4", 4, 200); // all fits
+  cacheRandom("cacherandom8", 8, 400); // half fits
+  cacheStride("cachestride32", 32, 16); // 4 reads per page, but the pages don't fit
+  cacheStride("cachestride128", 128, 16); // 1 read per page: no hits at all
+  cacheStride("cachestride128fits", 128, 4);
+
+  // The least recently used page goes: 1, rather than 0, which was read since
+  startCache();
+  boolean ok = true;
+  for (uint8_t page = 0; page < 4; page++)
+    ok &= cachedRead(page * 128, 16);
+  ok &= cachedRead(0, 16);
+  ok &= cachedRead(4 * 128, 16);
+  ok &= cachedRead(0, 16) && cachedRead(2 * 128, 16) && cachedRead(3 * 128, 16) && cachedRead(4 * 128, 16);
+  ok &= cachedRead(1 * 128, 16);
+  cacheResult("cachelru", ok);
+
+  // lastUse is 16 bits: when the clock wraps around, the page being used mustn't look
+  // like the least recently used one. Page 0 is read last, as the clock wraps, after
+  // page 1 has been read some 65000 times and 2 and 3 loaded
+  startCache();
+  ok = cachedRead(0, 1);
+  for (uint16_t i = 0; i < 65532; i++)
+    ok &= cachedRead(128, 1);
+  ok &= cachedRead(2 * 128, 1) && cachedRead(3 * 128, 1);
+  ok &= cachedRead(0, 1); // the clock wraps here
+  ok &= cachedRead(4 * 128, 1);
+  uint32_t misses = eeprom.getCacheMisses();
+  ok &= cachedRead(0, 1);
+  result("cachewrap");
+  value("ok", ok);
+  value("misses", misses);
+  value("hit", eeprom.getCacheMisses() == misses);
+  end();
+
+  // Writes update the cached page, so that reads from the cache see them
+  startCache();
+  ok = cachedRead(5 * 128, 128);
+  fill(buf, 10, 0x33);
+  ok &= eeprom.write(5 * 128 + 5, buf, 10) == 10;
+  eeprom.setPosition(5 * 128 + 100);
+  ok &= eeprom.writeByte(0x5a);
+  i2c16_segment_t segments[2] = { { buf, 10 }, { buf + 20, 30 } };
+  ok &= eeprom.writev(6 * 128 - 20, segments, 2) == 40; // into page 6, which isn't cached
+  ok &= cachedRead(5 * 128, 128) && cachedRead(6 * 128, 20);
+  cacheResult("cachewrite", ok);
+
+  // A write that fails drops the page, rather than leaving it as it would have been
+  // had the write gone through: NACKed (so the chip still has the old data)...
+  startCache();
+  ok = cachedRead(7 * 128, 128);
+  bus.failWrites = 1;
+  fill(buf, 8, 0x44);
+  ok &= eeprom.write(7 * 128 + 3, buf, 8) == 0;
+  ok &= cachedRead(7 * 128, 128);
+  cacheResult("cachenack", ok);
+
+  // ... or a bus error while waiting for the write cycle (so that the chip has the
+  // new data, whatever the write returned)
+  startCache();
+  ok = cachedRead(8 * 128, 128);
+  bus.failPoll = 1;
+  ok &= eeprom.write(8 * 128 + 3, buf, 8) == 0;
+  bus.failPoll = 0;
+  delay(10); // the write cycle
+  ok &= cachedRead(8 * 128, 128);
+  cacheResult("cachepollerror", ok);
+
+  eeprom.setCache(NULL, 0);
+}
+
+//
+// Arrays and structs, in EEPROM_BYTE_ORDER (test_eeprom24xx.py builds with either)
+//
+
+// Whether the chip holds value, of size bytes, at addr, in EEPROM_BYTE_ORDER
+boolean stored(uint32_t addr, uint32_t value, uint8_t size) {
+  for (uint8_t i = 0; i < size; i++) {
+    uint8_t shift = 8 * ((EEPROM_BYTE_ORDER == EEPROM_BIG_ENDIAN) ? size - 1 - i : i);
+    if (bus.memory[addr + i] != (byte)(value >> shift))
+      return false;
+  }
+  return true;
+}
+
+void arrayTests() {
+  static uint16_t words[300], wordsBack[300];
+  bus.writeCycle = 3000;
+
+  // 300 words (600 bytes), from 37 bytes before a page boundary: written a page at a
+  // time (6 writes), and read back in 240-byte chunks (3 reads)
+  uint32_t addr = 20 * 128 - 37;
+  for (uint16_t i = 0; i < 300; i++)
+    words[i] = 0x1234 + i * 0x0101;
+  bus.clearCounts();
+  uint16_t written = eeprom.writeArray(addr, words, 300);
+  uint32_t writes = bus.writes;
+  boolean ok = true;
+  for (uint16_t i = 0; i < 300; i++)
+    ok &= stored(addr + 2 * i, words[i], 2);
+  bus.clearCounts();
+  uint16_t read = eeprom.readArray(addr, wordsBack, 300);
+  result("words");
+  value("written", written);
+  value("writes", writes);
+  value("stored", ok);
+  value("read", read);
+  value("reads", bus.reads);
+  value("same", memcmp(words, wordsBack, sizeof(words)) == 0);
+  value("first", (uint16_t)bus.memory[addr] << 8 | bus.memory[addr + 1]);
+  end();
+
+  // 32-bit values, at the current position, with a value straddling each page boundary
+  static uint32_t longs[80], longsBack[80];
+  for (uint8_t i = 0; i < 80; i++)
+    longs[i] = 0x01020304UL * (i + 1);
+  eeprom.setPosition(40 * 128 - 2);
+  written = eeprom.writeArray(longs, 80);
+  ok = eeprom.getPosition() == 40 * 128 - 2 + 320;
+  for (uint8_t i = 0; i < 80; i++)
+    ok &= stored(40 * 128 - 2 + 4 * i, longs[i], 4);
+  eeprom.setPosition(40 * 128 - 2);
+  read = eeprom.readArray(longsBack, 80);
+  result("longs");
+  value("written", written);
+  value("stored", ok);
+  value("read", read);
+  value("same", memcmp(longs, longsBack, sizeof(longs)) == 0);
+  end();
+
+  // A struct across a page boundary, swapped member by member
+  calibration_t c = { -123456, 1.5, 0xbeef, 0 }, back;
+  addr = 30 * 128 - 3;
+  ok = eeprom.writeStruct(addr, c);
+  ok &= stored(addr, c.offset, 4) && stored(addr + 8, c.flags, 2);
+  uint32_t gain;
+  memcpy(&gain, &c.gain, 4);
+  ok &= stored(addr + 4, gain, 4);
+  memset(&back, 0, sizeof(back));
+  ok &= eeprom.readStruct(addr, back);
+  result("struct");
+  value("ok", ok);
+  value("same", memcmp(&c, &back, sizeof(c)) == 0);
+  end();
+
+  // The helpers for single numbers go the same way
+  eeprom.setPosition(50 * 128 - 1);
+  ok = eeprom.writeInt(-2) && eeprom.writeUInt(0xdeadbeef) && eeprom.writeFloat(-0.25);
+  ok &= stored(50 * 128 - 1, (uint32_t)-2, 4) && stored(50 * 128 + 3, 0xdeadbeef, 4);
+  eeprom.setPosition(50 * 128 - 1);
+  ok &= eeprom.readInt() == -2 && eeprom.readUInt() == 0xdeadbeef && eeprom.readFloat() == -0.25;
+  result("numbers");
+  value("ok", ok);
+  end();
+
+  // Past the end, as many whole values as fit
+  result("arrayend");
+  value("written", eeprom.writeArray(131072UL - 7, words, 10));
+  value("read", eeprom.readArray(131072UL - 7, wordsBack, 10));
+  value("outside", eeprom.writeArray(131072UL, words, 10));
+  end();
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  // The average starts out unknown, so the first write is polled all through; then
+  // it learns the chip's write cycle, and tracks it as that changes
+  writeCycles("cycle3000", 3000, 24);
+  writeCycles("cycle4500", 4500, 40);
+  writeCycles("cycle2000", 2000, 80);
+
+  bus.stuck = true;
+  failedWrite("stuck");
+  bus.stuck = false;
+  delay(10);
+
+  bus.failPoll = 1;
+  failedWrite("pollerror1");
+  bus.failPoll = 3;
+  delay(10);
+  failedWrite("pollerror3");
+  bus.failPoll = 0;
+  delay(10);
+
+  bus.writeProtected = true;
+  failedWrite("protected");
+  bus.writeProtected = false;
+
+  geometry("geometry1025", eeprom, bus, 131072UL, 128);
+  geometry("geometry512", eeprom512, bus512, 65536UL, 128);
+  geometry("geometry256", eeprom256, bus256, 32768UL, 64);
+  geometry("geometry128", eeprom128, bus128, 16384UL, 64);
+
+  cacheTests();
+  arrayTests();
+
+  Serial.println("done");
+}
+
+void loop() {
+  delay(1000);
+}
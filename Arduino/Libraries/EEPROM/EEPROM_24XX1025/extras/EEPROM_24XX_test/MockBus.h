@@ -0,0 +1,171 @@
+/*
+  MockBus.h - a 24XX EEPROM behind the I2C16Bus interface, for EEPROM_24XX_test
+
+  It keeps what's written, NACKs everything for writeCycle microseconds after a
+  write, and can be made to misbehave: never finish a write cycle, be write
+  protected, NACK a write, or answer an acknowledge poll with a bus error. Every
+  transaction takes as long as it would at 400 kHz, and is counted.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef MockBus_h
+#define MockBus_h
+
+#include <Arduino.h>
+#include <I2C16.h>
+
+// The status a NACKed transaction returns, as I2C16's address phase does
+#define MOCK_NACK 2
+
+class MockBus : public I2C16Bus
+{
+  public:
+    // capacity and pageSize as the chip's; blockBit is where its block select bit goes
+    // in the address (0 for none)
+    MockBus(uint32_t _capacity, uint8_t _pageSize, uint8_t _blockBit)
+      : capacity(_capacity), pageSize(_pageSize), blockBit(_blockBit), writeCycle(5000),
+        stuck(false), writeProtected(false), failWrites(0), failPoll(0), pointer(0),
+        busyUntil(0), inWriteCycle(false), pollsSinceWrite(0)
+    {
+      memset(memory, 0xff, sizeof(memory));
+      clearCounts();
+    }
+
+    byte memory[131072];
+    uint32_t capacity;
+    uint8_t pageSize;
+    uint8_t blockBit;
+
+    uint16_t writeCycle; // microseconds
+    boolean stuck; // never finishes a write cycle
+    boolean writeProtected; // ACKs writes, but neither stores them nor starts a write cycle
+    uint8_t failWrites; // NACKs the data of this many writes (so nothing is stored)
+    uint8_t failPoll; // answers this acknowledge poll after a write (1 = the first) with a bus error
+
+    // Transactions, by kind, and the data bytes read
+    uint32_t reads, writes, polls, bytesRead;
+
+    void clearCounts() { reads = writes = polls = bytesRead = 0; }
+
+    void begin() { }
+    uint32_t setClock(uint32_t hz) { return hz; }
+
+    uint8_t write(uint8_t address, uint16_t registerAddress, uint8_t data)
+    {
+      i2c16_segment_t segment = { &data, 1 };
+      return write(address, registerAddress, &segment, 1);
+    }
+
+    uint8_t write(uint8_t address, uint16_t registerAddress, const i2c16_segment_t *segments, uint8_t numberSegments)
+    {
+      uint16_t length = 0;
+      for (uint8_t s = 0; s < numberSegments; s++)
+        length += segments[s].length;
+      transfer(3 + length);
+      writes++;
+      if (busy())
+        return MOCK_NACK;
+      if (failWrites > 0)
+      {
+        failWrites--;
+        return MOCK_NACK;
+      }
+      pointer = fullAddress(address, registerAddress);
+      if (writeProtected)
+        return 0;
+
+      // Within a page, wrapping around at its end, as the chip does
+      uint32_t base = pointer & ~(uint32_t)(pageSize - 1);
+      uint16_t offset = pointer - base;
+      for (uint8_t s = 0; s < numberSegments; s++)
+      {
+        for (uint8_t i = 0; i < segments[s].length; i++)
+        {
+          memory[base + offset] = segments[s].data[i];
+          offset = (offset + 1) & (pageSize - 1);
+        }
+      }
+      pointer = base + offset;
+      busyUntil = micros() + writeCycle;
+      inWriteCycle = true;
+      pollsSinceWrite = 0;
+      return 0;
+    }
+
+    uint8_t read(uint8_t address, uint8_t numberBytes, uint8_t *dataBuffer)
+    {
+      transfer(1 + numberBytes);
+      reads++;
+      if (busy())
+        return MOCK_NACK;
+      uint32_t block = fullAddress(address, 0);
+      for (uint8_t i = 0; i < numberBytes; i++)
+      {
+        dataBuffer[i] = memory[pointer];
+        // Sequential reads roll over at the end of the block
+        pointer = block + ((pointer + 1 - block) & (blockSize() - 1));
+      }
+      bytesRead += numberBytes;
+      return 0;
+    }
+
+    uint8_t read(uint8_t address, uint16_t registerAddress, uint8_t numberBytes, uint8_t *dataBuffer)
+    {
+      transfer(3);
+      if (busy())
+        return MOCK_NACK;
+      pointer = fullAddress(address, registerAddress);
+      return read(address, numberBytes, dataBuffer);
+    }
+
+    uint8_t acknowledgePoll(uint8_t)
+    {
+      transfer(1);
+      polls++;
+      if (failPoll != 0 && ++pollsSinceWrite == failPoll)
+        return I2C16_POLL_ERROR;
+      return busy() ? I2C16_POLL_BUSY : I2C16_POLL_ACK;
+    }
+
+  private:
+    uint32_t pointer;
+    uint32_t busyUntil;
+    boolean inWriteCycle;
+    uint8_t pollsSinceWrite;
+
+    uint32_t blockSize() { return (capacity > 65536UL) ? 65536UL : capacity; }
+
+    uint32_t fullAddress(uint8_t address, uint16_t registerAddress)
+    {
+      uint32_t block = (blockBit != 0 && (address >> blockBit) & 1) ? 65536UL : 0;
+      return (block + registerAddress) & (capacity - 1);
+    }
+
+    boolean busy()
+    {
+      if (inWriteCycle && !stuck && (int32_t)(micros() - busyUntil) >= 0)
+        inWriteCycle = false;
+      return inWriteCycle;
+    }
+
+    // A start, the bytes (9 clocks each at 400 kHz), and a stop
+    void transfer(uint16_t bytes)
+    {
+      delayMicroseconds(bytes * 45 / 2 + 5);
+    }
+};
+
+#endif
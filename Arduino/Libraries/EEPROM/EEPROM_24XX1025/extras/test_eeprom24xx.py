@@ -0,0 +1,174 @@
+from __future__ import print_function, division
+import unittest, sys, os, re, subprocess
+
+# Host tests for EEPROM_24XX, on the simulator: python -m unittest test_eeprom24xx
+# EEPROM_24XX_test runs the library against MockBus (a 24XX1025 that can be made slow,
+# stuck or faulty) and prints what it measured, which is checked here.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SIMULATOR = os.path.join(HERE, '..', '..', '..', '..', 'Simulator')
+sys.path.insert(0, SIMULATOR)
+import sketchsim
+
+SKETCH = os.path.join(HERE, 'EEPROM_24XX_test')
+WRITE_TIMEOUT = 20000 # EEPROM_WRITE_TIMEOUT
+
+outputs = {}
+
+def run(defines = {}):
+	# The sketch's output, built with the given #defines (once)
+	key = tuple(sorted(defines.items()))
+	if key not in outputs:
+		exe = sketchsim.build(SKETCH, defines)
+		(status, out, err) = sketchsim.run(exe, ['--time', '30', '--quiet'], timeout = 600)
+		outputs[key] = out.decode('ascii', 'replace')
+		assert 'done' in outputs[key], outputs[key] + err
+	return outputs[key]
+
+def results(test, defines = {}):
+	# The sketch's measurements for a test: a dict per line
+	lines = [line.split() for line in run(defines).splitlines()]
+	return [dict(kv.split('=') for kv in line[1:]) for line in lines if line and line[0] == test]
+
+def numbers(test, key):
+	return [int(r[key]) for r in results(test)]
+
+def messages(test):
+	# The warnings the library printed just before the test's line
+	last = ''
+	for line in run().splitlines():
+		if line.startswith(test + ' '):
+			return last
+		last = line
+	return None
+
+class WriteCycleTest(unittest.TestCase):
+	def check_cycle(self, test, tWC, settle):
+		for r in results(test):
+			self.assertEqual((r['written'], r['ok']), ('128', '1'))
+		# The average settles within a few percent of the write cycle (polls are 20 us
+		# apart, plus the poll itself), and stays there
+		average = numbers(test, 'average')
+		for a in average[settle:]:
+			self.assertLess(abs(a - tWC), tWC / 20)
+		# Once it has, the bus is left alone for 7/8 of it, so only the last 1/8 takes
+		# polls (about 40 us each), rather than all of the write cycle
+		polls = numbers(test, 'polls')
+		for p in polls[settle:]:
+			self.assertLessEqual(p, tWC / 8 / 40 + 2)
+		return polls
+
+	def test_learns(self):
+		polls = self.check_cycle('cycle3000', 3000, 12)
+		self.assertGreater(polls[0], 50) # the average is unknown at first
+
+	def test_tracks(self):
+		# Slower writes are seen at once; faster ones only once the quiet time (7/8 of
+		# the average) is shorter than the write cycle, so that takes longer
+		self.check_cycle('cycle4500', 4500, 24)
+		self.check_cycle('cycle2000', 2000, 64)
+
+	def test_stuck(self):
+		# A chip that never answers doesn't hang the write
+		(r,) = results('stuck')
+		self.assertEqual(r['written'], '0')
+		self.assertGreater(int(r['us']), WRITE_TIMEOUT)
+		self.assertLess(int(r['us']), WRITE_TIMEOUT + 1000)
+		self.assertIn('never finished', messages('stuck'))
+
+	def test_bus_error(self):
+		# A bus error isn't mistaken for write protection, whether it's the first poll
+		# (which is how write protection shows) or a later one
+		for test in ('pollerror1', 'pollerror3'):
+			(r,) = results(test)
+			self.assertEqual(r['written'], '0')
+			self.assertIn('bus error', messages(test))
+
+	def test_write_protected(self):
+		(r,) = results('protected')
+		self.assertEqual(r['written'], '0')
+		self.assertIn('write protected', messages('protected'))
+
+class GeometryTest(unittest.TestCase):
+	def test_typedefs(self):
+		for (chip, page) in (('1025', 128), ('512', 128), ('256', 64), ('128', 64)):
+			(straddle, end, outside, long) = results('geometry' + chip)
+			self.assertEqual(straddle, { 'straddle': '10', 'ok': '1', 'writes': '2' }, chip)
+			self.assertEqual(end, { 'end': '100', 'ok': '1' }, chip)
+			# (Past the end, the length used to wrap round; only writeChunk() refusing the
+			# first piece kept that from going further)
+			self.assertEqual(outside, { 'at': '0', 'past': '0', 'small': '0', 'readat': '0' }, chip)
+			self.assertEqual(long, { 'long': '300', 'ok': '1' }, chip)
+
+	def test_refused(self):
+		# Geometries the template can't handle don't compile
+		for (bad, check) in (('1', 'capacityCheck'), ('2', 'pageSizeCheck')):
+			p = subprocess.Popen([sys.executable, os.path.join(SIMULATOR, 'sketchsim.py'), '-b',
+				'-D', 'BAD_GEOMETRY=' + bad, SKETCH], stdout = subprocess.PIPE, stderr = subprocess.PIPE)
+			(out, err) = p.communicate()
+			self.assertNotEqual(p.returncode, 0)
+			self.assertIn(check, err.decode('utf-8', 'replace'))
+
+class CacheTest(unittest.TestCase):
+	def cache(self, test):
+		(r,) = results(test)
+		r = dict((k, int(v)) for (k, v) in r.items())
+		self.assertEqual(r['ok'], 1, test) # every read returned what the chip holds
+		self.assertEqual(r['hits'] + r['misses'], r['lookups'], test)
+		self.assertEqual(r['reads'], r['misses'], test) # a page read per miss, and nothing else
+		return r
+
+	def test_random(self):
+		r = self.cache('cacherandom4')
+		self.assertEqual(r['misses'], 4)
+		r = self.cache('cacherandom8')
+		self.assertTrue(0.3 < r['hits'] / r['lookups'] < 0.7, r)
+
+	def test_strided(self):
+		# LRU can't keep a working set larger than the cache: every page is read again
+		# on the second pass
+		r = self.cache('cachestride32')
+		self.assertEqual((r['misses'], r['hits']), (32, 96))
+		r = self.cache('cachestride128')
+		self.assertEqual((r['misses'], r['hits']), (32, 0))
+		r = self.cache('cachestride128fits')
+		self.assertEqual((r['misses'], r['hits']), (4, 4))
+
+	def test_lru(self):
+		r = self.cache('cachelru')
+		self.assertEqual((r['misses'], r['hits']), (6, 5))
+
+	def test_clock_wrap(self):
+		(r,) = results('cachewrap')
+		self.assertEqual(r, { 'ok': '1', 'misses': '5', 'hit': '1' })
+
+	def test_write_through(self):
+		r = self.cache('cachewrite')
+		self.assertEqual(r['misses'], 2) # pages 5 and 6; the writes didn't drop page 5
+
+	def test_failed_write(self):
+		for test in ('cachenack', 'cachepollerror'):
+			r = self.cache(test)
+			self.assertEqual(r['misses'], 2, test) # read again after the write
+
+class ArrayTest(unittest.TestCase):
+	def check(self, defines, first):
+		(words,) = results('words', defines)
+		self.assertEqual(words, { 'written': '300', 'writes': '6', 'stored': '1', 'read': '300',
+			'reads': '3', 'same': '1', 'first': str(first) })
+		(longs,) = results('longs', defines)
+		self.assertEqual(longs, { 'written': '80', 'stored': '1', 'read': '80', 'same': '1' })
+		self.assertEqual(results('struct', defines), [{ 'ok': '1', 'same': '1' }])
+		self.assertEqual(results('numbers', defines), [{ 'ok': '1' }])
+		# 7 bytes left: 3 whole words
+		self.assertEqual(results('arrayend', defines), [{ 'written': '3', 'read': '3', 'outside': '0' }])
+
+	def test_little_endian(self):
+		self.check({}, 0x3412)
+
+	def test_big_endian(self):
+		# Every value is swapped on the way in and out
+		self.check({ 'EEPROM_BYTE_ORDER': 'EEPROM_BIG_ENDIAN' }, 0x1234)
+
+if __name__ == '__main__':
+	unittest.main()
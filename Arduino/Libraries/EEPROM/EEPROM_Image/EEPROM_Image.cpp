@@ -0,0 +1,97 @@
+#include "EEPROM_Image.h"
+#include <util/crc16.h>
+
+/*
+ * Multi-file EEPROM image reader
+ * Lets a single EEPROM hold many clips (or other data), addressed by index.
+ *
+ * License: MIT/BSD, same as the EEPROM_24XX1025 library.
+ */
+
+// Where directory entry N lives, relative to the start of the image
+#define ENTRY_POS(n) (sizeof(struct EEPROM_ImageHeader) + (uint32_t)(n) * sizeof(struct EEPROM_ImageEntry))
+
+// Updates a running CRC-CCITT with a block of data; same algorithm as build-image.py
+static uint16_t crcBlock(uint16_t crc, const byte *data, uint8_t length) {
+  for (uint8_t i = 0; i < length; i++)
+    crc = _crc_ccitt_update(crc, data[i]);
+  return crc;
+}
+
+boolean EEPROM_Image::begin(void) {
+  struct EEPROM_ImageHeader header = {};
+  numEntries = 0;
+
+  if (eeprom.read(base, &header, sizeof(header)) != sizeof(header))
+    return false;
+  if (strncmp(header.magic, IMAGE_MAGIC, 4) != 0 || header.version != IMAGE_VERSION
+      || header.entrySize != sizeof(struct EEPROM_ImageEntry))
+    return false;
+
+  // Check the directory as a whole, so that getEntry() can trust what it reads later
+  uint16_t crc = 0xffff;
+  struct EEPROM_ImageEntry entry;
+  for (uint8_t i = 0; i < header.count; i++) {
+    if (eeprom.read(base + ENTRY_POS(i), &entry, sizeof(entry)) != sizeof(entry))
+      return false;
+    crc = crcBlock(crc, (const byte *)&entry, sizeof(entry));
+  }
+  if (crc != header.dirChecksum)
+    return false;
+
+  numEntries = header.count;
+  return true;
+}
+
+boolean EEPROM_Image::getEntry(uint8_t index, struct EEPROM_ImageEntry *entry) {
+  // Entries are fixed-size, so this is a single read, no matter how many files there are
+  if (index >= numEntries)
+    return false;
+
+  return eeprom.read(base + ENTRY_POS(index), entry, sizeof(*entry)) == sizeof(*entry);
+}
+
+int16_t EEPROM_Image::find(const char *name) {
+  struct EEPROM_ImageEntry entry;
+  for (uint8_t i = 0; i < numEntries; i++) {
+    if (getEntry(i, &entry) && strncmp(entry.name, name, IMAGE_NAME_LEN) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+uint32_t EEPROM_Image::address(uint8_t index) {
+  struct EEPROM_ImageEntry entry;
+  if (!getEntry(index, &entry))
+    return 0xffffffff;
+
+  return base + entry.offset;
+}
+
+boolean EEPROM_Image::seek(uint8_t index) {
+  uint32_t addr = address(index);
+  if (addr == 0xffffffff)
+    return false;
+
+  return eeprom.setPosition(addr);
+}
+
+boolean EEPROM_Image::verify(uint8_t index) {
+  struct EEPROM_ImageEntry entry;
+  if (!getEntry(index, &entry))
+    return false;
+
+  byte buf[32];
+  uint16_t crc = 0xffff;
+  uint32_t pos = 0;
+  while (pos < entry.length) {
+    uint8_t len = min(sizeof(buf), entry.length - pos);
+    if (eeprom.read(base + entry.offset + pos, buf, len) != len)
+      return false;
+    crc = crcBlock(crc, buf, len);
+    pos += len;
+  }
+
+  return crc == entry.checksum;
+}
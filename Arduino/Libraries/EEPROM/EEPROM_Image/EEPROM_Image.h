@@ -0,0 +1,73 @@
+#ifndef _EEPROM_IMAGE_H
+#define _EEPROM_IMAGE_H
+
+#include <I2C16.h>
+#include <EEPROM_24XX1025.h>
+#include <Arduino.h>
+#include <inttypes.h>
+
+// Reads multi-file EEPROM images, as created by build-image.py
+// (see the EEPROM-serial-data project).
+
+#define IMAGE_MAGIC "EIMG"
+#define IMAGE_VERSION 1
+#define IMAGE_PAGE_SIZE 128
+#define IMAGE_NAME_LEN 16
+
+// Image layout (all integers little-endian, i.e. native AVR order):
+// 0:  header (16 bytes)
+// 16: directory; one 32-byte entry per file, so entry N is at 16 + 32 * N
+// The file data follows, each file starting on a 128-byte page boundary.
+
+struct EEPROM_ImageHeader {
+  char magic[4];      /* "EIMG" */
+  uint8_t version;
+  uint8_t count;      /* number of directory entries */
+  uint8_t entrySize;  /* sizeof(EEPROM_ImageEntry), for future extensions */
+  uint8_t reserved;
+  uint16_t dirChecksum; /* CRC-CCITT of all directory entries */
+  uint8_t padding[6];
+} __attribute__((packed));
+
+struct EEPROM_ImageEntry {
+  char name[IMAGE_NAME_LEN]; /* NUL-padded; not terminated if all 16 chars are used! */
+  uint32_t offset;    /* from the start of the image; always a multiple of 128 */
+  uint32_t length;    /* in bytes */
+  uint8_t format;     /* see below */
+  uint8_t flags;
+  uint16_t checksum;  /* CRC-CCITT of the data */
+  uint32_t param;     /* format specific; the sample rate for PCM data */
+} __attribute__((packed));
+
+// Entry formats
+enum {
+  IMAGE_FORMAT_RAW = 0, /* anything */
+  IMAGE_FORMAT_WAV = 1, /* a complete .wav file, headers and all */
+  IMAGE_FORMAT_PCM = 2, /* raw unsigned 8-bit mono samples; param is the sample rate */
+  IMAGE_FORMAT_PCM16 = 3 /* as above, but 16 bits (little-endian) per sample, for 10/12-bit DACs */
+};
+
+class EEPROM_Image {
+public:
+  EEPROM_Image(EEPROM_24XX1025 &_eeprom, uint32_t _base = 0) : eeprom(_eeprom), base(_base), numEntries(0) { }
+
+  // Reads and checks the header and directory. Must be called (and succeed)
+  // before anything else is used.
+  boolean begin(void);
+
+  uint8_t count(void) { return numEntries; }
+  boolean getEntry(uint8_t index, struct EEPROM_ImageEntry *entry);
+  int16_t find(const char *name); // returns the index, or -1 if not found
+
+  // Returns the absolute EEPROM address of a file's data, or 0xffffffff on failure
+  uint32_t address(uint8_t index);
+  boolean seek(uint8_t index); // sets the EEPROM position to the start of the file
+  boolean verify(uint8_t index); // checks the data against the stored checksum
+
+private:
+  EEPROM_24XX1025 &eeprom;
+  uint32_t base;
+  uint8_t numEntries;
+};
+
+#endif
@@ -0,0 +1,79 @@
+// Reads an image made by build-image.py, on the simulator, with the image in a
+// simulated 24LC1025 (--i2c-eeprom 24LC1025@0x50=FILE), and prints what EEPROM_Image
+// made of it, a line each: the test's name, then name=value pairs. test_eeprom_image.py
+// builds the images, runs it, and compares the lines with what it put in.
+
+#include <I2C16.h>
+#include <EEPROM_24XX1025.h>
+#include <EEPROM_Image.h>
+
+// Where the image starts in the EEPROM; test_eeprom_image.py builds with others too
+#define IMAGE_BASE 0
+
+EEPROM_24XX1025 eeprom(0, 0);
+EEPROM_Image image(eeprom, IMAGE_BASE);
+
+void value(const char *name, uint32_t v) {
+  Serial.print(' ');
+  Serial.print(name);
+  Serial.print('=');
+  Serial.print(v);
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  boolean ok = image.begin();
+  Serial.print("begin");
+  value("ok", ok);
+  value("count", image.count());
+  Serial.println();
+
+  struct EEPROM_ImageEntry entry;
+  for (uint8_t i = 0; i < image.count(); i++) {
+    if (!image.getEntry(i, &entry)) {
+      Serial.print("entry");
+      value("index", i);
+      value("read", 0);
+      Serial.println();
+      continue;
+    }
+    // Names are NUL-padded, but not terminated if they're 16 characters long
+    char name[IMAGE_NAME_LEN + 1];
+    memcpy(name, entry.name, IMAGE_NAME_LEN);
+    name[IMAGE_NAME_LEN] = 0;
+
+    Serial.print("entry");
+    value("index", i);
+    Serial.print(" name=");
+    Serial.print(name);
+    value("offset", entry.offset);
+    value("length", entry.length);
+    value("format", entry.format);
+    value("param", entry.param);
+    value("checksum", entry.checksum);
+    value("find", image.find(name));
+    value("address", image.address(i));
+    value("verify", image.verify(i));
+    if (entry.length > 0 && image.seek(i))
+      value("first", eeprom.readByte());
+    Serial.println();
+  }
+
+  // Past the end of the directory
+  uint8_t n = image.count();
+  Serial.print("outside");
+  value("get", image.getEntry(n, &entry));
+  value("address", image.address(n));
+  value("seek", image.seek(n));
+  value("verify", image.verify(n));
+  Serial.print(" find=");
+  Serial.print(image.find("no such file"));
+  Serial.println();
+
+  Serial.println("done");
+}
+
+void loop() {
+  delay(1000);
+}
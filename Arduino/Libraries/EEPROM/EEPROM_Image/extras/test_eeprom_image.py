@@ -0,0 +1,145 @@
+from __future__ import print_function, division
+import unittest, sys, os, subprocess, tempfile, shutil, random, wave, importlib.util
+
+# Host tests for EEPROM_Image, on the simulator: python -m unittest test_eeprom_image
+# Images are made by build-image.py (as from the command line), put in a simulated
+# 24LC1025, and read by EEPROM_Image_test; what it prints is checked against what went in,
+# also with images that have been damaged in various ways.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', '..', '..', 'Simulator'))
+import sketchsim
+
+SKETCH = os.path.join(HERE, 'EEPROM_Image_test')
+BUILD_IMAGE = os.path.join(HERE, '..', '..', '..', '..', 'Projects', 'EEPROM-serial-data', 'build-image.py')
+NOT_FOUND = 0xffffffff
+
+spec = importlib.util.spec_from_file_location('build_image', BUILD_IMAGE)
+build_image = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(build_image)
+
+def make_files(d):
+	# A few files of the kinds build-image.py knows about, and lengths around a page
+	rnd = random.Random(27)
+	files = [
+		('noise.bin', bytes(rnd.randrange(256) for i in range(1000))),
+		('sixteen_chars.da', bytes(rnd.randrange(256) for i in range(300))), # no room for the NUL
+		('empty.txt', b''),
+		('page.raw', bytes(range(128))),
+	]
+	paths = []
+	for (name, data) in files:
+		paths.append(os.path.join(d, name))
+		open(paths[-1], 'wb').write(data)
+	paths.append(os.path.join(d, 'tone.wav'))
+	w = wave.open(paths[-1], 'wb')
+	w.setnchannels(1)
+	w.setsampwidth(1)
+	w.setframerate(8000)
+	w.writeframes(bytes(128 + (i * 7 % 64) for i in range(2000)))
+	w.close()
+	return paths
+
+def entries(image):
+	# What build-image.py put in the directory: a dict per entry, named as the sketch prints them
+	(magic, version, count, size, reserved, crc) = build_image.HEADER.unpack_from(image, 0)
+	result = []
+	for i in range(count):
+		(name, offset, length, fmt, flags, checksum, param) = build_image.ENTRY.unpack_from(image,
+			build_image.HEADER.size + i * build_image.ENTRY.size)
+		result.append({ 'name': name.rstrip(b'\0').decode('ascii'), 'offset': offset, 'length': length,
+			'format': fmt, 'param': param, 'checksum': checksum })
+	return result
+
+class ImageTest(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.tmp = tempfile.mkdtemp()
+		path = os.path.join(cls.tmp, 'image.bin')
+		p = subprocess.Popen([sys.executable, BUILD_IMAGE, path] + make_files(cls.tmp),
+			stdout = subprocess.PIPE, stderr = subprocess.PIPE)
+		(out, err) = p.communicate()
+		assert p.returncode == 0, err
+		cls.image = open(path, 'rb').read()
+
+	@classmethod
+	def tearDownClass(cls):
+		shutil.rmtree(cls.tmp)
+
+	def read(self, image, base = 0):
+		# Runs the sketch on an EEPROM holding image at base; returns its lines, as
+		# (test, dict), with the numbers as ints
+		eeprom = os.path.join(self.tmp, 'eeprom.bin')
+		open(eeprom, 'wb').write(b'\xff' * base + image)
+		exe = sketchsim.build(SKETCH, { 'IMAGE_BASE': str(base) } if base else {})
+		(status, out, err) = sketchsim.run(exe, ['--i2c-eeprom', '24LC1025@0x50=' + eeprom,
+			'--time', '5', '--quiet'], timeout = 300)
+		out = out.decode('ascii', 'replace')
+		self.assertIn('done', out, out + err)
+		lines = []
+		for line in out.splitlines():
+			fields = line.split()
+			if len(fields) > 1:
+				d = dict(kv.split('=', 1) for kv in fields[1:])
+				lines.append((fields[0], dict((k, v if k == 'name' else int(v)) for (k, v) in d.items())))
+		return lines
+
+	def check(self, image, base = 0, bad = []):
+		# The sketch reads back every entry as build-image.py wrote it; the data of those
+		# in bad doesn't match its checksum
+		lines = self.read(image, base)
+		expected = entries(image)
+		self.assertEqual(lines[0], ('begin', { 'ok': 1, 'count': len(expected) }))
+		read = [d for (test, d) in lines if test == 'entry']
+		self.assertEqual(len(read), len(expected))
+		for (i, (r, e)) in enumerate(zip(read, expected)):
+			for k in e:
+				self.assertEqual(r[k], e[k], (i, k))
+			self.assertEqual(r['find'], i)
+			self.assertEqual(r['address'], base + e['offset'])
+			self.assertEqual(r['verify'], 0 if i in bad else 1, i)
+			if e['length']:
+				self.assertEqual(r['first'], image[e['offset']])
+		self.assertEqual(dict(lines)['outside'], { 'get': 0, 'address': NOT_FOUND, 'seek': 0, 'verify': 0, 'find': -1 })
+
+	def check_refused(self, image):
+		lines = self.read(image)
+		self.assertEqual(lines[0], ('begin', { 'ok': 0, 'count': 0 }))
+		self.assertEqual([test for (test, d) in lines], ['begin', 'outside'])
+		self.assertEqual(dict(lines)['outside'], { 'get': 0, 'address': NOT_FOUND, 'seek': 0, 'verify': 0, 'find': -1 })
+
+	def test_round_trip(self):
+		e = entries(self.image)
+		self.assertEqual([x['name'] for x in e], ['noise.bin', 'sixteen_chars.da', 'empty.txt', 'page.raw', 'tone.wav'])
+		self.assertEqual((e[4]['format'], e[4]['param']), (build_image.FORMAT_WAV, 8000))
+		self.check(self.image)
+
+	def test_base(self):
+		# An image further into the EEPROM, with the directory across the 64 KiB block boundary
+		self.check(self.image, base = 0x10000 - 64)
+
+	def test_bad_data(self):
+		# A changed byte in a file fails that file's check only; one in the padding after a
+		# file isn't part of it
+		e = entries(self.image)
+		image = bytearray(self.image)
+		image[e[1]['offset'] + 299] ^= 0x01
+		image[e[0]['offset'] + 1000] ^= 0xff
+		image[e[4]['offset']] ^= 0x80
+		self.check(bytes(image), bad = [1, 4])
+
+	def test_bad_directory(self):
+		# A changed entry fails the directory's checksum, so none of it is used
+		image = bytearray(self.image)
+		image[build_image.HEADER.size + build_image.ENTRY.size + 20] ^= 0x01 # entry 1's length
+		self.check_refused(bytes(image))
+
+	def test_not_an_image(self):
+		self.check_refused(b'EIMH' + self.image[4:])
+		self.check_refused(b'\xff' * 256) # an erased EEPROM
+		image = bytearray(self.image)
+		image[6] = 16 # entry size
+		self.check_refused(bytes(image))
+
+if __name__ == '__main__':
+	unittest.main()
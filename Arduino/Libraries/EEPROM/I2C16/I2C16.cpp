@@ -5,6 +5,11 @@
   Rev x.x - August 4th, 2012 - modified by Thomas Backman <serenity@exscape.org>
   		  - Use 16-bit addresses
 		  - Add acknowledge polling support (used in e.g. Microchip EEPROMs)
+		  - Add setClock() for any bus speed (including 1 MHz Fast Mode Plus)
+		    at any F_CPU
+		  - Add an optional transaction trace (I2C16_TRACE)
+		  - Add vectored (scatter-gather) writes
+		  - Add the I2C16Bus interface, shared with SoftI2C16
   Rev 5.0 - January 24th, 2012
           - Removed the use of interrupts completely from the library
             so TWI state changes are now polled. 
@@ -73,6 +78,35 @@ uint8_t I2C16::bufferIndex = 0;
 uint8_t I2C16::totalBytes = 0;
 uint16_t I2C16::timeOutDelay = 0;
 
+#ifdef I2C16_TRACE
+i2c16_trace_t I2C16::traceBuffer[I2C16_TRACE_SIZE];
+uint8_t I2C16::traceNext = 0;
+uint32_t I2C16::traceTotal = 0;
+
+// Declared at the top of a public method, this records the transaction when the
+// method returns, whichever return that is
+class I2C16TraceScope
+{
+  public:
+    I2C16TraceScope(I2C16 *_bus, uint8_t _address, uint8_t _type, uint8_t _length)
+      : bus(_bus), address(_address), type(_type), length(_length), start(micros())
+    {
+      bus->traceLockup = 0;
+    }
+    ~I2C16TraceScope()
+    {
+      bus->trace(address, type | bus->traceLockup, length, bus->returnStatus, start);
+    }
+  private:
+    I2C16 *bus;
+    uint8_t address, type, length;
+    uint32_t start;
+};
+#define TRACE(address, type, length) I2C16TraceScope traceScope(this, address, type, length)
+#else
+#define TRACE(address, type, length)
+#endif
+
 I2C16::I2C16()
 {
 }
@@ -95,10 +129,9 @@ void I2C16::begin()
     sbi(PORTD, 0);
     sbi(PORTD, 1);
   #endif
-  // initialize twi prescaler and bit rate
-  cbi(TWSR, TWPS0);
-  cbi(TWSR, TWPS1);
-  TWBR = ((F_CPU / 100000) - 16) / 2;
+  // initialize twi prescaler and bit rate. Not through the vtable: a global EEPROM
+  // driver in another file may call begin() before I2c16 has been constructed.
+  I2C16::setClock(100000);
   // enable twi module and acks
   TWCR = _BV(TWEN) | _BV(TWEA); 
 }
@@ -115,14 +148,38 @@ void I2C16::timeOut(uint16_t _timeOut)
 
 void I2C16::setSpeed(uint8_t _fast)
 {
-  if(!_fast)
-  {
-    TWBR = ((F_CPU / 100000) - 16) / 2;
-  }
-  else
-  {
-    TWBR = ((F_CPU / 400000) - 16) / 2;
+  setClock(_fast ? 400000 : 100000);
+}
+
+// Sets the SCL frequency to the fastest one possible that doesn't exceed _hz,
+// and returns it. The TWI clock is F_CPU / (16 + 2 * TWBR * 4^prescaler), so the
+// fastest possible is F_CPU / 16 (1 MHz at 16 MHz, 500 kHz at 8 MHz), and the
+// slowest F_CPU / 32656 (490 Hz at 16 MHz), which is also what 0 gets.
+uint32_t I2C16::setClock(uint32_t _hz)
+{
+  if(_hz == 0){_hz = 1;}
+  uint32_t divider = (F_CPU + _hz - 1) / _hz; // rounded up, to never exceed _hz
+  uint8_t prescaler = 0;
+  uint32_t bitRate = 0;
+  if(divider > 16)
+  {
+    // Use the smallest prescaler that can do it, for the finest steps
+    for(prescaler = 0; prescaler < 4; prescaler++)
+    {
+      uint16_t scale = 2 << (2 * prescaler); // 2 * 4^prescaler
+      bitRate = (divider - 16 + scale - 1) / scale;
+      if(bitRate <= 255){break;}
+    }
+    if(prescaler == 4)
+    {
+      // Slower than possible; use the slowest there is
+      prescaler = 3;
+      bitRate = 255;
+    }
   }
+  TWSR = (TWSR & ~(_BV(TWPS0) | _BV(TWPS1))) | prescaler;
+  TWBR = bitRate;
+  return(F_CPU / (16 + 2 * bitRate * (1UL << (2 * prescaler))));
 }
   
 void I2C16::pullup(uint8_t activate)
@@ -237,6 +294,7 @@ uint8_t I2C16::receive()
 
 uint8_t I2C16::write(uint8_t address, uint16_t registerAddress)
 {
+  TRACE(address, I2C16_TRACE_WRITE, 2);
   returnStatus = 0;
   returnStatus = start();
   if(returnStatus){return(returnStatus);}
@@ -274,6 +332,7 @@ uint8_t I2C16::write(int address, int registerAddress)
 
 uint8_t I2C16::write(uint8_t address, uint16_t registerAddress, uint8_t data)
 {
+  TRACE(address, I2C16_TRACE_WRITE, 3);
   returnStatus = 0;
   returnStatus = start(); 
   if(returnStatus){return(returnStatus);}
@@ -325,6 +384,22 @@ uint8_t I2C16::write(uint8_t address, uint16_t registerAddress, char *data)
 
 uint8_t I2C16::write(uint8_t address, uint16_t registerAddress, uint8_t *data, uint8_t numberBytes)
 {
+  i2c16_segment_t segment = { data, numberBytes };
+  return(write(address, registerAddress, &segment, 1));
+}
+
+// Sends the segments back to back, in a single transaction, as if they were one
+// buffer; e.g. a record header and its payload, without copying them together first
+uint8_t I2C16::write(uint8_t address, uint16_t registerAddress, const i2c16_segment_t *segments, uint8_t numberSegments)
+{
+#ifdef I2C16_TRACE
+  uint8_t numberBytes = 2;
+  for (uint8_t s = 0; s < numberSegments; s++)
+  {
+    numberBytes += segments[s].length;
+  }
+#endif
+  TRACE(address, I2C16_TRACE_WRITE, numberBytes);
   returnStatus = 0;
   returnStatus = start();
   if(returnStatus){return(returnStatus);}
@@ -346,14 +421,18 @@ uint8_t I2C16::write(uint8_t address, uint16_t registerAddress, uint8_t *data, u
     if(returnStatus == 1){return(3);}
     return(returnStatus);
   }
-  for (uint8_t i = 0; i < numberBytes; i++)
+  for (uint8_t s = 0; s < numberSegments; s++)
   {
-    returnStatus = sendByte(data[i]);
-    if(returnStatus)
-      {
-        if(returnStatus == 1){return(3);}
-        return(returnStatus);
-      }
+    const uint8_t *data = segments[s].data;
+    for (uint8_t i = 0; i < segments[s].length; i++)
+    {
+      returnStatus = sendByte(data[i]);
+      if(returnStatus)
+        {
+          if(returnStatus == 1){return(3);}
+          return(returnStatus);
+        }
+    }
   }
   returnStatus = stop();
   if(returnStatus)
@@ -371,6 +450,7 @@ uint8_t I2C16::read(int address, int numberBytes)
 
 uint8_t I2C16::read(uint8_t address, uint8_t numberBytes)
 {
+  TRACE(address, I2C16_TRACE_READ, numberBytes);
   bytesAvailable = 0;
   bufferIndex = 0;
   if(numberBytes == 0){numberBytes++;}
@@ -419,6 +499,7 @@ uint8_t I2C16::read(int address, int registerAddress, int numberBytes)
 
 uint8_t I2C16::read(uint8_t address, uint16_t registerAddress, uint8_t numberBytes)
 {
+  TRACE(address, I2C16_TRACE_READ, numberBytes + 2);
   bytesAvailable = 0;
   bufferIndex = 0;
   if(numberBytes == 0){numberBytes++;}
@@ -485,6 +566,7 @@ uint8_t I2C16::read(uint8_t address, uint16_t registerAddress, uint8_t numberByt
 
 uint8_t I2C16::read(uint8_t address, uint8_t numberBytes, uint8_t *dataBuffer)
 {
+  TRACE(address, I2C16_TRACE_READ, numberBytes);
   bytesAvailable = 0;
   bufferIndex = 0;
   if(numberBytes == 0){numberBytes++;}
@@ -527,6 +609,7 @@ uint8_t I2C16::read(uint8_t address, uint8_t numberBytes, uint8_t *dataBuffer)
 
 uint8_t I2C16::read(uint8_t address, uint16_t registerAddress, uint8_t numberBytes, uint8_t *dataBuffer)
 {
+  TRACE(address, I2C16_TRACE_READ, numberBytes + 2);
   bytesAvailable = 0;
   bufferIndex = 0;
   if(numberBytes == 0){numberBytes++;}
@@ -657,6 +740,7 @@ uint8_t I2C16::sendAddress(uint8_t i2cAddress)
 uint8_t I2C16::acknowledgePoll(uint8_t i2cAddress)
 {
   // Used to check for a response, while waiting for an EEPROM write.
+  TRACE(i2cAddress, I2C16_TRACE_POLL, 1);
   start();
   TWDR = SLA_W(i2cAddress);
   unsigned long startingTime = millis();
@@ -667,18 +751,20 @@ uint8_t I2C16::acknowledgePoll(uint8_t i2cAddress)
     if((millis() - startingTime) >= timeOutDelay)
     {
       lockUp();
-      return(1);
+      returnStatus = I2C16_POLL_ERROR;
+      return(I2C16_POLL_ERROR);
     }
        
   }
+  returnStatus = TWI_STATUS;
   if ((TWI_STATUS == MT_SLA_ACK) || (TWI_STATUS == MR_SLA_ACK))
   {
-    return 1;
+    return I2C16_POLL_ACK;
   }
   uint8_t bufferedStatus = TWI_STATUS;
   if ((TWI_STATUS == MT_SLA_NACK) || (TWI_STATUS == MR_SLA_NACK))
   {
-	  return 0;
+	  return I2C16_POLL_BUSY;
   }
   else
   {
@@ -770,7 +856,73 @@ void I2C16::lockUp()
 {
   TWCR = 0; //releases SDA and SCL lines to high impedance
   TWCR = _BV(TWEN) | _BV(TWEA); //reinitialize TWI 
+#ifdef I2C16_TRACE
+  traceLockup = I2C16_TRACE_LOCKUP;
+#endif
 }
 
+#ifdef I2C16_TRACE
+void I2C16::trace(uint8_t address, uint8_t type, uint8_t length, uint8_t status, uint32_t start)
+{
+  i2c16_trace_t *last = &traceBuffer[(traceNext + I2C16_TRACE_SIZE - 1) % I2C16_TRACE_SIZE];
+  if(type == I2C16_TRACE_POLL && traceTotal > 0 && last->type == I2C16_TRACE_POLL &&
+     last->address == address && last->status == MT_SLA_NACK)
+  {
+    // Still waiting for the same write; extend its entry, rather than filling
+    // the buffer with polls
+    last->end = micros();
+    last->status = status;
+    if(last->length < 255){last->length++;}
+    return;
+  }
+
+  i2c16_trace_t *entry = &traceBuffer[traceNext];
+  entry->start = start;
+  entry->end = micros();
+  entry->address = address;
+  entry->type = type;
+  entry->length = length;
+  entry->status = status;
+  traceNext = (traceNext + 1) % I2C16_TRACE_SIZE;
+  traceTotal++;
+}
+
+// Prints the trace, oldest first, one transaction per line:
+//   I2C16 <start> <end> 0x<address> <W|R|P>[L] <length> <status>
+// where L marks a lockup, followed by a summary line.
+void I2C16::dumpTrace()
+{
+  uint8_t n = (traceTotal < I2C16_TRACE_SIZE) ? traceTotal : I2C16_TRACE_SIZE;
+  for(uint8_t i = 0; i < n; i++)
+  {
+    i2c16_trace_t *entry = &traceBuffer[(traceNext + I2C16_TRACE_SIZE - n + i) % I2C16_TRACE_SIZE];
+    Serial.print("I2C16 ");
+    Serial.print(entry->start);
+    Serial.print(' ');
+    Serial.print(entry->end);
+    Serial.print(" 0x");
+    Serial.print(entry->address, HEX);
+    Serial.print(' ');
+    Serial.print("WRP"[entry->type & 0x03]);
+    if(entry->type & I2C16_TRACE_LOCKUP){Serial.print('L');}
+    Serial.print(' ');
+    Serial.print(entry->length);
+    Serial.print(' ');
+    Serial.println(entry->status);
+  }
+  Serial.print("I2C16 trace: ");
+  Serial.print(n);
+  Serial.print(" of ");
+  Serial.print(traceTotal);
+  Serial.println(" transactions");
+}
+
+void I2C16::clearTrace()
+{
+  traceNext = 0;
+  traceTotal = 0;
+}
+#endif
+
 I2C16 I2c16 = I2C16();
 
@@ -5,6 +5,11 @@
   Rev x.x - August 4th, 2012 - modified by Thomas Backman <serenity@exscape.org>
   		  - Use 16-bit addresses
 		  - Add acknowledge polling support (used in e.g. Microchip EEPROMs)
+		  - Add setClock() for any bus speed (including 1 MHz Fast Mode Plus)
+		    at any F_CPU
+		  - Add an optional transaction trace (I2C16_TRACE)
+		  - Add vectored (scatter-gather) writes
+		  - Add the I2C16Bus interface, shared with SoftI2C16
   Rev 5.0 - January 24th, 2012
           - Removed the use of interrupts completely from the library
             so TWI state changes are now polled. 
@@ -88,10 +93,61 @@
 
 #define MAX_BUFFER_SIZE 32
 
+// Uncomment to record every transaction (address, direction, length, status, and
+// micros() at its start and end) in a ring buffer, which dumpTrace() prints.
+// Each entry costs 12 bytes of RAM, and recording one takes a few microseconds.
+// extras/trace_histogram.py turns the dump into latency histograms.
+// #define I2C16_TRACE
+#define I2C16_TRACE_SIZE 16
+
+// What acknowledgePoll() returns, besides a bus error: I2C16_POLL_ERROR for a timeout,
+// or the TWI status
+#define I2C16_POLL_BUSY 0
+#define I2C16_POLL_ACK 1
+#define I2C16_POLL_ERROR 2
+
+// One piece of a vectored write; see write(address, registerAddress, segments, numberSegments)
+typedef struct {
+  const uint8_t *data;
+  uint8_t length;
+} i2c16_segment_t;
+
+#ifdef I2C16_TRACE
+#define I2C16_TRACE_WRITE 0
+#define I2C16_TRACE_READ 1
+#define I2C16_TRACE_POLL 2 // acknowledge polling; one entry per wait (length = number of polls)
+#define I2C16_TRACE_LOCKUP 0x80 // set if lockUp() reset the TWI during the transaction
+
+typedef struct {
+  uint32_t start; // micros()
+  uint32_t end;
+  uint8_t address;
+  uint8_t type;
+  uint8_t length; // data bytes (including the register address), or number of polls
+  uint8_t status; // returnStatus (0 = OK); for polls, the TWI status of the last one
+} i2c16_trace_t;
+#endif
+
 
 
+// The part of I2C16 that EEPROM_24XX1025 uses, so that it can use any bus that
+// implements it, e.g. a SoftI2C16 on two other pins. Return values are as in I2C16:
+// 0 on success, non-zero on failure.
+class I2C16Bus
+{
+  public:
+    virtual void begin() = 0;
+    virtual uint32_t setClock(uint32_t) = 0;
+    virtual uint8_t write(uint8_t address, uint16_t registerAddress, uint8_t data) = 0;
+    virtual uint8_t write(uint8_t address, uint16_t registerAddress, const i2c16_segment_t *segments, uint8_t numberSegments) = 0;
+    virtual uint8_t read(uint8_t address, uint8_t numberBytes, uint8_t *dataBuffer) = 0;
+    virtual uint8_t read(uint8_t address, uint16_t registerAddress, uint8_t numberBytes, uint8_t *dataBuffer) = 0;
+    // I2C16_POLL_BUSY while the device NACKs, i.e. is busy; I2C16_POLL_ACK once it ACKs;
+    // anything else is a bus error
+    virtual uint8_t acknowledgePoll(uint8_t i2cAddress) = 0;
+};
 
-class I2C16
+class I2C16 : public I2C16Bus
 {
   public:
     I2C16();
@@ -99,6 +155,7 @@ class I2C16
     void end();
     void timeOut(uint16_t);
     void setSpeed(uint8_t); 
+    uint32_t setClock(uint32_t);
     void pullup(uint8_t);
     void scan();
     uint8_t available();
@@ -110,6 +167,7 @@ class I2C16
 	uint8_t write(int address, int registerAddress, int data);
 	uint8_t write(uint8_t address, uint16_t registerAddress, char *data);
 	uint8_t write(uint8_t address, uint16_t registerAddress, uint8_t *data, uint8_t numberBytes);
+	uint8_t write(uint8_t address, uint16_t registerAddress, const i2c16_segment_t *segments, uint8_t numberSegments);
 	uint8_t read(int address, int numberBytes);
 	uint8_t read(uint8_t address, uint8_t numberBytes);
 	uint8_t read(int address, int registerAddress, int numberBytes);
@@ -119,6 +177,11 @@ class I2C16
 
 	uint8_t acknowledgePoll(uint8_t i2cAddress);
 
+#ifdef I2C16_TRACE
+    void dumpTrace();
+    void clearTrace();
+#endif
+
   private:
     uint8_t start();
     uint8_t sendAddress(uint8_t);
@@ -134,6 +197,14 @@ class I2C16
     static uint8_t totalBytes;
     static uint16_t timeOutDelay;
 
+#ifdef I2C16_TRACE
+    friend class I2C16TraceScope;
+    void trace(uint8_t address, uint8_t type, uint8_t length, uint8_t status, uint32_t start);
+    static i2c16_trace_t traceBuffer[I2C16_TRACE_SIZE];
+    static uint8_t traceNext;
+    static uint32_t traceTotal;
+    uint8_t traceLockup;
+#endif
 };
 
 extern I2C16 I2c16;
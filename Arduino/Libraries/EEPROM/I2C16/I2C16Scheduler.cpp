@@ -0,0 +1,139 @@
+/*
+  I2C16Scheduler.cpp - shares an I2C16Bus between several users, by priority and deadline
+
+  See I2C16Scheduler.h for the license (LGPL 2.1 or later).
+*/
+
+#include "I2C16Scheduler.h"
+
+I2C16Scheduler::I2C16Scheduler(I2C16Bus &_bus, uint8_t _chunkSize)
+  : completed(0), failed(0), deadlineMisses(0), worstLateness(0),
+    bus(_bus), chunkSize(_chunkSize ? _chunkSize : 1), numQueued(0), queue(NULL), numBusy(0)
+{
+}
+
+void I2C16Scheduler::submit(i2c16_request_t *request)
+{
+  request->status = I2C16_PENDING;
+  request->late = false;
+  request->offset = 0;
+  request->next = queue;
+  queue = request;
+  numQueued++;
+}
+
+// Polls each device that was written to once, and forgets those that are done
+// (or answer with a bus error, which the next request will then see)
+void I2C16Scheduler::pollBusy()
+{
+  uint8_t i = 0;
+  while (i < numBusy)
+  {
+    if ((int32_t)(micros() - busyUntil[i]) >= 0 || bus.acknowledgePoll(busyAddress[i]) != 0)
+    {
+      numBusy--;
+      busyAddress[i] = busyAddress[numBusy];
+      busyUntil[i] = busyUntil[numBusy];
+    }
+    else
+      i++;
+  }
+}
+
+boolean I2C16Scheduler::isBusy(uint8_t address)
+{
+  for (uint8_t i = 0; i < numBusy; i++)
+  {
+    if (busyAddress[i] == address)
+      return true;
+  }
+  return false;
+}
+
+// Returns the link pointing to the most urgent request that can go ahead (so that it can
+// be unlinked), or NULL if there is none
+i2c16_request_t **I2C16Scheduler::mostUrgent()
+{
+  i2c16_request_t **best = NULL;
+  for (i2c16_request_t **link = &queue; *link != NULL; link = &(*link)->next)
+  {
+    i2c16_request_t *r = *link;
+    // A write needs somewhere to remember the write cycle
+    if (isBusy(r->address) || (r->type == I2C16_WRITE && numBusy == I2C16_SCHEDULER_DEVICES))
+      continue;
+    if (best == NULL || r->priority > (*best)->priority ||
+       (r->priority == (*best)->priority && (int32_t)(r->deadline - (*best)->deadline) < 0))
+    {
+      best = link;
+    }
+  }
+  return best;
+}
+
+uint8_t I2C16Scheduler::run()
+{
+  if (numBusy > 0)
+    pollBusy();
+  i2c16_request_t **link = mostUrgent();
+  if (link == NULL)
+    return numQueued;
+  i2c16_request_t *r = *link;
+
+  uint8_t status = 0;
+  if (r->type == I2C16_WRITE && r->length > 255)
+  {
+    status = I2C16_TOO_LONG;
+  }
+  else if (r->type == I2C16_WRITE)
+  {
+    i2c16_segment_t segment = { r->data, (uint8_t)r->length };
+    status = bus.write(r->address, r->registerAddress, &segment, 1);
+    r->offset = r->length;
+    if (status == 0)
+    {
+      busyAddress[numBusy] = r->address;
+      busyUntil[numBusy] = micros() + I2C16_WRITE_CYCLE_MAX;
+      numBusy++;
+    }
+  }
+  else if (r->offset < r->length)
+  {
+    uint8_t n = (r->length - r->offset > chunkSize) ? chunkSize : r->length - r->offset;
+    status = bus.read(r->address, r->registerAddress + r->offset, n, r->data + r->offset);
+    r->offset += n;
+  }
+
+  if (status != 0 || r->offset >= r->length)
+    finish(link, status);
+  return numQueued;
+}
+
+void I2C16Scheduler::finish(i2c16_request_t **link, uint8_t status)
+{
+  i2c16_request_t *r = *link;
+  *link = r->next;
+  numQueued--;
+
+  uint32_t lateness = micros() - r->deadline;
+  if ((int32_t)lateness > 0)
+  {
+    r->late = true;
+    deadlineMisses++;
+    if (lateness > worstLateness)
+      worstLateness = lateness;
+  }
+  if (status)
+    failed++;
+  else
+    completed++;
+
+  r->status = status;
+  if (r->done != NULL)
+    r->done(r);
+}
+
+void I2C16Scheduler::flush()
+{
+  while (run() > 0)
+    ;
+}
@@ -0,0 +1,112 @@
+/*
+  I2C16Scheduler.h - shares an I2C16Bus between several users, by priority and deadline
+
+  Anything may call I2c16 at any time, so e.g. a sensor read can delay the next
+  audio buffer's EEPROM read past the point where the DAC runs dry. Instead,
+  users submit requests here, and loop() calls run() (often): each call does one
+  transaction, or one chunk of a long read, for the most urgent request, i.e.
+  the one with the highest priority, and of those, the earliest deadline.
+  Since long reads are split up, a more urgent request never waits for more
+  than one chunk.
+
+  Requests are queued in place (no copies, no allocation), so they must stay
+  in scope until done: static or global, in practice.
+
+  After a write, a device such as an EEPROM may be busy for several ms (and
+  NACK everything meanwhile), so requests for it are held back, while others
+  go ahead, until it answers an acknowledge poll, or I2C16_WRITE_CYCLE_MAX has
+  passed. Only the address written to is polled: the other half of a 24XX1025
+  (the same chip, at another address) isn't held back, so wait for the write's
+  done() before reading it, or use EEPROM_24XX, which waits by itself.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef I2C16Scheduler_h
+#define I2C16Scheduler_h
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include "I2C16.h"
+
+#define I2C16_READ 0
+#define I2C16_WRITE 1
+
+// request.status while the request is queued
+#define I2C16_PENDING 0xff
+// request.status for a write longer than one transaction can carry (255 bytes)
+#define I2C16_TOO_LONG 0xfe
+
+// How many devices may be in a write cycle at once, and the longest a write cycle takes
+// (in microseconds; the 24XX EEPROMs specify 5 ms)
+#define I2C16_SCHEDULER_DEVICES 4
+#define I2C16_WRITE_CYCLE_MAX 10000
+
+typedef struct i2c16_request {
+  // Set by the caller
+  uint8_t type; // I2C16_READ or I2C16_WRITE
+  uint8_t address;
+  uint16_t registerAddress; // for reads, advanced chunk by chunk, as by an EEPROM's address counter
+  uint8_t *data;
+  uint16_t length; // writes are sent in one transaction, so at most 255 bytes (else I2C16_TOO_LONG)
+  uint8_t priority; // higher goes first
+  uint32_t deadline; // micros() when the request should be done
+  void (*done)(struct i2c16_request *request); // called when done (optional, may be NULL)
+
+  // Set by the scheduler
+  uint8_t status; // I2C16_PENDING, then 0 or the bus's error code
+  boolean late; // finished after its deadline
+  uint16_t offset; // bytes done
+  struct i2c16_request *next;
+} i2c16_request_t;
+
+class I2C16Scheduler
+{
+  public:
+    // chunkSize is the most a read transfers per run() call; smaller chunks mean less
+    // waiting for urgent requests, but more time spent on address phases
+    I2C16Scheduler(I2C16Bus &_bus, uint8_t _chunkSize = 32);
+
+    void submit(i2c16_request_t *request);
+    // Performs the next transaction, if any (none while every queued request waits for a
+    // device's write cycle); returns the number of requests still queued
+    uint8_t run();
+    // run() until every request is done
+    void flush();
+    uint8_t queued() { return numQueued; }
+
+    // Statistics
+    uint32_t completed;
+    uint32_t failed;
+    uint32_t deadlineMisses;
+    uint32_t worstLateness; // in microseconds
+
+  private:
+    I2C16Bus &bus;
+    uint8_t chunkSize;
+    uint8_t numQueued;
+    i2c16_request_t *queue;
+    // Devices written to, that may still be busy with the write cycle
+    uint8_t busyAddress[I2C16_SCHEDULER_DEVICES];
+    uint32_t busyUntil[I2C16_SCHEDULER_DEVICES]; // micros()
+    uint8_t numBusy;
+
+    void pollBusy();
+    boolean isBusy(uint8_t address);
+    i2c16_request_t **mostUrgent();
+    void finish(i2c16_request_t **link, uint8_t status);
+};
+
+#endif
@@ -0,0 +1,163 @@
+// Exercises I2C16Scheduler against LogBus, on the simulator, and prints what went over
+// the bus and what the scheduler reported, a line each: the test's name, then
+// name=value pairs. test_scheduler.py runs it and checks them.
+
+#include <I2C16.h>
+#include <I2C16Scheduler.h>
+#include "LogBus.h"
+
+LogBus bus;
+I2C16Scheduler scheduler(bus, 32);
+
+#define NUM_REQUESTS 4
+i2c16_request_t requests[NUM_REQUESTS];
+byte data[NUM_REQUESTS][300];
+uint32_t finished[NUM_REQUESTS]; // micros() when done() was called
+uint8_t numDone;
+
+void done(i2c16_request_t *r) {
+  finished[r - requests] = micros();
+  numDone++;
+}
+
+// Sets up requests[i], with a deadline in microseconds from now, and submits it
+void submit(uint8_t i, uint8_t type, uint8_t address, uint16_t registerAddress, uint16_t length,
+            uint8_t priority, uint32_t deadline) {
+  i2c16_request_t *r = &requests[i];
+  r->type = type;
+  r->address = address;
+  r->registerAddress = registerAddress;
+  r->data = data[i];
+  r->length = length;
+  r->priority = priority;
+  r->deadline = micros() + deadline;
+  r->done = done;
+  scheduler.submit(r);
+}
+
+void start() {
+  bus.clear();
+  numDone = 0;
+  scheduler.completed = 0;
+  scheduler.failed = 0;
+  scheduler.deadlineMisses = 0;
+  scheduler.worstLateness = 0;
+}
+
+void value(const char *name, uint32_t v) {
+  Serial.print(' ');
+  Serial.print(name);
+  Serial.print('=');
+  Serial.print(v);
+}
+
+// The transactions, a line each, then the scheduler's statistics
+void report(const char *test) {
+  for (uint8_t i = 0; i < bus.numEntries; i++) {
+    logbus_entry_t *e = &bus.entries[i];
+    Serial.print(test);
+    Serial.print(" bus=");
+    Serial.print(e->type);
+    value("address", e->address);
+    value("register", e->registerAddress);
+    value("length", e->length);
+    value("start", e->start);
+    value("status", e->status);
+    Serial.println();
+  }
+  Serial.print(test);
+  value("completed", scheduler.completed);
+  value("failed", scheduler.failed);
+  value("misses", scheduler.deadlineMisses);
+  value("worst", scheduler.worstLateness);
+  value("polls", bus.polls);
+  value("done", numDone);
+  Serial.println();
+  Serial.flush();
+}
+
+// A request's outcome; lateness is how long after its deadline it finished (signed)
+void outcome(const char *test, uint8_t i) {
+  Serial.print(test);
+  value("request", i);
+  value("status", requests[i].status);
+  value("late", requests[i].late);
+  Serial.print(" lateness=");
+  Serial.print((int32_t)(finished[i] - requests[i].deadline));
+  boolean ok = true;
+  if (requests[i].type == I2C16_READ && requests[i].status == 0) {
+    for (uint16_t j = 0; j < requests[i].length; j++)
+      ok &= data[i][j] == (byte)(requests[i].registerAddress + j);
+  }
+  value("data", ok);
+  Serial.println();
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  // Highest priority first, and of those, the earliest deadline
+  start();
+  submit(0, I2C16_READ, 0x48, 1, 4, 1, 5000);
+  submit(1, I2C16_READ, 0x48, 2, 4, 2, 9000);
+  submit(2, I2C16_READ, 0x48, 3, 4, 2, 3000);
+  submit(3, I2C16_READ, 0x48, 4, 4, 1, 1000);
+  scheduler.flush();
+  report("order");
+
+  // A long read goes in chunks, and a more urgent request gets in between them
+  start();
+  submit(0, I2C16_READ, 0x48, 0x100, 100, 0, 100000);
+  scheduler.run();
+  submit(1, I2C16_READ, 0x49, 0x500, 8, 5, 100000);
+  scheduler.flush();
+  report("chunks");
+  outcome("chunks", 0);
+  outcome("chunks", 1);
+
+  // A write goes in one transaction, so one of more than 255 bytes fails, without
+  // touching the bus
+  start();
+  submit(0, I2C16_WRITE, 0x50, 0, 300, 0, 100000);
+  scheduler.flush();
+  submit(1, I2C16_WRITE, 0x50, 0, 255, 0, 100000);
+  scheduler.flush();
+  report("toolong");
+  outcome("toolong", 0);
+  outcome("toolong", 1);
+  delay(10);
+
+  // Reads of 32 bytes take some 800 us each: the first two finish late
+  start();
+  submit(0, I2C16_READ, 0x48, 0, 32, 0, 500);
+  submit(1, I2C16_READ, 0x48, 32, 32, 0, 1000);
+  submit(2, I2C16_READ, 0x48, 64, 32, 0, 10000);
+  scheduler.flush();
+  report("deadline");
+  for (uint8_t i = 0; i < 3; i++)
+    outcome("deadline", i);
+
+  // After a write, that address waits for the write cycle, however urgent; others don't
+  start();
+  submit(0, I2C16_WRITE, 0x50, 0x40, 16, 0, 100000);
+  scheduler.run();
+  submit(1, I2C16_READ, 0x50, 0x40, 16, 3, 1000);
+  submit(2, I2C16_READ, 0x51, 0, 4, 0, 100000);
+  scheduler.flush();
+  report("busy");
+  for (uint8_t i = 0; i < 3; i++)
+    outcome("busy", i);
+
+  // A device that doesn't answer: the request fails with the bus's status
+  start();
+  submit(0, I2C16_READ, LOGBUS_ABSENT, 0, 4, 0, 100000);
+  scheduler.flush();
+  report("absent");
+  outcome("absent", 0);
+
+  Serial.println("done");
+}
+
+void loop() {
+  delay(1000);
+}
@@ -0,0 +1,134 @@
+/*
+  LogBus.h - an I2C16Bus that logs every transaction, for I2C16Scheduler_test
+
+  Devices answer at every address but 0x7f (which NACKs everything), with
+  register address + offset as the data. After a write, the address NACKs for
+  writeCycle microseconds, as an EEPROM does. Every transaction takes as long as
+  it would at 400 kHz.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef LogBus_h
+#define LogBus_h
+
+#include <Arduino.h>
+#include <I2C16.h>
+
+#define LOGBUS_SIZE 64
+#define LOGBUS_ABSENT 0x7f
+#define LOGBUS_NACK 2
+
+typedef struct {
+  char type; // 'W'rite, 'R'ead, or 'P'oll
+  uint8_t address;
+  uint16_t registerAddress;
+  uint16_t length;
+  uint32_t start; // micros()
+  uint8_t status;
+} logbus_entry_t;
+
+class LogBus : public I2C16Bus
+{
+  public:
+    LogBus() : writeCycle(3000), numEntries(0), polls(0), busyAddress(0), busyUntil(0) {}
+
+    uint16_t writeCycle; // microseconds
+    logbus_entry_t entries[LOGBUS_SIZE]; // polls aren't logged, only counted
+    uint8_t numEntries;
+    uint32_t polls;
+
+    void clear() { numEntries = 0; polls = 0; }
+
+    void begin() { }
+    uint32_t setClock(uint32_t hz) { return hz; }
+
+    uint8_t write(uint8_t address, uint16_t registerAddress, uint8_t data)
+    {
+      i2c16_segment_t segment = { &data, 1 };
+      return write(address, registerAddress, &segment, 1);
+    }
+
+    uint8_t write(uint8_t address, uint16_t registerAddress, const i2c16_segment_t *segments, uint8_t numberSegments)
+    {
+      uint16_t length = 0;
+      for (uint8_t s = 0; s < numberSegments; s++)
+        length += segments[s].length;
+      uint8_t status = answers(address) ? 0 : LOGBUS_NACK;
+      log('W', address, registerAddress, length, status);
+      if (status == 0)
+      {
+        busyAddress = address;
+        busyUntil = micros() + writeCycle;
+      }
+      return status;
+    }
+
+    uint8_t read(uint8_t, uint8_t, uint8_t *)
+    {
+      return LOGBUS_NACK; // the scheduler always sends the register address
+    }
+
+    uint8_t read(uint8_t address, uint16_t registerAddress, uint8_t numberBytes, uint8_t *dataBuffer)
+    {
+      uint8_t status = answers(address) ? 0 : LOGBUS_NACK;
+      log('R', address, registerAddress, numberBytes, status);
+      for (uint8_t i = 0; status == 0 && i < numberBytes; i++)
+        dataBuffer[i] = registerAddress + i;
+      return status;
+    }
+
+    uint8_t acknowledgePoll(uint8_t address)
+    {
+      transfer(1);
+      polls++;
+      return answers(address) ? I2C16_POLL_ACK : I2C16_POLL_BUSY;
+    }
+
+  private:
+    uint8_t busyAddress;
+    uint32_t busyUntil;
+
+    boolean answers(uint8_t address)
+    {
+      if (address == LOGBUS_ABSENT)
+        return false;
+      return address != busyAddress || (int32_t)(micros() - busyUntil) >= 0;
+    }
+
+    void log(char type, uint8_t address, uint16_t registerAddress, uint16_t length, uint8_t status)
+    {
+      uint32_t start = micros();
+      transfer(3 + length);
+      if (numEntries < LOGBUS_SIZE)
+      {
+        logbus_entry_t *e = &entries[numEntries++];
+        e->type = type;
+        e->address = address;
+        e->registerAddress = registerAddress;
+        e->length = length;
+        e->start = start;
+        e->status = status;
+      }
+    }
+
+    // A start, the bytes (9 clocks each at 400 kHz), and a stop
+    void transfer(uint16_t bytes)
+    {
+      delayMicroseconds(bytes * 45 / 2 + 5);
+    }
+};
+
+#endif
@@ -0,0 +1,95 @@
+from __future__ import print_function, division
+import unittest, sys, os
+
+# Host tests for I2C16Scheduler, on the simulator: python -m unittest test_scheduler
+# I2C16Scheduler_test runs the scheduler against LogBus, which logs every transaction,
+# and prints the log and the scheduler's statistics, which are checked here.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', '..', '..', 'Simulator'))
+import sketchsim
+
+SKETCH = os.path.join(HERE, 'I2C16Scheduler_test')
+TOO_LONG = 0xfe # I2C16_TOO_LONG
+WRITE_CYCLE = 3000 # LogBus.writeCycle
+
+output = None
+
+def transfer(bytes):
+	# How long LogBus takes to send that many bytes, in microseconds
+	return bytes * 45 // 2 + 5
+
+def lines(test):
+	# The sketch's lines for a test, as dicts
+	global output
+	if output is None:
+		exe = sketchsim.build(SKETCH)
+		(status, out, err) = sketchsim.run(exe, ['--time', '10', '--quiet'], timeout = 600)
+		output = out.decode('ascii', 'replace')
+		assert 'done' in output, output + err
+	return [dict(kv.split('=') for kv in line.split()[1:]) for line in output.splitlines()
+		if line.startswith(test + ' ')]
+
+def transactions(test):
+	# (type, address, register, length, start) of each transaction
+	return [(l['bus'], int(l['address']), int(l['register']), int(l['length']), int(l['start']))
+		for l in lines(test) if 'bus' in l]
+
+def stats(test):
+	(s,) = [dict((k, int(v)) for (k, v) in l.items()) for l in lines(test) if 'completed' in l]
+	return s
+
+def outcomes(test):
+	return [dict((k, int(v)) for (k, v) in l.items()) for l in lines(test) if 'request' in l]
+
+class SchedulerTest(unittest.TestCase):
+	def test_order(self):
+		self.assertEqual([r for (t, a, r, n, s) in transactions('order')], [3, 2, 4, 1])
+		self.assertEqual(stats('order')['completed'], 4)
+
+	def test_chunks(self):
+		self.assertEqual([(a, r, n) for (t, a, r, n, s) in transactions('chunks')],
+			[(0x48, 0x100, 32), (0x49, 0x500, 8), (0x48, 0x120, 32), (0x48, 0x140, 32), (0x48, 0x160, 4)])
+		for o in outcomes('chunks'):
+			self.assertEqual((o['status'], o['data']), (0, 1))
+
+	def test_too_long(self):
+		(long, ok) = outcomes('toolong')
+		self.assertEqual(long['status'], TOO_LONG)
+		self.assertEqual(ok['status'], 0)
+		# Only the 255-byte write went out
+		self.assertEqual([(t, n) for (t, a, r, n, s) in transactions('toolong')], [('W', 255)])
+		s = stats('toolong')
+		self.assertEqual((s['completed'], s['failed'], s['done']), (1, 1, 2))
+
+	def test_deadlines(self):
+		o = outcomes('deadline')
+		self.assertEqual([r['late'] for r in o], [1, 1, 0])
+		for r in o:
+			self.assertEqual(r['late'], 1 if r['lateness'] > 0 else 0)
+		s = stats('deadline')
+		self.assertEqual(s['misses'], 2)
+		self.assertEqual(s['worst'], max(r['lateness'] for r in o))
+
+	def test_write_cycle(self):
+		((t0, a0, r0, n0, write), (t1, a1, r1, n1, other), (t2, a2, r2, n2, same)) = transactions('busy')
+		self.assertEqual([(t0, a0), (t1, a1), (t2, a2)], [('W', 0x50), ('R', 0x51), ('R', 0x50)])
+		# The write cycle starts once the write's 16 bytes are sent; polls are ~30 us each
+		cycle = same - (write + transfer(3 + n0))
+		self.assertGreaterEqual(cycle, WRITE_CYCLE)
+		self.assertLess(cycle, WRITE_CYCLE + 100)
+		self.assertGreater(stats('busy')['polls'], 0)
+		# The urgent read was held back past its deadline
+		o = outcomes('busy')
+		self.assertEqual([r['status'] for r in o], [0, 0, 0])
+		self.assertEqual(o[1]['late'], 1)
+		self.assertEqual(stats('busy')['misses'], 1)
+
+	def test_absent(self):
+		(o,) = outcomes('absent')
+		self.assertNotEqual(o['status'], 0)
+		s = stats('absent')
+		self.assertEqual((s['completed'], s['failed'], s['done']), (0, 1, 1))
+
+if __name__ == '__main__':
+	unittest.main()
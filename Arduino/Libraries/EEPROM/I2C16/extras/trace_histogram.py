@@ -0,0 +1,92 @@
+#!/usr/bin/env python
+import sys, re
+
+# Reads I2C16 trace dumps (see dumpTrace()) from a serial log, and prints the
+# latency distribution per transaction type and address, how long acknowledge
+# polling waited, and any errors and lockups.
+# Lines that aren't part of a dump are ignored, so a whole log can be fed in;
+# entries repeated in several dumps are only counted once.
+#
+# Usage: trace_histogram.py [log file ...] (or the log on stdin)
+
+LINE = re.compile(r'^I2C16 (\d+) (\d+) 0x([0-9A-Fa-f]+) ([WRP])(L?) (\d+) (\d+)\s*$')
+NAMES = { 'W': 'write', 'R': 'read', 'P': 'ack poll' }
+MT_SLA_ACK = 0x18 # the TWI status of a successful poll
+
+def parse(lines):
+	seen = set()
+	entries = []
+	for line in lines:
+		m = LINE.match(line.strip())
+		if m is None:
+			continue
+		key = m.groups()
+		if key in seen:
+			continue
+		seen.add(key)
+		(start, end, address, kind, lockup, length, status) = key
+		# micros() wraps around after ~71 minutes
+		duration = (int(end) - int(start)) & 0xffffffff
+		entries.append((kind, int(address, 16), duration, lockup == 'L', int(length), int(status)))
+	return entries
+
+def percentile(values, p):
+	return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+def histogram(durations):
+	# Power-of-two buckets, in microseconds
+	buckets = {}
+	for d in durations:
+		b = 1
+		while b < d:
+			b *= 2
+		buckets[b] = buckets.get(b, 0) + 1
+	most = max(buckets.values())
+	for b in sorted(buckets):
+		bar = '#' * max(1, buckets[b] * 40 // most)
+		print('  <= {0:>8} us {1:>6} {2}'.format(b, buckets[b], bar))
+
+def report(entries):
+	groups = {}
+	for e in entries:
+		groups.setdefault((e[0], e[1]), []).append(e)
+
+	for (kind, address) in sorted(groups):
+		group = groups[(kind, address)]
+		durations = sorted(e[2] for e in group)
+		print('{0} 0x{1:02X}: {2} transactions, min {3} us, median {4} us, p99 {5} us, max {6} us'.format(
+			NAMES[kind], address, len(group), durations[0], percentile(durations, 50),
+			percentile(durations, 99), durations[-1]))
+		if kind == 'P':
+			polls = sorted(e[4] for e in group)
+			print('  polls per wait: median {0}, max {1}{2}'.format(percentile(polls, 50), polls[-1],
+				' (255 means at least 255)' if polls[-1] == 255 else ''))
+			failed = [e for e in group if e[5] != MT_SLA_ACK]
+		else:
+			failed = [e for e in group if e[5] != 0]
+		lockups = [e for e in group if e[3]]
+		if failed:
+			statuses = sorted(set(e[5] for e in failed))
+			print('  {0} failed (status {1})'.format(len(failed), ', '.join(str(s) for s in statuses)))
+		if lockups:
+			print('  {0} lockups'.format(len(lockups)))
+		histogram(durations)
+		print('')
+
+def main(argv):
+	if len(argv) > 1:
+		lines = []
+		for name in argv[1:]:
+			with open(name) as f:
+				lines.extend(f.readlines())
+	else:
+		lines = sys.stdin.readlines()
+	entries = parse(lines)
+	if not entries:
+		print('No I2C16 trace entries found')
+		return 1
+	report(entries)
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))
@@ -0,0 +1,291 @@
+/*
+  SoftI2C16.h - a bit-banged I2C master with the I2C16Bus interface
+
+  Drives any two pins of an ATmega328P (Arduino Uno) as a second I2C bus, e.g.
+  for a second bank of 24XX1025 EEPROMs:
+
+    SoftI2C16<2, 3> bus2; // SDA on digital pin 2, SCL on pin 3
+    EEPROM_24XX1025 eeprom2(0, 0, EEPROM_24LC, bus2);
+
+  The pins are template parameters, so every pin access compiles to a single
+  sbi/cbi/sbic instruction. Both lines need pullups, as for the hardware TWI;
+  the pins are only ever driven low.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef SoftI2C16_h
+#define SoftI2C16_h
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include <util/delay_basic.h>
+#include <I2C16.h>
+
+// The I/O address of the PINx register, and the bit, of an Arduino Uno pin.
+// DDRx and PORTx follow PINx.
+#define SOFTI2C16_PINREG(pin) ((pin) < 8 ? 0x09 : ((pin) < 14 ? 0x03 : 0x06))
+#define SOFTI2C16_BIT(pin) ((pin) < 8 ? (pin) : ((pin) < 14 ? (pin) - 8 : (pin) - 14))
+
+// Roughly the cycles spent per half bit besides the delay loop
+#define SOFTI2C16_OVERHEAD 10
+
+// Return values, as in I2C16::write()
+#define SOFTI2C16_TIMEOUT 1 // a device held SCL low for too long
+#define SOFTI2C16_ADDRESS_NACK 2
+#define SOFTI2C16_DATA_NACK 3
+
+template <uint8_t sdaPin, uint8_t sclPin>
+class SoftI2C16 : public I2C16Bus
+{
+  public:
+    SoftI2C16() : delayCount(0) {}
+
+    void begin()
+    {
+      releaseBus();
+      // A device may have been reset in the middle of sending a byte, and be holding
+      // SDA low; clock it out of that
+      for (uint8_t i = 0; i < 9 && !sdaHigh(); i++)
+      {
+        sclLow();
+        halfBit();
+        sclRelease();
+        halfBit();
+      }
+      stop();
+    }
+
+    // As I2C16::setClock(): sets the fastest speed up to hz (the slowest for 0), and
+    // returns it (roughly; the top speed is around F_CPU / 20)
+    uint32_t setClock(uint32_t hz)
+    {
+      uint32_t cycles = hz ? F_CPU / 2 / hz : F_CPU;
+      uint32_t count = (cycles > SOFTI2C16_OVERHEAD) ? (cycles - SOFTI2C16_OVERHEAD + 2) / 3 : 0;
+      delayCount = (count > 255) ? 255 : count; // _delay_loop_1() takes 3 cycles per count
+      return F_CPU / (2 * (SOFTI2C16_OVERHEAD + 3UL * delayCount));
+    }
+
+    uint8_t write(uint8_t address, uint16_t registerAddress, uint8_t data)
+    {
+      i2c16_segment_t segment = { &data, 1 };
+      return write(address, registerAddress, &segment, 1);
+    }
+
+    uint8_t write(uint8_t address, uint16_t registerAddress, const i2c16_segment_t *segments, uint8_t numberSegments)
+    {
+      uint8_t status = startRegister(address, registerAddress);
+      if (status)
+        return status;
+      for (uint8_t s = 0; s < numberSegments; s++)
+      {
+        for (uint8_t i = 0; i < segments[s].length; i++)
+        {
+          if ((status = sendByte(segments[s].data[i])))
+            return fail(status, SOFTI2C16_DATA_NACK);
+        }
+      }
+      return stop();
+    }
+
+    uint8_t read(uint8_t address, uint8_t numberBytes, uint8_t *dataBuffer)
+    {
+      uint8_t status = start();
+      if (status == 0)
+        status = sendByte((address << 1) | 1);
+      if (status)
+        return fail(status, SOFTI2C16_ADDRESS_NACK);
+      return receive(numberBytes, dataBuffer);
+    }
+
+    uint8_t read(uint8_t address, uint16_t registerAddress, uint8_t numberBytes, uint8_t *dataBuffer)
+    {
+      uint8_t status = startRegister(address, registerAddress);
+      if (status)
+        return status;
+      // Repeated start, to read from where the register address points
+      return read(address, numberBytes, dataBuffer);
+    }
+
+    uint8_t acknowledgePoll(uint8_t i2cAddress)
+    {
+      uint8_t status = start();
+      if (status == 0)
+        status = sendByte(i2cAddress << 1);
+      stop();
+      if (status == SOFTI2C16_ADDRESS_NACK)
+        return I2C16_POLL_BUSY;
+      return status ? I2C16_POLL_ERROR : I2C16_POLL_ACK;
+    }
+
+  private:
+    enum {
+      SDA_PINREG = SOFTI2C16_PINREG(sdaPin),
+      SDA_MASK = 1 << SOFTI2C16_BIT(sdaPin),
+      SCL_PINREG = SOFTI2C16_PINREG(sclPin),
+      SCL_MASK = 1 << SOFTI2C16_BIT(sclPin)
+    };
+
+    // An Uno's pins are 0-19 (A0-A5 are 14-19), and SDA and SCL need one each
+    typedef char pinCheck[(sdaPin <= 19 && sclPin <= 19 && sdaPin != sclPin) ? 1 : -1];
+
+    uint8_t delayCount;
+
+    // The lines are open drain: PORTx stays 0, and a line is pulled low by making the
+    // pin an output, and released (to the pullup) by making it an input again
+    void sdaLow() { _SFR_IO8(SDA_PINREG + 1) |= SDA_MASK; }
+    void sdaRelease() { _SFR_IO8(SDA_PINREG + 1) &= ~SDA_MASK; }
+    uint8_t sdaHigh() { return _SFR_IO8(SDA_PINREG) & SDA_MASK; }
+    void sclLow() { _SFR_IO8(SCL_PINREG + 1) |= SCL_MASK; }
+    uint8_t sclHigh() { return _SFR_IO8(SCL_PINREG) & SCL_MASK; }
+
+    // Releases SCL, and waits for any device stretching the clock; false on a timeout
+    // (at least 25 ms)
+    boolean sclRelease()
+    {
+      _SFR_IO8(SCL_PINREG + 1) &= ~SCL_MASK;
+      uint16_t n = 0;
+      while (!sclHigh())
+      {
+        if (++n == 0)
+          return false;
+      }
+      return true;
+    }
+
+    void halfBit()
+    {
+      if (delayCount)
+        _delay_loop_1(delayCount);
+    }
+
+    void releaseBus()
+    {
+      _SFR_IO8(SDA_PINREG + 2) &= ~SDA_MASK;
+      _SFR_IO8(SCL_PINREG + 2) &= ~SCL_MASK;
+      sdaRelease();
+      _SFR_IO8(SCL_PINREG + 1) &= ~SCL_MASK;
+    }
+
+    // Works as a repeated start, too
+    uint8_t start()
+    {
+      sdaRelease();
+      halfBit();
+      if (!sclRelease())
+        return fail(SOFTI2C16_TIMEOUT, 0);
+      halfBit();
+      sdaLow();
+      halfBit();
+      sclLow();
+      return 0;
+    }
+
+    uint8_t stop()
+    {
+      sdaLow();
+      halfBit();
+      if (!sclRelease())
+      {
+        releaseBus();
+        return SOFTI2C16_TIMEOUT;
+      }
+      halfBit();
+      sdaRelease();
+      halfBit();
+      return 0;
+    }
+
+    // Ends a failed transaction; status is 1 (timeout) or 2 (NACK), and nack is what a
+    // NACK means here
+    uint8_t fail(uint8_t status, uint8_t nack)
+    {
+      if (status == SOFTI2C16_TIMEOUT)
+      {
+        releaseBus();
+        return SOFTI2C16_TIMEOUT;
+      }
+      stop();
+      return nack;
+    }
+
+    // Returns 0 on an ACK, SOFTI2C16_ADDRESS_NACK on a NACK, or SOFTI2C16_TIMEOUT
+    uint8_t sendByte(uint8_t data)
+    {
+      for (uint8_t mask = 0x80; mask; mask >>= 1)
+      {
+        if (data & mask)
+          sdaRelease();
+        else
+          sdaLow();
+        halfBit();
+        if (!sclRelease())
+          return SOFTI2C16_TIMEOUT;
+        halfBit();
+        sclLow();
+      }
+      sdaRelease();
+      halfBit();
+      if (!sclRelease())
+        return SOFTI2C16_TIMEOUT;
+      halfBit();
+      uint8_t nack = sdaHigh();
+      sclLow();
+      return nack ? SOFTI2C16_ADDRESS_NACK : 0;
+    }
+
+    // Reads numberBytes (ACKing all but the last), and ends the transaction
+    uint8_t receive(uint8_t numberBytes, uint8_t *dataBuffer)
+    {
+      for (uint8_t i = 0; i < numberBytes; i++)
+      {
+        uint8_t data = 0;
+        sdaRelease();
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+          halfBit();
+          if (!sclRelease())
+            return fail(SOFTI2C16_TIMEOUT, 0);
+          halfBit();
+          data = (data << 1) | (sdaHigh() ? 1 : 0);
+          sclLow();
+        }
+        dataBuffer[i] = data;
+        if (i + 1 < numberBytes)
+          sdaLow(); // ACK: more, please
+        halfBit();
+        if (!sclRelease())
+          return fail(SOFTI2C16_TIMEOUT, 0);
+        halfBit();
+        sclLow();
+      }
+      return stop();
+    }
+
+    // Starts a write to registerAddress
+    uint8_t startRegister(uint8_t address, uint16_t registerAddress)
+    {
+      uint8_t status = start();
+      if (status == 0)
+        status = sendByte(address << 1);
+      if (status)
+        return fail(status, SOFTI2C16_ADDRESS_NACK);
+      if ((status = sendByte(registerAddress >> 8)) || (status = sendByte(registerAddress & 0xff)))
+        return fail(status, SOFTI2C16_DATA_NACK);
+      return 0;
+    }
+};
+
+#endif
@@ -0,0 +1,168 @@
+// Exercises SoftI2C16 on the simulator, with a 24LC1025 on the TWI and another on a
+// bit-banged bus (pins 2 and 3), and prints what happened, a line per measurement: the
+// test's name, then name=value pairs. test_softi2c16.py runs it, with
+//   --soft-i2c bank2=2,3 --i2c-eeprom 24LC1025@0x50=FILE1 --i2c-eeprom 24LC1025@bank2:0x50=FILE2
+// and checks the numbers, and the two images.
+
+#include <I2C16.h>
+#include <SoftI2C16.h>
+#include <EEPROM_24XX1025.h>
+
+// The bit-banged bus goes first, as the EEPROM's constructor sets its clock
+SoftI2C16<2, 3> bus2;
+SoftI2C16<4, 5> unconnected; // no pullups: SCL never goes high
+EEPROM_24XX1025 eeprom1(0, 0);
+EEPROM_24XX1025 eeprom2(0, 0, EEPROM_24LC, bus2);
+
+#define PAGE 128
+#define PAGES 16
+#define OVERLAPPED 0x8000 // where the overlapped writes go
+
+byte page[PAGE];
+byte buf[PAGE];
+
+// What the tests write at each address of each bank
+byte pattern(uint8_t bank, uint32_t addr) {
+  return bank == 1 ? addr * 7 + 1 : addr * 13 + 5;
+}
+
+void fill(uint8_t bank, uint32_t addr) {
+  for (uint8_t i = 0; i < PAGE; i++)
+    page[i] = pattern(bank, addr + i);
+}
+
+void value(const char *name, uint32_t v) {
+  Serial.print(' ');
+  Serial.print(name);
+  Serial.print('=');
+  Serial.print(v);
+}
+
+// The speed setClock() picks, and how long a 16-byte read (22 bytes on the bus, with
+// the address bytes, a repeated START and a STOP) then takes
+void clock(uint32_t hz) {
+  uint32_t got = bus2.setClock(hz);
+  uint32_t start = micros();
+  uint8_t status = bus2.read(0x50, 0, 16, buf);
+  uint32_t us = micros() - start;
+  Serial.print("clock");
+  value("hz", hz);
+  value("got", got);
+  value("us", us);
+  value("status", status);
+  Serial.println();
+}
+
+// Bank 2's pages, written from bank 1's write cycles, straight on the bus: a page
+// whenever bank 2 has finished the last one
+uint16_t next2;
+
+void writeBank2(void) {
+  if (next2 == PAGES || bus2.acknowledgePoll(0x50) != I2C16_POLL_ACK)
+    return;
+  uint32_t addr = OVERLAPPED + (uint32_t)next2 * PAGE;
+  fill(2, addr);
+  i2c16_segment_t segment = { page, PAGE };
+  if (bus2.write(0x50, addr, &segment, 1) == 0)
+    next2++;
+}
+
+// Whether both banks hold their patterns, from addr on
+boolean verify(uint32_t addr) {
+  boolean ok = true;
+  for (uint16_t p = 0; p < PAGES; p++) {
+    uint32_t a = addr + (uint32_t)p * PAGE;
+    ok &= eeprom1.read(a, buf, PAGE) == PAGE;
+    for (uint8_t i = 0; i < PAGE; i++)
+      ok &= buf[i] == pattern(1, a + i);
+    ok &= eeprom2.read(a, buf, PAGE) == PAGE;
+    for (uint8_t i = 0; i < PAGE; i++)
+      ok &= buf[i] == pattern(2, a + i);
+  }
+  return ok;
+}
+
+void setup() {
+  Serial.begin(115200);
+  bus2.begin();
+
+  // setClock(), and the speed it gives
+  clock(0);
+  clock(50000);
+  clock(100000);
+  clock(400000);
+  clock(1000000);
+  bus2.setClock(EEPROM_24LC);
+
+  // A device that isn't there NACKs its address, whatever the transaction
+  Serial.print("nack");
+  value("write", bus2.write(0x53, 0, 0x55));
+  value("read", bus2.read(0x53, 0, 4, buf));
+  value("poll", bus2.acknowledgePoll(0x53));
+  Serial.println();
+
+  // An EEPROM in its write cycle NACKs polls, until it's done
+  uint8_t status = bus2.write(0x50, 0x7000, 0xaa);
+  uint32_t start = micros();
+  uint8_t first = bus2.acknowledgePoll(0x50);
+  uint16_t polls = 1;
+  while (bus2.acknowledgePoll(0x50) == I2C16_POLL_BUSY && micros() - start < 20000)
+    polls++;
+  Serial.print("busy");
+  value("write", status);
+  value("first", first);
+  value("polls", polls);
+  value("us", micros() - start);
+  Serial.println();
+
+  // Without pullups, SCL never goes high: every call times out
+  unconnected.begin();
+  start = micros();
+  Serial.print("timeout");
+  value("write", unconnected.write(0x50, 0, 0x55));
+  value("read", unconnected.read(0x50, 0, 4, buf));
+  value("poll", unconnected.acknowledgePoll(0x50));
+  value("us", micros() - start);
+  Serial.println();
+
+  // Two banks, one after the other: each write waits for its own write cycle
+  start = micros();
+  for (uint16_t p = 0; p < PAGES; p++) {
+    fill(1, (uint32_t)p * PAGE);
+    eeprom1.write((uint32_t)p * PAGE, page, PAGE);
+  }
+  for (uint16_t p = 0; p < PAGES; p++) {
+    fill(2, (uint32_t)p * PAGE);
+    eeprom2.write((uint32_t)p * PAGE, page, PAGE);
+  }
+  Serial.print("sequential");
+  value("us", micros() - start);
+  value("ok", verify(0));
+  Serial.println();
+
+  // ... and at once: bank 2 is written while bank 1 programs its pages
+  start = micros();
+  eeprom1.setIdleCallback(writeBank2);
+  for (uint16_t p = 0; p < PAGES; p++) {
+    uint32_t addr = OVERLAPPED + (uint32_t)p * PAGE;
+    fill(1, addr);
+    eeprom1.write(addr, page, PAGE);
+  }
+  eeprom1.setIdleCallback(NULL);
+  uint16_t overlapped = next2;
+  while (next2 < PAGES)
+    writeBank2();
+  while (bus2.acknowledgePoll(0x50) != I2C16_POLL_ACK)
+    ;
+  Serial.print("overlapped");
+  value("us", micros() - start);
+  value("pages", overlapped);
+  value("ok", verify(OVERLAPPED));
+  Serial.println();
+
+  Serial.println("done");
+}
+
+void loop() {
+  delay(1000);
+}
@@ -0,0 +1,103 @@
+from __future__ import print_function, division
+import unittest, sys, os, tempfile, shutil
+
+# Host tests for SoftI2C16, on the simulator: python -m unittest test_softi2c16
+# SoftI2C16_test drives a 24LC1025 on a bit-banged bus (the simulator's --soft-i2c,
+# which decodes the pins as a real part would) and another on the TWI, and prints what
+# it measured, which is checked here, along with what ended up in each chip.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', '..', '..', 'Simulator'))
+import sketchsim
+
+SKETCH = os.path.join(HERE, 'SoftI2C16_test')
+F_CPU = 16000000
+OVERHEAD = 10 # SOFTI2C16_OVERHEAD
+PAGE = 128
+PAGES = 16
+OVERLAPPED = 0x8000
+
+output = None
+images = {}
+
+def run():
+	global output
+	if output is None:
+		exe = sketchsim.build(SKETCH)
+		tmp = tempfile.mkdtemp()
+		try:
+			paths = [os.path.join(tmp, 'bank%d.bin' % bank) for bank in (1, 2)]
+			(status, out, err) = sketchsim.run(exe, ['--soft-i2c', 'bank2=2,3',
+				'--i2c-eeprom', '24LC1025@0x50=' + paths[0], '--i2c-eeprom', '24LC1025@bank2:0x50=' + paths[1],
+				'--time', '2', '--quiet'], timeout = 600)
+			for (bank, path) in ((1, paths[0]), (2, paths[1])):
+				images[bank] = open(path, 'rb').read()
+		finally:
+			shutil.rmtree(tmp)
+		output = out.decode('ascii', 'replace')
+		assert 'done' in output, output + err
+	return output
+
+def results(test):
+	lines = [line.split() for line in run().splitlines()]
+	return [dict((k, int(v)) for (k, v) in (kv.split('=') for kv in line[1:]))
+		for line in lines if line and line[0] == test]
+
+def pattern(bank, addr):
+	# As in the sketch
+	return (addr * 7 + 1 if bank == 1 else addr * 13 + 5) & 0xff
+
+class SoftI2C16Test(unittest.TestCase):
+	def test_set_clock(self):
+		clocks = results('clock')
+		for c in clocks:
+			self.assertEqual(c['status'], 0)
+			# The delay loop takes 3 cycles per count, up to 255 counts
+			count = (c['got'] and F_CPU // (2 * c['got']) - OVERHEAD) // 3
+			self.assertEqual(F_CPU // (2 * (OVERHEAD + 3 * count)), c['got'], c)
+			self.assertLessEqual(count, 255)
+			if c['hz']:
+				self.assertLessEqual(c['got'], c['hz'])
+		self.assertEqual([c['got'] for c in clocks], [10322, 50000, 97560, 363636, 800000])
+		# A 16-byte read is 22 bytes, at 9 clocks each, plus the STARTs and the STOP. Up to
+		# 100 kHz the delay loop is nearly all of each half bit; faster than that, the
+		# simulator (which doesn't charge for plain instructions) runs ahead of the board.
+		for c in clocks:
+			expected = 22 * 9 * 1e6 / c['got']
+			if c['got'] <= 100000:
+				self.assertLess(abs(c['us'] - expected), expected * 0.15, c)
+			else:
+				self.assertLess(c['us'], expected, c)
+		self.assertEqual(sorted([c['us'] for c in clocks], reverse = True), [c['us'] for c in clocks])
+
+	def test_nack(self):
+		self.assertEqual(results('nack'), [{ 'write': 2, 'read': 2, 'poll': 0 }]) # I2C16_POLL_BUSY
+
+	def test_write_cycle(self):
+		(r,) = results('busy')
+		self.assertEqual((r['write'], r['first']), (0, 0))
+		# The simulated 24LC1025's write cycle is 5 ms
+		self.assertGreater(r['us'], 5000)
+		self.assertLess(r['us'], 5200)
+
+	def test_timeout(self):
+		(r,) = results('timeout')
+		self.assertEqual((r['write'], r['read'], r['poll']), (1, 1, 2)) # I2C16_POLL_ERROR
+		self.assertLess(r['us'], 1000000)
+
+	def test_two_banks(self):
+		(sequential,) = results('sequential')
+		(overlapped,) = results('overlapped')
+		self.assertEqual((sequential['ok'], overlapped['ok']), (1, 1))
+		# Bank 2's pages all went in bank 1's write cycles, so that took not much more
+		# than half as long
+		self.assertEqual(overlapped['pages'], PAGES)
+		self.assertLess(overlapped['us'], sequential['us'] * 0.6)
+		# And each bank's chip holds its own data, not the other's
+		for bank in (1, 2):
+			for start in (0, OVERLAPPED):
+				data = images[bank][start:start + PAGES * PAGE]
+				self.assertEqual(data, bytes(pattern(bank, start + i) for i in range(PAGES * PAGE)))
+
+if __name__ == '__main__':
+	unittest.main()
@@ -3,45 +3,97 @@
 // Receives serial data via a custom protocol, and writes it to the EEPROM.
 
 // Protocol:
-// 1) Sender sends a byte with the transfer size for the coming chunk (1 - 255 bytes)
-// 2) Receiver sends an ACK byte
-// 3) Sender sends all the data in one go
-// 4) Receiver sends an ACK byte
+// 1) Sender sends a byte with the transfer size for the coming chunk (1 - 128 bytes),
+//    followed by its complement
+// 2) Receiver sends an ACK byte, or an ERR byte if the two didn't add up
+// 3) Sender sends the chunk's sequence number (starting at 0, wrapping at 256) and all
+//    the data in one go, followed by a 16-bit CRC (CCITT, LSB first) of both
+// 4) Receiver sends an ACK byte if the CRC matched, or an ERR byte if it didn't (or if
+//    the data stopped arriving).
 // 5) The receiver processes the received data.
 // 6) Receiver sends a RDY byte when it is ready to receive further data.
 // 7) The sender goes back to step 1, if there is more data to send.
 //
 // The loop is broken when the entire file is sent, after which
-// 8) The sender sends an END byte (0x0) signalling the end of the transmission.
+// 8) The sender sends an END byte (0x0) and its complement, signalling the end of the
+//    transmission, and the receiver answers with an ACK.
+//
+// After an ERR, or an answer that isn't what it expected (a garbled ACK, say), the
+// sender waits for the receiver to give up on whatever it was doing, discards anything
+// left, and restarts at step 1 with the same chunk. If it was the ACK in step 4 that got
+// garbled, the receiver has already stored the chunk; the sequence number tells it to
+// just answer ACK and RDY again this time.
+//
+// Baud rate negotiation:
+// Both ends start out at BASE_BAUD. Instead of a length byte, the sender may send
+// BAUD, followed by a rate index (into baudRates[] below) and its complement.
+// a) Receiver sends ACK (at the old rate), and switches to the new rate.
+// b) Sender sends PROBE_ROUNDS probe frames: PROBE_LEN bytes of data plus a CRC, just like step 3.
+//    The receiver answers each with ACK or ERR.
+// c) If every probe frame was received correctly, the sender sends COMMIT, and the receiver
+//    answers with ACK; the new rate is now in use.
+//    Otherwise (or if COMMIT doesn't arrive in time), the receiver falls back to BASE_BAUD.
+//    The sender then does the same, and may retry with a lower rate.
+// If FALLBACK_ERRORS chunks in a row fail (a bad length or CRC), both ends fall back to
+// BASE_BAUD on their own, since the link is clearly not reliable at the current rate.
+// In case the two ends don't agree on that count (since they can't see each other's
+// errors), the receiver also falls back if it hears nothing for RESYNC_TIMEOUT ms, and
+// the sender waits that long after falling back.
 
-// On the receiver side, the above applies, with the addition of sending the ERR byte (after discarding
-// all incoming bytes until "they stop coming") if there is a transmission error.
+// On the receiver side, a fatal error (more data than fits in the EEPROM) is signalled by
+// sending the ERR byte (after discarding all incoming bytes until "they stop coming"),
+// after which the receiver stops responding.
 
 #include <I2C16.h>
 #include <EEPROM_24XX1025.h>
+#include <util/crc16.h>
 
 EEPROM_24XX1025 eeprom (0, 0);
 
 #define RDY 0xfd
 #define ACK 0xfe
 #define ERR 0xfc
+#define BAUD 0xfb
+#define COMMIT 0xfa
 #define END 0x0
 
+#define BASE_BAUD 115200
+#define PROBE_LEN 64
+#define PROBE_ROUNDS 4
+#define FALLBACK_ERRORS 3
+#define RESYNC_TIMEOUT 1000
+
+// Rates the sender may ask for. With U2X, the 16 MHz UART hits all of these
+// with less than 4% error (the ones above 115200 exactly).
+const uint32_t baudRates[] = { 115200, 250000, 500000, 1000000 };
+#define NUM_BAUD_RATES (sizeof(baudRates) / sizeof(baudRates[0]))
+
 uint32_t bytesReceived = 0;
+uint8_t crcErrors = 0; // chunks in a row that failed their length or CRC
+byte sequence = 0; // of the next chunk to store
+uint32_t currentBaud = BASE_BAUD;
 
 void setup() {
-  Serial.begin(115200);
+  Serial.begin(BASE_BAUD);
   pinMode(13, OUTPUT);
 
   bytesReceived = 0;
   eeprom.setPosition(0); // Not really needed
 }
 
-void sendError(void) {
-  // Discard the rest of the bytes we've been sent
-  while (Serial.available()) {
-    Serial.read();
+void discardInput(void) {
+  // Discard the rest of the bytes we've been sent, i.e. wait until they stop coming
+  uint32_t last = millis();
+  while (millis() - last < 20) {
+    if (Serial.available()) {
+      Serial.read();
+      last = millis();
+    }
   }
+}
+
+void sendError(void) {
+  discardInput();
 
   Serial.write(ERR);
   Serial.flush();
@@ -58,16 +110,127 @@ void sendAck(void) {
   Serial.flush();
 }
 
+void sendNak(void) {
+  // Unlike sendError(), this is not fatal; the sender will retry.
+  discardInput();
+  Serial.write(ERR);
+  Serial.flush();
+}
+
 void sendRdy(void) {
   Serial.write(RDY);
   Serial.flush();
 }
 
+void setBaud(uint32_t rate) {
+  Serial.flush(); // Let any outgoing ACK finish at the old rate
+  Serial.end();
+  Serial.begin(rate);
+  currentBaud = rate;
+}
+
+int readTimeout(uint16_t timeout) {
+  // Returns the next byte, or -1 if none arrived within timeout milliseconds
+  uint32_t start = millis();
+  while (!Serial.available()) {
+    if (millis() - start >= timeout)
+      return -1;
+  }
+  return Serial.read();
+}
+
+boolean readFrame(byte *buf, uint8_t length) {
+  // Reads length bytes plus a CRC into buf. Returns true if everything
+  // arrived in time, and the CRC matched.
+  uint16_t crc = 0xffff;
+  for (int i = 0; i < length + 2; i++) {
+    int b = readTimeout(100);
+    if (b < 0)
+      return false;
+
+    if (i < length) {
+      buf[i] = b;
+      crc = _crc_ccitt_update(crc, b);
+    }
+    else if (i == length && b != (crc & 0xff))
+      return false;
+    else if (i == length + 1 && b != (crc >> 8))
+      return false;
+  }
+
+  return true;
+}
+
+void negotiateBaud(void) {
+  int idx = readTimeout(100);
+  int check = readTimeout(100);
+  if (idx < 0 || check < 0 || (byte)~idx != check || (size_t)idx >= NUM_BAUD_RATES) {
+    sendNak();
+    return;
+  }
+
+  sendAck();
+  setBaud(baudRates[idx]);
+
+  // Run the probe; we need to answer every frame, even after a failure,
+  // so that the sender knows where we are.
+  byte buf[PROBE_LEN];
+  uint8_t failures = 0;
+  for (int i = 0; i < PROBE_ROUNDS; i++) {
+    if (readFrame(buf, PROBE_LEN))
+      sendAck();
+    else {
+      failures++;
+      sendNak();
+    }
+  }
+
+  if (failures == 0 && readTimeout(250) == COMMIT) {
+    sendAck();
+    crcErrors = 0;
+  }
+  else {
+    // Either the link is bad, or the sender gave up on this rate
+    setBaud(BASE_BAUD);
+  }
+}
+
+void failed(void) {
+  // Ask for the chunk again, unless this rate is clearly too fast
+  sendNak();
+  if (++crcErrors >= FALLBACK_ERRORS && currentBaud != BASE_BAUD) {
+    setBaud(BASE_BAUD);
+    crcErrors = 0;
+  }
+}
+
 void loop() {
-  while (Serial.available() == 0) { }
-  
-  byte length = Serial.read();
-  if (length == END || length > 128) {
+  // If the sender has fallen back to BASE_BAUD without us noticing, all we hear
+  // is silence (or garbage, see failed()), so fall back too after a while
+  uint32_t start = millis();
+  while (Serial.available() == 0) {
+    if (currentBaud != BASE_BAUD && millis() - start >= RESYNC_TIMEOUT) {
+      setBaud(BASE_BAUD);
+      crcErrors = 0;
+    }
+  }
+
+  byte command = Serial.read();
+  if (command == BAUD) {
+    negotiateBaud();
+    return;
+  }
+
+  // Lengths (and END) come with their complement. Anything that doesn't add up was
+  // garbled on the way, so don't act on it; the sender will try again.
+  int check = readTimeout(100);
+  if (check < 0 || (byte)~command != check || command > 128) {
+    failed();
+    return;
+  }
+
+  if (command == END) {
+    sendAck();
     // Stop receiving!
     for (;;) {
       digitalWrite(13, HIGH);
@@ -78,29 +241,31 @@ void loop() {
   }
 
   // Request the sender to start delivering those bytes!
+  byte length = command;
   sendAck();
 
-  char buf[128] = {0};
+  byte buf[1 + 128] = {0}; // sequence number + data
 
-  for (int i = 0; i < length; i++) {
-    while (!Serial.available()) { }
-    int b = Serial.read();
-    if (b >= 0 && b <= 0xff) {
-      // Make sure this is a received byte, not an error (e.g. -1)
-      buf[i] = b;
-    }
-    else {
-      sendError();
-    }
-    
-    bytesReceived++;
-    
-    if (bytesReceived > 131072) {
-      sendError();
-    }
+  if (!readFrame(buf, 1 + length)) {
+    failed();
+    return;
+  }
+  crcErrors = 0;
+
+  if (buf[0] != sequence) {
+    // We stored this one already, but the sender didn't get our ACK
+    sendAck();
+    sendRdy();
+    return;
+  }
+
+  bytesReceived += length;
+  if (bytesReceived > 131072) {
+    sendError();
   }
 
   sendAck(); // Tell the sender we got the data OK
-  eeprom.write((byte *)buf, length);
+  eeprom.write(buf + 1, length);
+  sequence++;
   sendRdy(); // We're ready for the next chunk, if any
 }
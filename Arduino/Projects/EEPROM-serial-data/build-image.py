@@ -0,0 +1,173 @@
+from __future__ import print_function
+import sys, os, struct, wave
+from optparse import OptionParser
+
+# Builds a multi-file EEPROM image, readable by the EEPROM_Image Arduino library.
+# The result is written to the EEPROM like any other file, e.g. with serial-transfer.py.
+# See the EEPROM_Image README for the format.
+
+MAGIC = b'EIMG'
+VERSION = 1
+PAGE_SIZE = 128
+NAME_LEN = 16
+EEPROM_SIZE = 131072
+
+HEADER = struct.Struct('<4sBBBBH6x')
+ENTRY = struct.Struct('<16sIIBBHI')
+
+FORMAT_RAW = 0
+FORMAT_WAV = 1
+FORMAT_PCM = 2
+FORMAT_PCM16 = 3
+FORMAT_NAMES = { FORMAT_RAW: 'raw', FORMAT_WAV: 'wav', FORMAT_PCM: 'pcm', FORMAT_PCM16: 'pcm16' }
+
+def crc_ccitt(data, crc = 0xffff):
+	# Same as _crc_ccitt_update() in avr-libc's util/crc16.h
+	for c in bytearray(data):
+		b = c ^ (crc & 0xff)
+		b ^= (b << 4) & 0xff
+		crc = (((b << 8) | (crc >> 8)) ^ (b >> 4) ^ (b << 3)) & 0xffff
+	return crc
+
+def align(n):
+	return (n + PAGE_SIZE - 1) // PAGE_SIZE * PAGE_SIZE
+
+def classify(filename, data):
+	# Returns (format, param) for a file
+	if filename.lower().endswith('.wav'):
+		try:
+			w = wave.open(filename, 'rb')
+			rate = w.getframerate()
+			w.close()
+			return (FORMAT_WAV, rate)
+		except (wave.Error, EOFError):
+			pass
+	return (FORMAT_RAW, 0)
+
+def build(files):
+	# files is a list of (name, format, param, data) tuples; returns the image as a byte string
+	count = len(files)
+	if count > 255:
+		raise ValueError('Too many files (max 255)')
+
+	offset = align(HEADER.size + ENTRY.size * count)
+	entries = b''
+	body = b''
+	for (name, fmt, param, data) in files:
+		if len(name) > NAME_LEN:
+			raise ValueError('Name too long (max {0} characters): {1}'.format(NAME_LEN, name))
+		entries += ENTRY.pack(name.encode('ascii'), offset, len(data), fmt, 0, crc_ccitt(data), param)
+		padded = data + b'\xff' * (align(len(data)) - len(data))
+		body += padded
+		offset += len(padded)
+
+	header = HEADER.pack(MAGIC, VERSION, count, ENTRY.size, 0, crc_ccitt(entries))
+	image = header + entries
+	image += b'\xff' * (align(len(image)) - len(image))
+	return image + body
+
+def parse(image):
+	# The inverse of build(); returns a list of (name, format, param, data) tuples,
+	# and raises ValueError if anything doesn't check out.
+	if len(image) < HEADER.size:
+		raise ValueError('Image too short')
+	(magic, version, count, entrySize, reserved, dirChecksum) = HEADER.unpack_from(image, 0)
+	if magic != MAGIC or version != VERSION or entrySize != ENTRY.size:
+		raise ValueError('Not a valid image (bad magic, version or entry size)')
+
+	entries = image[HEADER.size : HEADER.size + ENTRY.size * count]
+	if crc_ccitt(entries) != dirChecksum:
+		raise ValueError('Directory checksum mismatch')
+
+	files = []
+	for i in range(0, count):
+		(name, offset, length, fmt, flags, checksum, param) = ENTRY.unpack_from(entries, i * ENTRY.size)
+		name = name.rstrip(b'\0').decode('ascii')
+		if offset % PAGE_SIZE != 0:
+			raise ValueError('{0}: not page aligned'.format(name))
+		data = image[offset : offset + length]
+		if len(data) != length or crc_ccitt(data) != checksum:
+			raise ValueError('{0}: data checksum mismatch'.format(name))
+		files.append((name, fmt, param, data))
+	return files
+
+def main(argv):
+	parser = OptionParser(usage = '%prog [options] <output image> <file> [file ...]\n       %prog --list <image>')
+	parser.add_option('--list', action = 'store_true', help = 'list (and verify) the files in an image')
+	parser.add_option('--convert', action = 'store_true',
+		help = 'convert .wav files to raw PCM for the DAC streamer: mono, dithered to the DAC\'s bit width, '
+		'and resampled if needed (requires NumPy)')
+	parser.add_option('--dac', default = 'MCP4901',
+		help = 'DAC model to convert for [%default]; for 10- and 12-bit models, set DAC_MODEL and DAC_BITS in the streamer to match')
+	parser.add_option('--rate', type = 'int', help = 'sample rate to convert to [the source rate, if within the budget]')
+	parser.add_option('--budget', type = 'int', default = 20200,
+		help = 'bytes per second the streamer can read from the EEPROM [%default]')
+	parser.add_option('--normalize', action = 'store_true', help = 'scale converted files to full volume')
+	(options, args) = parser.parse_args(argv[1:])
+
+	if options.list:
+		if len(args) != 1:
+			parser.error('--list takes exactly one image')
+		try:
+			files = parse(open(args[0], 'rb').read())
+		except (IOError, ValueError) as e:
+			print('Failed to read image: {0}'.format(e), file = sys.stderr)
+			return 2
+		for (i, (name, fmt, param, data)) in enumerate(files):
+			print('{0:3} {1:16} {2:5} {3:7} bytes  param {4}'.format(i, name, FORMAT_NAMES.get(fmt, fmt), len(data), param))
+		return 0
+
+	if len(args) < 2:
+		parser.print_usage(sys.stderr)
+		return 1
+
+	if options.convert:
+		import wavprep
+		if options.dac not in wavprep.DAC_BITS:
+			parser.error('unknown DAC model {0}; known models are {1}'.format(options.dac, ', '.join(sorted(wavprep.DAC_BITS))))
+
+	files = []
+	for filename in args[1:]:
+		try:
+			data = open(filename, 'rb').read()
+		except IOError as e:
+			print('Failed to read {0}: {1}'.format(filename, e), file = sys.stderr)
+			return 2
+		name = os.path.basename(filename)[:NAME_LEN]
+
+		if options.convert and filename.lower().endswith('.wav'):
+			try:
+				wanted = options.rate or wavprep.read_header(data)[0][2]
+				(data, rate, bits) = wavprep.convert(data, options.dac, options.rate, options.budget, options.normalize)
+			except ValueError as e:
+				print('Failed to convert {0}: {1}'.format(filename, e), file = sys.stderr)
+				return 2
+			width = 1 if bits <= 8 else 2
+			print('Converted {0}: {1} samples at {2} Hz, {3} bits'.format(filename, len(data) // width, rate, bits))
+			if rate < wanted:
+				print('Note: {0} Hz is the most that --budget {1} allows at {2} byte(s) per sample, '
+					'so {3} was resampled to that instead of {4} Hz'.format(rate, options.budget, width, filename, wanted), file = sys.stderr)
+			files.append((name, FORMAT_PCM if bits <= 8 else FORMAT_PCM16, rate, data))
+		else:
+			(fmt, param) = classify(filename, data)
+			files.append((name, fmt, param, data))
+
+	try:
+		image = build(files)
+	except ValueError as e:
+		print(e, file = sys.stderr)
+		return 4
+
+	if len(image) > EEPROM_SIZE:
+		print('Image is too big for the EEPROM ({0} bytes, max {1})!'.format(len(image), EEPROM_SIZE), file = sys.stderr)
+		return 4
+
+	# Make sure what we wrote can be read back
+	assert [(f[0], f[3]) for f in parse(image)] == [(f[0], f[3]) for f in files]
+
+	open(args[0], 'wb').write(image)
+	print('Wrote {0} files, {1} bytes ({2} free) to {3}'.format(len(files), len(image), EEPROM_SIZE - len(image), args[0]))
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))
@@ -0,0 +1,258 @@
+from __future__ import print_function, division
+import sys, os, time, random, select, struct, fcntl, tty
+from optparse import OptionParser
+
+# A stand-in for an Arduino running EEPROM_serial_writer, on a pseudo-terminal, so that
+# serial-transfer.py can be tried out (and the baud rate negotiation measured) without one:
+#   python serial-standin.py --errors 500000:1e-4,1000000:1e-2 -o received.bin
+#   python serial-transfer.py somefile /dev/pts/N
+# It speaks the same protocol as the sketch, with the same timeouts, into a simulated
+# 128 kiB EEPROM, and injects framing errors (a byte arriving as some other byte, in either
+# direction) at the given rate per byte, for each baud rate. Like on a real serial line,
+# everything is garbled if the two ends aren't at the same baud rate (seeing the sender's
+# rate needs Linux). Bytes take as long as they would on the wire, and chunks as long as the
+# EEPROM takes to write them, so that the throughput serial-transfer.py reports is realistic.
+#
+# After each transfer (the END), the received data is written to the output file, if any,
+# and the stand-in "resets" for the next one.
+
+# Must match EEPROM_serial_writer.ino
+ERR = 0xfc
+RDY = 0xfd
+ACK = 0xfe
+BAUD = 0xfb
+COMMIT = 0xfa
+END = 0x0
+
+BASE_BAUD = 115200
+PROBE_LEN = 64
+PROBE_ROUNDS = 4
+FALLBACK_ERRORS = 3
+RESYNC_TIMEOUT = 1.0
+BAUD_RATES = [115200, 250000, 500000, 1000000]
+
+PAGE_SIZE = 128
+WRITE_TIME = 0.005 # per page
+TCGETS2 = 0x802C542A # Linux; struct termios2 ends with c_ispeed, c_ospeed
+
+def crc_ccitt_update(crc, b):
+	b ^= crc & 0xff
+	b ^= (b << 4) & 0xff
+	return (((b << 8) | (crc >> 8)) ^ (b >> 4) ^ (b << 3)) & 0xffff
+
+class Link:
+	# The Arduino's end of the serial line: the pty master, at our baud rate
+	def __init__(self, fd, errors, rng):
+		self.fd = fd
+		self.errors = errors
+		self.rng = rng
+		self.rate = BASE_BAUD
+		self.input = []
+		self.busy_until = 0 # when the last byte in or out is done on the wire
+		self.garbled = 0
+
+	def their_rate(self):
+		try:
+			buf = bytearray(44)
+			fcntl.ioctl(self.fd, TCGETS2, buf)
+			return struct.unpack('IIIIB19sII', bytes(buf))[-1]
+		except (IOError, OSError):
+			return self.rate
+
+	def garble(self, data):
+		# A framing error leaves some other byte in the receiver's buffer
+		same = self.their_rate() == self.rate
+		p = self.errors.get(self.rate, 0)
+		out = bytearray(data)
+		for i in range(len(out)):
+			if not same or self.rng.random() < p:
+				out[i] = (out[i] + self.rng.randint(1, 255)) & 0xff
+				self.garbled += 1
+		return out
+
+	def wire(self, n):
+		# Wait until n more bytes (10 bits each) would be through
+		self.busy_until = max(self.busy_until, time.time()) + n * 10.0 / self.rate
+		if self.busy_until - time.time() > 0.001:
+			time.sleep(self.busy_until - time.time())
+
+	def read(self, timeout):
+		# Returns the next byte, or None if none arrived within timeout seconds (None = forever)
+		if not self.input:
+			r, w, x = select.select([self.fd], [], [], timeout)
+			if not r:
+				return None
+			self.input = list(self.garble(os.read(self.fd, 4096)))
+		self.wire(1)
+		return self.input.pop(0)
+
+	def discard(self):
+		# Like discardInput(): wait until the bytes stop coming for 20 ms
+		while self.read(0.02) is not None:
+			pass
+
+	def write(self, b):
+		self.wire(1)
+		os.write(self.fd, bytes(self.garble([b])))
+
+	def set_rate(self, rate):
+		self.rate = rate
+
+class Receiver:
+	# EEPROM_serial_writer, one transfer's worth
+	def __init__(self, link):
+		self.link = link
+		self.eeprom = bytearray()
+		self.crc_errors = 0
+		self.sequence = 0
+		self.failed_frames = 0
+		self.duplicates = 0
+
+	def log(self, msg):
+		print('[{0} baud] {1}'.format(self.link.rate, msg))
+
+	def set_baud(self, rate):
+		if rate != self.link.rate:
+			self.log('switching to {0} baud'.format(rate))
+		self.link.set_rate(rate)
+
+	def nak(self):
+		self.link.discard()
+		self.link.write(ERR)
+
+	def failed(self):
+		self.failed_frames += 1
+		self.nak()
+		self.crc_errors += 1
+		if self.crc_errors >= FALLBACK_ERRORS and self.link.rate != BASE_BAUD:
+			self.log('{0} errors in a row'.format(self.crc_errors))
+			self.set_baud(BASE_BAUD)
+			self.crc_errors = 0
+
+	def read_frame(self, length):
+		crc = 0xffff
+		data = bytearray()
+		for i in range(length + 2):
+			b = self.link.read(0.1)
+			if b is None:
+				return None
+			if i < length:
+				data.append(b)
+				crc = crc_ccitt_update(crc, b)
+			elif i == length and b != crc & 0xff:
+				return None
+			elif i == length + 1 and b != crc >> 8:
+				return None
+		return data
+
+	def negotiate(self):
+		idx = self.link.read(0.1)
+		check = self.link.read(0.1)
+		if idx is None or check is None or ~idx & 0xff != check or idx >= len(BAUD_RATES):
+			self.nak()
+			return
+
+		self.link.write(ACK)
+		self.set_baud(BAUD_RATES[idx])
+		failures = 0
+		for i in range(PROBE_ROUNDS):
+			if self.read_frame(PROBE_LEN) is not None:
+				self.link.write(ACK)
+			else:
+				failures += 1
+				self.nak()
+
+		if failures == 0 and self.link.read(0.25) == COMMIT:
+			self.link.write(ACK)
+			self.crc_errors = 0
+			self.log('probe passed')
+		else:
+			self.log('probe failed ({0}/{1} frames)'.format(failures, PROBE_ROUNDS))
+			self.set_baud(BASE_BAUD)
+
+	def run(self):
+		# Returns when the transfer is over
+		while True:
+			command = self.link.read(None if self.link.rate == BASE_BAUD else RESYNC_TIMEOUT)
+			if command is None:
+				self.log('nothing heard for {0} s'.format(RESYNC_TIMEOUT))
+				self.set_baud(BASE_BAUD)
+				self.crc_errors = 0
+				continue
+			if command == BAUD:
+				self.negotiate()
+				continue
+
+			check = self.link.read(0.1)
+			if check is None or ~command & 0xff != check or command > 128:
+				self.failed()
+				continue
+			if command == END:
+				self.link.write(ACK)
+				return
+
+			self.link.write(ACK)
+			frame = self.read_frame(1 + command)
+			if frame is None:
+				self.failed()
+				continue
+			self.crc_errors = 0
+
+			if frame[0] != self.sequence:
+				self.duplicates += 1
+				self.link.write(ACK)
+				self.link.write(RDY)
+				continue
+			if len(self.eeprom) + command > 131072:
+				# The sketch gives up for good here; so do we, for this transfer
+				self.link.discard()
+				self.link.write(ERR)
+				return
+
+			self.link.write(ACK)
+			start = len(self.eeprom)
+			self.eeprom += frame[1:]
+			self.sequence = (self.sequence + 1) & 0xff
+			pages = (len(self.eeprom) - 1) // PAGE_SIZE - start // PAGE_SIZE + 1
+			time.sleep(pages * WRITE_TIME)
+			self.link.write(RDY)
+
+def parse_errors(option, opt, value, parser):
+	# 500000:1e-4,1000000:1e-2
+	for item in value.split(','):
+		rate, p = item.split(':')
+		parser.values.errors[int(rate)] = float(p)
+
+def main(argv):
+	parser = OptionParser(usage = 'Usage: %prog [options]')
+	parser.set_defaults(errors = {})
+	parser.add_option('-e', '--errors', type = 'string', action = 'callback', callback = parse_errors,
+		help = 'framing error rate per byte at each baud rate, e.g. 500000:1e-4,1000000:1e-2 (default: none)')
+	parser.add_option('-o', '--output', help = 'write each transfer\'s data to this file')
+	parser.add_option('-s', '--seed', type = 'int', help = 'random seed, for repeatable runs')
+	parser.add_option('-n', '--count', type = 'int', default = 0, help = 'exit after this many transfers (default: never)')
+	(options, args) = parser.parse_args(argv[1:])
+
+	master, slave = os.openpty()
+	tty.setraw(slave) # until the sender opens it; we keep it open, so that it survives the sender closing it
+	print('Serial port: {0}'.format(os.ttyname(slave)))
+	sys.stdout.flush()
+
+	rng = random.Random(options.seed)
+	transfers = 0
+	while options.count == 0 or transfers < options.count:
+		link = Link(master, options.errors, rng)
+		receiver = Receiver(link)
+		receiver.run()
+		transfers += 1
+		print('Received {0} bytes: {1} failed frames, {2} duplicate chunks, {3} bytes garbled'.format(
+			len(receiver.eeprom), receiver.failed_frames, receiver.duplicates, link.garbled))
+		if options.output:
+			open(options.output, 'wb').write(receiver.eeprom)
+		sys.stdout.flush()
+
+if __name__ == '__main__':
+	try:
+		sys.exit(main(sys.argv))
+	except KeyboardInterrupt:
+		pass
@@ -1,6 +1,6 @@
-# serial is the pySerial module
+# serial is the pySerial module (pip install pyserial)
 import serial, sys, os
-from time import sleep
+from time import sleep, time
 
 # Transfers data over a serial ("RS-232", though not really) link to an Arduino.
 # Thomas Backman, August 5 2012
@@ -8,31 +8,133 @@ from time import sleep
 ERR = 0xfc
 RDY = 0xfd
 ACK = 0xfe
+BAUD = 0xfb
+COMMIT = 0xfa
 END = 0x0
 
+BASE_BAUD = 115200
+PROBE_LEN = 64
+PROBE_ROUNDS = 4
+FALLBACK_ERRORS = 3
+RESYNC_TIMEOUT = 1.0
+
+# Must match baudRates[] in EEPROM_serial_writer.ino, since rates are sent as indexes
+BAUD_RATES = [115200, 250000, 500000, 1000000]
+
 # Protocol documentation (quick and dirty; I wrote the protocol as I wrote this program!)
 # S = sender, R = receiver. Data transmission is always uni-directional, though the receiver
 # sends back ACK or ERR codes.
 
-# 1) Sender sends a byte with the transfer size (1 - 255 bytes)
-# 2) Receiver sends an ACK byte
-# 3) Sender sends all the data in one go
-# 4) Receiver sends an ACK byte
+# 1) Sender sends a byte with the transfer size (1 - 128 bytes), and its complement
+# 2) Receiver sends an ACK byte, or an ERR byte if the two didn't add up
+# 3) Sender sends the chunk's sequence number (0 - 255, wrapping) and all the data in one go,
+#    followed by a 16-bit CRC (CCITT, LSB first) of both
+# 4) Receiver sends an ACK byte, or an ERR byte if the CRC didn't match
 # 5) The receiver processes the received data.
 # 6) Receiver sends a RDY byte when it is ready to receive further data.
 # 7) The sender goes back to step 1, if there is more data to send.
 #
 # The loop is broken when the entire file is sent, after which
-# 8) The sender sends an END byte (0x0) signalling the end of the transmission.
+# 8) The sender sends an END byte (0x0) and its complement signalling the end of the
+#    transmission, and the receiver sends an ACK.
+
+# On an ERR, or on anything else than the expected answer (a garbled byte, or nothing at all),
+# the sender resyncs (see resync() below) and starts over at step 1 with the same chunk.
+# The sequence number lets the receiver skip a chunk it has already stored, in case it was
+# its ACK that was garbled.
+
+# Before the transfer, the sender negotiates the highest baud rate that works; see
+# EEPROM_serial_writer.ino for the details. In short: BAUD <index> <~index>, ACK, switch rates,
+# PROBE_ROUNDS probe frames that must all be ACKed, then COMMIT and ACK.
+# If FALLBACK_ERRORS chunks in a row fail, both sides drop back to BASE_BAUD, and the
+# sender negotiates again, with the failed rate as the (exclusive) upper limit. The receiver
+# also drops back if it hears nothing for RESYNC_TIMEOUT, so the sender waits that long first.
 
 # On the receiver side, the above applies, with the addition of sending the ERR byte (after discarding
-# all incoming bytes until "they stop coming") if there is a transmission error.
+# all incoming bytes until "they stop coming") if there is a fatal transmission error.
 
-if len(sys.argv) != 2:
-	print >> sys.stderr, 'Usage: {0} <filename to transfer> (1 - 131072 bytes)'.format(sys.argv[0])
+def crc_ccitt_update(crc, b):
+	# Same as _crc_ccitt_update() in avr-libc's util/crc16.h
+	b ^= crc & 0xff
+	b ^= (b << 4) & 0xff
+	return (((b << 8) | (crc >> 8)) ^ (b >> 4) ^ (b << 3)) & 0xffff
+
+def frame(payload):
+	crc = 0xffff
+	for c in payload:
+		crc = crc_ccitt_update(crc, ord(c))
+	return payload + chr(crc & 0xff) + chr(crc >> 8)
+
+def expect(s, code):
+	response = s.read()
+	return len(response) == 1 and ord(response) == code
+
+def resync(s):
+	# Something got garbled. Give the receiver time to notice (it times out after 100 ms,
+	# and answers ERR), then throw away whatever it said, so that we start over in step.
+	sleep(0.2)
+	s.flushInput()
+
+def set_baud(s, rate):
+	s.flush()
+	s.baudrate = rate
+
+def try_baud(s, idx):
+	# Returns the number of failed probe frames at this rate, or None if
+	# the receiver didn't accept the switch at all.
+	s.flushInput()
+	s.write(chr(BAUD) + chr(idx) + chr(~idx & 0xff))
+	if not expect(s, ACK):
+		# Either it didn't get the request, or we didn't get its ACK, in which case
+		# it's now waiting for probe frames at the new rate; wait for it to give up
+		sleep(RESYNC_TIMEOUT)
+		s.flushInput()
+		return None
+
+	set_baud(s, BAUD_RATES[idx])
+	sleep(0.01) # Give the receiver time to switch as well
+
+	failures = 0
+	for i in range(0, PROBE_ROUNDS):
+		s.write(frame(os.urandom(PROBE_LEN)))
+		if not expect(s, ACK):
+			failures += 1
+			# The receiver waits for the frame to time out before it answers;
+			# resynchronize so that the next frame starts fresh
+			sleep(0.15)
+			s.flushInput()
+
+	if failures == 0:
+		s.write(chr(COMMIT))
+		if expect(s, ACK):
+			return 0
+		failures = 1
+
+	# The receiver falls back on its own; wait until it has, and do the same
+	sleep(0.3)
+	set_baud(s, BASE_BAUD)
+	s.flushInput()
+	return failures
+
+def negotiate(s, limit):
+	# Tries the rates below limit, fastest first. Returns the rate in use afterwards.
+	for idx in range(limit - 1, 0, -1):
+		t = time()
+		failures = try_baud(s, idx)
+		if failures is None:
+			print >> sys.stderr, "Remote end didn't acknowledge the switch to {0} baud".format(BAUD_RATES[idx])
+			continue
+		print 'Probed {0} baud: {1}/{2} frames failed ({3} ms)'.format(BAUD_RATES[idx], failures, PROBE_ROUNDS, int((time() - t) * 1000))
+		if failures == 0:
+			return idx
+	return 0
+
+if len(sys.argv) not in (2, 3):
+	print >> sys.stderr, 'Usage: {0} <filename to transfer> (1 - 131072 bytes) [serial port]'.format(sys.argv[0])
 	sys.exit(1)
 
 filename = sys.argv[1]
+port = sys.argv[2] if len(sys.argv) == 3 else '/dev/tty.usbmodemfd121'
 print 'File to transfer:', filename
 
 if not os.path.exists(filename):
@@ -41,7 +143,7 @@ if not os.path.exists(filename):
 
 try:
 	# The file is supposed be 128 kiB or less, so...
-	data = open(filename).read()
+	data = open(filename, 'rb').read()
 except:
 	print >> sys.stderr,  'Failed to read file data! Exiting.'
 	sys.exit(4)
@@ -57,7 +159,7 @@ print bytesToSend, 'bytes to transfer'
 # OK, we have what we need! Let's see...
 
 try:
-	s = serial.Serial('/dev/tty.usbmodemfd121', 115200, timeout=6)
+	s = serial.Serial(port, BASE_BAUD, timeout=6)
 except:
 	print >> sys.stderr, 'Error setting up the serial link. Exiting.'
 	sys.exit(8)
@@ -70,45 +172,62 @@ sys.stdout.flush()
 sleep(3)
 print 'done!'
 
+s.timeout = 1
+rate = negotiate(s, len(BAUD_RATES))
+print 'Transferring at {0} baud'.format(BAUD_RATES[rate])
+
 # Used for the progress display
 last_len = 0
 print 'Transfer progress:',
 
+errors = 0
+retransmits = 0
+sequence = 0
+start = time()
+
 while bytesToSend > bytesSent:
 	# Calculate and send the length of this chunk (1-128 bytes)
 	chunksize = min(128, bytesToSend - bytesSent)
-	s.write(chr(chunksize))
+	s.write(chr(chunksize) + chr(~chunksize & 0xff))
 #print 'In loop. {0} bytes sent, {1} bytes to go. {2} bytes in this chunk'.format(bytesSent, bytesToSend - bytesSent, chunksize)
 
-	# Did we get an ACK?
-	response = s.read()
-	if not (len(response) == 1 and ord(response) == ACK):
-		print >> sys.stderr, "Remote end didn't acknowledge. Response: {0}".format(hex(ord(response)))
-		print >> sys.stderr, "Exiting."
-		sys.exit(16)
-	
-#print 'ACK received, sending data'
-	# Send the data
-	s.write(data[bytesSent : bytesSent + 128])
+	# Did we get an ACK? If so, send the data, and listen for the next one
+	ok = expect(s, ACK)
+	if ok:
+		s.write(frame(chr(sequence) + data[bytesSent : bytesSent + chunksize]))
+		ok = expect(s, ACK)
+
+	if not ok:
+		# An ERR, a garbled answer or none at all; send the chunk again, unless this rate is clearly too fast
+		resync(s)
+		retransmits += 1
+		errors += 1
+		if errors >= FALLBACK_ERRORS and rate != 0:
+			print >> sys.stderr, '\n{0} errors in a row at {1} baud; falling back'.format(errors, BAUD_RATES[rate])
+			set_baud(s, BASE_BAUD)
+			sleep(RESYNC_TIMEOUT) # in case the receiver counted fewer errors than we did
+			s.flushInput()
+			rate = negotiate(s, rate)
+			print 'Transferring at {0} baud'.format(BAUD_RATES[rate])
+			errors = 0
+		elif errors >= 10:
+			print >> sys.stderr, '\nToo many errors, even at {0} baud. Exiting.'.format(BASE_BAUD)
+			sys.exit(16)
+		continue
+	errors = 0
 
-	# Listen for ACK
-	response = s.read()
-	if not (len(response) == 1 and ord(response) == ACK):
-		print >> sys.stderr, "Remote end didn't acknowledge. Response: {0}".format(hex(ord(response)))
-		print >> sys.stderr, "Exiting."
-		sys.exit(16)
-	
 #print 'ACK received; write cycle underway. Waiting for RDY...'
-	# We got an ACK; device should now be writing. Wait for the ready byte. If received, loop again.
+	# We got an ACK; device should now be writing. Wait for the ready byte (if it got garbled,
+	# the device is still ready, since it sent it). If received, loop again.
 	response = s.read()
-	if not (len(response) == 1 and ord(response) == RDY):
-		print >> sys.stderr, "Remote end didn't send ready byte in time. Response: {0}".format(hex(ord(response)))
-		print >> sys.stderr, "Exiting."
+	if len(response) != 1:
+		print >> sys.stderr, "Remote end didn't send ready byte in time. Exiting."
 		sys.exit(16)
-	
+
 #print 'RDY received. Looping...'
 
 	bytesSent += chunksize
+	sequence = (sequence + 1) & 0xff
 
 # Print progress
 	for i in range (0, last_len): sys.stdout.write('\b')
@@ -117,10 +236,15 @@ while bytesToSend > bytesSent:
 	last_len = len(out)
 	sys.stdout.flush()
 
+elapsed = time() - start
 print "\nLoop finished."
 if bytesToSend == bytesSent:
-	s.write(chr(END))
-	print 'Successfully transferred {0} bytes!'.format(bytesSent)
+	for i in range(0, 10):
+		s.write(chr(END) + chr(~END & 0xff))
+		if expect(s, ACK):
+			break
+		resync(s)
+	print 'Successfully transferred {0} bytes in {1:.1f} s ({2:.0f} bytes/s, {3} chunks resent)!'.format(bytesSent, elapsed, bytesSent / elapsed, retransmits)
 else:
 	print 'Something bad happened! bytesToSend={0} bytesSent{1}'.format(bytesToSend, bytesSent)
 	sys.exit(32)
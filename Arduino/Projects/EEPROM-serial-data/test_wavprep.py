@@ -0,0 +1,61 @@
+from __future__ import print_function, division
+import unittest, struct
+import numpy as np
+import wavprep
+
+# Host tests for wavprep.py: python -m unittest test_wavprep
+
+def make_wav(x, rate, channels = 1):
+	# 16-bit PCM .wav of a float array (frames * channels values)
+	pcm = np.clip(np.round(np.asarray(x) * 32767), -32768, 32767).astype('<i2').tobytes()
+	fmt = struct.pack('<4sIHHIIHH', b'fmt ', 16, wavprep.WAVE_FORMAT_PCM, channels, rate, rate * 2 * channels, 2 * channels, 16)
+	body = b'WAVE' + fmt + struct.pack('<4sI', b'data', len(pcm)) + pcm
+	return struct.pack('<4sI', b'RIFF', len(body)) + body
+
+class QuantizeTest(unittest.TestCase):
+	def test_all_codes(self):
+		# A slow ramp across the whole range must use odd codes as well as even ones,
+		# i.e. the full resolution of the DAC
+		for bits in (8, 10, 12):
+			q = wavprep.quantize(np.linspace(-1.0, 1.0, 50 * 2 ** bits), bits)
+			odd = np.count_nonzero(q & 1)
+			self.assertGreater(odd, len(q) // 4, '{0} bits: {1} odd codes'.format(bits, odd))
+			self.assertGreater(len(q) - odd, len(q) // 4)
+			self.assertGreaterEqual(len(np.unique(q)), 2 ** bits - 8)
+
+	def test_range(self):
+		for bits in (8, 12):
+			q = wavprep.quantize(np.array([-1.0, 1.0] * 1000 + [-2.0, 2.0]), bits)
+			self.assertTrue(q.min() >= 0 and q.max() <= 2 ** bits - 1)
+
+	def test_noise_shaping(self):
+		# The shaped error doesn't accumulate: the running sum of the output follows
+		# that of the input to within a couple of LSBs, however long the signal
+		bits = 8
+		x = 0.7 * np.sin(np.arange(100000) * 0.01)
+		q = wavprep.quantize(x, bits).astype(np.float64) - 2 ** bits // 2
+		drift = np.cumsum(q) - np.cumsum(x * ((2 ** bits - 1) / 2.0 - 2))
+		self.assertLess(np.abs(drift).max(), 2.0)
+
+	def test_dc(self):
+		# Silence comes out as the midpoint, give or take the dither
+		q = wavprep.quantize(np.zeros(10000), 8)
+		self.assertAlmostEqual(q.mean(), 128, delta = 0.05)
+
+class ConvertTest(unittest.TestCase):
+	def test_convert(self):
+		t = np.arange(44100) / 44100.0
+		stereo = np.column_stack((np.sin(2 * np.pi * 440 * t), np.sin(2 * np.pi * 440 * t))).ravel() * 0.5
+		(samples, rate, bits) = wavprep.convert(make_wav(stereo, 44100, 2), 'MCP4901', rate = 11025)
+		self.assertEqual((rate, bits), (11025, 8))
+		self.assertEqual(len(samples), 11025)
+		q = np.frombuffer(samples, dtype = np.uint8)
+		self.assertGreater(np.count_nonzero(q & 1), len(q) // 4)
+
+		(samples, rate, bits) = wavprep.convert(make_wav(stereo, 44100, 2), 'MCP4921', rate = 8000)
+		q = np.frombuffer(samples, dtype = '<u2')
+		self.assertEqual((rate, bits, len(q)), (8000, 12, 8000))
+		self.assertTrue(q.max() < 4096 and np.count_nonzero(q & 1) > len(q) // 4)
+
+if __name__ == '__main__':
+	unittest.main()
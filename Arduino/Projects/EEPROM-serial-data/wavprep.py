@@ -0,0 +1,189 @@
+from __future__ import print_function, division
+import sys, struct
+try:
+	from math import gcd
+except ImportError:
+	from fractions import gcd # Python 2
+import numpy as np
+
+# Converts (more or less) arbitrary .wav files to what the EEPROM DAC streamer can play:
+# mono, at a sample rate the EEPROM can keep up with, and quantized to the DAC's bit width.
+# Everything is done on whole NumPy arrays, without per-sample Python loops, so that
+# even multi-minute files convert in a fraction of a second.
+
+# Bit widths of the DACs supported by the DAC_MCP49xx library
+DAC_BITS = {
+	'MCP4901': 8, 'MCP4902': 8,
+	'MCP4911': 10, 'MCP4912': 10,
+	'MCP4921': 12, 'MCP4922': 12,
+}
+
+# Bytes per second the streamer can read from the EEPROM (see MAX_SAMPLE_RATE in the streamer)
+DEFAULT_BUDGET = 20200
+
+WAVE_FORMAT_PCM = 1
+WAVE_FORMAT_IEEE_FLOAT = 3
+WAVE_FORMAT_EXTENSIBLE = 0xfffe
+
+def read_header(data):
+	# Finds the format and data chunks of a .wav file (as a byte string). Returns
+	# (format, position, size): the format chunk's fields as a tuple (audio format,
+	# channels, rate, byte rate, block align, bits), and where the samples are.
+	if data[0:4] != b'RIFF' or data[8:12] != b'WAVE':
+		raise ValueError('Not a .wav file')
+
+	fmt = None
+	pos = 12
+	while pos + 8 <= len(data):
+		(chunk, size) = struct.unpack_from('<4sI', data, pos)
+		body = data[pos + 8 : pos + 8 + size]
+		if chunk == b'fmt ':
+			fmt = struct.unpack_from('<HHIIHH', body, 0)
+			if fmt[0] == WAVE_FORMAT_EXTENSIBLE and len(body) >= 26:
+				# The real format is the first two bytes of the SubFormat GUID
+				fmt = (struct.unpack_from('<H', body, 24)[0],) + fmt[1:]
+		elif chunk == b'data':
+			if fmt is None:
+				raise ValueError('Data chunk before format chunk')
+			return (fmt, pos + 8, len(body))
+		pos += 8 + size + (size & 1) # chunks are padded to even sizes
+	raise ValueError('No data chunk found')
+
+def read_wav(data):
+	# Parses a .wav file (as a byte string). Returns (samples, rate), where samples is
+	# a float64 array of shape (frames, channels), scaled to -1.0 ... 1.0.
+	# Handles 8/16/24/32-bit integer and 32/64-bit float data, which Python's
+	# wave module doesn't all support.
+	(fmt, pos, size) = read_header(data)
+	return (decode(data[pos : pos + size], fmt), fmt[2])
+
+def decode(body, fmt):
+	(audioFormat, channels, rate, byteRate, blockAlign, bits) = fmt
+	width = bits // 8
+	frames = len(body) // (width * channels)
+	body = body[: frames * width * channels]
+
+	if audioFormat == WAVE_FORMAT_IEEE_FLOAT and bits in (32, 64):
+		x = np.frombuffer(body, dtype = '<f%d' % width).astype(np.float64)
+	elif audioFormat == WAVE_FORMAT_PCM and bits == 8:
+		x = (np.frombuffer(body, dtype = np.uint8).astype(np.float64) - 128) / 128
+	elif audioFormat == WAVE_FORMAT_PCM and bits in (16, 32):
+		x = np.frombuffer(body, dtype = '<i%d' % width).astype(np.float64) / 2 ** (bits - 1)
+	elif audioFormat == WAVE_FORMAT_PCM and bits == 24:
+		# No 24-bit dtype; place the three bytes in the top of an int32
+		b = np.frombuffer(body, dtype = np.uint8).reshape(-1, 3).astype(np.int32)
+		x = ((b[:, 0] << 8) | (b[:, 1] << 16) | (b[:, 2] << 24)).astype(np.float64) / 2 ** 31
+	else:
+		raise ValueError('Unsupported format {0}, {1} bits'.format(audioFormat, bits))
+
+	return x.reshape(frames, channels)
+
+def downmix(x):
+	# A matrix-vector product is many times faster than x.mean(axis = 1) here
+	return x.dot(np.full(x.shape[1], 1.0 / x.shape[1]))
+
+def fast_length(n, multiple):
+	# The smallest multiple of multiple that is >= n, where n / multiple only has
+	# the prime factors 2, 3 and 5, so that the FFT stays fast
+	k = -(-n // multiple)
+	while True:
+		m = k
+		for p in (2, 3, 5):
+			while m % p == 0:
+				m //= p
+		if m == 1:
+			return k * multiple
+		k += 1
+
+def resample(x, src, dst, guard = 4096):
+	# Band-limited resampling in the frequency domain: transform the entire clip,
+	# keep (or zero-pad) the spectrum up to the new Nyquist frequency, and transform back.
+	# The clip is zero-padded (by at least guard samples), so that the end doesn't wrap
+	# around into the start, and to a length that gives an exact integer number of output
+	# samples, so that the rate conversion is exact.
+	if src == dst:
+		return x.copy()
+
+	g = gcd(src, dst)
+	(up, down) = (dst // g, src // g)
+	n = fast_length(len(x) + guard, down)
+	m = n // down * up
+
+	X = np.fft.rfft(x, n)
+	bins = min(len(X), m // 2 + 1)
+	Y = np.zeros(m // 2 + 1, dtype = complex)
+	Y[:bins] = X[:bins]
+	if dst < src:
+		# Roll off the top 5% below the new Nyquist frequency instead of cutting it off
+		# like a brick wall, which would ring
+		taper = max(1, bins // 20)
+		Y[bins - taper : bins] *= 0.5 + 0.5 * np.cos(np.linspace(0, np.pi, taper))
+
+	y = np.fft.irfft(Y, m) * (m / n)
+	return y[: len(x) * up // down]
+
+def normalize(x, peak = 1.0):
+	m = np.abs(x).max()
+	return x * (peak / m) if m > 0 else x
+
+def quantize(x, bits, seed = 0):
+	# Quantizes -1.0 ... 1.0 to unsigned integers of the given width, with TPDF dither
+	# and first-order noise shaping (the quantization error is fed back, pushing the
+	# noise towards high frequencies, where it's less audible).
+	#
+	# Error feedback looks inherently sequential, but for a first-order shaper it isn't:
+	# with y[n] = x[n] + e[n-1] and e[n] = y[n] - q[n], the errors telescope, and the
+	# running sum of the output is simply the rounded running sum of the input. So
+	# q[n] = round(S[n] + d[n]) - round(S[n-1] + d[n-1]), with S the cumulative sum.
+	levels = 2 ** bits
+	# Leave room for the dither and the shaped error (about +/- 2 LSB in total)
+	scale = (levels - 1) / 2.0 - 2
+
+	d = np.random.RandomState(seed)
+	dither = d.uniform(-0.5, 0.5, len(x)) + d.uniform(-0.5, 0.5, len(x))
+
+	s = np.cumsum(np.clip(x, -1.0, 1.0) * scale) # centered, so the sum stays small
+	r = np.round(s + dither)
+	q = np.diff(np.concatenate(([0.0], r)))
+	# q is already a whole number; offset it by a whole number too, since rounding again
+	# (to even, at every .5) would merge each pair of codes into one
+	return np.clip(q + levels // 2, 0, levels - 1).astype(np.uint16)
+
+def convert(data, dac = 'MCP4901', rate = None, budget = DEFAULT_BUDGET, norm = False):
+	# Converts a .wav file (as a byte string) for the given DAC. The sample rate is the
+	# source rate, unless either rate is given, or the bus budget (bytes/second) is
+	# too small for it; note that samples for 10- and 12-bit DACs take two bytes, so
+	# they only get half the rate. Returns (samples as a byte string, rate, bits); samples wider
+	# than 8 bits are stored as little-endian 16-bit values.
+	bits = DAC_BITS[dac]
+	width = 1 if bits <= 8 else 2
+
+	(x, src) = read_wav(data)
+	x = downmix(x)
+
+	dst = rate if rate else src
+	dst = min(dst, budget // width)
+	x = resample(x, src, dst)
+	if norm:
+		x = normalize(x)
+
+	q = quantize(x, bits)
+	out = q.astype(np.uint8) if width == 1 else q.astype('<u2')
+	return (out.tobytes(), dst, bits)
+
+def write_wav(samples, rate):
+	# Wraps 8-bit samples in a minimal .wav header, as the streamer expects when
+	# it's used without an image
+	fmt = struct.pack('<4sIHHIIHHH', b'fmt ', 18, WAVE_FORMAT_PCM, 1, rate, rate, 1, 8, 0)
+	body = b'WAVE' + fmt + struct.pack('<4sI', b'data', len(samples)) + samples
+	return struct.pack('<4sI', b'RIFF', len(body)) + body
+
+if __name__ == '__main__':
+	if len(sys.argv) not in (3, 4):
+		print('Usage: {0} <input .wav> <output .wav> [sample rate]'.format(sys.argv[0]), file = sys.stderr)
+		print('Converts to mono, 8-bit .wav for the DAC streamer (single-file mode).', file = sys.stderr)
+		sys.exit(1)
+
+	(samples, rate, bits) = convert(open(sys.argv[1], 'rb').read(), rate = int(sys.argv[3]) if len(sys.argv) == 4 else None, norm = True)
+	open(sys.argv[2], 'wb').write(write_wav(samples, rate))
+	print('Wrote {0} samples at {1} Hz to {2}'.format(len(samples), rate, sys.argv[2]))
@@ -2,6 +2,7 @@
 #include <EEPROM_24XX1025.h>
 #include <SPI.h>
 #include <DAC_MCP49x1.h>
+#include <EEPROM_Image.h>
 
 // For the interrupt timer
 #include <avr/io.h>
@@ -32,9 +33,62 @@ typedef struct {
 buffer_t buf1, buf2;
 buffer_t *readBuffer = &buf1, *writeBuffer = &buf2;
 
-// Initialize the two libraries we're using
-DAC_MCP49x1 dac(DAC_MCP49x1::MCP4901, 10);
+// The DAC, and its bit width. 8-bit DACs play 8-bit .wav files and PCM clips; 10- and
+// 12-bit ones play PCM16 clips (16 bits per sample, as made by build-image.py --dac),
+// which take twice the EEPROM bandwidth per sample.
+#define DAC_MODEL DAC_MCP49x1::MCP4901
+#define DAC_BITS 8
+#if DAC_BITS > 8
+#define SAMPLE_BYTES 2
+typedef uint16_t sample_t;
+#else
+#define SAMPLE_BYTES 1
+typedef byte sample_t;
+#endif
+
+// The most bytes per second the EEPROM can keep up with. At 400 kHz, the bus moves
+// roughly 31 kilobytes/sec in practice, and we need some margin for re-addressing.
+#define MAX_BYTE_RATE 20200
+#define MAX_SAMPLE_RATE (MAX_BYTE_RATE / SAMPLE_BYTES)
+
+// If nonzero, the DAC is always updated at this rate, and clips (of any rate up to
+// MAX_SAMPLE_RATE) are resampled to it on the fly, using linear interpolation.
+// If 0, the DAC is updated at the clips' own sample rate.
+#define DAC_RATE 0
+
+// Where a clip's audio data is, in the EEPROM
+typedef struct {
+  uint32_t position;
+  uint32_t length;
+} clip_t;
+
+// The playlist. Each entry plays a clip (by its index in the EEPROM image; without
+// an image, only clip 0 exists: the .wav file at address 0) from the start.
+// When loopEnd is reached, playback jumps back to loopStart, "loops" times (LOOP_FOREVER
+// for... forever); after that, the clip plays on until its end, and the next entry starts.
+// A loopEnd of 0 means the end of the clip. Both are in samples.
+// The playlist itself starts over when the last entry is finished.
+// Clips are spliced sample-accurately, with no gap (and no crossfade) in between,
+// so loop points should be chosen where the waveforms line up.
+#define LOOP_FOREVER 255
+typedef struct {
+  uint8_t clip;
+  uint8_t loops;
+  uint32_t loopStart;
+  uint32_t loopEnd;
+} playlist_entry_t;
+
+playlist_entry_t playlist[] = {
+  { 0, LOOP_FOREVER, 0, 0 } // Loop clip 0, in its entirety, forever
+};
+#define PLAYLIST_LENGTH (sizeof(playlist) / sizeof(playlist[0]))
+
+clip_t clips[PLAYLIST_LENGTH]; // one per playlist entry, in the same order
+
+// Initialize the libraries we're using
+DAC_MCP49x1 dac(DAC_MODEL, 10);
 EEPROM_24XX1025 eeprom(0, 0);
+EEPROM_Image image(eeprom);
 
 void error() {
   // Stop the timer, and beep until reset
@@ -43,7 +97,7 @@ void error() {
     for (int i=0; i < 70; i++) {
       dac.output(0);
       delayMicroseconds(2000);
-      dac.output(127);
+      dac.output((1 << (DAC_BITS - 1)) - 1);
       delayMicroseconds(2000);
     }
 
@@ -51,20 +105,13 @@ void error() {
   }
 }
 
-uint32_t waveDataPosition = 0, waveDataLength = 0;
-
-void setup() {
-  Serial.begin(115200);
-
-  // Set up the DAC to the fastest possible operation
-  dac.setSPIDivider(SPI_CLOCK_DIV2);
-  dac.setPortWrite(true);
-
+// Parses the .wav file starting at the EEPROM address start, and stores the location
+// of the audio data in *clip. Returns the sample rate. Uses buf1 as scratch space.
+uint32_t parseWave(uint32_t start, clip_t *clip) {
   // Read the wave format
   // 12 is the number of bytes in the first header; 16 a semi-magic number for
   // the number of bytes to read after the struct, covering some unknowns
-  eeprom.setPosition(0);
-  eeprom.read(0, buf1.buffer, 12 + sizeof(struct WAVE_format) + 16);
+  eeprom.read(start, buf1.buffer, 12 + sizeof(struct WAVE_format) + 16);
 
   // Parse the wave format data, to make sure we can understand it
   // etc. Also, find the location and length of the audio data.
@@ -73,11 +120,11 @@ void setup() {
   uint32_t sampleRate = fmt->sampleRate; // cache, since the buffer will be overwritten soon
   if (strncmp(fmt->fmt, "fmt ", 4) == 0) {
     // Valid format chunk
-    if (fmt->numChannels != 1 || fmt->audioFormat != 1
-       || fmt->bitsPerSample != 8 || fmt->sampleRate > 20200) 
+    if (fmt->numChannels != 1 || fmt->audioFormat != 1 || SAMPLE_BYTES != 1
+       || fmt->bitsPerSample != 8 || fmt->sampleRate > MAX_SAMPLE_RATE) 
      {
       // Invalid format for this program
-      Serial.println("ERROR: invalid format (not mono/PCM/8-bit/max 20.2 kHz sample rate)");
+      Serial.println("ERROR: invalid format (not mono/PCM/8-bit, or sample rate too high, or not an 8-bit DAC)");
       error();
     }
   }
@@ -87,44 +134,187 @@ void setup() {
     error();
   }
 
-  // Again, 12 is the size of the first chunk, which is always the same
-  uint32_t waveChunkPosition = 12 + sizeof(struct WAVE_format) + fmt->extraFormatBytes;
+  // Again, 12 is the size of the first chunk, which is always the same; the format
+  // chunk follows, its size not counting its own 8-byte header. (extraFormatBytes is
+  // only there if the chunk is over 16 bytes, which plain PCM files rarely are.)
+  uint32_t waveChunkPosition = 12 + 8 + fmt->fmtChunkSize;
   
   // Is this a data chunk?
-  if (strncmp((const char *)(buf1.buffer + waveChunkPosition), "data", 4) != 0) {
+  if (waveChunkPosition + 8 > 12 + sizeof(struct WAVE_format) + 16
+      || strncmp((const char *)(buf1.buffer + waveChunkPosition), "data", 4) != 0) {
     Serial.println("ERROR: the data chunk was not where I expected");
     error();
   }
 
   // These are the important things from the WAVE data (apart from sample rate):
   // where the stuff to play is!  
-  waveDataPosition = waveChunkPosition + 8; /* 8 for "data" + data length (32 bits) */
-  waveDataLength = *((uint32_t *)( (const char *)(buf1.buffer + waveChunkPosition + 4))); // Ugh
-  
+  clip->position = start + waveChunkPosition + 8; /* 8 for "data" + data length (32 bits) */
+  clip->length = *((uint32_t *)( (const char *)(buf1.buffer + waveChunkPosition + 4))); // Ugh
+
+  return sampleRate;
+}
+
+// Sample timing.
+// A sample period is rarely a whole number of CPU cycles (16 MHz / 22050 Hz = 725.62...),
+// so rounding OCR1A once would play everything slightly too fast or too slow.
+// Instead, the ISR alternates between periods of periodWhole and periodWhole + 1 cycles,
+// Bresenham style, so that the average is *exactly* F_CPU / timerRate over time.
+uint16_t timerRate = 0;   // how many times per second the ISR runs
+uint16_t periodWhole = 0; // F_CPU / timerRate, i.e. the shorter period
+uint16_t periodLong = 0;  // timerRate - (F_CPU % timerRate); see the ISR
+uint16_t periodAcc = 0;   // the fractional cycles owed so far, in units of 1/timerRate
+
+// Resampling (see DAC_RATE): the position between the two samples we interpolate
+// between, as a 16-bit fraction, and how far it moves per DAC update.
+// The step is rounded down, so the remainder is accumulated the same way as above.
+uint32_t resampleStep = 0; // 16.16 fixed point; source rate / DAC rate
+uint16_t resampleRem = 0;  // ((source rate << 16) % DAC rate)
+uint16_t resamplePhase = 0;
+uint32_t resampleAcc = 0;
+
+// Finds clip number n, either in the EEPROM image, or (without one) as a single .wav file,
+// and stores its location in *clip. Returns the sample rate.
+uint32_t loadClip(boolean haveImage, uint8_t n, clip_t *clip) {
+  if (!haveImage) {
+    if (n != 0) {
+      Serial.println("ERROR: no EEPROM image, so there is only clip 0");
+      error();
+    }
+    return parseWave(0, clip);
+  }
+
+  struct EEPROM_ImageEntry entry;
+  if (!image.getEntry(n, &entry)) {
+    Serial.println("ERROR: no such clip in the EEPROM image");
+    error();
+  }
+
+  if (entry.format == IMAGE_FORMAT_WAV) {
+    return parseWave(image.address(n), clip);
+  }
+  else if (entry.format == (SAMPLE_BYTES == 1 ? IMAGE_FORMAT_PCM : IMAGE_FORMAT_PCM16)
+           && entry.param <= MAX_SAMPLE_RATE && entry.length % SAMPLE_BYTES == 0) {
+    // Already raw samples, so no header to parse
+    clip->position = image.address(n);
+    clip->length = entry.length;
+    return entry.param;
+  }
+
+  Serial.println("ERROR: clip is not a .wav file or PCM for this DAC's bit width (or its sample rate is too high)");
+  error();
+  return 0;
+}
+
+// Where the reader is in the playlist
+uint8_t playlistItem = 0;
+uint32_t clipOffset = 0; // bytes into the current clip
+uint8_t loopsLeft = 0;
+
+void startPlaylist(void) {
+  playlistItem = 0;
+  clipOffset = 0;
+  loopsLeft = playlist[0].loops;
+}
+
+// Fills an entire buffer with the audio that comes next, following loops and
+// moving on through the playlist as needed. Since the buffer is always filled
+// up, the end of one clip and the start of the next are read into the same buffer,
+// and the next clip is already buffered while the current one finishes playing.
+void fillBuffer(buffer_t *b) {
+  uint8_t filled = 0;
+
+  while (filled < BUFSIZE) {
+    playlist_entry_t *entry = &playlist[playlistItem];
+    clip_t *clip = &clips[playlistItem];
+    uint32_t end = (loopsLeft > 0 && entry->loopEnd) ? entry->loopEnd * SAMPLE_BYTES : clip->length;
+
+    uint32_t n = min((uint32_t)(BUFSIZE - filled), end - clipOffset);
+    if (n > 0) {
+      eeprom.read(clip->position + clipOffset, b->buffer + filled, n);
+      filled += n;
+      clipOffset += n;
+    }
+
+    if (clipOffset >= end) {
+      if (loopsLeft > 0) {
+        // Back to the loop point
+        clipOffset = entry->loopStart * SAMPLE_BYTES;
+        if (loopsLeft != LOOP_FOREVER)
+          loopsLeft--;
+      }
+      else {
+        // On to the next clip
+        playlistItem = (playlistItem + 1) % PLAYLIST_LENGTH;
+        clipOffset = 0;
+        loopsLeft = playlist[playlistItem].loops;
+      }
+    }
+  }
+
+  b->length = filled;
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  // Set up the DAC to the fastest possible operation
+  dac.setSPIDivider(SPI_CLOCK_DIV2);
+  dac.setPortWrite(true);
+
+  uint32_t sampleRate = 0;
+  boolean haveImage = image.begin();
+  for (uint8_t i = 0; i < PLAYLIST_LENGTH; i++) {
+    uint32_t rate = loadClip(haveImage, playlist[i].clip, &clips[i]);
+
+    // The timer runs at a single rate, so all clips have to match
+    if (sampleRate != 0 && rate != sampleRate) {
+      Serial.println("ERROR: all clips in the playlist must have the same sample rate");
+      error();
+    }
+    sampleRate = rate;
+
+    uint32_t samples = clips[i].length / SAMPLE_BYTES;
+    uint32_t loopEnd = playlist[i].loopEnd ? playlist[i].loopEnd : samples;
+    if (samples == 0 || loopEnd > samples || playlist[i].loopStart >= loopEnd) {
+      Serial.println("ERROR: invalid loop points (or empty clip) in the playlist");
+      error();
+    }
+  }
+
   // Read the first chunk before the timer is started, so that we always
-  // have a full buffer ready  
-  eeprom.setPosition(waveDataPosition);
-  eeprom.read(buf1.buffer, min(BUFSIZE, waveDataLength));
-  buf1.length = min(BUFSIZE, waveDataLength);
+  // have a full buffer ready
+  startPlaylist();
+  fillBuffer(&buf1);
   readBuffer = &buf1;
   writeBuffer = &buf2;
   
-  // Calculate how many cycles are between each sample update (ORC1A register)
-  // Formula: (1/samplerate)/(clock cycle length) - 1
-  float inv_sample = 1.0f / ((float)sampleRate);
-  float cycles_tmp = inv_sample/(0.0000000625f); // 62.5 ns = clock cycle time at 16 MHz
-  uint32_t cycles = (uint32_t)cycles_tmp;
-  // Take care of the "-1" part, if that brings us closer to the real value
-  if (cycles_tmp - cycles <= 0.5)
-    cycles--;
-    
-  Serial.print("CPU cycles per sample: "); Serial.println(cycles);
-  
-  // Set up the timer. No prescaling, and fire every OCR1A + 1 (IIRC) cycles  
+#if DAC_RATE
+  timerRate = DAC_RATE;
+  resampleStep = ((uint32_t)sampleRate << 16) / DAC_RATE;
+  resampleRem = ((uint32_t)sampleRate << 16) % DAC_RATE;
+#else
+  timerRate = sampleRate;
+#endif
+
+  // Timer1 is 16 bits, so the period can't be longer than 65536 cycles
+  if (timerRate == 0 || F_CPU / timerRate > 65536UL) {
+    Serial.println("ERROR: sample rate too low");
+    error();
+  }
+  periodWhole = F_CPU / timerRate;
+  periodLong = timerRate - (F_CPU % timerRate);
+  periodAcc = 0;
+
+  Serial.print("CPU cycles per sample: "); Serial.print(periodWhole);
+  Serial.print(" + "); Serial.print(F_CPU % timerRate);
+  Serial.print("/"); Serial.println(timerRate);
+
+  // Set up the timer. No prescaling, and fire every OCR1A + 1 cycles; the ISR
+  // sets OCR1A for each following period.
   cli();
   TCCR1A = 0;
   TCCR1B = 0;
-  OCR1A = cycles;
+  OCR1A = periodWhole - 1;
   TCCR1B |= (1 << WGM12);
   TCCR1B |= (1 << CS10);
   TIMSK1 |= (1 << OCIE1A);
@@ -132,7 +322,6 @@ void setup() {
 }
 
 volatile uint8_t waitForSwap = 1; // used to wait until the next buffer is "free to use"
-uint32_t bytesRead = 0; // how many bytes read this (audio) loop
 
 // So, the main idea here is rather simple:
 // The main loop() reads from the EEPROM. When finished, it waits for the playback
@@ -143,20 +332,10 @@ uint32_t bytesRead = 0; // how many bytes read this (audio) loop
 // (approximately every 50 microseconds at ~20 kHz).
 
 void loop() {
-  // We need this temporary variable. If we do writeBuffer->length = eeprom.read(...)
-  // and then bytesRead += writeBuffer->length, the results will be incorrect.
-  // The ISR swaps the buffers *between* the execution of the two lines of code, and so
-  // the bytesRead is incremented incorrectly, and bad playback results.
-  uint32_t tmp = eeprom.read(writeBuffer->buffer, min(BUFSIZE, waveDataLength - bytesRead));
-  writeBuffer->length = tmp;
-  bytesRead += tmp;
-  
-  // Loop when we reach the end
-  if (bytesRead >= waveDataLength) {
-    eeprom.setPosition(waveDataPosition);
-    bytesRead = 0;
-  }
-  
+  // The ISR may swap the buffers while we're reading, if we don't keep up (in which
+  // case playback is broken anyway), so make sure we fill the buffer we started on.
+  fillBuffer(writeBuffer);
+
   waitForSwap = 1;
   while (waitForSwap) {
     // The ISR will break this loop when it's time to do so.
@@ -168,9 +347,17 @@ void loop() {
 // How many bytes we are into the buffer.
 uint8_t playbackPosition = 0;
 
-ISR(TIMER1_COMPA_vect) {
-  dac.output(readBuffer->buffer[playbackPosition++]);
-  
+// Returns the next sample from the buffer, swapping buffers when needed. Buffers
+// always hold whole samples, since clips, loop points and BUFSIZE are all multiples
+// of SAMPLE_BYTES.
+static inline sample_t nextSample(void) {
+#if SAMPLE_BYTES == 2
+  sample_t sample = readBuffer->buffer[playbackPosition] | (readBuffer->buffer[playbackPosition + 1] << 8);
+  playbackPosition += 2;
+#else
+  sample_t sample = readBuffer->buffer[playbackPosition++];
+#endif
+
   if (playbackPosition >= readBuffer->length) {
     // We've read the entire contents of this buffer; swap them!
     buffer_t *tmp = readBuffer;
@@ -179,4 +366,49 @@ ISR(TIMER1_COMPA_vect) {
     playbackPosition = 0;
     waitForSwap = 0; // Tell the EEPROM reader/buffer writer loop to keep going now
   }
+
+  return sample;
+}
+
+ISR(TIMER1_COMPA_vect) {
+  // Set the length of the period that just started (the timer was reset to 0 at
+  // the compare match, and won't reach OCR1A for hundreds of cycles).
+  // periodAcc accumulates F_CPU % timerRate per sample; each time it reaches
+  // timerRate, we owe one whole cycle, and use a long period. Written this way
+  // to stay within 16 bits.
+  if (periodAcc >= periodLong) {
+    periodAcc -= periodLong;
+    OCR1A = periodWhole; // periodWhole + 1 cycles
+  }
+  else {
+    periodAcc += timerRate - periodLong;
+    OCR1A = periodWhole - 1;
+  }
+
+#if DAC_RATE
+  // Interpolate between the last two source samples; this delays the output by one
+  // source sample, but means we never need to peek into the next buffer.
+  static sample_t s0 = 1 << (DAC_BITS - 1), s1 = 1 << (DAC_BITS - 1);
+  uint32_t phase = (uint32_t)resamplePhase + resampleStep;
+  resampleAcc += resampleRem;
+  if (resampleAcc >= DAC_RATE) {
+    resampleAcc -= DAC_RATE;
+    phase++;
+  }
+  while (phase >= 65536UL) {
+    phase -= 65536UL;
+    s0 = s1;
+    s1 = nextSample();
+  }
+  resamplePhase = phase;
+
+#if SAMPLE_BYTES == 2
+  // The product needs more than 16 bits here
+  dac.output(s0 + (((int32_t)s1 - s0) * (resamplePhase >> 4) >> 12));
+#else
+  dac.output(s0 + (((int16_t)s1 - s0) * (int16_t)(resamplePhase >> 9) >> 7));
+#endif
+#else
+  dac.output(nextSample());
+#endif
 }
@@ -0,0 +1,192 @@
+from __future__ import print_function, division
+import unittest, sys, os, re, shutil, tempfile, wave, importlib.util
+from fractions import Fraction
+
+# Host tests for the streamer, on the simulator: python -m unittest test_streamer
+# The sketch is built with a test playlist, plays an image made by build-image.py,
+# and the DAC's output (from the timeline) is checked sample by sample.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', 'Simulator'))
+import sketchsim
+
+spec = importlib.util.spec_from_file_location('build_image', os.path.join(HERE, '..', 'EEPROM-serial-data', 'build-image.py'))
+build_image = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(build_image)
+
+F_CPU = 16000000
+LOOP_FOREVER = 255
+
+def expected(clips, playlist, n):
+	# What the playlist should play, as a list of n samples: each entry plays its clip
+	# up to loopEnd, then loopStart..loopEnd "loops" times, then on to the end
+	out = []
+	while len(out) < n:
+		for (clip, loops, start, end) in playlist:
+			data = clips[clip]
+			end = end or len(data)
+			out += data[:end]
+			if loops == LOOP_FOREVER:
+				while len(out) < n:
+					out += data[start:end]
+			out += data[start:end] * loops + data[end:]
+	return out[:n]
+
+class Streamer(object):
+	# The sketch, built with the given playlist and #defines
+	def __init__(self, playlist, defines = {}):
+		# The copy is always in the same place, so the core is only compiled once
+		self.dir = tempfile.mkdtemp()
+		sketch = os.path.join(tempfile.gettempdir(), 'sketchsim', 'test_streamer', 'EEPROM_DAC_streamer')
+		if not os.path.isdir(sketch):
+			os.makedirs(sketch)
+		src = open(os.path.join(HERE, 'EEPROM_DAC_streamer.ino')).read()
+		entries = ',\n'.join('  {{ {0}, {1}, {2}, {3} }}'.format(*e) for e in playlist)
+		(src, n) = re.subn(r'(playlist_entry_t playlist\[\] = \{\n).*?(\n\};)', lambda m: m.group(1) + entries + m.group(2), src, flags = re.S)
+		assert n == 1
+		open(os.path.join(sketch, 'EEPROM_DAC_streamer.ino'), 'w').write(src)
+		self.exe = sketchsim.build(sketch, defines)
+
+	def play(self, files, seconds, dac = 'MCP4901'):
+		# Returns the timeline of a run with an image of files ((name, format, rate, data) tuples)
+		image = os.path.join(self.dir, 'image.bin')
+		timeline = os.path.join(self.dir, 'timeline.txt')
+		open(image, 'wb').write(build_image.build(files))
+		(rc, out, err) = sketchsim.run(self.exe, ['--dac', dac, '--i2c-eeprom', '24LC1025@0x50=' + image,
+			'--time', str(seconds), '--timeline', timeline, '--quiet'], timeout = 120)
+		if rc != 0:
+			raise AssertionError('the run failed ({0}): {1}{2}'.format(rc, out.decode('ascii', 'replace'), err))
+		return sketchsim.read_timeline(timeline, ('dac', 'isr'))
+
+	def close(self):
+		shutil.rmtree(self.dir)
+
+def dac_values(events):
+	return [int(f[1]) for (t, kind, f) in events if kind == 'dac']
+
+def timer_flags(events):
+	# When each Timer1 compare match happened: the ISR's start, less its latency
+	return [t - int(f[1]) for (t, kind, f) in events if kind == 'isr' and f[0] == 'TIMER1_COMPA']
+
+def pcm(values):
+	return bytes(bytearray(values))
+
+def pcm16(values):
+	return b''.join(bytes(bytearray((v & 0xff, v >> 8))) for v in values)
+
+class PlaylistTest(unittest.TestCase):
+	# Clip lengths and loop points that aren't multiples of BUFSIZE, so that every
+	# splice lands in the middle of a buffer
+	RATE = 8000
+	CLIPS = [list(range(0, 200)), [255 - i for i in range(0, 53)]]
+	PLAYLIST = [(0, 2, 10, 150), (1, 0, 0, 0), (1, 1, 20, 0)]
+
+	def setUp(self):
+		self.streamer = Streamer(self.PLAYLIST)
+
+	def tearDown(self):
+		self.streamer.close()
+
+	def test_splicing(self):
+		files = [('a', build_image.FORMAT_PCM, self.RATE, pcm(self.CLIPS[0])),
+			('b', build_image.FORMAT_PCM, self.RATE, pcm(self.CLIPS[1]))]
+		events = self.streamer.play(files, 0.3)
+		played = dac_values(events)
+		self.assertGreater(len(played), 0.28 * self.RATE)
+		# The playlist, several times over, with nothing missing, repeated or reordered
+		self.assertEqual(played, expected(self.CLIPS, self.PLAYLIST, len(played)))
+
+		# ... and without a gap: no sample is late, even where the reader crosses a splice
+		times = [t for (t, kind, f) in events if kind == 'dac']
+		period = F_CPU / self.RATE
+		gaps = [b - a for (a, b) in zip(times, times[1:])]
+		self.assertLess(max(gaps), period * 1.1)
+		self.assertGreater(min(gaps), period * 0.9)
+
+	def test_wav_and_pcm(self):
+		# A .wav clip and a raw one, spliced the same way
+		wav = os.path.join(self.streamer.dir, 'a.wav')
+		w = wave.open(wav, 'wb')
+		w.setnchannels(1)
+		w.setsampwidth(1)
+		w.setframerate(self.RATE)
+		w.writeframes(pcm(self.CLIPS[0]))
+		w.close()
+		files = [('a.wav', build_image.FORMAT_WAV, self.RATE, open(wav, 'rb').read()),
+			('b', build_image.FORMAT_PCM, self.RATE, pcm(self.CLIPS[1]))]
+		played = dac_values(self.streamer.play(files, 0.1))
+		self.assertEqual(played, expected(self.CLIPS, self.PLAYLIST, len(played)))
+
+class LoopForeverTest(unittest.TestCase):
+	def test_loop_forever(self):
+		# An intro, then a loop that never ends; the second clip is never reached
+		clips = [list(range(0, 150)), [200] * 10]
+		playlist = [(0, LOOP_FOREVER, 100, 130), (1, 0, 0, 0)]
+		streamer = Streamer(playlist)
+		try:
+			played = dac_values(streamer.play([('a', build_image.FORMAT_PCM, 8000, pcm(clips[0])),
+				('b', build_image.FORMAT_PCM, 8000, pcm(clips[1]))], 0.1))
+		finally:
+			streamer.close()
+		self.assertEqual(played, expected(clips, playlist, len(played)))
+		self.assertNotIn(200, played)
+
+class Pcm16Test(unittest.TestCase):
+	def test_pcm16(self):
+		# A 12-bit DAC, with two bytes per sample: splices must stay on whole samples
+		clips = [[(i * 37) % 4096 for i in range(0, 101)], [4095 - i for i in range(0, 77)]]
+		playlist = [(0, 1, 33, 90), (1, 0, 0, 0)]
+		streamer = Streamer(playlist, { 'DAC_MODEL': 'DAC_MCP49x1::MCP4921', 'DAC_BITS': '12' })
+		try:
+			played = dac_values(streamer.play([('a', build_image.FORMAT_PCM16, 4000, pcm16(clips[0])),
+				('b', build_image.FORMAT_PCM16, 4000, pcm16(clips[1]))], 0.2, dac = 'MCP4921'))
+		finally:
+			streamer.close()
+		self.assertGreater(len(played), 0.18 * 4000)
+		self.assertEqual(played, expected(clips, playlist, len(played)))
+
+class RateTest(unittest.TestCase):
+	def test_exact_rate(self):
+		# The sample period alternates between the two nearest whole numbers of cycles,
+		# and averages out to the exact rate: a fraction of a ppm over the run, where
+		# rounding the period once would be off by up to 600 ppm at these rates
+		streamer = Streamer([(0, LOOP_FOREVER, 0, 0)])
+		try:
+			for rate in (11025, 19999, 8000):
+				events = streamer.play([('a', build_image.FORMAT_PCM, rate, pcm(range(0, 256)))], 0.3)
+				flags = timer_flags(events)
+				periods = set(b - a for (a, b) in zip(flags, flags[1:]))
+				whole = F_CPU // rate
+				self.assertTrue(periods <= set((whole, whole + 1)), '{0} Hz: periods of {1}'.format(rate, sorted(periods)))
+				average = Fraction(flags[-1] - flags[0], len(flags) - 1)
+				ppm = abs(float(average * rate / F_CPU) - 1) * 1e6
+				self.assertLess(ppm, 0.5, '{0} Hz: {1:.2f} ppm off'.format(rate, ppm))
+		finally:
+			streamer.close()
+
+	def test_resampling(self):
+		# With DAC_RATE, the DAC runs at that rate, and each output is the linear
+		# interpolation between the two source samples before the (exact) source position.
+		# The whole run has to match, so the position can't drift either.
+		src = [(i * 3) % 256 for i in range(0, 1000)]
+		streamer = Streamer([(0, LOOP_FOREVER, 0, 0)], { 'DAC_RATE': '16000' })
+		try:
+			events = streamer.play([('a', build_image.FORMAT_PCM, 11025, pcm(src))], 0.3)
+		finally:
+			streamer.close()
+		flags = timer_flags(events)
+		self.assertEqual(set(b - a for (a, b) in zip(flags, flags[1:])), set((F_CPU // 16000,)))
+
+		def sample(i):
+			return src[i % len(src)] if i >= 0 else 128 # the sketch starts from the midpoint
+		played = dac_values(events)
+		self.assertGreater(len(played), 0.28 * 16000)
+		for (k, value) in enumerate(played):
+			position = Fraction(11025 * (k + 1), 16000)
+			n = position.numerator // position.denominator
+			(s0, s1) = (sample(n - 2), sample(n - 1))
+			ideal = s0 + (s1 - s0) * float(position - n)
+			self.assertLess(abs(value - ideal), 2, 'output {0}: {1}, not {2:.1f}'.format(k, value, ideal))
+
+if __name__ == '__main__':
+	unittest.main()
@@ -1,6 +1,6 @@
 /*
  * Temperature sampler for a greenhouse temperature monitor
- * Samples the temperature from 2 sensors, and sends it via Ethernet to a
+ * Samples the temperature from 1-wire (or analog) sensors, and sends it via Ethernet to a
  * Python server. The Python server saves it to an RRD database,
  * which is accessed by a PHP/jQuery website to produce graphs according to
  * user input.
@@ -9,21 +9,58 @@
  * * Custom PCB (also tested w/ Arduino Uno R3 + breadboard)
  * * Atmel Atmega328P-PU (DIP)
  * * WIZnet WIZ820io SPI Ethernet module
- * * 2x Maxim DS18S20 1-wire temperature sensors
+ * * Maxim DS18S20 1-wire temperature sensors (2 in use; up to MAX_SENSORS, which
+ *   may also be DS18B20s or analog sensors; see SensorDrivers.h)
  *
  * Thomas Backman, 2012
  * serenity@exscape.org
  * http://blog.exscape.org
  */
 
-///
-/// TODO: Improve stability; use warn() instead of panic(), so that operation can resume
-/// for transient events!
-///
-
 #include <SPI.h>
 #include <Ethernet.h>
 #include <OneWire.h>
+#include <EEPROM.h>
+#include "SensorDrivers.h"
+
+// How often to sample, in timer ticks (1/10 s). A conversion takes up to 750 ms,
+// so 8 ticks is the minimum.
+#define SAMPLE_INTERVAL 100
+
+// With AGGREGATE_SAMPLES > 0, readings aren't sent one by one. Instead, each sensor's
+// min/max/mean/variance over every AGGREGATE_SAMPLES (at most 255) samples is computed
+// on the fly, and only that summary is sent. E.g. SAMPLE_INTERVAL 10 with
+// AGGREGATE_SAMPLES 60 samples once a second, and sends one summary a minute.
+// Requires BINARY_PACKETS.
+#define AGGREGATE_SAMPLES 0
+
+// Send readings in the compact binary format; see sendBatch() for both formats
+#define BINARY_PACKETS
+
+// DS18B20 resolution (9 - 12 bits); lower resolutions convert faster
+#define DS18B20_RESOLUTION 12
+
+// Analog temperature sensors, if any, as { pin, type } pairs; see SensorDrivers.h
+// for the types. E.g.: #define ANALOG_CHANNELS { A2, ANALOG_TMP36 }, { A3, ANALOG_LM35 }
+// #define ANALOG_CHANNELS
+
+// Readings that can't be sent are kept in a backlog, and sent once the server answers
+// again. The backlog holds BACKLOG_SIZE readings in RAM: as many as fit in BACKLOG_RAM
+// bytes, i.e. 16 with MAX_SENSORS 8, or 4 summaries with AGGREGATE_SAMPLES. With
+// BACKLOG_EEPROM defined, older readings spill over to a 24XX1025 EEPROM (A0 = A1 = 0),
+// which holds SPILL_RECORDS of them (printed at startup). A reading has room for
+// MAX_SENSORS temperatures however many sensors there are, so with MAX_SENSORS 8 that's
+// 5450 readings (24 bytes each), i.e. 15 hours' worth at SAMPLE_INTERVAL 100; with
+// AGGREGATE_SAMPLES, 1486 summaries (88 bytes each).
+#define BACKLOG_RAM 384
+#define BACKLOG_SIZE (BACKLOG_RAM / sizeof(reading_t))
+// #define BACKLOG_EEPROM
+
+#ifdef BACKLOG_EEPROM
+#include <I2C16.h>
+#include <EEPROM_24XX1025.h>
+#include <util/crc16.h>
+#endif
 
 // Pin definitions
 #define WIZRST 8
@@ -37,37 +74,143 @@
 // and rapid changes are unexpected here.
 #define MAX_DELTA 4
 
-// The current UNIX timestamp. Updated from the server now and then,
-// and updated by the 1 Hz timer
+// The current UNIX timestamp. Set from the server (see clockTask()),
+// and incremented every second by the timer
 volatile uint32_t current_time = 0;
+// Since it starts out at 0, any big number means that it has been synced with the server
+#define TIME_VALID(t) ((t) > 1348512615UL)
+
+// A point in time with sub-second resolution; see getTime()
+typedef struct {
+  uint32_t sec; // UNIX timestamp
+  uint32_t usec; // 0 - 999999
+} timestamp_t;
 
-// Simple alternative to a true associative array
+// A sensor in the registry; see loadRegistry()
 typedef struct {
   byte addr[8];
-  boolean found;
-} device_list_t;
-
-// A list of the DS18S20 sensors used.
-// All addresses need to be listed here, so that we can be sure
-// that the sensors won't "change place" as with a dynamic detection.
-// "Sensor 1" must always remain the same sensor, etc.
-#define NUM_SENSORS 2
-device_list_t devices[NUM_SENSORS] =
+  SensorDriver *driver; // NULL if no driver handles it (any more)
+  boolean present; // found in the last bus scan
+  boolean seen; // found in the current bus scan
+} sensor_t;
+
+// A task in the cooperative task loop; see loop()
+typedef struct {
+  void (*run)(void);
+  uint32_t due; // tick count at which to run it next
+} task_t;
+
+// The sensor registry.
+// Each sensor is given a stable ID (its position in the registry) the first time it's found,
+// so that "sensor 1" always remains the same sensor, no matter which sensors are added,
+// removed or moved around later. The registry is kept in the internal EEPROM:
+//   REGISTRY_ADDR + 0: 'G', 'S'
+//                 + 2: number of sensors
+//                 + 3: the sensors' 8-byte addresses, by ID
+// When the EEPROM is blank, the registry starts out with knownSensors[], so that the
+// sensors we already had keep their IDs. To start over, define CLEAR_REGISTRY, upload,
+// and undefine it again.
+// RAM is what limits MAX_SENSORS. Each sensor costs 18 bytes (12 in sensors[], 2 in
+// sensorHash[], 4 for its last and current readings), plus 19 for its window with
+// AGGREGATE_SAMPLES; and every backlog entry has 2 bytes for it (10 with
+// AGGREGATE_SAMPLES), so more sensors mean fewer entries in BACKLOG_RAM. That puts the
+// ceiling at 32 sensors (16 with AGGREGATE_SAMPLES, where a backlog of 2 summaries
+// already takes BACKLOG_RAM); the registry and the packets themselves would take 255.
+#define MAX_SENSORS 8
+#define REGISTRY_ADDR 0
+// #define CLEAR_REGISTRY
+
+// The last known server IP is kept in the internal EEPROM too (after the registry), so
+// that after a reset, the server can be asked directly rather than searched for:
+//   SERVER_CACHE_ADDR + 0: 'S', 'V'
+//                     + 2: IP address
+#define SERVER_CACHE_ADDR (REGISTRY_ADDR + 3 + 8 * MAX_SENSORS)
+
+const byte knownSensors[][8] =
 {
-  //  { { 0x10, 0x3e, 0x3a, 0x2f, 0x02, 0x08, 0x00, 0xef }, false }, // Old sensor 0
-  //  { { 0x10, 0x05, 0x5d, 0x2f, 0x02, 0x08, 0x00, 0xba }, false }  // Old sensor 1
-  { { 0x10, 0x66, 0x5d, 0x8d, 0x02, 0x08, 0x00, 0x8e }, false }, // Sensor 0
-  { { 0x10, 0x88, 0xbd, 0x8d, 0x02, 0x08, 0x00, 0x6e }, false } // Sensor 1
+  //  { 0x10, 0x3e, 0x3a, 0x2f, 0x02, 0x08, 0x00, 0xef }, // Old sensor 0
+  //  { 0x10, 0x05, 0x5d, 0x2f, 0x02, 0x08, 0x00, 0xba }, // Old sensor 1
+  { 0x10, 0x66, 0x5d, 0x8d, 0x02, 0x08, 0x00, 0x8e }, // Sensor 0
+  { 0x10, 0x88, 0xbd, 0x8d, 0x02, 0x08, 0x00, 0x6e } // Sensor 1
 };
 
-// Store the last reading, to remove outliers.
+sensor_t sensors[MAX_SENSORS];
+uint8_t sensorCount = 0;
+
+// Hash table from address to ID, so that bus scans don't need to compare each address
+// to every registered one. Open addressing with linear probing; the entries are ID + 1,
+// with 0 meaning empty.
+// A power of two, at least 2 * MAX_SENSORS.
+#define SENSOR_HASH_SIZE (MAX_SENSORS <= 8 ? 16 : MAX_SENSORS <= 16 ? 32 : 64)
+uint8_t sensorHash[SENSOR_HASH_SIZE];
+
+#if MAX_SENSORS > 32 || (MAX_SENSORS > 16 && AGGREGATE_SAMPLES > 0)
+#error MAX_SENSORS is more than there is RAM for; see above
+#endif
+
+// Marks a missing value in readings (-128 C; the sensors go down to -55 C)
+#define NO_READING ((int16_t)0x8000)
+
+// A timestamped reading, as stored in the backlog
+// With AGGREGATE_SAMPLES, this is instead the summary of a window of samples.
+typedef struct {
+  uint32_t seq;
+  uint32_t time; // UNIX timestamp (of the first sample), or 0 if the clock wasn't set yet
+  int16_t temp[MAX_SENSORS]; // degrees C, Q8.8 fixed point (i.e. 1/256 C); the mean, if aggregated
+#if AGGREGATE_SAMPLES > 0
+  int16_t min[MAX_SENSORS];
+  int16_t max[MAX_SENSORS];
+  uint32_t variance[MAX_SENSORS]; // in (1/256 C)^2
+#endif
+} reading_t;
+
+// The state of the backlog's EEPROM ring, as stored in the EEPROM; see spillSave()
+typedef struct {
+  uint32_t gen;
+  uint32_t head, count; // in records
+  uint16_t recordSize; // sizeof(reading_t), which depends on MAX_SENSORS and AGGREGATE_SAMPLES
+  uint16_t crc; // CRC-CCITT of the above
+} spill_state_t;
+
+// Running statistics for one sensor over one aggregation window.
+// The sums are of the differences from the window's first sample ("shifted data"), which
+// keeps them small enough for exact integer math, and avoids the cancellation that makes
+// the plain sum-of-squares formula useless for data with a large offset. sumSq is 64 bits
+// since the first sample may be far off the rest (an 85 C power-on value accepted on
+// retry, say), or the temperature may really swing that much within a window.
+typedef struct {
+  int16_t shift;
+  int16_t min, max;
+  int32_t sum;
+  uint64_t sumSq;
+  uint8_t n; // number of samples
+} window_t;
+
+// Store the last reading (Q8.8), to remove outliers.
 // The sensors sometimes return 85 C (their default value). Since this *may* be valid
 // (though that is insanely unlikely for *this* project), we compare it to the previous reading.
-float last_reading[NUM_SENSORS];
+int16_t last_reading[MAX_SENSORS];
 uint32_t missed_answers = 0; // number of answers without a response, in a row
 
 OneWire ds(ONEWIRE_PIN);
 
+// The sensor drivers; a sensor is used if one of these handles it
+DS18S20 ds18s20(ds);
+DS18B20 ds18b20(ds, DS18B20_RESOLUTION);
+#ifdef ANALOG_CHANNELS
+const analog_channel_t analogChannels[] = { ANALOG_CHANNELS };
+AnalogSensors analogSensors(analogChannels, sizeof(analogChannels) / sizeof(analogChannels[0]));
+#endif
+
+SensorDriver *drivers[] = {
+  &ds18s20,
+  &ds18b20,
+#ifdef ANALOG_CHANNELS
+  &analogSensors,
+#endif
+};
+#define NUM_DRIVERS (sizeof(drivers) / sizeof(drivers[0]))
+
 // Used to give each data packet (and response packet) a unique ID.
 // Won't wrap: 2^32 times 10 seconds per packet = ~1361 years!
 // ... and that would also require 100% consecutive uptime!
@@ -97,38 +240,6 @@ void setNetLED(boolean on) {
   digitalWrite(NET_LED, on ? LOW : HIGH);
 }
 
-void blinkStatusOnce(unsigned short ms_lit) {
-  setStatusLED(true);
-  delay(ms_lit);
-  setStatusLED(false);
-}
-
-void blinkNetOnce(unsigned short ms_lit) {
-  setNetLED(true);
-  delay(ms_lit);
-  setNetLED(false);
-}
-
-void sendPing(void) {
-  // Sends a "PING" UDP packet and hopes to receive a "PONG". Simple connectivity test,
-  // nothing more.
-  udp.begin(localport);
-  udpSendPacket("PING");
-  char buf[4] = {0};
-  int ret = udpRecvPacket(buf, 4, 2000);
-  udp.flush();
-  udp.stop();
-
-  if (ret > 0 && strncmp(buf, "PONG", 4) == 0) {
-    setNetLED(true);
-    Serial.println("PONG received!");
-  }
-  else {
-    setNetLED(false);
-    Serial.println("WARNING: PONG not received!");
-  }
-}
-
 void panic(const char *str) {
   // Attempt to tell the server, which then sends an email
   const int BUFSIZE = 96;
@@ -179,154 +290,250 @@ void addr_to_str(const byte *addr, char *addr_str) {
   addr[7]);
 }
 
-// Searches for the temperature sensors, and makes sure
-// that they are all found
-void findTemperatureSensors(void) {
-  int tries = 0;
-restart:
-
-  // Reset the bus, so that we "start over" at the first device
-  ds.reset_search();
-
-  // All 1-wire comms start with a bus reset
-  ds.reset();
-
-  byte addr[8]; // addresses are 64 bits each
-  while (ds.search(addr)) {
-    if (OneWire::crc8(addr, 7) != addr[7]) {
-      tries++;
-      if (tries > 5) {
-        panic("Device address CRC error, multiple times! Halting!");
-      }
-      goto restart; // Yay. Still, adding a second loop to "make it acceptable" (no goto)
-      // is not really better, is it?
-    }
+SensorDriver *findDriver(const byte *addr) {
+  for (uint8_t i=0; i < NUM_DRIVERS; i++) {
+    if (drivers[i]->handles(addr))
+      return drivers[i];
+  }
+  return NULL;
+}
 
-    Serial.print("found sensor: ");
-    char buf[40] = {0};
-    addr_to_str(addr, buf);
-    Serial.println(buf);
+uint8_t hashAddr(const byte *addr) {
+  // The last byte is a CRC of the rest, and thus already well mixed
+  return (addr[7] ^ addr[1]) & (SENSOR_HASH_SIZE - 1);
+}
 
-    for (int i=0; i < NUM_SENSORS; i++) {
-      if (memcmp(devices[i].addr, addr, 8) == 0) {
-        // Found one of the sensors
-        devices[i].found = true;
-      }
-    }
+// Returns the ID of the sensor with this address, or -1 if it isn't registered
+int findSensor(const byte *addr) {
+  for (uint8_t h = hashAddr(addr); sensorHash[h] != 0; h = (h + 1) & (SENSOR_HASH_SIZE - 1)) {
+    if (memcmp(sensors[sensorHash[h] - 1].addr, addr, 8) == 0)
+      return sensorHash[h] - 1;
   }
+  return -1;
+}
 
-  // Did we find them all?
-  for (int i=0; i < NUM_SENSORS; i++) {
-    if (devices[i].found == false) {
-      char buf[64] = {0};
-      char *s = "Could not find sensor with address ";
-      strcpy(buf, s);
-      addr_to_str(devices[i].addr, buf + strlen(s));
-      panic(buf);
-    }
+void hashSensor(uint8_t id) {
+  uint8_t h = hashAddr(sensors[id].addr);
+  while (sensorHash[h] != 0) {
+    h = (h + 1) & (SENSOR_HASH_SIZE - 1);
   }
+  sensorHash[h] = id + 1;
 }
 
-float readTemperature(int dev) {
-  if (dev >= NUM_SENSORS) {
-    panic("Invalid device number given to readTemperature()!");
+// Adds a sensor to the registry, and saves it to the EEPROM.
+// Returns its ID, or -1 if the registry is full.
+int registerSensor(const byte *addr) {
+  if (sensorCount == MAX_SENSORS)
+    return -1;
+
+  uint8_t id = sensorCount;
+  memcpy(sensors[id].addr, addr, 8);
+  sensors[id].driver = findDriver(addr);
+  sensors[id].present = false;
+  sensors[id].seen = false;
+  for (int i=0; i < 8; i++) {
+    EEPROM.write(REGISTRY_ADDR + 3 + 8 * id + i, addr[i]);
   }
+  // The count is written last, so a reset halfway through can't leave a half-written entry
+  sensorCount++;
+  EEPROM.write(REGISTRY_ADDR + 2, sensorCount);
+  hashSensor(id);
 
-  int crc_tries = 0;
-  bool have_retried_reading = false;
-restart_temp:
-
-  ds.reset();
-  ds.select(devices[dev].addr);
-  ds.write(0x44); // CONVERT T command = 44h
+  return id;
+}
 
-  // Devices sends all 0 bits while converting (not on parasitic power!)
-  while (ds.read() == 0) {
-    delayMicroseconds(50);
+void loadRegistry(void) {
+#ifdef CLEAR_REGISTRY
+  EEPROM.write(REGISTRY_ADDR, 0xff);
+#endif
+
+  memset(sensorHash, 0, sizeof(sensorHash));
+  sensorCount = 0;
+
+  if (EEPROM.read(REGISTRY_ADDR) != 'G' || EEPROM.read(REGISTRY_ADDR + 1) != 'S') {
+    Serial.println("No sensor registry found; creating one");
+    EEPROM.write(REGISTRY_ADDR + 2, 0);
+    EEPROM.write(REGISTRY_ADDR, 'G');
+    EEPROM.write(REGISTRY_ADDR + 1, 'S');
+    for (uint8_t i=0; i < sizeof(knownSensors) / 8; i++) {
+      registerSensor(knownSensors[i]);
+    }
   }
-  delay(5);
-
-  ds.reset();
-  ds.select(devices[dev].addr);
-  ds.write(0xBE); // READ SCRATCHPAD command = BEh
-
-  // Read back the data
-  byte data[8] = {0};
-  byte crc;
+  else {
+    uint8_t count = EEPROM.read(REGISTRY_ADDR + 2);
+    if (count > MAX_SENSORS) {
+      Serial.print("WARNING: registry has more sensors than MAX_SENSORS; ignoring all but the first ");
+      Serial.println(MAX_SENSORS);
+      count = MAX_SENSORS;
+    }
 
-  for (int i=0; i<8; i++) {
-    data[i] = ds.read();
+    for (uint8_t id=0; id < count; id++) {
+      for (int i=0; i < 8; i++) {
+        sensors[id].addr[i] = EEPROM.read(REGISTRY_ADDR + 3 + 8 * id + i);
+      }
+      sensors[id].driver = findDriver(sensors[id].addr);
+      sensors[id].present = false;
+      sensors[id].seen = false;
+      hashSensor(id);
+    }
+    sensorCount = count;
   }
-  crc = ds.read();
 
-  // Check for all ones (eight 0xff bytes)
-  char count = 0;
-  for (int i=0; i < 8; i++) {
-    if (data[i] == 0xff)
-      count++;
-    else break;
-  }
-  if (count == 8) {
-    panic("All ones received - a sensor is most likely disconnected!");
+#ifdef ANALOG_CHANNELS
+  // Analog channels can't be found by scanning, so register them here
+  for (uint8_t i=0; i < analogSensors.count(); i++) {
+    byte addr[8];
+    analogSensors.address(i, addr);
+    if (findSensor(addr) < 0 && registerSensor(addr) < 0)
+      Serial.println("WARNING: sensor registry full; ignoring analog channel");
   }
+#endif
+
+  Serial.print(sensorCount);
+  Serial.println(" sensors registered");
+}
 
-  if (OneWire::crc8(data, 8) != crc) {
-    crc_tries++;
-    if (crc_tries > 5) {
-      panic("Invalid data CRC, multiple times!");
+// Does one step of a bus scan, i.e. finds one device, which takes about 15 ms; the scan
+// is split up like this so that other tasks get to run in between.
+// Returns true when the scan is complete. New sensors are registered, and sensors that
+// have appeared or disappeared since the last scan are reported.
+bool scanStep(void) {
+  static bool scanning = false;
+
+  if (!scanning) {
+    // Reset the bus, so that we "start over" at the first device
+    ds.reset_search();
+    for (uint8_t id=0; id < sensorCount; id++) {
+      sensors[id].seen = (sensors[id].driver != NULL && sensors[id].driver->alwaysPresent());
     }
-    goto restart_temp;
+    scanning = true;
   }
 
-  float temp; // The actual temperature
+  byte addr[8]; // addresses are 64 bits each
+  if (ds.search(addr)) {
+    if (OneWire::crc8(addr, 7) != addr[7]) {
+      // The rest of this scan can't be trusted either; leave everything as it was,
+      // and try again next time
+      Serial.println("WARNING: device address CRC error; scan aborted");
+      scanning = false;
+      for (uint8_t id=0; id < sensorCount; id++) {
+        sensors[id].seen = sensors[id].present;
+      }
+      return true;
+    }
 
-  // Prettier names without extra RAM use. Ugly, yes, but this *is* embedded after all
-#define LSB (data[0])
-#define MSB (data[1])
-#define count_remain (data[6])
-#define count_per_c (data[7])
+    if (findDriver(addr) == NULL) // Not a sensor we know how to use
+      return false;
+
+    int id = findSensor(addr);
+    if (id < 0) {
+      char buf[24] = {0};
+      addr_to_str(addr, buf);
+      id = registerSensor(addr);
+      if (id < 0) {
+        Serial.print("WARNING: sensor registry full; ignoring sensor ");
+        Serial.println(buf);
+        return false;
+      }
+      Serial.print("New sensor ");
+      Serial.print(buf);
+      Serial.print(" registered as sensor ");
+      Serial.println(id);
+    }
+    sensors[id].seen = true;
+    return false;
+  }
 
-  // Is the temperature negative?
-  boolean below_zero = (MSB == 0xff) ? true : false;
+  // Scan complete
+  scanning = false;
+  for (uint8_t id=0; id < sensorCount; id++) {
+    if (sensors[id].seen != sensors[id].present) {
+      Serial.print("Sensor ");
+      Serial.print(id);
+      Serial.println(sensors[id].seen ? " appeared" : " disappeared");
+      sensors[id].present = sensors[id].seen;
+    }
+  }
+  return true;
+}
 
-  if (below_zero) {
-    // Temperature is below 0! Use the simpler, less precise formula:
-    temp = -1 * ((0xff - LSB + 1)/2.0f);
+// Reads the result of the last conversion from a sensor into *temp (Q8.8); the sensor's
+// driver must have been started, and be done, first.
+// If the value looks like an outlier, and accept_outlier is false, READ_RETRY is returned,
+// and the caller should convert again (and then accept whatever it gets).
+uint8_t readTemperature(int dev, bool accept_outlier, int16_t *temp) {
+  if (dev >= sensorCount || sensors[dev].driver == NULL) {
+    panic("Invalid device number given to readTemperature()!");
   }
-  else {
-    // Temperature is positive; use the full-resolution (1/16 C) formula,
-    // mostly to get "less digital-looking" graphs, even though the added
-    // resolution doesn't mean added *accuracy*.
-    temp = (LSB >> 1) - 0.25 + (count_per_c - count_remain)/((float)count_per_c);
 
-    // NEW: shift away one LSB, since that bit is only noise anyway - the graph often jumps
-    // between two values, back and forth, for hours.
-    // temp = (LSB >> 1) - 0.25 + ((count_per_c - count_remain) >> 1)/((float)(count_per_c >> 1));
+  uint8_t ret = sensors[dev].driver->read(sensors[dev].addr, temp);
+  if (ret != READ_OK) {
+    Serial.print("WARNING: no valid data from sensor ");
+    Serial.print(dev);
+    Serial.println(" - it's most likely disconnected!");
+    return ret;
   }
 
   // Remove extreme outliers. Since we sample very often, big changes between two readings
   // are very unlikely.
-  if ((data[0] == 0xAA || fabs(last_reading[dev] - temp) >= MAX_DELTA) && have_retried_reading == false) {
-    // 0xAA (85 C) is the sensor's default value (before taking readings), and is suspect,
+  if ((*temp == 85 * 256 || abs(last_reading[dev] - *temp) >= MAX_DELTA * 256) && !accept_outlier) {
+    // 85 C is the DS18x20s' default value (before taking readings), and is suspect,
     // since it's higher than we'd expect for this sensor. Retry if that value is read.
     // Also retry if the difference between the last reading and this reading is too big.
     // (This will always retry the first time after boot; doesn't really matter.)
     Serial.print("WARNING: retrying reading for sensor ");
     Serial.print(dev);
     Serial.print("; reading differs too much from previous reading (delta C: ");
-    Serial.print(fabs(last_reading[dev] - temp));
+    Serial.print(abs(last_reading[dev] - *temp) / 256.0);
     Serial.println(").");
-    have_retried_reading = true;
-    goto restart_temp;
+    return READ_RETRY;
   }
 
-  last_reading[dev] = temp;
+  last_reading[dev] = *temp;
 
-  return temp;
+  return READ_OK;
 }
 
 bool dhcpInProgress = false;
 bool serverContacted = false;
+bool serverKnown = false; // false until a PONG has told us the server's IP
+bool netUp = false; // did the last reading get an answer?
+bool clockSynced = false; // set by the time exchange (see clockTask()), not by data ACKs
+
+// Timer1 ticks at TICKS_PER_SECOND, and all tasks are scheduled in ticks
+#define TICKS_PER_SECOND 10
+#define SECONDS(s) ((uint32_t)(s) * TICKS_PER_SECOND)
+
+// Allowed on top of the slowest driver's conversion time before giving up
+#define CONVERSION_MARGIN (TICKS_PER_SECOND / 4)
+#define ACK_TIMEOUT SECONDS(2)
+#define DISCOVERY_MIN SECONDS(2) // first retry; doubled after each failure
+#define DISCOVERY_MAX SECONDS(120)
+#define MAX_MISSED_ANSWERS 6 // in a row, before looking for the server again
+#define WIZNET_RESET_AFTER 8 // failed discovery attempts (about 6 minutes)
+#define DHCP_INTERVAL SECONDS(60)
+#define TICK_COUNTS (F_CPU / 256 / TICKS_PER_SECOND) // Timer1 counts per tick, 6250 (16 µs each)
+#define LED_FLASH 2 // ticks, i.e. 200 ms
+
+#if SAMPLE_INTERVAL < 8
+#error SAMPLE_INTERVAL is shorter than the conversion time of the sensors
+#endif
+#if AGGREGATE_SAMPLES > 255
+#error AGGREGATE_SAMPLES must be at most 255
+#endif
+#if AGGREGATE_SAMPLES > 0 && !defined(BINARY_PACKETS)
+#error AGGREGATE_SAMPLES requires BINARY_PACKETS
+#endif
+
+volatile uint32_t ticks = 0; // Incremented by the timer; read with getTicks()
+volatile uint8_t subsecond = 0; // Ticks since current_time was last incremented
+
+// Clock discipline, applied by the timer; see clockUpdate().
+// Each tick is stretched by tickAdjust (+ slewAdjust, for the next slewTicks ticks) timer
+// counts, in 1/65536 counts.
+volatile int32_t tickAdjust = 0;
+volatile int32_t slewAdjust = 0;
+volatile uint32_t slewTicks = 0;
 
 void setup() {
   Serial.begin(9600);
@@ -340,23 +547,34 @@ void setup() {
   // Enable internal pullups for all unused pins
   // 3 through A5 (i.e. the right-hand side) are the addon pins
   unsigned char unused_pins[] = { 4, 5, 6, 7, 3, A2, A3, A4, A5 };
-  for (int i=0; i < sizeof(unused_pins); i++) {
-    pinMode(i, INPUT);
-    digitalWrite(i, HIGH);
+  for (uint8_t i=0; i < sizeof(unused_pins); i++) {
+#ifdef ANALOG_CHANNELS
+    // ... except analog sensor inputs, which the pullup would throw off
+    bool analog = false;
+    for (uint8_t j=0; j < analogSensors.count(); j++) {
+      analog |= (analogChannels[j].pin == unused_pins[i]);
+    }
+    if (analog)
+      continue;
+#endif
+    pinMode(unused_pins[i], INPUT);
+    digitalWrite(unused_pins[i], HIGH);
   }
 
   dhcpInProgress = true; // Start blinking the net LED, in the timer
 
-  // Set up Timer1 for 1 Hz operation
+  // Set up Timer1 for 10 Hz operation
   cli();
   TCCR1A = 0;
   TCCR1B = 0;
-  OCR1A = 15624; // 16 MHz / 1024 / 15625 [sic] = exactly 1 Hz
+  OCR1A = TICK_COUNTS - 1; // 16 MHz / 256 / 6250 [sic] = exactly 10 Hz
   TCCR1B |= (1 << WGM12);
-  TCCR1B |= (1 << CS10) | (1 << CS12); // 1024 prescaler
+  TCCR1B |= (1 << CS12); // 256 prescaler
   TIMSK1 |= (1 << OCIE1A);
   sei();
 
+  // Nothing else can happen without an IP address, so this is the one place
+  // where we still block.
   Serial.println("Retrieving IP address...");
   while (Ethernet.begin(mac) != 1) {
     Serial.println("DHCP failed, retrying...");
@@ -368,44 +586,121 @@ void setup() {
   Serial.print("Got an IP address: ");
   serialPrintIP(Ethernet.localIP());
 
-  findTemperatureSensors();
+  loadRegistry(); // The sensors themselves are found by the sensor task
+  loadServerCache();
+#ifdef BACKLOG_EEPROM
+  spillBegin();
+#endif
+  randomSeed(micros()); // Varies with how long DHCP took; used for the discovery jitter
 
-  //serverip = IPAddress(192,168,99,250);
-  updateServerIP(); // Broadcasts a PING message, to which the server replies
+  // The socket stays open from here on; all tasks share it.
+  udp.begin(localport);
+
+  //serverip = IPAddress(192,168,99,250); serverKnown = true;
+  // The discovery task will find the server (see serverFound()) as soon as loop() starts.
 }
 
-volatile boolean time_to_work = false;
-// ISR is called every second; exactly once every 10 seconds
-// isn't possible (at 16 MHz clock) without custom code:
 ISR(TIMER1_COMPA_vect) {
+  ticks++;
+
+  // Make the next tick longer or shorter by whole timer counts, keeping the fraction
+  // for later ticks, so that ticks are as long as the clock discipline says on average.
+  // TCNT1 has only just been reset, so the new OCR1A takes effect for this very tick.
+  static int32_t phase = 0;
+  int32_t adjust = tickAdjust;
+  if (slewTicks > 0) {
+    adjust += slewAdjust;
+    slewTicks--;
+  }
+  phase += adjust;
+  int16_t counts = phase >> 16;
+  phase -= (int32_t)counts << 16;
+  OCR1A = TICK_COUNTS - 1 + counts;
+
+  if (++subsecond < TICKS_PER_SECOND)
+    return;
 
-  // Blink LEDs while starting up.
-  // Both LEDs are off to begin with.
-  // Net blinks until DHCP is finished, after which it is constantly lit.
-  // Status then blinks until contact with the server has been acquired,
-  // after which it is is off, but blinks quickly once each time a reading is sent.
-  static bool lastnet = false, laststatus = false;
+  subsecond = 0;
+  current_time++;
+
+  // Blink the Net LED until DHCP is finished. loop() isn't running yet at that point,
+  // so this can't be left to the LED task.
+  static bool lastnet = false;
   if (dhcpInProgress) {
-     // Blink the Net LED until DHCP is finished
      setNetLED(!lastnet);
      lastnet = !lastnet;
   }
-  else if (!serverContacted) {
-    // Blink the status LED until the server has been contacted, after
-    // DHCP has finished
-    setStatusLED(!laststatus);
-    laststatus = !laststatus;
+}
+
+uint32_t getTicks(void) {
+  // 32-bit reads aren't atomic on AVR
+  uint8_t oldSREG = SREG;
+  cli();
+  uint32_t t = ticks;
+  SREG = oldSREG;
+  return t;
+}
+
+// Reads the clock, to the timer's resolution of 16 µs
+void getTime(timestamp_t *t) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint32_t sec = current_time;
+  uint8_t sub = subsecond;
+  uint16_t count = TCNT1;
+  // If the timer has just matched, the ISR is pending; TCNT1 has then already wrapped,
+  // but subsecond and current_time haven't been updated yet
+  if ((TIFR1 & (1 << OCF1A)) && count < TICK_COUNTS / 2) {
+    if (++sub == TICKS_PER_SECOND) {
+      sub = 0;
+      sec++;
+    }
   }
+  SREG = oldSREG;
 
-  static byte count = 0;
-  count++;
-  current_time++;
-  if (count >= 10) {
-    count = 0;
+  t->sec = sec;
+  t->usec = (uint32_t)sub * (1000000 / TICKS_PER_SECOND) + (uint32_t)count * 16;
+  if (t->usec > 999999)
+    t->usec = 999999; // A stretched tick can run slightly over
+}
+
+// Sets the clock; the tick count isn't affected, so nothing is rescheduled
+void setClock(const timestamp_t *t) {
+  uint8_t oldSREG = SREG;
+  cli();
+  current_time = t->sec;
+  subsecond = t->usec / (1000000 / TICKS_PER_SECOND);
+  TCNT1 = min((t->usec % (1000000 / TICKS_PER_SECOND)) / 16, OCR1A - 1u);
+  TIFR1 = (1 << OCF1A); // A pending match belongs to the old time
+  SREG = oldSREG;
+}
 
-    // Wake the task loop!
-    time_to_work = true;
+void timeAdd(timestamp_t *t, int32_t us) {
+  int32_t usec = (int32_t)t->usec + us % 1000000;
+  t->sec += us / 1000000;
+  if (usec < 0) {
+    usec += 1000000;
+    t->sec--;
   }
+  else if (usec >= 1000000) {
+    usec -= 1000000;
+    t->sec++;
+  }
+  t->usec = usec;
+}
+
+// Calculates a - b in µs. Returns false if they're too far apart (over ~30 minutes).
+bool timeDiff(const timestamp_t *a, const timestamp_t *b, int32_t *us) {
+  int32_t sec = a->sec - b->sec;
+  if (sec > 2000 || sec < -2000)
+    return false;
+  *us = sec * 1000000L + ((int32_t)a->usec - (int32_t)b->usec);
+  return true;
+}
+
+// True if the tick count "when" has been reached; works across wraparound
+bool reached(uint32_t now, uint32_t when) {
+  return (int32_t)(now - when) >= 0;
 }
 
 void udpSendPacket(const char *str, IPAddress addr) {
@@ -424,6 +719,7 @@ int udpRecvPacket(char *buf, uint16_t maxsize, uint16_t timeout) {
   // timeout: timeout in milliseconds
   // Return value: negative for errors, 0 for timeout, otherwise number of bytes
   // received.
+  // Blocks; only used outside of the task loop (by panic()).
 
   int packetSize = 0;
   uint32_t start = millis();
@@ -444,146 +740,1010 @@ int udpRecvPacket(char *buf, uint16_t maxsize, uint16_t timeout) {
   return udp.read(buf, maxsize);
 }
 
-IPAddress bcast;
+///
+/// The task loop.
+/// loop() never blocks; instead, it runs a set of cooperative tasks, each of which does
+/// a small piece of work and returns. A task says when it next wants to run by calling
+/// sleepTicks(); if it doesn't, it's run again on the next pass (used for polling).
+/// Tasks that wait for something (a conversion, an answer) are simple state machines.
+///
 
-IPAddress calculateBroadcast(void) {
-  IPAddress subnetMask = Ethernet.subnetMask(); // E.g. 255.255.255.0
-  IPAddress subnetIP = Ethernet.localIP();      // E.g. 192.168.99.0
-  IPAddress _bcast;                             // E.g. 192.168.99.255
+task_t *currentTask = NULL;
 
-  for (int i=0; i < 4; i++) {
-    subnetIP[i] &= subnetMask[i];
+void sleepTicks(uint32_t n) {
+  currentTask->due = getTicks() + n;
+}
+
+void sleepUntil(uint32_t when) {
+  currentTask->due = when;
+}
+
+int16_t readings[MAX_SENSORS]; // Q8.8, or NO_READING
+
+///
+/// The backlog: a FIFO of readings not yet acknowledged by the server.
+/// The oldest readings are in the EEPROM (if any), the newest in RAM; when the RAM ring
+/// is full, its oldest reading is moved to the end of the EEPROM ring, which keeps the order.
+/// When everything is full, the oldest reading is dropped.
+/// The EEPROM ring survives a reset (see spillLoad()); the readings still in RAM don't.
+///
+
+reading_t backlog[BACKLOG_SIZE];
+typedef char backlogSizeCheck[(BACKLOG_SIZE >= 2) ? 1 : -1]; // BACKLOG_RAM is too small
+uint8_t backlogHead = 0, backlogCount = 0;
+uint32_t backlogDropped = 0;
+
+#ifdef BACKLOG_EEPROM
+EEPROM_24XX1025 eeprom (0, 0);
+
+// The EEPROM ring's head and count are kept at the start of the EEPROM; see spillSave()
+#define SPILL_SLOTS 16
+#define SPILL_BASE (SPILL_SLOTS * sizeof(spill_state_t)) // where the records start
+#define SPILL_RECORDS ((131072UL - SPILL_BASE) / sizeof(reading_t))
+#define SPILL_ADDR(n) (SPILL_BASE + (n) * sizeof(reading_t))
+uint32_t spillHead = 0, spillCount = 0; // in records
+uint32_t spillGen = 0; // of the last state written
+bool spillDirty = false; // readings have been popped since the state was last written
+
+uint16_t spillCRC(const spill_state_t *s) {
+  uint16_t crc = 0xffff;
+  for (uint8_t i=0; i < sizeof(*s) - sizeof(s->crc); i++) { // the CRC is last
+    crc = _crc_ccitt_update(crc, ((const uint8_t *)s)[i]);
   }
+  return crc;
+}
 
-  for (int i=0; i < 4; i++) {
-    _bcast[i] = subnetIP[i] | (~subnetMask[i]);
+// Each change is written to the next of SPILL_SLOTS slots in turn, to spread the wear, with
+// a generation number and a CRC; the valid slot with the highest generation is the current one. A record is always written before
+// the state that includes it, so a reset halfway through an append loses only that record.
+void spillSave(void) {
+  spill_state_t s = { ++spillGen, spillHead, spillCount, sizeof(reading_t), 0 };
+  s.crc = spillCRC(&s);
+  eeprom.write((spillGen % SPILL_SLOTS) * sizeof(spill_state_t), &s, sizeof(s));
+  spillDirty = false;
+}
+
+// Finds the EEPROM ring left by the last run, if any. Sequence numbers continue from its
+// newest reading, since a batch is numbered from its first reading onwards.
+void spillLoad(void) {
+  spill_state_t current;
+  bool found = false;
+  for (uint8_t i=0; i < SPILL_SLOTS; i++) {
+    spill_state_t s;
+    if (eeprom.read(i * sizeof(spill_state_t), &s, sizeof(s)) != sizeof(s) || s.crc != spillCRC(&s))
+      continue; // Blank, or torn by a reset
+    if (!found || (int32_t)(s.gen - current.gen) > 0)
+      current = s;
+    found = true;
+  }
+
+  spillHead = spillCount = 0;
+  if (!found)
+    return;
+  spillGen = current.gen; // Even if the state can't be used, newer ones must win over it
+  if (current.recordSize != sizeof(reading_t) || current.head >= SPILL_RECORDS || current.count > SPILL_RECORDS) {
+    Serial.println("WARNING: EEPROM backlog is from a different configuration; discarding it");
+    return;
   }
+  spillHead = current.head;
+  spillCount = current.count;
 
-  return _bcast;
+  if (spillCount > 0) {
+    reading_t r;
+    eeprom.read(SPILL_ADDR((spillHead + spillCount - 1) % SPILL_RECORDS), &r, sizeof(r));
+    seq = r.seq + 1;
+  }
+  Serial.print(spillCount);
+  Serial.println(" readings recovered from the EEPROM backlog");
 }
 
-void updateServerIP(void) {
-  while (true) {
-    Serial.println("Updating server IP...");
-    bcast = IPAddress(255,255,255,255);
-    udp.begin(localport);
-    udpSendPacket("PING", bcast);
-    char tmp[32] = {0};
-    Serial.println("Waiting for answer from server...");
-    if (udpRecvPacket(tmp, 31, 2000) > 0) {
-      if (strncmp(tmp, "PONG", 4) == 0) {
-        IPAddress rem = udp.remoteIP();
-        Serial.print("Answer received. Server IP is: ");
-        serialPrintIP(rem);
-        serverip = rem;
-        serverContacted = true;
+void spillBegin(void) {
+  spillLoad();
+  Serial.print("The EEPROM backlog has room for ");
+  Serial.print(SPILL_RECORDS);
+  Serial.println(" readings");
+}
+#endif
+
+uint32_t backlogSize(void) {
+#ifdef BACKLOG_EEPROM
+  return spillCount + backlogCount;
+#else
+  return backlogCount;
+#endif
+}
 
-        return;
-      }
-      else {
-        Serial.println("PING failed, invalid response (not PONG)! Retrying in 10 seconds...");
-      }
+void backlogPush(const reading_t *r) {
+  if (backlogCount == BACKLOG_SIZE) {
+#ifdef BACKLOG_EEPROM
+    if (spillCount == SPILL_RECORDS) {
+      spillHead = (spillHead + 1) % SPILL_RECORDS;
+      spillCount--;
+      backlogDropped++;
     }
-    else
-      Serial.println("No response received, retrying in 10 seconds...");
+    eeprom.write(SPILL_ADDR((spillHead + spillCount) % SPILL_RECORDS), &backlog[backlogHead], sizeof(reading_t));
+    spillCount++;
+    spillSave();
+#else
+    backlogDropped++;
+#endif
+    backlogHead = (backlogHead + 1) % BACKLOG_SIZE;
+    backlogCount--;
+  }
+
+  backlog[(backlogHead + backlogCount) % BACKLOG_SIZE] = *r;
+  backlogCount++;
+}
 
-      delay(10000);
+// Copies the n-th oldest reading to *r
+void backlogPeek(uint32_t n, reading_t *r) {
+#ifdef BACKLOG_EEPROM
+  if (n < spillCount) {
+    eeprom.read(SPILL_ADDR((spillHead + n) % SPILL_RECORDS), r, sizeof(reading_t));
+    return;
   }
+  n -= spillCount;
+#endif
+  *r = backlog[(backlogHead + n) % BACKLOG_SIZE];
 }
 
-void loop() {
-  while (time_to_work == false) {
-    // Flag is cleared by ISR
+// Call backlogSync() after popping, to make it stick
+void backlogPop(void) {
+#ifdef BACKLOG_EEPROM
+  if (spillCount > 0) {
+    spillHead = (spillHead + 1) % SPILL_RECORDS;
+    spillCount--;
+    spillDirty = true;
+    return;
   }
+#endif
+  if (backlogCount > 0) {
+    backlogHead = (backlogHead + 1) % BACKLOG_SIZE;
+    backlogCount--;
+  }
+}
 
-  Ethernet.maintain();
+// Saves the EEPROM ring's state after readings have been popped; once per batch is
+// enough, since a reset in between only means that a few readings are sent twice
+void backlogSync(void) {
+#ifdef BACKLOG_EEPROM
+  if (spillDirty)
+    spillSave();
+#endif
+}
 
-  Serial.println("Starting temperature sampling...");
+// LED flashes end at these tick counts; see ledTask()
+uint32_t statusFlashEnd = 0, netFlashEnd = 0;
 
-  Serial.print("Sensor 0: ");
-  float sensor_0 = readTemperature(0);
-  Serial.print(sensor_0);
-  Serial.println(" C");
+void flashStatusLED(void) {
+  statusFlashEnd = getTicks() + LED_FLASH;
+}
 
-  Serial.print("Sensor 1: ");
-  float sensor_1 = readTemperature(1);
-  Serial.print(sensor_1);
-  Serial.println(" C");
+void flashNetLED(void) {
+  netFlashEnd = getTicks() + LED_FLASH;
+}
 
-  // .print() only shows 2 decimals, and
-  // sprintf doesn't accept floats at all.
-  // Workaround: convert to signed integer, transmit,
-  // convert back on receiving end
-  char buf[34] = {0};
-  sprintf(buf, "%ld:%ld SEQ %lu",
-  (int32_t)(sensor_0 * 10000),
-  (int32_t)(sensor_1 * 10000),
-  seq);
+#if AGGREGATE_SAMPLES > 0
+// Adds sample x (Q8.8) to a window
+void windowAdd(window_t *w, int16_t x) {
+  if (w->n == 0) {
+    w->shift = w->min = w->max = x;
+    w->sum = 0;
+    w->sumSq = 0;
+  }
+  if (x < w->min)
+    w->min = x;
+  if (x > w->max)
+    w->max = x;
+
+  // Any difference fits: |d| < 2^16, so sum < 2^24 and sumSq < 2^40 with 255 samples
+  int32_t d = (int32_t)x - w->shift;
+  uint32_t ad = labs(d);
+  w->sum += d;
+  w->sumSq += ad * ad;
+  w->n++;
+}
 
-  udp.begin(localport);
-  udpSendPacket(buf);
+// Calculates the mean (Q8.8) and population variance (in (1/256 C)^2) of a window.
+// The mean is NO_READING if the window is empty.
+void windowResult(const window_t *w, int16_t *mean, uint32_t *variance) {
+  uint8_t n = w->n;
+  if (n == 0) {
+    *mean = NO_READING;
+    *variance = 0;
+    return;
+  }
 
-  memset(buf, 0, 34);
-  int ret = 0;
-  ret = udpRecvPacket(buf, 33, 2000);
-  calculateBroadcast();
-  if (ret <= 0) {
-    setNetLED(false);
-    Serial.println("Failed to receive data: timeout/error");
-    blinkNetOnce(150);
-    missed_answers++;
-
-    if (missed_answers >= 30) {
-      // No contact for a while... Looks like the server may be down or such. It may
-      // have a new IP (in case it isn't static).
-      // updateServerIP will block and loop until it gets a response from the server!
-      updateServerIP();
+  // With sum = q*n + r (q and r having the same sign as sum),
+  //   n^2 * variance = n * sumSq - sum^2 = n * (sumSq - q * (sum + r)) - r^2
+  // where q * (sum + r) >= 0, and <= sumSq. The variance itself is at most (2^16 / 2)^2,
+  // so it fits in 32 bits.
+  int32_t q = w->sum / n;
+  int32_t r = w->sum % n;
+  uint64_t a = w->sumSq - (uint64_t)labs(q) * (uint32_t)labs(w->sum + r);
+  *variance = (a - (uint32_t)(r * r) / n) / n;
+
+  // Round the mean to nearest
+  *mean = w->shift + q + ((2 * r >= n) ? 1 : (2 * r <= -n) ? -1 : 0);
+}
+#endif
+
+// Samples every SAMPLE_INTERVAL: starts a conversion, reads the sensors when it's done,
+// and then scans the bus for sensors that have been added or removed.
+// Sensors that are missing are left out of the readings (as NO_READING); everything
+// else keeps going.
+void sensorTask(void) {
+  static enum { SENSORS_SCANNING, SENSORS_WAITING, SENSORS_CONVERTING } state = SENSORS_SCANNING;
+  static uint32_t nextSample = 0, conversionStart = 0;
+  static uint32_t sampleStart = 0; // ticks when the (first) conversion started
+  static bool retrying = false;
+  static uint8_t cycle = 0;
+  uint32_t now = getTicks();
+
+  if (state == SENSORS_SCANNING) {
+    if (!scanStep())
+      return; // More to do; run again on the next pass
+    state = SENSORS_WAITING;
+    sleepUntil(nextSample);
+    return;
+  }
+
+  if (state == SENSORS_WAITING) {
+    // Samples stay on a fixed grid, no matter how long the conversion and scan took. If we
+    // somehow fell behind by more than an interval, skip ahead rather than sampling in a burst.
+    nextSample += SAMPLE_INTERVAL;
+    if (reached(now, nextSample))
+      nextSample = now + SAMPLE_INTERVAL;
+
+    bool any = false;
+    for (uint8_t i=0; i < sensorCount; i++) {
+      any |= sensors[i].present;
     }
-    // TODO: "cache" data if current_time is set properly (> 1348512615 for example.
-    // since it starts out at 0, any big number means it'll have synced the time prior
-    // to the downtime.)
-    goto loop_end;
+    if (!any) {
+      Serial.println("WARNING: no sensors found!");
+      state = SENSORS_SCANNING;
+      return;
+    }
+
+    Serial.println("Starting temperature sampling...");
+    for (uint8_t i=0; i < sensorCount; i++) {
+      if (sensors[i].present)
+        sensors[i].driver->configure(sensors[i].addr);
+    }
+    cycle++;
+    for (uint8_t i=0; i < NUM_DRIVERS; i++) {
+      drivers[i]->start(cycle);
+    }
+    // Not now: printing may have blocked on the serial port since the task started
+    conversionStart = getTicks();
+    sampleStart = conversionStart;
+    retrying = false;
+    state = SENSORS_CONVERTING;
+    sleepTicks(1);
+    return;
   }
-  /* else success */
-  missed_answers = 0;
 
-  setNetLED(true);
+  // SENSORS_CONVERTING
+  bool done = true;
+  for (uint8_t i=0; i < NUM_DRIVERS; i++) {
+    done &= drivers[i]->done();
+  }
+  if (!done) {
+    uint16_t ms = 0;
+    for (uint8_t i=0; i < NUM_DRIVERS; i++) {
+      ms = max(ms, drivers[i]->conversionTime());
+    }
+    if (reached(now, conversionStart + (uint32_t)ms * TICKS_PER_SECOND / 1000 + CONVERSION_MARGIN)) {
+      Serial.println("WARNING: temperature conversion never finished!");
+      state = SENSORS_SCANNING;
+      return;
+    }
+    sleepTicks(1);
+    return;
+  }
+
+  bool suspicious = false;
+  for (uint8_t i=0; i < sensorCount; i++) {
+    if (!sensors[i].present || (retrying && readings[i] != NO_READING))
+      continue;
+
+    uint8_t ret = readTemperature(i, retrying, &readings[i]);
+    if (ret == READ_RETRY)
+      suspicious = true;
+    if (ret != READ_OK) {
+      // If it failed, the next scan will tell whether it's really gone
+      readings[i] = NO_READING;
+    }
+  }
+
+  if (suspicious && !retrying) {
+    // Convert again (all sensors; it takes no longer than converting one),
+    // and accept whatever we get this time
+    cycle++;
+    for (uint8_t i=0; i < NUM_DRIVERS; i++) {
+      drivers[i]->start(cycle);
+    }
+    conversionStart = getTicks(); // the warnings above take a couple of ticks to print
+    retrying = true;
+    sleepTicks(1);
+    return;
+  }
+
+  for (uint8_t i=0; i < sensorCount; i++) {
+    if (!sensors[i].present)
+      readings[i] = NO_READING;
+    Serial.print("Sensor ");
+    Serial.print(i);
+    Serial.print(": ");
+    if (readings[i] == NO_READING)
+      Serial.println("no reading");
+    else {
+      Serial.print(readings[i] / 256.0);
+      Serial.println(" C");
+    }
+  }
+
+  // The time the sample was taken, not now: other tasks (e.g. sends waiting for ARP while
+  // the server is away) can hold up reading it for seconds. The clock may well have been
+  // set in the meantime, so go back from now rather than remembering the time then.
+  uint32_t sampleTime = TIME_VALID(current_time) ?
+    current_time - (getTicks() - sampleStart) / TICKS_PER_SECOND : 0;
+
+  reading_t r;
+#if AGGREGATE_SAMPLES > 0
+  static window_t windows[MAX_SENSORS];
+  static uint8_t windowSamples = 0;
+  static uint32_t windowStart = 0;
+
+  if (windowSamples == 0)
+    windowStart = sampleTime;
+  for (uint8_t i=0; i < sensorCount; i++) {
+    if (readings[i] != NO_READING)
+      windowAdd(&windows[i], readings[i]);
+  }
+
+  if (++windowSamples == AGGREGATE_SAMPLES) {
+    r.seq = seq++;
+    r.time = windowStart;
+    for (uint8_t i=0; i < MAX_SENSORS; i++) {
+      windowResult(&windows[i], &r.temp[i], &r.variance[i]);
+      r.min[i] = windows[i].n ? windows[i].min : NO_READING;
+      r.max[i] = windows[i].n ? windows[i].max : NO_READING;
+      windows[i].n = 0;
+    }
+    backlogPush(&r);
+    windowSamples = 0;
+  }
+#else
+  r.seq = seq++;
+  r.time = sampleTime;
+  for (uint8_t i=0; i < MAX_SENSORS; i++) {
+    r.temp[i] = (i < sensorCount) ? readings[i] : NO_READING;
+  }
+  backlogPush(&r);
+#endif
+
+  state = SENSORS_SCANNING;
+}
+
+// Sends the backlog to the server, oldest first, in batches, and waits (without blocking)
+// for the answer, which recvTask() picks up.
+//
+// There are two packet formats. The binary one (the default) is a header followed by
+// one record per reading; all values are little-endian:
+//   uint8  type        PACKET_DATA
+//   uint8  sensors     number of temperatures per reading, i.e. registered sensors
+//   uint8  count       number of readings
+//   uint8  reserved    0
+//   uint32 seq         sequence number of the first reading; the rest follow in order
+//   uint32 time        timestamp of the first reading
+// then, for each reading:
+//   varint delta       seconds since the previous reading (0 for the first); 7 bits per byte,
+//                      least significant first, high bit set on all but the last byte
+//   int16  temp[sensors]  degrees C in Q8.8 fixed point (1/256 C); -32768 if missing
+// With AGGREGATE_SAMPLES, the type is PACKET_SUMMARY, the reserved byte holds the number
+// of samples per summary, and each record has, per sensor, instead of temp:
+//   int16  mean, min, max  Q8.8, as above
+//   uint32 variance    in (1/256 C)^2
+// The server acknowledges cumulatively, i.e. everything up to and including a sequence number:
+//   uint8  type        PACKET_ACK
+//   uint32 seq         last reading received
+//   uint32 time        the server's current time
+//
+// In the ASCII format (BINARY_PACKETS not defined), each reading is one line:
+//   <temp 0>:<temp 1> SEQ <seq> TIME <timestamp>
+// with the temperatures in degrees C * 10000 (U if missing), and the server answers
+//   OK SEQ <first seq>-<last seq> TIME <current time>
+// (a plain "OK SEQ <seq> TIME <current time>" acknowledges a single reading).
+//
+// A timestamp of 0 means that our clock wasn't set when the reading was taken, and that the
+// server should use the time of arrival instead. Such readings are only useful when sent
+// live, so they're dropped rather than kept in the backlog if the server doesn't answer.
+#define PACKET_DATA 0xD1
+#define PACKET_SUMMARY 0xD2
+#define PACKET_ACK 0xA1
+
+// A batch is as many readings as fit in BATCH_BYTES, counting the most each one can take
+// (the longest varint, or the longest ASCII line) for the sensors registered, so that a packet
+// never outgrows the WIZnet's 2 kB socket buffer, or an Ethernet frame (1472 bytes of UDP
+// payload). With 8 sensors, that's 66 readings, 16 summaries or 10 ASCII lines per packet.
+#define BATCH_BYTES 1400
+#ifdef BINARY_PACKETS
+#define BATCH_HEADER 12
+#if AGGREGATE_SAMPLES > 0
+#define RECORD_MAX(sensors) (5 + 10 * (sensors))
+#else
+#define RECORD_MAX(sensors) (5 + 2 * (sensors))
+#endif
+#else
+#define BATCH_HEADER 0
+#define RECORD_MAX(sensors) (12 * (sensors) + 32)
+#endif
+#define RETRY_INTERVAL SECONDS(10)
+
+enum { SEND_IDLE, SEND_WAIT_ACK } sendState = SEND_IDLE;
+bool ackReceived = false;
+uint32_t sentFirst = 0, sentLast = 0; // the readings we're waiting for an answer to
+uint32_t ackedLast = 0; // the last reading the answer covered
+
+void put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+void put32(uint8_t *p, uint32_t v) {
+  put16(p, v & 0xffff);
+  put16(p + 2, v >> 16);
+}
+
+uint32_t get32(const uint8_t *p) {
+  return p[0] | ((uint16_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint8_t putVarint(uint8_t *p, uint32_t v) {
+  uint8_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+// The number of readings to send in one packet, at most; the count is a byte
+uint32_t batchLimit(void) {
+  return min((BATCH_BYTES - BATCH_HEADER) / RECORD_MAX(sensorCount), 255);
+}
+
+// Sends readings [0, n) of the backlog as a single packet
+void sendBatch(uint32_t n) {
+  reading_t r;
+  udp.beginPacket(serverip, serverport);
+
+#ifdef BINARY_PACKETS
+  uint8_t record[RECORD_MAX(MAX_SENSORS)];
+  uint32_t lastTime = 0;
+  for (uint32_t i=0; i < n; i++) {
+    backlogPeek(i, &r);
+    if (i == 0) {
+#if AGGREGATE_SAMPLES > 0
+      uint8_t header[12] = { PACKET_SUMMARY, sensorCount, (uint8_t)n, AGGREGATE_SAMPLES };
+#else
+      uint8_t header[12] = { PACKET_DATA, sensorCount, (uint8_t)n, 0 };
+#endif
+      put32(header + 4, r.seq);
+      put32(header + 8, r.time);
+      udp.write(header, sizeof(header));
+      sentFirst = r.seq;
+      lastTime = r.time;
+    }
+
+    uint8_t len = putVarint(record, r.time - lastTime);
+    for (int j=0; j < sensorCount; j++) {
+      put16(record + len, r.temp[j]);
+      len += 2;
+#if AGGREGATE_SAMPLES > 0
+      put16(record + len, r.min[j]);
+      put16(record + len + 2, r.max[j]);
+      put32(record + len + 4, r.variance[j]);
+      len += 8;
+#endif
+    }
+    udp.write(record, len);
+    lastTime = r.time;
+  }
+#else
+  for (uint32_t i=0; i < n; i++) {
+    backlogPeek(i, &r);
+    if (i == 0)
+      sentFirst = r.seq;
+
+    char line[RECORD_MAX(MAX_SENSORS)] = {0};
+    char *p = line;
+    for (int j=0; j < sensorCount; j++) {
+      if (j > 0)
+        *p++ = ':';
+      // Q8.8 to degrees * 10000 (which is 625/16 = 10000/256), since the
+      // server expects integers. (sprintf doesn't accept floats at all.)
+      if (r.temp[j] == NO_READING)
+        *p++ = 'U'; // "unknown", as in RRD
+      else
+        p += sprintf(p, "%ld", (int32_t)r.temp[j] * 625 / 16);
+    }
+    sprintf(p, " SEQ %lu TIME %lu\n", r.seq, r.time);
+    udp.write(line);
+  }
+#endif
+
+  udp.endPacket();
+  sentLast = r.seq;
+}
+
+void sendTask(void) {
+  static uint32_t ackDeadline = 0;
+  uint32_t now = getTicks();
+  reading_t r;
+
+  if (sendState == SEND_IDLE) {
+    if (backlogSize() == 0 || !serverKnown) {
+      sleepTicks(1);
+      return;
+    }
+
+    sendBatch(min(backlogSize(), batchLimit()));
+    ackReceived = false;
+    ackDeadline = now + ACK_TIMEOUT;
+    sendState = SEND_WAIT_ACK;
+    return;
+  }
+
+  // SEND_WAIT_ACK
+  if (ackReceived) {
+    // Remove what the server has acknowledged. The next batch, if any, goes out right away,
+    // so a backlog drains at the speed of the round trips.
+    while (backlogSize() > 0) {
+      backlogPeek(0, &r);
+      if ((int32_t)(r.seq - ackedLast) > 0)
+        break;
+      backlogPop();
+    }
+    backlogSync();
+    missed_answers = 0;
+    sendState = SEND_IDLE;
+    Serial.println("");
+    return;
+  }
+
+  if (!reached(now, ackDeadline))
+    return; // Keep polling; answers arrive within a few ms when all is well
 
+  Serial.println("Failed to receive data: timeout/error");
+  netUp = false;
+  flashNetLED();
+  missed_answers++;
+
+  // Readings taken before the clock was set can't be timestamped afterwards
+  while (backlogSize() > 0) {
+    backlogPeek(0, &r);
+    if (r.time != 0)
+      break;
+    backlogPop();
+  }
+  backlogSync();
+
+  Serial.print("Backlog: ");
+  Serial.print(backlogSize());
+  Serial.print(" readings (");
+  Serial.print(backlogDropped);
+  Serial.println(" dropped so far)");
+
+  sendState = SEND_IDLE;
+  if (missed_answers >= MAX_MISSED_ANSWERS) {
+    // No contact for a while... Looks like the server may be down or such. It may
+    // have a new IP (in case it isn't static). Let the discovery task look for it.
+    serverKnown = false;
+    missed_answers = 0;
+  }
+  Serial.println("");
+  sleepTicks(RETRY_INTERVAL);
+}
+
+// Handles an answer covering readings [first, last]. ok is false if the server refused them.
+void acknowledge(uint32_t first, uint32_t last, uint32_t recv_time, bool ok) {
+  if (sendState != SEND_WAIT_ACK || (int32_t)(first - sentFirst) < 0 ||
+      (int32_t)(last - first) < 0 || (int32_t)(sentLast - last) < 0) {
+    Serial.print("Invalid response! SEQ = ");
+    Serial.print(first);
+    Serial.print("-");
+    Serial.print(last);
+    Serial.print(", but should have been ");
+    Serial.print(sentFirst);
+    Serial.print("-");
+    Serial.println(sentLast);
+    // Most likely a late answer to something that already timed out; ignore it
+    return;
+  }
+
+  netUp = true;
+  ackReceived = true;
+
+  if (!ok) {
+    // Don't resend readings the server refuses; they'd only be refused again
+    Serial.println("Invalid response! Status is not OK; dropping the readings");
+    ackedLast = sentLast;
+    return;
+  }
+  ackedLast = last;
+
+  // Servers that don't do the time exchange still set the clock this way, though only
+  // to the second, and without drift compensation
+  if (!clockSynced) {
+    // Disable interrupts while modifying the timestamp, just in case
+    cli();
+    current_time = recv_time;
+    sei();
+  }
+
+  flashStatusLED();
+  serverContacted = true;
+}
+
+void handleAnswer(char *buf) {
   Serial.print("Response: [");
   Serial.print(buf);
   Serial.println("]");
 
-  uint32_t recv_seq;
-  char stat[8];
-  memset(stat, 0, 8);
+  // Parse "<status> SEQ <first>[-<last>] TIME <time>"
+  uint32_t first = 0, last = 0, recv_time = 0;
+  char *p = strstr(buf, "SEQ ");
+  if (p != NULL) {
+    first = strtoul(p + 4, &p, 10);
+    last = (*p == '-') ? strtoul(p + 1, &p, 10) : first;
+    p = strstr(p, "TIME ");
+    if (p != NULL)
+      recv_time = strtoul(p + 5, NULL, 10);
+  }
 
-  // Disable interrupts while modifying the timestamp, just in case
-  cli();
-  sscanf(buf, "%s SEQ %lu TIME %lu", stat, &recv_seq, &current_time);
-  sei();
+  // An ASCII answer must cover the batch from its start
+  if (first != sentFirst)
+    first = sentLast + 1; // i.e. invalid
+
+  acknowledge(first, last, recv_time, strncmp(buf, "OK ", 3) == 0);
+}
+
+///
+/// The clock.
+/// The timer keeps time, and clockTask() keeps it in step with the server, much like a
+/// (very) simplified NTP. Every sync is a burst of SYNC_BURST exchanges:
+///   uint8  type        PACKET_TIME_REQUEST
+///   uint32 t1 sec, usec   our time when sending the request
+/// which the server answers with
+///   uint8  type        PACKET_TIME_REPLY
+///   uint32 t1 sec, usec   as in the request
+///   uint32 t2 sec, usec   the server's time when the request arrived
+///   uint32 t3 sec, usec   the server's time when sending the reply
+/// Given t4, our time when the reply arrives, the round trip delay is
+/// (t4 - t1) - (t3 - t2), and our clock is behind the server's by
+/// ((t2 - t1) + (t3 - t4)) / 2, assuming the delay is the same both ways. Only the
+/// exchange with the shortest delay in a burst is used, since it's the least likely
+/// to have been held up somewhere (including by our own task loop).
+///
+/// Rather than setting the clock every time, which would make it jump back and forth,
+/// the offset is slewed away by adjusting the tick length for a while. The offset that
+/// has built up by the next sync is down to the crystal's frequency error, which
+/// is thus estimated, and compensated for from then on, so that the clock stays
+/// accurate for hours (to within a few ppm) even if the server goes away.
+///
+#define PACKET_TIME_REQUEST 0xC1
+#define PACKET_TIME_REPLY 0xC2
+
+#define SYNC_BURST 4
+#define SYNC_MIN 16 // seconds between syncs; doubled after each good sync, up to SYNC_MAX
+#define SYNC_MAX 1024
+#define SYNC_GOOD 20000L // µs; a smaller offset counts as a good sync
+#define STEP_THRESHOLD 128000L // µs; bigger offsets are stepped rather than slewed
+#define MAX_FREQ 5000 // ppm; a 16 MHz resonator (unlike a crystal) can be off by 0.5%
+
+int32_t clockFreq = 0; // how much to lengthen each tick, in ppm (Q8.8 fixed point)
+uint32_t lastSync = 0; // tick count
+uint16_t syncInterval = SYNC_MIN;
+
+bool clockWaiting = false, clockReplied = false;
+timestamp_t clockRequest; // t1 of the request we're waiting for
+int32_t bestOffset, bestDelay; // of the current burst, in µs
+
+// Handles a PACKET_TIME_REPLY that arrived at t4
+void clockReply(const uint8_t *p, const timestamp_t *t4) {
+  timestamp_t t1 = { get32(p + 1), get32(p + 5) };
+  timestamp_t t2 = { get32(p + 9), get32(p + 13) };
+  timestamp_t t3 = { get32(p + 17), get32(p + 21) };
+  if (!clockWaiting || t1.sec != clockRequest.sec || t1.usec != clockRequest.usec)
+    return; // A late reply to a request that timed out
+
+  clockReplied = true;
+  int32_t d41, d32, d21, d34;
+  if (!timeDiff(t4, &t1, &d41) || !timeDiff(&t3, &t2, &d32))
+    return; // Nonsense
+  int32_t delay = d41 - d32;
+
+  if (!timeDiff(&t2, &t1, &d21) || !timeDiff(&t3, t4, &d34)) {
+    // We're way off, most likely because the clock has never been set. Set it right away;
+    // the rest of the burst will tell how far off this was.
+    timeAdd(&t3, delay / 2);
+    setClock(&t3);
+    clockSynced = true;
+    lastSync = getTicks();
+    bestDelay = INT32_MAX;
+    Serial.println("Clock set");
+    return;
+  }
+
+  if (delay < bestDelay) {
+    bestDelay = delay;
+    bestOffset = d21 / 2 + d34 / 2;
+  }
+}
 
-  if (strcmp(stat, "OK") != 0) {
-    Serial.println("Invalid response! Status is not OK");
-    // TODO: handle error. For now, ignore it
+// Corrects the clock by offset µs, and updates the frequency estimate
+void clockUpdate(int32_t offset) {
+  uint32_t now = getTicks();
+
+  Serial.print("Clock offset ");
+  Serial.print(offset);
+  Serial.print(" us, round trip ");
+  Serial.print(bestDelay);
+  Serial.print(" us; ");
+
+  if (!clockSynced || labs(offset) > STEP_THRESHOLD) {
+    timestamp_t t;
+    getTime(&t);
+    timeAdd(&t, offset);
+    setClock(&t);
+    clockSynced = true;
+    syncInterval = SYNC_MIN;
+    Serial.println("stepped");
   }
   else {
-    blinkStatusOnce(150);
-    serverContacted = true;
+    // The previous offset was slewed away, so this one built up since the last sync, due to
+    // the frequency error that is left. Correct for half of it, which smooths out the noise.
+    // (Offset in µs per second is ppm.) Positive offsets mean we're slow, i.e. shorten ticks.
+    // Over less than SYNC_MIN / 2 (e.g. right after the clock was set), the noise would
+    // swamp the estimate.
+    uint32_t elapsed = (now - lastSync) / TICKS_PER_SECOND;
+    if (elapsed >= SYNC_MIN / 2)
+      clockFreq = constrain(clockFreq - offset * 128 / (int32_t)elapsed, -256L * MAX_FREQ, 256L * MAX_FREQ);
+
+    // Slew the offset away over half the interval. That takes at most 16000 ppm
+    // (128 ms over 8 s), which the timer copes with easily.
+    int32_t slew = -offset * 512 / syncInterval; // ppm, Q8.8
+    cli();
+    // ppm Q8.8 to 1/65536 timer counts per tick: * 65536 * 6250 / 10^6 / 256 = * 8 / 5
+    tickAdjust = clockFreq * 8 / 5;
+    slewAdjust = slew * 8 / 5;
+    slewTicks = SECONDS(syncInterval / 2);
+    sei();
+
+    syncInterval = (labs(offset) < SYNC_GOOD) ? min(syncInterval * 2, SYNC_MAX) : SYNC_MIN;
+    Serial.print("frequency ");
+    Serial.print(clockFreq / 256.0);
+    Serial.println(" ppm");
   }
+  lastSync = now;
+}
 
-  if (recv_seq != seq) {
-    Serial.print("Invalid response! SEQ = ");
-    Serial.print(recv_seq);
-    Serial.print(", but should have been ");
-    Serial.println(seq);
-    // TODO: handle error
+// Syncs the clock every syncInterval seconds, with a burst of time exchanges
+void clockTask(void) {
+  static uint8_t sent = 0;
+  static uint32_t deadline = 0;
+  uint32_t now = getTicks();
+
+  if (clockWaiting) {
+    if (!clockReplied && !reached(now, deadline))
+      return; // Keep polling
+    clockWaiting = false;
+
+    if (sent == SYNC_BURST) {
+      sent = 0;
+      if (bestDelay != INT32_MAX)
+        clockUpdate(bestOffset);
+      // else the server didn't answer, or doesn't do the time exchange; try again later
+      sleepTicks(SECONDS(syncInterval));
+      return;
+    }
   }
 
-loop_end:
-  seq++;
-  udp.flush();
+  if (!serverKnown) {
+    sleepTicks(SECONDS(1));
+    return;
+  }
+
+  if (sent == 0)
+    bestDelay = INT32_MAX;
+
+  uint8_t request[9] = { PACKET_TIME_REQUEST };
+  getTime(&clockRequest);
+  put32(request + 1, clockRequest.sec);
+  put32(request + 5, clockRequest.usec);
+  udp.beginPacket(serverip, serverport);
+  udp.write(request, sizeof(request));
+  udp.endPacket();
+
+  sent++;
+  clockWaiting = true;
+  clockReplied = false;
+  deadline = now + ACK_TIMEOUT;
+}
+
+// Picks up whatever has arrived on the socket, and hands it to whoever is waiting for it
+void recvTask(void) {
+  if (udp.parsePacket() <= 0)
+    return;
+
+  // As early as possible, for the time exchange
+  timestamp_t arrival;
+  getTime(&arrival);
+
+  char buf[48] = {0};
+  int len = udp.read(buf, sizeof(buf) - 1);
+
+  if (len == 25 && (uint8_t)buf[0] == PACKET_TIME_REPLY) {
+    clockReply((uint8_t *)buf, &arrival);
+  }
+  else if (len == 9 && (uint8_t)buf[0] == PACKET_ACK) {
+    uint32_t last = get32((uint8_t *)buf + 1);
+    Serial.print("Acknowledged up to SEQ ");
+    Serial.println(last);
+    // Cumulative, so everything we sent up to there is covered
+    acknowledge(sentFirst, last, get32((uint8_t *)buf + 5), true);
+  }
+  else if (strncmp(buf, "PONG", 4) == 0) {
+    serverFound(udp.remoteIP());
+  }
+  else if (strncmp(buf, "OK", 2) == 0 || strncmp(buf, "ERR", 3) == 0) {
+    handleAnswer(buf);
+  }
+  else {
+    Serial.print("Ignoring unexpected packet: ");
+    Serial.println(buf);
+  }
+}
+
+///
+/// Server discovery.
+/// While we don't know where the server is (after booting, or after MAX_MISSED_ANSWERS
+/// unanswered readings), discoveryTask() looks for it by sending PING. The cached server IP,
+/// if any, is asked first (by unicast, so it's quick to confirm); after that, PING is
+/// broadcast as well, with exponential backoff (and some jitter, so that many nodes don't
+/// all retry at once). If that goes on for too long, the WIZnet may have locked up, so
+/// it's reset. The other tasks keep running throughout; readings pile up in the backlog.
+///
+
+IPAddress cachedServer; // 0.0.0.0 if none
+uint16_t discoveryAttempts = 0; // since the server was lost
+uint32_t serverLost = 0; // tick count
+
+void loadServerCache(void) {
+  if (EEPROM.read(SERVER_CACHE_ADDR) != 'S' || EEPROM.read(SERVER_CACHE_ADDR + 1) != 'V')
+    return;
+  for (int i=0; i < 4; i++) {
+    cachedServer[i] = EEPROM.read(SERVER_CACHE_ADDR + 2 + i);
+  }
+  Serial.print("Cached server IP: ");
+  serialPrintIP(cachedServer);
+}
+
+// Called when a PONG arrives from ip
+void serverFound(IPAddress ip) {
+  Serial.print("Answer received. Server IP is: ");
+  serialPrintIP(ip);
+
+  if (!serverKnown && discoveryAttempts > 0) {
+    Serial.print("Reconnected after ");
+    Serial.print((getTicks() - serverLost) / TICKS_PER_SECOND);
+    Serial.print(" s; ");
+    Serial.print(backlogDropped);
+    Serial.println(" readings dropped so far");
+  }
+
+  if (!(ip == cachedServer)) {
+    // Only written when it changes, to spare the EEPROM
+    cachedServer = ip;
+    EEPROM.write(SERVER_CACHE_ADDR, 0xff);
+    for (int i=0; i < 4; i++) {
+      EEPROM.write(SERVER_CACHE_ADDR + 2 + i, ip[i]);
+    }
+    EEPROM.write(SERVER_CACHE_ADDR + 1, 'V');
+    EEPROM.write(SERVER_CACHE_ADDR, 'S');
+  }
+
+  serverip = ip;
+  serverKnown = true;
+  serverContacted = true;
+  netUp = true;
+  discoveryAttempts = 0;
+}
+
+// Resets the WIZnet, and sets it up again with the address we already have. Unlike
+// setup(), this doesn't wait for DHCP; the lease is still good, and dhcpTask() renews it.
+void restartWiznet(void) {
+  IPAddress ip = Ethernet.localIP();
+  IPAddress dns = Ethernet.dnsServerIP();
+  IPAddress gateway = Ethernet.gatewayIP();
+  IPAddress subnet = Ethernet.subnetMask();
+
+  Serial.println("No server for a long time; resetting the WIZnet");
   udp.stop();
+  resetWiznet(); // Blocks for 0.5 s; samples are on a fixed grid, so none are lost
+  Ethernet.begin(mac, ip, dns, gateway, subnet);
+  udp.begin(localport);
+}
 
-  Serial.println("");
-  time_to_work = false;
+void discoveryTask(void) {
+  if (serverKnown) {
+    sleepTicks(SECONDS(1));
+    return;
+  }
+
+  if (discoveryAttempts == 0)
+    serverLost = getTicks();
+  else if (discoveryAttempts % WIZNET_RESET_AFTER == 0)
+    restartWiznet();
+
+  Serial.println("Updating server IP...");
+  bool cached = ((uint32_t)cachedServer != 0);
+  if (cached)
+    udpSendPacket("PING", cachedServer);
+  if (discoveryAttempts > 0 || !cached) {
+    udpSendPacket("PING", IPAddress(255,255,255,255));
+  }
+
+  uint32_t backoff = DISCOVERY_MIN << min(discoveryAttempts, 6);
+  if (backoff > DISCOVERY_MAX)
+    backoff = DISCOVERY_MAX;
+  if (discoveryAttempts < 0xffff)
+    discoveryAttempts++;
+  sleepTicks(backoff - random(backoff / 4));
+}
+
+void dhcpTask(void) {
+  // Note that the Ethernet library blocks while it renews the lease, which happens
+  // rarely (every few hours with typical lease times); the rest of the time this is quick.
+  Ethernet.maintain();
+  sleepTicks(DHCP_INTERVAL);
+}
+
+// Both LEDs are off to begin with.
+// Net blinks until DHCP is finished (see the ISR), after which it is constantly lit
+// as long as the server answers. Status then blinks until contact with the server has
+// been acquired, after which it is off, but blinks quickly once each time a reading is sent.
+void ledTask(void) {
+  uint32_t now = getTicks();
+
+  if (!serverContacted)
+    setStatusLED((now / TICKS_PER_SECOND) & 1);
+  else
+    setStatusLED(!reached(now, statusFlashEnd));
+
+  setNetLED(netUp || !reached(now, netFlashEnd));
+  sleepTicks(1);
+}
+
+task_t tasks[] = {
+  { sensorTask, 0 },
+  { recvTask, 0 },
+  { sendTask, 0 },
+  { clockTask, 0 },
+  { discoveryTask, 0 },
+  { dhcpTask, 0 },
+  { ledTask, 0 }
+};
+#define NUM_TASKS (sizeof(tasks) / sizeof(tasks[0]))
+
+void loop() {
+  for (uint8_t i=0; i < NUM_TASKS; i++) {
+    if (reached(getTicks(), tasks[i].due)) {
+      currentTask = &tasks[i];
+      tasks[i].run();
+    }
+  }
 }
@@ -0,0 +1,154 @@
+#include "SensorDrivers.h"
+
+// Temperature sensor drivers for Greenhouse_DAQ
+
+DS18x20::DS18x20(OneWire &_bus, byte _family) : bus(_bus), family(_family) {
+}
+
+void DS18x20::start(uint8_t cycle) {
+  // The DS18S20 and DS18B20 drivers share the bus, and one command starts them all
+  static uint8_t lastCycle = 0;
+  static OneWire *lastBus = NULL;
+  if (cycle == lastCycle && lastBus == &bus)
+    return;
+  lastCycle = cycle;
+  lastBus = &bus;
+
+  bus.reset();
+  bus.skip();
+  bus.write(0x44); // CONVERT T command = 44h
+}
+
+boolean DS18x20::done(void) {
+  // Devices send 0 bits while converting (not on parasitic power!); since they share the
+  // bus, we read a 1 only once the *slowest* sensor is done.
+  // A single read time slot takes ~70 µs, so this is cheap enough to poll.
+  return bus.read_bit() == 1;
+}
+
+uint8_t DS18x20::readScratchpad(const byte *addr, byte *data) {
+  int crc_tries = 0;
+
+restart:
+  bus.reset();
+  bus.select(addr);
+  bus.write(0xBE); // READ SCRATCHPAD command = BEh
+
+  for (int i=0; i < 9; i++) {
+    data[i] = bus.read();
+  }
+
+  // Check for all ones (eight 0xff bytes)
+  char count = 0;
+  for (int i=0; i < 8; i++) {
+    if (data[i] == 0xff)
+      count++;
+    else break;
+  }
+  if (count == 8)
+    return READ_FAILED;
+
+  if (OneWire::crc8(data, 8) != data[8]) {
+    crc_tries++;
+    if (crc_tries > 5)
+      return READ_FAILED;
+    // The conversion result is still in the scratchpad, so just read it again
+    goto restart;
+  }
+
+  return READ_OK;
+}
+
+uint8_t DS18x20::read(const byte *addr, int16_t *temp) {
+  byte data[9];
+  uint8_t ret = readScratchpad(addr, data);
+  if (ret == READ_OK)
+    *temp = decode(data);
+  return ret;
+}
+
+int16_t DS18S20::decode(const byte *data) {
+  // Prettier names without extra RAM use. Ugly, yes, but this *is* embedded after all
+#define LSB (data[0])
+#define MSB (data[1])
+#define count_remain (data[6])
+#define count_per_c (data[7])
+
+  if (MSB == 0xff) {
+    // Temperature is below 0! Use the simpler, less precise formula,
+    // i.e. LSB is a two's complement value in half degrees
+    return (int16_t)(int8_t)LSB * 128;
+  }
+
+  // Temperature is positive; use the full-resolution (1/16 C) formula,
+  // mostly to get "less digital-looking" graphs, even though the added
+  // resolution doesn't mean added *accuracy*:
+  //   temp = (LSB >> 1) - 0.25 + (count_per_c - count_remain) / count_per_c
+  // count_per_c is always 16, but don't count on it.
+  if (count_per_c == 0)
+    return (int16_t)(LSB >> 1) * 256;
+  return (int16_t)(LSB >> 1) * 256 - 64 + ((count_per_c - count_remain) * 256) / count_per_c;
+
+#undef LSB
+#undef MSB
+#undef count_remain
+#undef count_per_c
+}
+
+DS18B20::DS18B20(OneWire &_bus, uint8_t _resolution) : DS18x20(_bus, FAMILY_DS18B20) {
+  resolution = constrain(_resolution, 9, 12);
+}
+
+void DS18B20::configure(const byte *addr) {
+  // The resolution is in the configuration register, which is written along with the
+  // alarm thresholds (which we don't use; these are the defaults). It's not copied to
+  // the EEPROM, so a sensor that browns out between two scans comes back at 12 bits
+  // without ever having disappeared, and goes on converting at that (slowest) resolution;
+  // hence this is written before every conversion (about 8 ms of bus time per sensor).
+  bus.reset();
+  bus.select(addr);
+  bus.write(0x4E); // WRITE SCRATCHPAD command = 4Eh
+  bus.write(0x4B); // TH
+  bus.write(0x46); // TL
+  bus.write(((resolution - 9) << 5) | 0x1f);
+}
+
+int16_t DS18B20::decode(const byte *data) {
+  // A two's complement value in 1/16 C; at lower resolutions, the lowest bits are undefined
+  int16_t raw = (int16_t)((data[1] << 8) | data[0]);
+  raw &= ~((1 << (12 - resolution)) - 1);
+  return raw * 16;
+}
+
+AnalogSensors::AnalogSensors(const analog_channel_t *_channels, uint8_t _count, uint16_t _vref_mv)
+  : channels(_channels), numChannels(_count), vref_mv(_vref_mv) {
+}
+
+void AnalogSensors::address(uint8_t n, byte *addr) {
+  memset(addr, 0, 8);
+  addr[0] = FAMILY_ANALOG;
+  addr[1] = channels[n].pin;
+  addr[7] = OneWire::crc8(addr, 7);
+}
+
+uint8_t AnalogSensors::read(const byte *addr, int16_t *temp) {
+  const analog_channel_t *ch = NULL;
+  for (uint8_t i=0; i < numChannels; i++) {
+    if (channels[i].pin == addr[1])
+      ch = &channels[i];
+  }
+  if (ch == NULL)
+    return READ_FAILED;
+
+  // Oversample 16 times; besides averaging out the noise, this gives two extra bits
+  uint16_t sum = 0;
+  for (int i=0; i < 16; i++) {
+    sum += analogRead(ch->pin);
+  }
+
+  // Millivolts * 16, then to Q8.8:
+  //   temp = (mv - offset) / (mv_per_c_x10 / 10) * 256 = (mv16 - 16 * offset) * 160 / mv_per_c_x10
+  int32_t mv16 = (int32_t)sum * vref_mv / 1024;
+  *temp = constrain(((mv16 - 16L * ch->offset_mv) * 160) / ch->mv_per_c_x10, -32767L, 32767L);
+  return READ_OK;
+}
@@ -0,0 +1,122 @@
+#ifndef _SENSORDRIVERS_H
+#define _SENSORDRIVERS_H
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include <OneWire.h>
+
+// Temperature sensor drivers for Greenhouse_DAQ
+//
+// Every sensor is identified by an 8-byte address: its ROM code for 1-Wire sensors, or a
+// made-up one for analog channels (see AnalogSensors::address()). Each driver handles
+// the sensors with one family code (the first byte), and converts their readings to
+// degrees C in Q8.8 fixed point (1/256 C).
+//
+// Sampling is done in three steps, so that all sensors convert at the same time:
+// start() on every driver, then done() until every driver is done, then read() for
+// each sensor.
+
+// Return values for read()
+#define READ_OK 0
+#define READ_RETRY 1 // looks like an outlier; convert again (used by the sketch)
+#define READ_FAILED 2 // no (valid) answer; the sensor is most likely disconnected
+
+// 1-Wire family codes
+#define FAMILY_DS18S20 0x10
+#define FAMILY_DS18B20 0x28
+// Not a real family; used for the made-up addresses of analog channels
+#define FAMILY_ANALOG 0xA0
+
+class SensorDriver {
+  public:
+  // True if this driver handles the sensor with this address
+  virtual boolean handles(const byte *addr) = 0;
+  // True for sensors that can't be found by a bus scan, and are always considered present
+  virtual boolean alwaysPresent(void) { return false; }
+  // Called for each sensor that's present before every conversion, e.g. to (re)write
+  // its settings
+  virtual void configure(const byte *) { }
+  // Starts a conversion on all of this driver's sensors. Drivers may share a bus; cycle
+  // is different for each sampling cycle, so that a shared bus is only started once.
+  virtual void start(uint8_t) { }
+  // True once the conversion started by start() has finished
+  virtual boolean done(void) { return true; }
+  // The longest a conversion may take, in milliseconds
+  virtual uint16_t conversionTime(void) { return 0; }
+  // Reads a sensor's latest result into *temp (Q8.8)
+  virtual uint8_t read(const byte *addr, int16_t *temp) = 0;
+};
+
+// DS18S20 and DS18B20 sensors are converted together, by a single CONVERT T to
+// all devices on the bus (SKIP ROM).
+class DS18x20 : public SensorDriver {
+  public:
+  DS18x20(OneWire &_bus, byte _family);
+  boolean handles(const byte *addr) { return addr[0] == family; }
+  void start(uint8_t cycle);
+  boolean done(void);
+  uint8_t read(const byte *addr, int16_t *temp);
+
+  protected:
+  // Converts a (CRC checked) scratchpad to Q8.8
+  virtual int16_t decode(const byte *data) = 0;
+  uint8_t readScratchpad(const byte *addr, byte *data);
+  OneWire &bus;
+  byte family;
+};
+
+// DS18S20: 9-bit, with extended (1/16 C) resolution from COUNT_REMAIN; 750 ms conversions
+class DS18S20 : public DS18x20 {
+  public:
+  DS18S20(OneWire &_bus) : DS18x20(_bus, FAMILY_DS18S20) { }
+  uint16_t conversionTime(void) { return 750; }
+
+  protected:
+  int16_t decode(const byte *data);
+};
+
+// DS18B20: 9 to 12 bits of resolution, where each bit less halves the conversion time
+// (from 750 ms at 12 bits down to 94 ms at 9 bits)
+class DS18B20 : public DS18x20 {
+  public:
+  DS18B20(OneWire &_bus, uint8_t _resolution = 12);
+  void configure(const byte *addr);
+  uint16_t conversionTime(void) { return 750 >> (12 - resolution); }
+
+  protected:
+  int16_t decode(const byte *data);
+  uint8_t resolution;
+};
+
+// An analog temperature sensor (LM35, TMP36, MCP9700 and the like), which outputs
+// offset_mv at 0 C, and mv_per_c_x10 / 10 more millivolts per degree
+typedef struct {
+  uint8_t pin;
+  int16_t offset_mv;
+  uint16_t mv_per_c_x10;
+} analog_channel_t;
+
+#define ANALOG_LM35 0, 100
+#define ANALOG_TMP36 500, 100
+#define ANALOG_MCP9700 500, 100
+#define ANALOG_MCP9701 400, 195
+
+class AnalogSensors : public SensorDriver {
+  public:
+  // vref_mv is the ADC reference voltage, i.e. usually the supply voltage
+  AnalogSensors(const analog_channel_t *_channels, uint8_t _count, uint16_t _vref_mv = 5000);
+  boolean handles(const byte *addr) { return addr[0] == FAMILY_ANALOG; }
+  boolean alwaysPresent(void) { return true; }
+  uint8_t read(const byte *addr, int16_t *temp);
+
+  uint8_t count(void) { return numChannels; }
+  // The made-up address of channel n, for the sensor registry
+  void address(uint8_t n, byte *addr);
+
+  private:
+  const analog_channel_t *channels;
+  uint8_t numChannels;
+  uint16_t vref_mv;
+};
+
+#endif
@@ -0,0 +1,196 @@
+from __future__ import print_function
+import struct
+
+# Reference encoder/decoder for the Greenhouse_DAQ UDP protocol.
+# See the comment above sendBatch() in Greenhouse_DAQ.ino for the packet formats.
+
+PORT = 40100
+
+PACKET_DATA = 0xD1
+PACKET_SUMMARY = 0xD2
+PACKET_ACK = 0xA1
+PACKET_TIME_REQUEST = 0xC1
+PACKET_TIME_REPLY = 0xC2
+
+DATA_HEADER = struct.Struct('<BBBBII')
+ACK = struct.Struct('<BII')
+SUMMARY_STATS = struct.Struct('<hhhI')
+# Timestamps are (seconds, microseconds) pairs
+TIME_REQUEST = struct.Struct('<BII')
+TIME_REPLY = struct.Struct('<BIIIIII')
+
+# A sensor without a reading (e.g. one that has been disconnected) is sent as this,
+# and decoded as None
+NO_READING = -32768
+
+def is_binary(packet):
+	return len(packet) > 0 and bytearray(packet[:1])[0] in (PACKET_DATA, PACKET_SUMMARY, PACKET_ACK)
+
+def put_varint(v):
+	out = bytearray()
+	while v >= 0x80:
+		out.append((v & 0x7f) | 0x80)
+		v >>= 7
+	out.append(v)
+	return bytes(out)
+
+def get_varint(data, pos):
+	# Returns (value, new position)
+	v = shift = 0
+	while True:
+		if pos >= len(data):
+			raise ValueError('Truncated varint')
+		b = bytearray(data[pos : pos + 1])[0]
+		pos += 1
+		v |= (b & 0x7f) << shift
+		shift += 7
+		if not b & 0x80:
+			return (v & 0xffffffff, pos)
+		if shift > 28:
+			raise ValueError('Varint too long')
+
+def to_q8(t):
+	return NO_READING if t is None else int(round(t * 256))
+
+def from_q8(v):
+	return None if v == NO_READING else v / 256.0
+
+def encode_data(readings):
+	# readings is a list of (seq, time, temps) with consecutive sequence numbers,
+	# and temps a list of degrees C (or None)
+	(seq, time, temps) = readings[0]
+	out = DATA_HEADER.pack(PACKET_DATA, len(temps), len(readings), 0, seq, time)
+	last = time
+	for (seq, time, temps) in readings:
+		out += put_varint((time - last) & 0xffffffff)
+		out += struct.pack('<%dh' % len(temps), *[to_q8(t) for t in temps])
+		last = time
+	return out
+
+def encode_summary(summaries, samples):
+	# summaries is a list of (seq, time, stats), with stats a list of
+	# (mean, min, max, variance) per sensor, in degrees C and C^2, or None
+	(seq, time, stats) = summaries[0]
+	out = DATA_HEADER.pack(PACKET_SUMMARY, len(stats), len(summaries), samples, seq, time)
+	last = time
+	for (seq, time, stats) in summaries:
+		out += put_varint((time - last) & 0xffffffff)
+		for s in stats:
+			(mean, lo, hi, var) = s if s is not None else (None, None, None, 0)
+			out += SUMMARY_STATS.pack(to_q8(mean), to_q8(lo), to_q8(hi), int(round(var * 65536)))
+		last = time
+	return out
+
+def decode_data(packet):
+	# The inverse of encode_data() and encode_summary(); raises ValueError for
+	# malformed packets. Temperatures are exact, since they're multiples of 1/256.
+	# For summary packets, each reading's values are (mean, min, max, variance) tuples.
+	if len(packet) < DATA_HEADER.size:
+		raise ValueError('Packet too short')
+	(kind, sensors, count, samples, seq, time) = DATA_HEADER.unpack_from(packet, 0)
+	if kind not in (PACKET_DATA, PACKET_SUMMARY):
+		raise ValueError('Not a data packet')
+	size = 2 if kind == PACKET_DATA else SUMMARY_STATS.size
+
+	pos = DATA_HEADER.size
+	readings = []
+	for i in range(0, count):
+		(delta, pos) = get_varint(packet, pos)
+		time = (time + delta) & 0xffffffff
+		if pos + size * sensors > len(packet):
+			raise ValueError('Packet too short')
+		if kind == PACKET_DATA:
+			values = [from_q8(t) for t in struct.unpack_from('<%dh' % sensors, packet, pos)]
+		else:
+			values = []
+			for j in range(0, sensors):
+				(mean, lo, hi, var) = SUMMARY_STATS.unpack_from(packet, pos + j * size)
+				values.append(None if mean == NO_READING else (mean / 256.0, lo / 256.0, hi / 256.0, var / 65536.0))
+		pos += size * sensors
+		readings.append(((seq + i) & 0xffffffff, time, values))
+	if pos != len(packet):
+		raise ValueError('Trailing data')
+	return readings
+
+def encode_ack(seq, time):
+	return ACK.pack(PACKET_ACK, seq, time)
+
+def decode_ack(packet):
+	(kind, seq, time) = ACK.unpack(packet)
+	if kind != PACKET_ACK:
+		raise ValueError('Not an ack packet')
+	return (seq, time)
+
+def decode_ascii(packet):
+	# One reading per line: "<temp 0>:<temp 1> SEQ <seq> [TIME <time>]", temperatures
+	# in degrees C * 10000, or U if missing. Older firmware sends no TIME, which is
+	# returned as 0.
+	readings = []
+	for line in packet.decode('ascii').splitlines():
+		fields = line.split()
+		if len(fields) not in (3, 5) or fields[1] != 'SEQ' or (len(fields) == 5 and fields[3] != 'TIME'):
+			raise ValueError('Malformed line: {0!r}'.format(line))
+		temps = [None if t == 'U' else int(t) / 10000.0 for t in fields[0].split(':')]
+		time = int(fields[4]) if len(fields) == 5 else 0
+		readings.append((int(fields[2]), time, temps))
+	if not readings:
+		raise ValueError('Empty packet')
+	return readings
+
+def encode_ascii_ack(first, last, time):
+	if first == last:
+		return 'OK SEQ {0} TIME {1}'.format(first, time).encode('ascii')
+	return 'OK SEQ {0}-{1} TIME {2}'.format(first, last, time).encode('ascii')
+
+def decode_ascii_ack(packet):
+	# The inverse of encode_ascii_ack(); returns (first, last, time)
+	fields = packet.decode('ascii', 'replace').split()
+	if len(fields) != 5 or fields[0] != 'OK' or fields[1] != 'SEQ' or fields[3] != 'TIME':
+		raise ValueError('Not an ack: {0!r}'.format(packet))
+	try:
+		(first, _, last) = fields[2].partition('-')
+		return (int(first), int(last or first), int(fields[4]))
+	except ValueError:
+		raise ValueError('Not an ack: {0!r}'.format(packet))
+
+def to_timestamp(t):
+	# From a time.time() value
+	sec = int(t)
+	return (sec, min(int(round((t - sec) * 1000000)), 999999))
+
+def from_timestamp(ts):
+	return ts[0] + ts[1] / 1000000.0
+
+def is_time_request(packet):
+	return len(packet) == TIME_REQUEST.size and bytearray(packet[:1])[0] == PACKET_TIME_REQUEST
+
+def encode_time_request(t1):
+	return TIME_REQUEST.pack(PACKET_TIME_REQUEST, *t1)
+
+def time_reply(request, t2, t3):
+	# The reply to a time request (which arrived at t2), sent at t3; see clockTask()
+	# in Greenhouse_DAQ.ino. The timestamps are time.time() values, and the reply should
+	# be sent right after this is called.
+	(kind, sec, usec) = TIME_REQUEST.unpack(request)
+	if kind != PACKET_TIME_REQUEST:
+		raise ValueError('Not a time request')
+	return TIME_REPLY.pack(PACKET_TIME_REPLY, sec, usec, *(to_timestamp(t2) + to_timestamp(t3)))
+
+def decode_time_reply(packet):
+	# Returns (t1, t2, t3) as timestamps
+	v = TIME_REPLY.unpack(packet)
+	if v[0] != PACKET_TIME_REPLY:
+		raise ValueError('Not a time reply')
+	return (v[1:3], v[3:5], v[5:7])
+
+def decode(packet):
+	# Decodes a data packet in either format. Returns (readings, binary)
+	if is_binary(packet):
+		return (decode_data(packet), True)
+	return (decode_ascii(packet), False)
+
+def answer(readings, binary, time):
+	# The acknowledgement the DAQ expects for a data packet
+	if binary:
+		return encode_ack(readings[-1][0], time)
+	return encode_ascii_ack(readings[0][0], readings[-1][0], time)
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+import sys, time, asyncio, argparse
+import daq_protocol
+
+# Ingest server for many Greenhouse_DAQ nodes: speaks the same protocol as receiver.py
+# (PING, time requests, and data packets in either format), but asynchronously, keeping track of each
+# node by address and port, and storing nothing. Meant as a reference for the real
+# server, and as the target of load_generator.py.
+#
+# Requires Python 3.7+ (asyncio).
+
+def seq_after(a, b):
+	# Sequence numbers wrap around, like in the DAQ
+	return 0 < (a - b) & 0xffffffff < 0x80000000
+
+class Node:
+	def __init__(self):
+		self.last_seq = None # the last reading stored
+		self.packets = 0
+		self.readings = 0
+		self.duplicates = 0
+		self.last_seen = 0
+
+class IngestProtocol(asyncio.DatagramProtocol):
+	def __init__(self, verbose):
+		self.verbose = verbose
+		self.nodes = {}
+		self.packets = 0
+		self.readings = 0
+		self.duplicates = 0
+		self.bad = 0
+
+	def connection_made(self, transport):
+		self.transport = transport
+
+	def datagram_received(self, packet, addr):
+		arrival = time.time()
+		self.packets += 1
+		if daq_protocol.is_time_request(packet):
+			self.transport.sendto(daq_protocol.time_reply(packet, arrival, time.time()), addr)
+			return
+		if packet.startswith(b'PING'):
+			self.transport.sendto(b'PONG', addr)
+			return
+		if packet.startswith(b'PANIC'):
+			self.transport.sendto(b'OK', addr)
+			print('{0}:{1}: {2}'.format(addr[0], addr[1], packet.decode('ascii', 'replace')))
+			return
+
+		try:
+			(readings, binary) = daq_protocol.decode(packet)
+		except (ValueError, UnicodeDecodeError) as e:
+			self.bad += 1
+			if self.verbose:
+				print('{0}:{1}: bad packet ({2})'.format(addr[0], addr[1], e), file = sys.stderr)
+			return
+
+		now = int(time.time())
+		self.transport.sendto(daq_protocol.answer(readings, binary, now), addr)
+
+		node = self.nodes.get(addr)
+		if node is None:
+			node = self.nodes[addr] = Node()
+		node.packets += 1
+		node.last_seen = now
+		for (seq, t, values) in readings:
+			# Readings are resent if an answer is lost, so anything at or before the last
+			# stored one is a duplicate
+			if node.last_seq is not None and not seq_after(seq, node.last_seq):
+				node.duplicates += 1
+				self.duplicates += 1
+				continue
+			node.last_seq = seq
+			node.readings += 1
+			self.readings += 1
+			if self.verbose:
+				print('{0}:{1}: SEQ {2} TIME {3} {4}'.format(addr[0], addr[1], seq, t, values))
+
+async def report(proto, interval):
+	last = (time.monotonic(), 0, 0)
+	while True:
+		await asyncio.sleep(interval)
+		now = time.monotonic()
+		elapsed = now - last[0]
+		print('{0} nodes, {1:.0f} packets/s, {2:.0f} readings/s ({3} duplicates, {4} bad packets so far)'.format(
+			len(proto.nodes), (proto.packets - last[1]) / elapsed, (proto.readings - last[2]) / elapsed,
+			proto.duplicates, proto.bad))
+		last = (now, proto.packets, proto.readings)
+
+async def serve(args):
+	loop = asyncio.get_running_loop()
+	(transport, proto) = await loop.create_datagram_endpoint(
+		lambda: IngestProtocol(args.verbose), local_addr = (args.bind, args.port))
+	print('Listening on UDP port {0}'.format(args.port))
+	try:
+		await report(proto, args.interval)
+	finally:
+		transport.close()
+
+def main(argv):
+	parser = argparse.ArgumentParser(description = 'Greenhouse_DAQ ingest server')
+	parser.add_argument('-p', '--port', type = int, default = daq_protocol.PORT)
+	parser.add_argument('-b', '--bind', default = '0.0.0.0', help = 'address to listen on')
+	parser.add_argument('-i', '--interval', type = float, default = 5, help = 'seconds between statistics')
+	parser.add_argument('-v', '--verbose', action = 'store_true', help = 'print every reading')
+	args = parser.parse_args(argv[1:])
+	asyncio.run(serve(args))
+
+if __name__ == '__main__':
+	try:
+		sys.exit(main(sys.argv))
+	except KeyboardInterrupt:
+		pass
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+import sys, time, random, asyncio, argparse, resource
+import daq_protocol
+
+# Load generator for ingest_server.py (or any server speaking the Greenhouse_DAQ
+# protocol): emulates many DAQ nodes, each with its own socket. A node finds the server
+# with a PING, and then sends a batch of readings every interval, waiting for the answer
+# (and resending after a timeout) like the real thing. Reports the packet rate and the
+# ACK latency.
+#
+# E.g. 2000 nodes, each sending 4 readings per second in the binary format:
+#   ./load_generator.py -n 2000 -r 4 -b 1
+#
+# Requires Python 3.7+ (asyncio).
+
+# As in the DAQ
+ACK_TIMEOUT = 2.0 # seconds
+BATCH_BYTES = 1400
+
+def batch_limit(sensors, ascii):
+	# Readings per packet, counting the most each can take (no aggregation)
+	if ascii:
+		return min(BATCH_BYTES // (12 * sensors + 32), 255)
+	return min((BATCH_BYTES - 12) // (5 + 2 * sensors), 255)
+
+class Stats:
+	def __init__(self):
+		self.sent = 0
+		self.acked = 0
+		self.timeouts = 0
+		self.latencies = []
+		# Set when it's time to stop; wait_for() can swallow a cancellation (before Python
+		# 3.12), so the nodes check this as well
+		self.stopping = False
+
+class NodeProtocol(asyncio.DatagramProtocol):
+	def __init__(self):
+		self.answers = asyncio.Queue()
+
+	def datagram_received(self, packet, addr):
+		self.answers.put_nowait(packet)
+
+	def error_received(self, exc):
+		# E.g. ICMP port unreachable, if the server isn't running
+		pass
+
+def percentile(values, p):
+	if not values:
+		return float('nan')
+	values = sorted(values)
+	return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+class Node:
+	def __init__(self, args, stats, server):
+		self.args = args
+		self.stats = stats
+		self.server = server
+		self.seq = random.randrange(0, 1 << 32)
+		self.temps = [random.uniform(5, 35) for i in range(0, args.sensors)]
+
+	def reading(self):
+		# A random walk, in whole 1/16 C steps like a DS18x20
+		self.temps = [round((t + random.uniform(-0.1, 0.1)) * 16) / 16.0 for t in self.temps]
+		r = (self.seq, int(time.time()), list(self.temps))
+		self.seq = (self.seq + 1) & 0xffffffff
+		return r
+
+	def encode(self, readings):
+		if self.args.ascii:
+			lines = []
+			for (seq, t, temps) in readings:
+				values = ':'.join(str(int(round(v * 10000))) for v in temps)
+				lines.append('{0} SEQ {1} TIME {2}\n'.format(values, seq, t))
+			return ''.join(lines).encode('ascii')
+		return daq_protocol.encode_data(readings)
+
+	def is_answer(self, packet, readings):
+		try:
+			if self.args.ascii:
+				return daq_protocol.decode_ascii_ack(packet)[:2] == (readings[0][0], readings[-1][0])
+			return daq_protocol.decode_ack(packet)[0] == readings[-1][0]
+		except ValueError:
+			return False
+
+	async def exchange(self, packet, check):
+		# Sends a packet, and waits for an answer that passes check(); returns the round trip
+		# time in seconds, or None on a timeout
+		self.stats.sent += 1
+		start = time.monotonic()
+		self.transport.sendto(packet)
+		deadline = start + ACK_TIMEOUT
+		while True:
+			remaining = deadline - time.monotonic()
+			if remaining <= 0:
+				self.stats.timeouts += 1
+				return None
+			try:
+				answer = await asyncio.wait_for(self.proto.answers.get(), remaining)
+			except asyncio.TimeoutError:
+				self.stats.timeouts += 1
+				return None
+			if check(answer):
+				return time.monotonic() - start
+			# A late answer to something that already timed out; ignore it
+
+	async def run(self):
+		loop = asyncio.get_running_loop()
+		(self.transport, self.proto) = await loop.create_datagram_endpoint(NodeProtocol, remote_addr = self.server)
+		try:
+			# Spread the nodes out over the first interval, like nodes booting at random times
+			await asyncio.sleep(random.uniform(0, self.args.interval))
+			while await self.exchange(b'PING', lambda p: p.startswith(b'PONG')) is None:
+				if self.stats.stopping:
+					return
+
+			backlog = []
+			next_send = time.monotonic()
+			while not self.stats.stopping:
+				backlog.extend(self.reading() for i in range(0, self.args.batch))
+				batch = backlog[:batch_limit(self.args.sensors, self.args.ascii)]
+				rtt = await self.exchange(self.encode(batch), lambda p: self.is_answer(p, batch))
+				if rtt is not None:
+					self.stats.acked += 1
+					self.stats.latencies.append(rtt)
+					del backlog[:len(batch)]
+				next_send += self.args.interval
+				await asyncio.sleep(max(0, next_send - time.monotonic()))
+		finally:
+			self.transport.close()
+
+async def report(stats, interval, duration):
+	start = last_time = time.monotonic()
+	last_sent = last_acked = 0
+	while True:
+		await asyncio.sleep(interval)
+		now = time.monotonic()
+		elapsed = now - last_time
+		latencies = stats.latencies
+		stats.latencies = []
+		print('{0:.0f} packets/s sent, {1:.0f} acked/s, ACK latency p50 {2:.2f} ms, p99 {3:.2f} ms ({4} timeouts so far)'.format(
+			(stats.sent - last_sent) / elapsed, (stats.acked - last_acked) / elapsed,
+			percentile(latencies, 50) * 1000, percentile(latencies, 99) * 1000, stats.timeouts))
+		(last_time, last_sent, last_acked) = (now, stats.sent, stats.acked)
+		if duration and now - start >= duration:
+			return
+
+async def generate(args):
+	stats = Stats()
+	server = (args.server, args.port)
+	nodes = [asyncio.ensure_future(Node(args, stats, server).run()) for i in range(0, args.nodes)]
+	try:
+		await report(stats, args.report, args.duration)
+	finally:
+		stats.stopping = True
+		for n in nodes:
+			n.cancel()
+		await asyncio.gather(*nodes, return_exceptions = True)
+
+def main(argv):
+	parser = argparse.ArgumentParser(description = 'Greenhouse_DAQ load generator')
+	parser.add_argument('-s', '--server', default = '127.0.0.1')
+	parser.add_argument('-p', '--port', type = int, default = daq_protocol.PORT)
+	parser.add_argument('-n', '--nodes', type = int, default = 100, help = 'number of nodes to emulate')
+	parser.add_argument('-r', '--rate', type = float, default = 1, help = 'packets per second per node')
+	parser.add_argument('-b', '--batch', type = int, default = 1, help = 'readings per packet')
+	parser.add_argument('-c', '--sensors', type = int, default = 2, help = 'sensors per node')
+	parser.add_argument('-a', '--ascii', action = 'store_true', help = 'use the ASCII format')
+	parser.add_argument('-d', '--duration', type = float, default = 0, help = 'seconds to run (0: forever)')
+	parser.add_argument('-i', '--report', type = float, default = 5, help = 'seconds between statistics')
+	args = parser.parse_args(argv[1:])
+	args.interval = 1.0 / args.rate
+
+	# One socket per node
+	(soft, hard) = resource.getrlimit(resource.RLIMIT_NOFILE)
+	if soft != resource.RLIM_INFINITY and soft < args.nodes + 64:
+		want = args.nodes + 64 if hard == resource.RLIM_INFINITY else min(hard, args.nodes + 64)
+		resource.setrlimit(resource.RLIMIT_NOFILE, (want, hard))
+		if want < args.nodes + 64:
+			print('WARNING: the open file limit ({0}) is too low for {1} nodes'.format(hard, args.nodes), file = sys.stderr)
+
+	asyncio.run(generate(args))
+
+if __name__ == '__main__':
+	try:
+		sys.exit(main(sys.argv))
+	except KeyboardInterrupt:
+		pass
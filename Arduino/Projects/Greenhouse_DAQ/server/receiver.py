@@ -0,0 +1,54 @@
+from __future__ import print_function
+import sys, socket, time
+import daq_protocol
+
+# A minimal stand-in for the real server: answers PING and time requests, and acknowledges and prints
+# every reading it receives, in either packet format. Handy for testing the DAQ (or
+# load_generator.py) without the RRD setup.
+
+def format_value(v):
+	if v is None:
+		return '-'
+	if isinstance(v, tuple):
+		(mean, lo, hi, var) = v
+		return '{0:.4f} ({1:.4f} - {2:.4f}, sd {3:.4f})'.format(mean, lo, hi, var ** 0.5)
+	return '{0:.4f}'.format(v)
+
+def main(argv):
+	port = int(argv[1]) if len(argv) > 1 else daq_protocol.PORT
+	s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	s.bind(('', port))
+	print('Listening on UDP port {0}'.format(port))
+
+	while True:
+		(packet, addr) = s.recvfrom(2048)
+		arrival = time.time()
+		if daq_protocol.is_time_request(packet):
+			s.sendto(daq_protocol.time_reply(packet, arrival, time.time()), addr)
+			continue
+		if packet.startswith(b'PING'):
+			s.sendto(b'PONG', addr)
+			print('{0}: PING'.format(addr[0]))
+			continue
+		if packet.startswith(b'PANIC'):
+			s.sendto(b'OK', addr)
+			print('{0}: {1}'.format(addr[0], packet.decode('ascii', 'replace')))
+			continue
+
+		try:
+			(readings, binary) = daq_protocol.decode(packet)
+		except ValueError as e:
+			print('{0}: bad packet ({1}): {2!r}'.format(addr[0], e, packet), file = sys.stderr)
+			continue
+
+		s.sendto(daq_protocol.answer(readings, binary, int(time.time())), addr)
+		for (seq, t, values) in readings:
+			text = '  '.join(format_value(v) for v in values)
+			print('{0}: SEQ {1} TIME {2} {3}'.format(addr[0], seq, t, text))
+
+if __name__ == '__main__':
+	try:
+		sys.exit(main(sys.argv))
+	except KeyboardInterrupt:
+		pass
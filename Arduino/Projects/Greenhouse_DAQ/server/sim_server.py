@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+from __future__ import print_function
+import sys, argparse, binascii
+import daq_protocol
+
+# The server, as the network of a simulated DAQ:
+#   Simulator/sketchsim.py Projects/Greenhouse_DAQ --udp-peer 'server/sim_server.py ...'
+# Answers as receiver.py does, but in the simulator's virtual time, and can be taken down for
+# a while, to see the DAQ's backlog and server discovery at work; its clock can drift and
+# jump, for the DAQ's clock sync. Every packet is in the
+# simulator's timeline; this only answers them. See Simulator/core/Ethernet.cpp for the lock
+# step protocol on stdin and stdout.
+
+def parse_range(s):
+	(start, _, end) = s.partition('-')
+	return (float(start) if start else 0.0, float(end) if end else float('inf'))
+
+def parse_jump(s):
+	(at, _, by) = s.partition('=')
+	return (float(at), float(by))
+
+class SimServer:
+	def __init__(self, args):
+		self.args = args
+		self.down = [parse_range(r) for r in args.down]
+		self.jumps = [parse_jump(j) for j in args.jump]
+
+	def is_down(self, t):
+		return any(start <= t < end for (start, end) in self.down)
+
+	def server_time(self, t):
+		# The server's clock, at virtual time t. The DAQ's crystal being off by -PPM looks the
+		# same to it as the server's clock running fast by PPM, which is simpler to do here.
+		return self.args.epoch + t * (1 + self.args.drift / 1e6) + sum(by for (at, by) in self.jumps if at <= t)
+
+	def answer(self, packet, t):
+		# The answer to a packet that arrives at virtual time t, if any
+		if daq_protocol.is_time_request(packet):
+			return daq_protocol.time_reply(packet, self.server_time(t), self.server_time(t + self.args.turnaround / 1e6))
+		if packet.startswith(b'PING'):
+			return b'PONG'
+		if packet.startswith(b'PANIC'):
+			return b'OK'
+		try:
+			(readings, binary) = daq_protocol.decode(packet)
+		except (ValueError, UnicodeDecodeError) as e:
+			print('sim_server: bad packet ({0}): {1!r}'.format(e, packet), file = sys.stderr)
+			return None
+		if self.args.verbose:
+			for (seq, time, values) in readings:
+				print('sim_server: {0:.3f}: SEQ {1} TIME {2} {3}'.format(t, seq, time, values), file = sys.stderr)
+		return daq_protocol.answer(readings, binary, int(self.server_time(t)))
+
+	def handle(self, fields):
+		# "send <us> <srcip> <srcport> <dstip> <dstport> <hex>"; returns the lines to answer with
+		(us, srcip, srcport, dstip, dstport, data) = fields
+		t = int(us) / 1e6
+		broadcast = dstip.endswith('.255')
+		if dstip != self.args.ip and not broadcast:
+			return ['arpfail'] # nobody there
+		if self.is_down(t):
+			return [] if broadcast else ['arpfail']
+		if int(dstport) != self.args.port:
+			return []
+
+		packet = binascii.unhexlify(data) if data != '-' else b''
+		delay = self.args.delay
+		reply = self.answer(packet, t + delay / 1e6)
+		if reply is None:
+			return []
+		return ['recv {0} {1} {2} {3} {4}'.format(2 * delay + self.args.turnaround, self.args.ip,
+			self.args.port, srcport, binascii.hexlify(reply).decode('ascii'))]
+
+def main(argv):
+	parser = argparse.ArgumentParser(description = 'Greenhouse_DAQ server, for the simulator')
+	parser.add_argument('--ip', default = '192.168.1.10', help = "the server's address")
+	parser.add_argument('-p', '--port', type = int, default = daq_protocol.PORT)
+	parser.add_argument('--down', action = 'append', default = [], metavar = 'FROM-TO',
+		help = 'virtual seconds during which the server is off (repeatable; TO may be left out)')
+	parser.add_argument('--epoch', type = float, default = 1350000000.0,
+		help = "the server's UNIX time at virtual time 0")
+	parser.add_argument('--drift', type = float, default = 0.0,
+		help = "how fast the server's clock runs, in ppm, against the DAQ's (i.e. the DAQ's crystal is off by minus this)")
+	parser.add_argument('--jump', action = 'append', default = [], metavar = 'AT=SECONDS',
+		help = "set the server's clock forward (or back) by SECONDS at virtual second AT (repeatable)")
+	parser.add_argument('--delay', type = int, default = 300, help = 'one-way network delay, in us')
+	parser.add_argument('--turnaround', type = int, default = 100, help = "the server's time to answer, in us")
+	parser.add_argument('-v', '--verbose', action = 'store_true', help = 'print every reading on stderr')
+	server = SimServer(parser.parse_args(argv[1:]))
+
+	for line in sys.stdin:
+		fields = line.split()
+		if not fields:
+			continue
+		if fields[0] != 'send' or len(fields) != 7:
+			print('sim_server: unexpected line: {0!r}'.format(line), file = sys.stderr)
+			lines = []
+		else:
+			lines = server.handle(fields[1:])
+		sys.stdout.write(''.join(l + '\n' for l in lines) + 'end\n')
+		sys.stdout.flush()
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))
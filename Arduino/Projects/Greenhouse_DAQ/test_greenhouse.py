@@ -0,0 +1,491 @@
+from __future__ import print_function, division
+import unittest, sys, os, re, math, shutil, tempfile, binascii, shlex
+
+# Host tests for the DAQ, on the simulator: python -m unittest test_greenhouse
+# The sketch runs with simulated sensors, and server/sim_server.py as the server; what
+# went over the 1-Wire bus and the network is checked from the timeline.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', 'Simulator'))
+sys.path.insert(0, os.path.join(HERE, 'server'))
+import sketchsim, daq_protocol
+
+F_CPU = 16000000
+SIM_SERVER = os.path.join(HERE, 'server', 'sim_server.py')
+SERVER_IP = '192.168.1.10'
+EPOCH = 1350000000 # sim_server.py's time at the start of the run
+BACKLOG_SIZE = 16
+BATCH_BYTES = 1400
+
+# Sensors 0 and 1 (knownSensors[]), and a DS18B20 that is registered as sensor 2 when found
+S0 = '10-0008028d5d66'
+S1 = '10-0008028dbd88'
+B0 = '28-00000abcdef1'
+
+builds = {}
+
+def build(defines = {}):
+	key = tuple(sorted(defines.items()))
+	if key not in builds:
+		builds[key] = sketchsim.build(HERE, defines)
+	return builds[key]
+
+class Run(object):
+	# A run of the DAQ: its serial output, and the timeline with times in seconds
+	def __init__(self, serial, events):
+		self.serial = serial
+		self.events = [(t / F_CPU, kind, f) for (t, kind, f) in events]
+
+	def registered(self):
+		# The IDs the sensors found on the bus were registered as, by their ROM (as
+		# --onewire names them); sensors 0 and 1 are registered from the start
+		ids = { S0: 0, S1: 1 }
+		for (rom, id) in re.findall(r'New sensor ([0-9a-f:]+) registered as sensor (\d+)', self.serial):
+			b = rom.split(':')
+			ids[b[0] + '-' + ''.join(reversed(b[1:7]))] = int(id)
+		return ids
+
+	def onewire(self, what):
+		# (time, sensor, fields) for each 1-Wire command of this kind
+		return [(t, f[0], f[2:]) for (t, kind, f) in self.events if kind == 'onewire' and f[1] == what]
+
+	def sent(self):
+		# (time, destination IP, payload) for each packet the DAQ sent
+		return [(t, f[2], binascii.unhexlify(f[4]) if f[4] != '-' else b'')
+			for (t, kind, f) in self.events if kind == 'udp' and f[0] == 'send']
+
+	def received(self):
+		# (time, payload) for each packet the DAQ received
+		return [(t, binascii.unhexlify(f[4]) if f[4] != '-' else b'')
+			for (t, kind, f) in self.events if kind == 'udp' and f[0] == 'recv']
+
+	def packets(self):
+		# (time, payload) for each data (or summary) packet sent
+		return [(t, p) for (t, ip, p) in self.sent() if p[:1] in (b'\xd1', b'\xd2')]
+
+	def data(self):
+		# (time, readings) for each data packet sent, decoded as the server does
+		return [(t, daq_protocol.decode_data(p)) for (t, p) in self.packets()]
+
+	def delivered(self, down = []):
+		# The readings that reached the server, i.e. were sent while it was up
+		return [reading for (t, readings) in self.data() if not any(a <= t < b for (a, b) in down)
+			for reading in readings]
+
+	def samples(self):
+		# The start of each sample, i.e. the conversions that aren't retries
+		converts = sorted(set(t for (t, sensor, f) in self.onewire('convert')))
+		return [t for (i, t) in enumerate(converts) if i == 0 or t - converts[i - 1] > 2]
+
+def run(seconds, sensors, server = [], defines = {}, eeprom = None, args = []):
+	# Runs the DAQ for a while with the given sensors (as --onewire takes them), and the
+	# server started with the given options; eeprom is the internal EEPROM's image
+	exe = build(defines)
+	d = tempfile.mkdtemp()
+	try:
+		timeline = os.path.join(d, 'timeline.txt')
+		peer = ' '.join(shlex.quote(a) for a in [sys.executable, SIM_SERVER] + list(server))
+		cmd = ['--time', str(seconds), '--timeline', timeline, '--quiet', '--udp-peer', peer,
+			'--eeprom', eeprom or os.path.join(d, 'eeprom.bin')]
+		for s in sensors:
+			cmd += ['--onewire', s]
+		(rc, out, err) = sketchsim.run(exe, cmd + list(args), timeout = 300)
+		if rc != 0:
+			raise AssertionError('the run failed ({0}): {1}'.format(rc, err))
+		return Run(out.decode('ascii', 'replace'), sketchsim.read_timeline(timeline))
+	finally:
+		shutil.rmtree(d)
+
+class ParallelConversionTest(unittest.TestCase):
+	def test_one_conversion_for_all(self):
+		sensors = (S0, S1, B0)
+		r = run(45, [S0 + '=21.5', S1 + '=19.25', B0 + '=18'])
+		converts = {}
+		for (t, sensor, f) in r.onewire('convert'):
+			converts.setdefault(t, set()).add(sensor)
+		# A sample every 10 s, plus the retry after boot; each a single CONVERT T to all sensors
+		self.assertGreaterEqual(len(converts), 5)
+		for (t, started) in converts.items():
+			self.assertEqual(started, set(sensors), 'at {0:.3f} s'.format(t))
+
+		# Each sensor is read once per conversion, once the slowest one is done: the whole
+		# round takes a single conversion time (plus the reads, and any warnings printed
+		# in between), rather than one per sensor
+		reads = r.onewire('read')
+		starts = sorted(converts) + [float('inf')]
+		for (start, end) in zip(starts, starts[1:]):
+			these = [(t, sensor) for (t, sensor, f) in reads if start < t < end]
+			self.assertEqual(sorted(sensor for (t, sensor) in these), sorted(sensors))
+			self.assertGreaterEqual(min(t for (t, sensor) in these) - start, 0.75)
+			self.assertLess(max(t for (t, sensor) in these) - start, 1.5)
+
+class TaskLoopTest(unittest.TestCase):
+	def test_every_reading_sent(self):
+		# The first reading after boot is always converted twice (it looks like an outlier,
+		# compared to nothing); it must still make it, and so must all the others, in order
+		r = run(125, [S0 + '=21.5', B0 + '=18'])
+		seqs = [reading[0] for (t, readings) in r.data() for reading in readings]
+		self.assertEqual(seqs, list(range(0, 13)))
+		for (t, readings) in r.data():
+			for (seq, time, temps) in readings:
+				self.assertEqual(temps, [21.5, None, 18.0])
+
+	def test_sample_grid(self):
+		# Samples stay on a fixed 10 s grid, however long the rest takes, and whether or not
+		# the server answers (nothing waits for it)
+		for server in ([], ['--down', '0-']):
+			r = run(125, [S0 + '=21.5', B0 + '=18'], server)
+			samples = r.samples() # the first is as soon as the sensors have been found
+			self.assertEqual(len(samples), 13, server)
+			for (a, b) in zip(samples[1:], samples[2:]):
+				self.assertAlmostEqual(b - a, 10.0, delta = 0.11)
+			# Reading the sensors and sending the reading only take a moment after the
+			# conversion (the first sample is converted twice)
+			if not server:
+				for (sample, (t, readings)) in zip(samples[1:], r.data()[1:]):
+					self.assertLess(t - sample, 1.5)
+
+class BacklogTest(unittest.TestCase):
+	SENSORS = [S0 + '=21.5', B0 + '=18']
+
+	def check_times(self, r, readings):
+		# Readings keep the time their conversion started, however long ARP timeouts held
+		# up reading and storing them while the server was away, and however late they're sent
+		samples = r.samples()
+		for (seq, time, temps) in readings:
+			self.assertTrue(-1 < time - (EPOCH + samples[seq]) < 1, 'reading {0}: {1}'.format(seq, time - EPOCH))
+
+	def test_outage(self):
+		# A minute without the server: the readings are sent once it's back, in order, once each
+		down = [(15, 75)]
+		r = run(150, self.SENSORS, ['--down', '15-75'])
+		readings = r.delivered(down)
+		self.assertEqual([seq for (seq, time, temps) in readings], list(range(0, len(r.samples()))))
+		self.check_times(r, readings)
+
+	def test_overflow(self):
+		# Longer than the backlog holds: the oldest readings are dropped, and the newest
+		# BACKLOG_SIZE are sent when the server is found again
+		down = [(15, 400)]
+		r = run(520, self.SENSORS, ['--down', '15-400'])
+		seqs = [seq for (seq, time, temps) in r.delivered(down)]
+		self.assertEqual(len(seqs), len(set(seqs)))
+		self.assertEqual(seqs, sorted(seqs))
+		dropped = int(re.findall(r'Reconnected after \d+ s; (\d+) readings dropped', r.serial)[-1])
+		missing = sorted(set(range(0, len(r.samples()))) - set(seqs))
+		self.assertGreater(dropped, 0)
+		self.assertEqual(missing, list(range(missing[0], missing[0] + dropped)))
+		first = [readings for (t, readings) in r.data() if t >= 400][0]
+		self.assertEqual([seq for (seq, time, temps) in first], list(range(missing[-1] + 1, missing[-1] + 1 + BACKLOG_SIZE)))
+		self.check_times(r, r.delivered(down))
+
+	def test_eeprom_spill(self):
+		# With BACKLOG_EEPROM, the same outage loses nothing...
+		d = tempfile.mkdtemp()
+		try:
+			defines = { 'BACKLOG_EEPROM': '1' }
+			image = os.path.join(d, 'spill.bin')
+			spill = ['--i2c-eeprom', '24LC1025@0x50=' + image]
+			down = [(15, 400)]
+			r = run(520, self.SENSORS, ['--down', '15-400'], defines, args = spill)
+			readings = r.delivered(down)
+			self.assertEqual([seq for (seq, time, temps) in readings], list(range(0, len(r.samples()))))
+			self.check_times(r, readings)
+
+			# ... and what was spilled survives a reset (what was still in RAM doesn't),
+			# with the sequence numbers carrying on after it
+			os.remove(image)
+			eeprom = os.path.join(d, 'eeprom.bin')
+			before = run(300, self.SENSORS, ['--down', '15-'], defines, eeprom, spill)
+			after = run(60, self.SENSORS, [], defines, eeprom, spill)
+			recovered = int(re.search(r'(\d+) readings recovered', after.serial).group(1))
+			self.assertEqual(recovered, len(before.samples()) - 2 - BACKLOG_SIZE) # 2 were sent
+			seqs = [seq for (seq, time, temps) in after.delivered()]
+			self.assertEqual(seqs, list(range(2, 2 + recovered + len(after.samples()))))
+		finally:
+			shutil.rmtree(d)
+
+class BinaryPacketTest(unittest.TestCase):
+	def test_packets(self):
+		# Samples 150 s apart, so that the deltas in a batch take two varint bytes; a negative
+		# temperature, and a registered sensor that's missing
+		r = run(1000, [S0 + '=21.5625', B0 + '=-3.75'], ['--down', '15-700'], { 'SAMPLE_INTERVAL': '1500' })
+		packets = [(t, p) for (t, ip, p) in r.sent() if p[:1] == b'\xd1']
+		self.assertGreater(len(packets), 3)
+		for (t, p) in packets:
+			(kind, sensors, count, reserved, seq, time) = daq_protocol.DATA_HEADER.unpack_from(p, 0)
+			self.assertEqual((kind, sensors, reserved), (daq_protocol.PACKET_DATA, 3, 0))
+			readings = daq_protocol.decode_data(p) # checks the length, too
+			for (seq, time, temps) in readings:
+				self.assertEqual(temps, [21.5625, None, -3.75])
+			for (a, b) in zip(readings, readings[1:]):
+				self.assertEqual(b[0], a[0] + 1)
+				self.assertAlmostEqual(b[1] - a[1], 150, delta = 3)
+
+		# The backlog went out as one batch: a 1-byte delta (0) for the first reading, and
+		# 2-byte ones for the rest
+		batch = max((p for (t, p) in packets), key = len)
+		count = bytearray(batch)[2]
+		self.assertGreaterEqual(count, 4)
+		self.assertEqual(len(batch), daq_protocol.DATA_HEADER.size + (1 + 6) + (count - 1) * (2 + 6))
+
+		# Each answer acknowledges the last reading of the packet before it
+		acks = [(t, daq_protocol.decode_ack(p)) for (t, p) in r.received() if p[:1] == b'\xa1']
+		self.assertGreater(len(acks), 2)
+		for (t, (seq, time)) in acks:
+			last = [p for (sent, p) in packets if sent < t][-1]
+			self.assertEqual(seq, daq_protocol.decode_data(last)[-1][0])
+			self.assertAlmostEqual(time, EPOCH + t, delta = 1)
+
+class AggregationTest(unittest.TestCase):
+	def check_summaries(self, n, b0, seconds):
+		# Runs with S0 steady and B0 as given, a sample a second summarized every n, and
+		# checks B0's statistics against what it sent (in 1/16 C); returns the summaries
+		r = run(seconds, [S0 + '=21.5', B0 + '=' + b0], [], { 'AGGREGATE_SAMPLES': str(n), 'SAMPLE_INTERVAL': '10' })
+		values = [int(f[0], 16) * 16 for (t, sensor, f) in r.onewire('read') if sensor == B0]
+		values = values[1:] # the first one after boot is retried
+		summaries = [reading for (t, readings) in r.data() for reading in readings]
+		for (seq, time, stats) in summaries:
+			self.assertEqual(stats[0], (21.5, 21.5, 21.5, 0.0))
+			self.assertEqual(stats[1], None) # sensor 1 isn't there
+			window = [x - 65536 * 16 if x >= 32768 * 16 else x for x in values[n * seq : n * (seq + 1)]]
+			(mean, lo, hi, variance) = stats[2]
+			exact = sum(window) / n
+			self.assertLessEqual(abs(mean * 256 - exact), 0.5, seq)
+			self.assertEqual((lo * 256, hi * 256), (min(window), max(window)))
+			exact = sum((x - exact) ** 2 for x in window) / n
+			self.assertLessEqual(abs(variance * 65536 - exact), 1, seq)
+		for (a, b) in zip(summaries, summaries[1:]):
+			self.assertEqual(b[0], a[0] + 1)
+			self.assertAlmostEqual(b[1] - a[1], n, delta = 1)
+		return summaries
+
+	def test_summaries(self):
+		# Rising by 0.05 C/s, summarized every 6 samples
+		self.assertGreaterEqual(len(self.check_summaries(6, '20,0.05', 60)), 7)
+
+	def test_wide_swing(self):
+		# Rising by 3 C/s from -20 C: about 36 C within each window of 12, so the differences
+		# from the window's first sample go far beyond 16 C; the mean and variance still hold
+		summaries = self.check_summaries(12, '-20,3', 45)
+		self.assertGreaterEqual(len(summaries), 3)
+		self.assertTrue(any(hi - lo > 30 for (seq, time, stats) in summaries for (mean, lo, hi, variance) in stats[2:3]))
+
+	def test_batch_size(self):
+		# With all eight sensors registered, a backlog goes out in as many readings (or
+		# summaries) as fit in BATCH_BYTES, and no more: the packets stay within an
+		# Ethernet frame, so the WIZnet never has to drop one
+		sensors = [S0 + '=21.5', S1 + '=19'] + ['28-00000abcde0{0}=18.{0}'.format(i) for i in range(1, 7)]
+		for (defines, limit) in (({ 'AGGREGATE_SAMPLES': '2' }, 16), ({}, 66)):
+			defines.update({ 'SAMPLE_INTERVAL': '20', 'BACKLOG_SIZE': '100' })
+			r = run(260, sensors, ['--down', '15-160'], defines)
+			packets = r.packets()
+			self.assertEqual(max(bytearray(p)[1] for (t, p) in packets), 8)
+			self.assertLessEqual(max(len(p) for (t, p) in packets), BATCH_BYTES)
+			self.assertEqual(max(bytearray(p)[2] for (t, p) in packets), limit, defines)
+			self.assertFalse([f for (t, kind, f) in r.events if kind == 'udp' and f[0] == 'drop'])
+			# ... and all of it arrives
+			seqs = [seq for (seq, time, temps) in r.delivered([(15, 160)])]
+			self.assertEqual(seqs, list(range(0, len(seqs))))
+			self.assertGreater(len(seqs), limit)
+
+class RegistryTest(unittest.TestCase):
+	def test_many_sensors(self):
+		# At MAX_SENSORS' ceiling: every sensor gets an ID of its own, which it keeps after a
+		# reset, however the bus changes; and every reading carries all of them
+		d = tempfile.mkdtemp()
+		try:
+			eeprom = os.path.join(d, 'eeprom.bin')
+			roms = ['28-00000abc{0:04x}'.format(0x1000 + 37 * i) for i in range(0, 30)]
+			temps = dict((rom, round(5 + i * 0.5, 1)) for (i, rom) in enumerate(roms))
+			defines = { 'MAX_SENSORS': '32' }
+			r = run(25, [S0 + '=21.5', S1 + '=19'] + ['{0}={1}'.format(rom, temps[rom]) for rom in roms], [], defines, eeprom)
+			ids = r.registered()
+			self.assertEqual(sorted(ids.values()), list(range(0, 32)))
+			self.assertGreaterEqual(len(r.data()), 2)
+			for (t, readings) in r.data():
+				for (seq, time, values) in readings:
+					self.assertEqual(len(values), 32)
+					self.assertEqual([values[ids[rom]] for rom in roms], [temps[rom] for rom in roms])
+
+			# Half of them gone, and the rest found in another order: the IDs stay the same
+			rest = list(reversed(roms[::2]))
+			r = run(25, [S1 + '=19'] + ['{0}={1}'.format(rom, temps[rom]) for rom in rest], [], defines, eeprom)
+			self.assertNotIn('registered as sensor', r.serial)
+			self.assertGreaterEqual(len(r.data()), 2)
+			for (t, readings) in r.data():
+				for (seq, time, values) in readings:
+					self.assertEqual([values[ids[rom]] for rom in rest], [temps[rom] for rom in rest])
+					self.assertEqual([values[ids[rom]] for rom in roms[1::2]], [None] * 15)
+		finally:
+			shutil.rmtree(d)
+
+class DecoderTest(unittest.TestCase):
+	def first_reading(self, sensors, defines = {}):
+		r = run(15, sensors, [], defines)
+		return (r, r.data()[0][1][0][2])
+
+	def test_ds18s20(self):
+		# Above 0 C, COUNT_REMAIN gives the full 1/16 C; below, only the 9-bit value is used
+		temps = [21.5, 25.0625, 0.0, 0.9375, 125.0, -0.5, -10.25, -55.0]
+		for (a, b) in zip(temps[0::2], temps[1::2]):
+			(r, reading) = self.first_reading(['{0}={1}'.format(S0, a), '{0}={1}'.format(S1, b)])
+			for (t, decoded) in zip((a, b), reading):
+				if t >= 0:
+					self.assertEqual(decoded, t)
+				else:
+					self.assertLessEqual(abs(decoded - t), 0.5, t)
+					self.assertEqual(decoded * 2, int(decoded * 2))
+
+	def test_ds18b20(self):
+		# The bits below the resolution are masked off (the sensor leaves them undefined),
+		# and lower resolutions convert faster
+		temps = [25.4375, 0.5625, -10.0625, 125.0, -55.0]
+		sensors = ['28-00000abcde0{0}={1}'.format(i, t) for (i, t) in enumerate(temps)]
+		for resolution in (9, 10, 11, 12):
+			(r, reading) = self.first_reading(sensors, { 'DS18B20_RESOLUTION': str(resolution) })
+			step = 2 ** (12 - resolution)
+			ids = r.registered()
+			for (sensor, t) in zip(sensors, temps):
+				decoded = reading[ids[sensor.split('=')[0]]]
+				raw = int(math.floor(t * 16 + 0.5))
+				self.assertEqual(decoded, (raw // step) * step / 16.0, '{0} C at {1} bits'.format(t, resolution))
+
+			# Each sensor's resolution is written before every sample's conversion
+			writes = r.onewire('write')
+			for f in [f for (t, sensor, f) in writes]:
+				self.assertEqual(int(f[2], 16), ((resolution - 9) << 5) | 0x1f)
+			for sample in r.samples():
+				before = set(sensor for (t, sensor, f) in writes if sample - 0.5 < t < sample)
+				self.assertEqual(before, set(s.split('=')[0] for s in sensors))
+			conversion = 0.75 / step
+			reads = r.onewire('read')
+			for (t, sensor, f) in r.onewire('convert'):
+				done = min(rt for (rt, rs, rf) in reads if rt > t)
+				self.assertTrue(conversion <= done - t < conversion + 0.15, '{0} bits: read after {1:.3f} s'.format(resolution, done - t))
+
+	def test_ds18b20_brownout(self):
+		# A DS18B20 that loses power between two scans comes back at 12 bits without ever
+		# having left the bus (the same ROM twice, plugged in back to back). Its resolution
+		# must be rewritten, so that it goes on converting in the 9-bit time.
+		r = run(65, [B0 + '=18@0-36', B0 + '=18@36.05-'], [], { 'DS18B20_RESOLUTION': '9' })
+		self.assertNotIn('disappeared', r.serial)
+		reads = r.onewire('read')
+		converts = [t for (t, sensor, f) in r.onewire('convert')]
+		self.assertGreaterEqual(len([t for t in converts if t > 37]), 2)
+		for t in converts:
+			done = min(rt for (rt, rs, rf) in reads if rt > t)
+			self.assertLess(done - t, 0.25, 'read {0:.3f} s after the conversion at {1:.1f} s'.format(done - t, t))
+		b0 = r.registered()[B0]
+		for (t, readings) in r.data():
+			for (seq, time, temps) in readings:
+				self.assertEqual(temps[b0], 18.0)
+
+class ClockSyncTest(unittest.TestCase):
+	# The DAQ's crystal off by 100 ppm either way, as sim_server.py's --drift plays it
+
+	def syncs(self, r):
+		# (time, offset in us, frequency estimate in ppm, or None if the clock was stepped)
+		# for each sync after the first, from the serial output as it left the UART
+		result = []
+		for (t, kind, f) in r.events:
+			if kind == 'serial' and f[:3] == ['tx', 'Clock', 'offset']:
+				m = re.match(r'(-?\d+) us, round trip \d+ us; (?:stepped|frequency (-?[\d.]+) ppm)', ' '.join(f[3:]))
+				result.append((t, int(m.group(1)), float(m.group(2)) if m.group(2) else None))
+		return result
+
+	def check_converges(self, syncs, ppm):
+		# Each sync halves what's left of the frequency error, while the interval between
+		# syncs doubles; so the offsets stay about the same, until they count as good
+		# (under 20 ms) and the interval stops at 1024 s
+		slewed = [(t, offset, freq) for (t, offset, freq) in syncs if freq is not None]
+		errors = [abs(freq - ppm) for (t, offset, freq) in slewed]
+		for (a, b) in zip(errors, errors[1:]):
+			self.assertLessEqual(b, a * 0.6 + 0.5, errors)
+		self.assertLess(errors[-1], 2)
+		for (t, offset, freq) in syncs:
+			self.assertLess(abs(offset), 20000)
+		# What builds up between the last two syncs is down to what's left of the error
+		((t0, o0, f0), (t1, o1, f1)) = syncs[-2:]
+		self.assertLess(abs(o1) / (t1 - t0), 3)
+
+	def test_slow_crystal(self):
+		# The server's clock runs fast, so the DAQ's offsets are positive, and it lengthens
+		# its ticks less, i.e. a negative frequency estimate
+		r = run(3600, [S0 + '=21.5'], ['--drift', '100'])
+		self.assertEqual(r.serial.count('Clock set'), 1)
+		syncs = self.syncs(r)
+		self.assertEqual([s for s in syncs if s[2] is None], [])
+		self.check_converges(syncs, -100)
+
+	def test_fast_crystal_and_step(self):
+		# A jump of half a second in the server's clock is stepped, not slewed, at the next
+		# sync; the syncs start again from 16 s apart, and the frequency estimate is kept
+		r = run(3600, [S0 + '=21.5'], ['--drift', '-100', '--jump', '1500=0.5'])
+		syncs = self.syncs(r)
+		stepped = [i for (i, (t, offset, freq)) in enumerate(syncs) if freq is None]
+		self.assertEqual(len(stepped), 1)
+		i = stepped[0]
+		(t, offset, freq) = syncs[i]
+		self.assertLess(syncs[i - 1][0], 1500)
+		self.assertGreater(t, 1500)
+		self.assertLess(abs(offset - 500000), 20000)
+		self.assertAlmostEqual(syncs[i + 1][0] - t, 16, delta = 1)
+		self.assertLess(abs(syncs[i + 1][2] - syncs[i - 1][2]), 2)
+		self.check_converges(syncs[:i] + syncs[i + 1:], 100)
+
+class DiscoveryTest(unittest.TestCase):
+	def test_backoff(self):
+		# Without a server (or a cached one), PING is broadcast at doubling intervals from
+		# 2 s up to 120 s, less up to a quarter of jitter; the WIZnet is reset on the
+		# 8th retry; and the server is found within one interval of coming up
+		r = run(700, [S0 + '=21.5'], ['--down', '0-600'])
+		pings = [(t, ip) for (t, ip, p) in r.sent() if p == b'PING']
+		self.assertEqual(set(ip for (t, ip) in pings), set(['255.255.255.255']))
+		times = [t for (t, ip) in pings]
+		resets = [t for (t, kind, f) in r.events if kind == 'net' and f[0] == 'static']
+		self.assertEqual(len(resets), 1)
+		self.assertAlmostEqual(resets[0], times[8], delta = 1)
+
+		jittered = 0
+		for (i, (a, b)) in enumerate(zip(times, times[1:])):
+			backoff = min(2 << i, 120)
+			extra = 1.0 if i == 7 else 0.1 # the reset takes a while
+			self.assertTrue(backoff * 0.75 - 0.1 <= b - a <= backoff + extra, 'retry {0} after {1:.1f} s'.format(i + 1, b - a))
+			if b - a < backoff - 0.2:
+				jittered += 1
+		self.assertGreater(jittered, len(times) // 2)
+
+		found = [t for (t, p) in r.received() if p == b'PONG']
+		self.assertEqual(len(found), 1)
+		self.assertTrue(600 < found[0] < 721)
+		self.assertTrue([t for (t, p) in r.packets() if t > found[0]])
+
+	def test_cached_server(self):
+		# Once found, the server's IP is kept in the EEPROM, and asked directly after a reset;
+		# if it has moved, the unicast fails, and broadcasting finds it again
+		d = tempfile.mkdtemp()
+		try:
+			eeprom = os.path.join(d, 'eeprom.bin')
+			sensors = [S0 + '=21.5']
+			first = run(20, sensors, [], eeprom = eeprom)
+			self.assertEqual([ip for (t, ip, p) in first.sent() if p == b'PING'], ['255.255.255.255'])
+
+			again = run(20, sensors, [], eeprom = eeprom)
+			self.assertEqual([ip for (t, ip, p) in again.sent() if p == b'PING'], [SERVER_IP])
+			self.assertIn('Cached server IP: ' + SERVER_IP, again.serial)
+			self.assertEqual(len([p for (t, p) in again.received() if p == b'PONG']), 1)
+
+			moved = run(20, sensors, ['--ip', '192.168.1.20'], eeprom = eeprom)
+			pings = [ip for (t, ip, p) in moved.sent() if p == b'PING']
+			self.assertEqual(pings[:3], [SERVER_IP, SERVER_IP, '255.255.255.255'])
+			self.assertIn(['arpfail', SERVER_IP], [f for (t, kind, f) in moved.events if kind == 'udp'])
+			self.assertEqual(set(ip for (t, ip, p) in moved.sent() if p[:1] == b'\xd1'), set(['192.168.1.20']))
+
+			last = run(20, sensors, ['--ip', '192.168.1.20'], eeprom = eeprom)
+			self.assertEqual([ip for (t, ip, p) in last.sent() if p == b'PING'], ['192.168.1.20'])
+		finally:
+			shutil.rmtree(d)
+
+if __name__ == '__main__':
+	unittest.main()
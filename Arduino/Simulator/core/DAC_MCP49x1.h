@@ -0,0 +1,10 @@
+#ifndef _DAC_MCP49X1_H
+#define _DAC_MCP49X1_H
+
+// The single-output DACs' library went into DAC_MCP49xx, which covers both kinds;
+// sketches written against the old name still build.
+#include <DAC_MCP49xx.h>
+
+typedef DAC_MCP49xx DAC_MCP49x1;
+
+#endif
@@ -0,0 +1,93 @@
+// The EEPROM library, and the internal EEPROM under it (--eeprom)
+
+#include <string.h>
+#include <string>
+#include "sim.h"
+#include "Arduino.h"
+#include "EEPROM.h"
+
+#define EEPROM_SIZE 1024
+#define WRITE_CYCLE_US 3400
+#define READ_CYCLES 12
+#define WRITE_CYCLES 20
+
+namespace sim {
+
+class InternalEeprom : public Device {
+  public:
+  InternalEeprom() : Device("EEPROM"), busyUntil(0), dirty(false), reads(0), writes(0), waited(0) {
+    memset(memory, 0xff, sizeof(memory));
+  }
+
+  std::string path;
+  uint8_t memory[EEPROM_SIZE];
+  uint64_t busyUntil;
+  bool dirty;
+  uint32_t reads, writes;
+  uint64_t waited; // cycles spent waiting for a write cycle to end
+
+  void begin(void) {
+    if (path.empty())
+      return;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f) {
+      size_t n = fread(memory, 1, sizeof(memory), f);
+      (void)n;
+      fclose(f);
+    }
+  }
+
+  // As eeprom_read_byte() and eeprom_write_byte(): wait for EEPE to clear first
+  void wait(void) {
+    if (now < busyUntil) {
+      waited += busyUntil - now;
+      spendUntil(busyUntil);
+    }
+  }
+
+  void finish(void) {
+    if (!dirty || path.empty())
+      return;
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == NULL || fwrite(memory, 1, sizeof(memory), f) != sizeof(memory))
+      warn("couldn't save the EEPROM to %s", path.c_str());
+    if (f)
+      fclose(f);
+  }
+
+  void summary(FILE *f) {
+    if (reads || writes)
+      fprintf(f, "  EEPROM: %lu reads, %lu writes, %.1f ms waiting for write cycles\n",
+              (unsigned long)reads, (unsigned long)writes, waited / (F_CPU / 1000.0));
+  }
+};
+
+static InternalEeprom eeprom SIM_EARLY;
+
+static void setPath(const char *path) {
+  eeprom.path = path;
+}
+
+static Option eepromOption("eeprom", "FILE", "the internal EEPROM's contents (blank if FILE doesn't exist); saved back if written", setPath);
+
+}
+
+EEPROMClass EEPROM;
+
+uint8_t EEPROMClass::read(int address)
+{
+  sim::eeprom.wait();
+  sim::spend(READ_CYCLES);
+  sim::eeprom.reads++;
+  return sim::eeprom.memory[address & (EEPROM_SIZE - 1)];
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+  sim::eeprom.wait();
+  sim::spend(WRITE_CYCLES);
+  sim::eeprom.writes++;
+  sim::eeprom.memory[address & (EEPROM_SIZE - 1)] = value;
+  sim::eeprom.dirty = true;
+  sim::eeprom.busyUntil = sim::now + SIM_US(WRITE_CYCLE_US);
+}
@@ -0,0 +1,19 @@
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <inttypes.h>
+
+// The EEPROM library, as in Arduino 1.0: the ATmega328P's 1 KiB of internal EEPROM.
+// A write takes 3.4 ms, during which the next access waits, as eeprom_write_byte() does.
+// The contents come from --eeprom, and are saved back to it if they were written to.
+
+class EEPROMClass
+{
+  public:
+    uint8_t read(int);
+    void write(int, uint8_t);
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
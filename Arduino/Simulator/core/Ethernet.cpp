@@ -0,0 +1,539 @@
+// The Ethernet library (UDP and DHCP), and the W5100 under it, at the level of the
+// library's calls: each takes about as long as its SPI traffic (the 1.0 library moves
+// every byte with a 4-byte SPI frame, about 9 us), and the socket buffers are as small
+// as the W5100's. The rest of the network is a peer process (--udp-peer), which gets
+// every packet sent, and answers in lock step:
+//   sim -> peer:  send <us> <srcip> <srcport> <dstip> <dstport> <hex>
+//   peer -> sim:  recv <delay us> <srcip> <srcport> <dstport> <hex>   (any number of)
+//                 arpfail                                             (unicast only)
+//                 end
+// where <us> is the virtual time, and a packet received arrives <delay us> after the
+// one it answers was sent. Packets go in the timeline as
+// "udp <send|recv|drop|arpfail> ..."; without a peer, what's sent goes nowhere.
+
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "sim.h"
+#include "Arduino.h"
+#include "Ethernet.h"
+
+// What the library's calls take, in microseconds
+#define INIT_US 300000 // W5100Class::init() starts with delay(300)
+#define DHCP_US 1500000 // DISCOVER, OFFER, REQUEST and ACK on a quiet LAN
+#define DHCP_TIMEOUT_US 60000000 // begin(mac)'s default timeout
+#define BYTE_US 9 // a byte to or from a socket buffer
+#define SOCKET_US 150
+#define BEGIN_PACKET_US 200
+#define END_PACKET_US 300
+#define PARSE_PACKET_US 40 // reading RX_RSR, twice, as getRXReceivedSize() does
+#define READ_US 60 // recv()'s register traffic
+#define ARP_TIMEOUT_US 1800000 // RTR (200 ms) times RCR + 1 (9) tries
+
+// The W5100's limits
+#define SOCKET_BUFFER 2048
+#define UDP_HEADER 8 // in front of each packet in the receive buffer
+#define MAX_PAYLOAD 1472 // in one Ethernet frame
+
+namespace sim {
+
+struct Packet {
+  uint64_t arrival;
+  IPAddress ip;
+  uint16_t srcPort, dstPort;
+  std::vector<uint8_t> data;
+};
+
+struct Socket {
+  bool open;
+  uint16_t port;
+  std::deque<Packet> rx;
+  uint16_t rxBytes; // in the receive buffer, headers included
+  std::vector<uint8_t> tx;
+  IPAddress txIP;
+  uint16_t txPort;
+};
+
+static std::string ipString(const IPAddress &ip) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+  return buf;
+}
+
+static bool parseIP(const char *s, IPAddress *ip) {
+  unsigned a, b, c, d;
+  int n = 0;
+  if (sscanf(s, "%u.%u.%u.%u%n", &a, &b, &c, &d, &n) != 4 || s[n] != '\0' || a > 255 || b > 255 || c > 255 || d > 255)
+    return false;
+  *ip = IPAddress(a, b, c, d);
+  return true;
+}
+
+static std::string hex(const std::vector<uint8_t> &data) {
+  std::string s;
+  char buf[4];
+  for (size_t i = 0; i < data.size(); i++) {
+    snprintf(buf, sizeof(buf), "%02x", data[i]);
+    s += buf;
+  }
+  return data.empty() ? "-" : s;
+}
+
+class W5100 : public Device {
+  public:
+  W5100() : Device("W5100"), dhcp(true), peerIn(NULL), peerOut(NULL), peerPid(0), sent(0),
+    received(0), dropped(0), arpFailures(0) {
+    dhcpIP = IPAddress(192, 168, 1, 177);
+    for (int i = 0; i < MAX_SOCK_NUM; i++) {
+      sockets[i].open = false;
+      sockets[i].rxBytes = 0;
+    }
+  }
+
+  bool dhcp;
+  IPAddress dhcpIP;
+  std::string peerCommand;
+  IPAddress ip, gateway, dns, subnet;
+  Socket sockets[MAX_SOCK_NUM];
+
+  void begin(void) {
+    if (peerCommand.empty())
+      return;
+    int toPeer[2], fromPeer[2];
+    if (pipe(toPeer) != 0 || pipe(fromPeer) != 0)
+      fail("--udp-peer: can't make a pipe");
+    fflush(stdout);
+    peerPid = fork();
+    if (peerPid < 0)
+      fail("--udp-peer: can't fork");
+    if (peerPid == 0) {
+      dup2(toPeer[0], 0);
+      dup2(fromPeer[1], 1);
+      ::close(toPeer[1]);
+      ::close(fromPeer[0]);
+      execl("/bin/sh", "sh", "-c", peerCommand.c_str(), (char *)NULL);
+      _exit(127);
+    }
+    ::close(toPeer[0]);
+    ::close(fromPeer[1]);
+    peerOut = fdopen(toPeer[1], "w");
+    peerIn = fdopen(fromPeer[0], "r");
+    signal(SIGPIPE, SIG_IGN);
+  }
+
+  // The W5100 is set up from scratch: all sockets are closed
+  void init(void) {
+    spendUntil(now + SIM_US(INIT_US));
+    for (int i = 0; i < MAX_SOCK_NUM; i++)
+      closeSocket(i);
+  }
+
+  void closeSocket(int s) {
+    sockets[s].open = false;
+    sockets[s].rx.clear();
+    sockets[s].rxBytes = 0;
+    sockets[s].tx.clear();
+  }
+
+  // Sends a socket's transmit buffer; returns whether it went out
+  bool send(int s) {
+    Socket &sock = sockets[s];
+    Packet p;
+    p.ip = sock.txIP;
+    p.dstPort = sock.txPort;
+    p.srcPort = sock.port;
+    p.data.swap(sock.tx);
+    if (p.data.size() > MAX_PAYLOAD) {
+      dropped++;
+      trace("udp", "drop mtu %u %s %u %s", p.srcPort, ipString(p.ip).c_str(), p.dstPort, hex(p.data).c_str());
+      return true; // the W5100 says SEND_OK all the same
+    }
+    sent++;
+    trace("udp", "send %u %s %u %s", p.srcPort, ipString(p.ip).c_str(), p.dstPort, hex(p.data).c_str());
+    if (peerOut == NULL)
+      return true;
+
+    fprintf(peerOut, "send %llu %s %u %s %u %s\n", (unsigned long long)(now / (F_CPU / 1000000)),
+            ipString(ip).c_str(), p.srcPort, ipString(p.ip).c_str(), p.dstPort, hex(p.data).c_str());
+    fflush(peerOut);
+    bool arpFailed = false;
+    char line[4096];
+    for (;;) {
+      if (fgets(line, sizeof(line), peerIn) == NULL)
+        fail("--udp-peer: the peer quit");
+      std::vector<std::string> f = split(line);
+      if (f.size() == 1 && f[0] == "end")
+        break;
+      if (f.size() == 1 && f[0] == "arpfail") {
+        arpFailed = !broadcast(p.ip);
+        continue;
+      }
+      if (f.size() != 6 || f[0] != "recv")
+        fail("--udp-peer: expected recv, arpfail or end, not: %s", line);
+      Packet r;
+      r.arrival = now + SIM_US(strtoull(f[1].c_str(), NULL, 10));
+      if (!parseIP(f[2].c_str(), &r.ip))
+        fail("--udp-peer: not an IP address: %s", f[2].c_str());
+      r.srcPort = atoi(f[3].c_str());
+      r.dstPort = atoi(f[4].c_str());
+      if (f[5] != "-") {
+        for (size_t i = 0; i + 1 < f[5].size(); i += 2)
+          r.data.push_back(strtoul(f[5].substr(i, 2).c_str(), NULL, 16));
+      }
+      insert(r);
+    }
+
+    if (arpFailed) {
+      // Nobody answers ARP for the address; the W5100 retries until it times out
+      arpFailures++;
+      trace("udp", "arpfail %s", ipString(p.ip).c_str());
+      spendUntil(now + SIM_US(ARP_TIMEOUT_US));
+      return false;
+    }
+    return true;
+  }
+
+  uint64_t nextEvent(void) {
+    return incoming.empty() ? SIM_NEVER : incoming.front().arrival;
+  }
+
+  void event(void) {
+    while (!incoming.empty() && incoming.front().arrival <= now) {
+      Packet p = incoming.front();
+      incoming.pop_front();
+      Socket *sock = NULL;
+      for (int i = 0; i < MAX_SOCK_NUM; i++) {
+        if (sockets[i].open && sockets[i].port == p.dstPort)
+          sock = &sockets[i];
+      }
+      const char *why = NULL;
+      if (sock == NULL)
+        why = "port";
+      else if (sock->rxBytes + UDP_HEADER + p.data.size() > SOCKET_BUFFER)
+        why = "full";
+      if (why) {
+        dropped++;
+        trace("udp", "drop %s %s %u %u %s", why, ipString(p.ip).c_str(), p.srcPort, p.dstPort, hex(p.data).c_str());
+        continue;
+      }
+      received++;
+      trace("udp", "recv %s %u %u %s", ipString(p.ip).c_str(), p.srcPort, p.dstPort, hex(p.data).c_str());
+      sock->rxBytes += UDP_HEADER + p.data.size();
+      sock->rx.push_back(p);
+    }
+  }
+
+  void finish(void) {
+    if (peerOut == NULL)
+      return;
+    fclose(peerOut);
+    fclose(peerIn);
+    waitpid(peerPid, NULL, 0);
+  }
+
+  void summary(FILE *f) {
+    if (sent || received || dropped)
+      fprintf(f, "  W5100: %lu packets sent, %lu received, %lu dropped, %lu ARP failures\n",
+              (unsigned long)sent, (unsigned long)received, (unsigned long)dropped, (unsigned long)arpFailures);
+  }
+
+  private:
+  FILE *peerIn, *peerOut;
+  pid_t peerPid;
+  std::deque<Packet> incoming; // by arrival
+  uint32_t sent, received, dropped, arpFailures;
+
+  bool broadcast(const IPAddress &a) {
+    uint32_t mask = subnet;
+    return (uint32_t)a == 0xffffffff || ((uint32_t)a & ~mask) == ~mask;
+  }
+
+  void insert(const Packet &p) {
+    std::deque<Packet>::iterator i = incoming.end();
+    while (i != incoming.begin() && (i - 1)->arrival > p.arrival)
+      --i;
+    incoming.insert(i, p);
+    reschedule();
+  }
+
+  static std::vector<std::string> split(const char *line) {
+    std::vector<std::string> fields;
+    std::string s(line);
+    size_t pos = 0;
+    for (;;) {
+      pos = s.find_first_not_of(" \t\r\n", pos);
+      if (pos == std::string::npos)
+        break;
+      size_t end = s.find_first_of(" \t\r\n", pos);
+      fields.push_back(s.substr(pos, end - pos));
+      pos = end;
+    }
+    return fields;
+  }
+};
+
+static W5100 w5100 SIM_EARLY;
+
+static void setDhcp(const char *s) {
+  if (strcmp(s, "none") == 0)
+    w5100.dhcp = false;
+  else if (!parseIP(s, &w5100.dhcpIP))
+    fail("--dhcp: expected an IP address or none, not %s", s);
+}
+
+static void setPeer(const char *s) {
+  w5100.peerCommand = s;
+}
+
+static Option dhcpOption("dhcp", "IP|none", "the address DHCP hands out (on a /24, with .1 as the gateway and DNS); default 192.168.1.177", setDhcp);
+static Option peerOption("udp-peer", "COMMAND", "run COMMAND as the rest of the network (see Ethernet.cpp)", setPeer);
+
+}
+
+EthernetClass Ethernet;
+
+int EthernetClass::begin(uint8_t *)
+{
+  sim::w5100.init();
+  if (!sim::w5100.dhcp) {
+    // Nobody answers the DISCOVERs
+    sim::spendUntil(sim::now + SIM_US(DHCP_TIMEOUT_US));
+    sim::trace("net", "dhcp failed");
+    return 0;
+  }
+  sim::spendUntil(sim::now + SIM_US(DHCP_US));
+  IPAddress ip = sim::w5100.dhcpIP;
+  sim::w5100.ip = ip;
+  sim::w5100.gateway = sim::w5100.dns = IPAddress(ip[0], ip[1], ip[2], 1);
+  sim::w5100.subnet = IPAddress(255, 255, 255, 0);
+  sim::trace("net", "dhcp %s", sim::ipString(ip).c_str());
+  return 1;
+}
+
+void EthernetClass::begin(uint8_t *mac_address, IPAddress local_ip)
+{
+  // Assume the DNS server will be the machine on the same network as the local IP
+  // but with last octet being '1'
+  IPAddress dns_server = local_ip;
+  dns_server[3] = 1;
+  begin(mac_address, local_ip, dns_server);
+}
+
+void EthernetClass::begin(uint8_t *mac_address, IPAddress local_ip, IPAddress dns_server)
+{
+  // Assume the gateway will be the machine on the same network as the local IP
+  // but with last octet being '1'
+  IPAddress gateway = local_ip;
+  gateway[3] = 1;
+  begin(mac_address, local_ip, dns_server, gateway);
+}
+
+void EthernetClass::begin(uint8_t *mac_address, IPAddress local_ip, IPAddress dns_server, IPAddress gateway)
+{
+  IPAddress subnet(255, 255, 255, 0);
+  begin(mac_address, local_ip, dns_server, gateway, subnet);
+}
+
+void EthernetClass::begin(uint8_t *, IPAddress local_ip, IPAddress dns_server, IPAddress gateway, IPAddress subnet)
+{
+  sim::w5100.init();
+  sim::w5100.ip = local_ip;
+  sim::w5100.dns = dns_server;
+  sim::w5100.gateway = gateway;
+  sim::w5100.subnet = subnet;
+  sim::trace("net", "static %s", sim::ipString(local_ip).c_str());
+}
+
+int EthernetClass::maintain()
+{
+  // The lease is as long as the run
+  sim::spend(SIM_US(2 * BYTE_US));
+  return DHCP_CHECK_NONE;
+}
+
+IPAddress EthernetClass::localIP()
+{
+  sim::spend(SIM_US(4 * BYTE_US));
+  return sim::w5100.ip;
+}
+
+IPAddress EthernetClass::subnetMask()
+{
+  sim::spend(SIM_US(4 * BYTE_US));
+  return sim::w5100.subnet;
+}
+
+IPAddress EthernetClass::gatewayIP()
+{
+  sim::spend(SIM_US(4 * BYTE_US));
+  return sim::w5100.gateway;
+}
+
+IPAddress EthernetClass::dnsServerIP()
+{
+  sim::spend(SIM_US(4 * BYTE_US));
+  return sim::w5100.dns;
+}
+
+/* Constructor */
+EthernetUDP::EthernetUDP() : _sock(MAX_SOCK_NUM) {}
+
+/* Start EthernetUDP socket, listening at local port PORT */
+uint8_t EthernetUDP::begin(uint16_t port) {
+  if (_sock != MAX_SOCK_NUM)
+    return 0;
+
+  sim::spend(SIM_US(SOCKET_US));
+  for (int i = 0; i < MAX_SOCK_NUM; i++) {
+    if (!sim::w5100.sockets[i].open) {
+      _sock = i;
+      break;
+    }
+  }
+
+  if (_sock == MAX_SOCK_NUM)
+    return 0;
+
+  _port = port;
+  _remaining = 0;
+  sim::w5100.closeSocket(_sock);
+  sim::w5100.sockets[_sock].open = true;
+  sim::w5100.sockets[_sock].port = port;
+  return 1;
+}
+
+/* Release any resources being used by this EthernetUDP instance */
+void EthernetUDP::stop()
+{
+  if (_sock == MAX_SOCK_NUM)
+    return;
+
+  sim::spend(SIM_US(SOCKET_US));
+  sim::w5100.closeSocket(_sock);
+  _sock = MAX_SOCK_NUM;
+}
+
+int EthernetUDP::beginPacket(const char *host, uint16_t port)
+{
+  sim::warn("DNS isn't simulated; beginPacket(\"%s\", %u) fails", host, port);
+  return 0;
+}
+
+int EthernetUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+  if (_sock == MAX_SOCK_NUM || (uint32_t)ip == 0 || port == 0)
+    return 0;
+  sim::spend(SIM_US(BEGIN_PACKET_US));
+  _offset = 0;
+  sim::w5100.sockets[_sock].tx.clear();
+  sim::w5100.sockets[_sock].txIP = ip;
+  sim::w5100.sockets[_sock].txPort = port;
+  return 1;
+}
+
+int EthernetUDP::endPacket()
+{
+  if (_sock == MAX_SOCK_NUM)
+    return 0;
+  sim::spend(SIM_US(END_PACKET_US));
+  return sim::w5100.send(_sock);
+}
+
+size_t EthernetUDP::write(uint8_t byte)
+{
+  return write(&byte, 1);
+}
+
+size_t EthernetUDP::write(const uint8_t *buffer, size_t size)
+{
+  if (_sock == MAX_SOCK_NUM)
+    return 0;
+  // As bufferData(): what doesn't fit in the transmit buffer is left out
+  std::vector<uint8_t> &tx = sim::w5100.sockets[_sock].tx;
+  size_t n = min(size, SOCKET_BUFFER - tx.size());
+  sim::spend(SIM_US(20 + n * BYTE_US));
+  tx.insert(tx.end(), buffer, buffer + n);
+  _offset += n;
+  return n;
+}
+
+int EthernetUDP::parsePacket()
+{
+  // discard any remaining bytes in the last packet
+  flush();
+
+  sim::spend(SIM_US(PARSE_PACKET_US));
+  if (_sock == MAX_SOCK_NUM || sim::w5100.sockets[_sock].rx.empty())
+    return 0;
+
+  // The header: the sender's address and port, and the length
+  sim::spend(SIM_US(READ_US + UDP_HEADER * BYTE_US));
+  sim::Packet &p = sim::w5100.sockets[_sock].rx.front();
+  _remoteIP = p.ip;
+  _remotePort = p.srcPort;
+  _remaining = p.data.size();
+  _offset = 0;
+  if (_remaining == 0)
+    done();
+  return _remaining;
+}
+
+int EthernetUDP::available()
+{
+  return _remaining;
+}
+
+int EthernetUDP::read()
+{
+  uint8_t byte;
+  if (_remaining > 0 && read(&byte, 1) > 0)
+    return byte;
+
+  // If we get here, there's no data available
+  return -1;
+}
+
+int EthernetUDP::read(unsigned char* buffer, size_t len)
+{
+  if (_remaining <= 0)
+    return -1;
+
+  int got = min((size_t)_remaining, len);
+  sim::spend(SIM_US(READ_US + got * BYTE_US));
+  sim::Packet &p = sim::w5100.sockets[_sock].rx.front();
+  memcpy(buffer, &p.data[_offset], got);
+  _offset += got;
+  _remaining -= got;
+  if (_remaining == 0)
+    done();
+  return got;
+}
+
+int EthernetUDP::peek()
+{
+  if (_remaining <= 0)
+    return -1;
+  sim::spend(SIM_US(READ_US + BYTE_US));
+  return sim::w5100.sockets[_sock].rx.front().data[_offset];
+}
+
+void EthernetUDP::flush()
+{
+  // As the library: reads the rest of the packet, a byte at a time
+  while (available())
+  {
+    read();
+  }
+}
+
+void EthernetUDP::done()
+{
+  sim::Socket &sock = sim::w5100.sockets[_sock];
+  sock.rxBytes -= UDP_HEADER + sock.rx.front().data.size();
+  sock.rx.pop_front();
+}
@@ -0,0 +1,42 @@
+#ifndef ethernet_h
+#define ethernet_h
+
+#include <inttypes.h>
+#include "IPAddress.h"
+#include "EthernetUdp.h"
+
+// The Ethernet library, as in Arduino 1.0, on a simulated W5100: DHCP (--dhcp), and
+// UDP to and from a peer process (--udp-peer) that plays the rest of the network.
+// TCP (EthernetClient and EthernetServer) isn't simulated. The calls take about as
+// long as the library's SPI traffic does; see Ethernet.cpp.
+
+#define MAX_SOCK_NUM 4
+
+// The results of maintain()
+#define DHCP_CHECK_NONE         (0)
+#define DHCP_CHECK_RENEW_FAIL   (1)
+#define DHCP_CHECK_RENEW_OK     (2)
+#define DHCP_CHECK_REBIND_FAIL  (3)
+#define DHCP_CHECK_REBIND_OK    (4)
+
+class EthernetClass {
+public:
+  // Initialise the Ethernet shield to use the provided MAC address and gain the rest of the
+  // configuration through DHCP.
+  // Returns 0 if the DHCP configuration failed, and 1 if it succeeded
+  int begin(uint8_t *mac_address);
+  void begin(uint8_t *mac_address, IPAddress local_ip);
+  void begin(uint8_t *mac_address, IPAddress local_ip, IPAddress dns_server);
+  void begin(uint8_t *mac_address, IPAddress local_ip, IPAddress dns_server, IPAddress gateway);
+  void begin(uint8_t *mac_address, IPAddress local_ip, IPAddress dns_server, IPAddress gateway, IPAddress subnet);
+  int maintain();
+
+  IPAddress localIP();
+  IPAddress subnetMask();
+  IPAddress gatewayIP();
+  IPAddress dnsServerIP();
+};
+
+extern EthernetClass Ethernet;
+
+#endif
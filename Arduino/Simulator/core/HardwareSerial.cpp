@@ -0,0 +1,261 @@
+// The UART, and Serial on top of it, as in the 1.0 core: write() queues bytes in a
+// 64-byte buffer that the UDRE interrupt feeds to the UART, and the RX interrupt
+// fills another 64-byte buffer that read() takes from. Both ISRs are simulated,
+// so heavy serial traffic delays the sketch's own ISRs as it would on the board.
+
+#include <stdint.h>
+#include <string>
+#include "sim.h"
+#include "Arduino.h"
+
+#define SERIAL_BUFFER_SIZE 64
+
+// What the core's ISRs and functions take, in cycles
+#define RX_ISR_CYCLES 60
+#define UDRE_ISR_CYCLES 55
+#define WRITE_CYCLES 40
+#define READ_CYCLES 30
+
+namespace sim {
+
+struct RingBuffer {
+  uint8_t buffer[SERIAL_BUFFER_SIZE];
+  uint8_t head, tail;
+  // As the core's: one slot is always free
+  bool full(void) { return (head + 1) % SERIAL_BUFFER_SIZE == tail; }
+  bool empty(void) { return head == tail; }
+  uint8_t size(void) { return (head - tail + SERIAL_BUFFER_SIZE) % SERIAL_BUFFER_SIZE; }
+  void put(uint8_t c) { buffer[head] = c; head = (head + 1) % SERIAL_BUFFER_SIZE; }
+  uint8_t get(void) { uint8_t c = buffer[tail]; tail = (tail + 1) % SERIAL_BUFFER_SIZE; return c; }
+};
+
+static void rxISR(void);
+static void udreISR(void);
+
+class Uart : public Device {
+  public:
+  Uart() : Device("serial"), out(NULL), in(NULL), byteCycles(0), udrFull(false), shifting(false),
+    shiftEnd(0), rxNext(SIM_NEVER), rxReady(false), rxData(0), sent(0), received(0), overruns(0),
+    dropped(0) {
+    rx.head = rx.tail = tx.head = tx.tail = 0;
+  }
+
+  FILE *out, *in;
+  RingBuffer rx, tx;
+
+  void begin(void) {
+    if (out == NULL)
+      out = stdout;
+    mapVector(SIM_USART_RX, "USART_RX", rxISR, this);
+    mapVector(SIM_USART_UDRE, "USART_UDRE", udreISR, this);
+  }
+
+  void setBaud(unsigned long baud) {
+    // As the 1.0 core: double speed mode, except at 57600, where it's too far off
+    bool u2x = baud != 57600;
+    uint32_t ubrr = ((F_CPU / (u2x ? 4 : 8)) / baud - 1) / 2;
+    byteCycles = 10 * (u2x ? 8 : 16) * (ubrr + 1); // a start bit, 8 data bits and a stop bit
+    if (in && rxNext == SIM_NEVER)
+      rxNext = now + byteCycles;
+    reschedule();
+  }
+
+  void stop(void) {
+    byteCycles = 0;
+    rxNext = SIM_NEVER;
+    reschedule();
+  }
+
+  bool enabled(void) { return byteCycles != 0; }
+
+  uint64_t nextEvent(void) {
+    uint64_t t = shifting ? shiftEnd : SIM_NEVER;
+    return rxNext < t ? rxNext : t;
+  }
+
+  void event(void) {
+    if (shifting && shiftEnd <= now) {
+      shifting = false;
+      output(shifted);
+      if (udrFull) {
+        udrFull = false;
+        startShift(udr);
+      }
+    }
+    if (rxNext <= now) {
+      int c = fgetc(in);
+      if (c == EOF) {
+        rxNext = SIM_NEVER;
+      }
+      else {
+        // The UART holds one byte; the next one overruns it if the ISR hasn't run
+        if (rxReady)
+          overruns++;
+        rxReady = true;
+        rxData = c;
+        rxNext = now + byteCycles;
+      }
+    }
+  }
+
+  bool interruptPending(uint8_t vector) {
+    if (vector == SIM_USART_RX)
+      return rxReady;
+    return !udrFull && !tx.empty(); // UDRIE is set while the buffer has data
+  }
+
+  // Puts a byte in the UART data register; it starts shifting out at once if the
+  // UART is idle
+  void load(uint8_t c) {
+    if (!shifting)
+      startShift(c);
+    else {
+      udr = c;
+      udrFull = true;
+    }
+  }
+
+  void receive(void) {
+    rxReady = false;
+    if (rx.full())
+      dropped++;
+    else
+      rx.put(rxData);
+    received++;
+  }
+
+  void summary(FILE *f) {
+    if (sent || received)
+      fprintf(f, "  serial: %lu bytes sent, %lu received, %lu overruns, %lu dropped (buffer full)\n",
+              (unsigned long)sent, (unsigned long)received, (unsigned long)overruns, (unsigned long)dropped);
+  }
+
+  void finish(void) {
+    flushLine();
+    if (out)
+      fflush(out);
+  }
+
+  private:
+  uint32_t byteCycles;
+  uint8_t udr, shifted;
+  bool udrFull, shifting;
+  uint64_t shiftEnd, rxNext;
+  bool rxReady;
+  uint8_t rxData;
+  uint32_t sent, received, overruns, dropped;
+  std::string line; // for the timeline
+
+  void startShift(uint8_t c) {
+    shifted = c;
+    shifting = true;
+    shiftEnd = now + byteCycles;
+    reschedule();
+  }
+
+  void output(uint8_t c) {
+    fputc(c, out);
+    sent++;
+    if (c == '\n') {
+      flushLine();
+    }
+    else if (c == '\r') {
+    }
+    else {
+      char buf[8];
+      if (c >= ' ' && c < 0x7f && c != '\\')
+        line += (char)c;
+      else {
+        snprintf(buf, sizeof(buf), "\\x%02x", c);
+        line += buf;
+      }
+      if (line.size() >= 200)
+        flushLine();
+    }
+  }
+
+  void flushLine(void) {
+    if (!line.empty())
+      trace("serial", "tx %s", line.c_str());
+    line.clear();
+  }
+};
+
+static Uart uart SIM_EARLY;
+
+static void rxISR(void) {
+  spend(RX_ISR_CYCLES);
+  uart.receive();
+}
+
+static void udreISR(void) {
+  spend(UDRE_ISR_CYCLES);
+  uart.load(uart.tx.get());
+}
+
+static void setOut(const char *path) {
+  uart.out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+  if (uart.out == NULL)
+    fail("can't write %s", path);
+}
+
+static void setIn(const char *path) {
+  uart.in = strcmp(path, "-") ? fopen(path, "r") : stdin;
+  if (uart.in == NULL)
+    fail("can't read %s", path);
+}
+
+static Option outOption("serial-out", "FILE", "where the serial output goes; default stdout", setOut);
+static Option inOption("serial-in", "FILE", "serial input, received back to back from Serial.begin() on (- for stdin)", setIn);
+
+}
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long baud) {
+  sim::spend(WRITE_CYCLES);
+  sim::uart.setBaud(baud);
+}
+
+void HardwareSerial::end() {
+  flush();
+  sim::uart.stop();
+}
+
+int HardwareSerial::available(void) {
+  sim::spend(READ_CYCLES);
+  return sim::uart.rx.size();
+}
+
+int HardwareSerial::peek(void) {
+  sim::spend(READ_CYCLES);
+  if (sim::uart.rx.empty())
+    return -1;
+  return sim::uart.rx.buffer[sim::uart.rx.tail];
+}
+
+int HardwareSerial::read(void) {
+  sim::spend(READ_CYCLES);
+  if (sim::uart.rx.empty())
+    return -1;
+  return sim::uart.rx.get();
+}
+
+void HardwareSerial::flush(void) {
+  // As in 1.0: waits for the transmission to finish
+  while (!sim::uart.tx.empty() && sim::uart.enabled())
+    sim::spendUntil(sim::uart.nextEvent());
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  sim::spend(WRITE_CYCLES);
+  if (!sim::uart.enabled())
+    return 1; // the UART is off, so the byte goes nowhere
+  // With the buffer full, wait for the UDRE ISR to make room; with interrupts off,
+  // that's forever, as on the board (well, until --time runs out)
+  while (sim::uart.tx.full())
+    sim::spendUntil(sim::uart.nextEvent());
+  sim::uart.tx.put(c);
+  sim::checkInterrupts();
+  return 1;
+}
@@ -0,0 +1,26 @@
+#ifndef HardwareSerial_h
+#define HardwareSerial_h
+
+#include <inttypes.h>
+#include "Stream.h"
+
+// The UART. Output goes to stdout (or --serial-out), at the baud rate: a full 64-byte
+// buffer makes write() wait, as on the board. Input comes from --serial-in, and
+// overflows the 64-byte receive buffer if it isn't read in time.
+class HardwareSerial : public Stream
+{
+  public:
+    void begin(unsigned long baud);
+    void end();
+    virtual int available(void);
+    virtual int peek(void);
+    virtual int read(void);
+    virtual void flush(void);
+    virtual size_t write(uint8_t);
+    using Print::write; // pull in write(str) and write(buf, size) from Print
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
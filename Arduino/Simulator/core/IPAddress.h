@@ -0,0 +1,44 @@
+#ifndef IPAddress_h
+#define IPAddress_h
+
+#include <stdint.h>
+#include <string.h>
+
+// An IPv4 address, as in the Arduino 1.0 core; the octets are in network order, and
+// the uint32_t conversion gives them as they lie in memory (on a little-endian host,
+// as on the AVR). Not Printable here; print the octets instead.
+
+class IPAddress {
+private:
+    uint8_t _address[4];  // IPv4 address
+
+public:
+    // Constructors
+    IPAddress() { memset(_address, 0, sizeof(_address)); }
+    IPAddress(uint8_t first_octet, uint8_t second_octet, uint8_t third_octet, uint8_t fourth_octet) {
+        _address[0] = first_octet;
+        _address[1] = second_octet;
+        _address[2] = third_octet;
+        _address[3] = fourth_octet;
+    }
+    IPAddress(uint32_t address) { memcpy(_address, &address, sizeof(_address)); }
+    IPAddress(const uint8_t *address) { memcpy(_address, address, sizeof(_address)); }
+
+    // Overloaded cast operator to allow IPAddress objects to be used where a pointer
+    // to a four-byte uint8_t array is expected
+    operator uint32_t() const { uint32_t a; memcpy(&a, _address, sizeof(a)); return a; }
+    bool operator==(const IPAddress& addr) const { return memcmp(_address, addr._address, sizeof(_address)) == 0; }
+    bool operator==(const uint8_t* addr) const { return memcmp(_address, addr, sizeof(_address)) == 0; }
+
+    // Overloaded index operator to allow getting and setting individual octets of the address
+    uint8_t operator[](int index) const { return _address[index]; }
+    uint8_t& operator[](int index) { return _address[index]; }
+
+    // Overloaded copy operators to allow initialisation of IPAddress objects from other types
+    IPAddress& operator=(const uint8_t *address) { memcpy(_address, address, sizeof(_address)); return *this; }
+    IPAddress& operator=(uint32_t address) { memcpy(_address, &address, sizeof(_address)); return *this; }
+};
+
+const IPAddress INADDR_NONE(0,0,0,0);
+
+#endif
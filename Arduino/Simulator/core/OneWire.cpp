@@ -0,0 +1,350 @@
+// The OneWire library (2.x), and the 1-Wire bus under it: the library's time slots,
+// with the parts on the bus (see sim_bus.h) answering each one
+
+#include <vector>
+#include "sim.h"
+#include "sim_bus.h"
+#include "Arduino.h"
+#include "OneWire.h"
+
+namespace sim {
+
+static std::vector<OneWireSlave *> &oneWireSlaves(void) {
+  static std::vector<OneWireSlave *> list;
+  return list;
+}
+
+OneWireSlave::OneWireSlave() {
+  oneWireSlaves().push_back(this);
+}
+
+// Every part sees every slot, so none of these may stop early
+static bool busReset(void) {
+  bool presence = false;
+  for (size_t i = 0; i < oneWireSlaves().size(); i++)
+    presence |= oneWireSlaves()[i]->reset();
+  return presence;
+}
+
+static void busWrite(bool bit) {
+  for (size_t i = 0; i < oneWireSlaves().size(); i++)
+    oneWireSlaves()[i]->writeBit(bit);
+}
+
+static bool busRead(void) {
+  bool level = true;
+  for (size_t i = 0; i < oneWireSlaves().size(); i++)
+    level &= oneWireSlaves()[i]->readBit();
+  return level;
+}
+
+// The library times its slots with delayMicroseconds(), between noInterrupts() and
+// interrupts(); the latter enables interrupts whether or not they were on before
+static void timed(uint32_t us) {
+  spend(SIM_US(us));
+}
+
+static void critical(uint32_t us) {
+  setInterrupts(false);
+  spend(SIM_US(us));
+  setInterrupts(true);
+}
+
+}
+
+OneWire::OneWire(uint8_t thePin)
+{
+  pin = thePin;
+  pinMode(pin, INPUT);
+#if ONEWIRE_SEARCH
+  reset_search();
+#endif
+}
+
+uint8_t OneWire::reset(void)
+{
+  sim::critical(0);
+  sim::timed(480);
+  sim::setInterrupts(false);
+  sim::spend(SIM_US(70));
+  uint8_t r = sim::busReset();
+  sim::setInterrupts(true);
+  sim::timed(410);
+  return r;
+}
+
+void OneWire::write_bit(uint8_t v)
+{
+  if (v & 1) {
+    sim::critical(10);
+    sim::busWrite(true);
+    sim::timed(55);
+  } else {
+    sim::critical(65);
+    sim::busWrite(false);
+    sim::timed(5);
+  }
+}
+
+uint8_t OneWire::read_bit(void)
+{
+  sim::setInterrupts(false);
+  sim::spend(SIM_US(13));
+  uint8_t r = sim::busRead();
+  sim::setInterrupts(true);
+  sim::timed(53);
+  return r;
+}
+
+void OneWire::write(uint8_t v, uint8_t power /* = 0 */) {
+  uint8_t bitMask;
+
+  for (bitMask = 0x01; bitMask; bitMask <<= 1) {
+    OneWire::write_bit( (bitMask & v)?1:0);
+  }
+  if ( !power) {
+    depower();
+  }
+}
+
+void OneWire::write_bytes(const uint8_t *buf, uint16_t count, bool power /* = 0 */) {
+  for (uint16_t i = 0 ; i < count ; i++)
+    write(buf[i]);
+  if (!power) {
+    depower();
+  }
+}
+
+uint8_t OneWire::read() {
+  uint8_t bitMask;
+  uint8_t r = 0;
+
+  for (bitMask = 0x01; bitMask; bitMask <<= 1) {
+    if ( OneWire::read_bit()) r |= bitMask;
+  }
+  return r;
+}
+
+void OneWire::read_bytes(uint8_t *buf, uint16_t count) {
+  for (uint16_t i = 0 ; i < count ; i++)
+    buf[i] = read();
+}
+
+void OneWire::select(const uint8_t rom[8])
+{
+  uint8_t i;
+
+  write(0x55);           // Choose ROM
+
+  for (i = 0; i < 8; i++) write(rom[i]);
+}
+
+void OneWire::skip()
+{
+  write(0xCC);           // Skip ROM
+}
+
+void OneWire::depower()
+{
+  // Parasite power isn't simulated; the parts are taken to have their own supply
+  sim::critical(0);
+}
+
+#if ONEWIRE_SEARCH
+
+void OneWire::reset_search()
+{
+  // reset the search state
+  LastDiscrepancy = 0;
+  LastDeviceFlag = false;
+  LastFamilyDiscrepancy = 0;
+  for(int i = 7; ; i--) {
+    ROM_NO[i] = 0;
+    if ( i == 0) break;
+  }
+}
+
+void OneWire::target_search(uint8_t family_code)
+{
+   // set the search state to find SearchFamily type devices
+   ROM_NO[0] = family_code;
+   for (uint8_t i = 1; i < 8; i++)
+      ROM_NO[i] = 0;
+   LastDiscrepancy = 64;
+   LastFamilyDiscrepancy = 0;
+   LastDeviceFlag = false;
+}
+
+// The search algorithm of Maxim's application note 187: each pass takes the branch
+// it took last time up to the last discrepancy, the other branch there, and the
+// 0 branch from then on
+uint8_t OneWire::search(uint8_t *newAddr)
+{
+   uint8_t id_bit_number;
+   uint8_t last_zero, rom_byte_number, search_result;
+   uint8_t id_bit, cmp_id_bit;
+
+   unsigned char rom_byte_mask, search_direction;
+
+   // initialize for search
+   id_bit_number = 1;
+   last_zero = 0;
+   rom_byte_number = 0;
+   rom_byte_mask = 1;
+   search_result = 0;
+
+   // if the last call was not the last one
+   if (!LastDeviceFlag)
+   {
+      // 1-Wire reset
+      if (!reset())
+      {
+         // reset the search
+         LastDiscrepancy = 0;
+         LastDeviceFlag = false;
+         LastFamilyDiscrepancy = 0;
+         return false;
+      }
+
+      // issue the search command
+      write(0xF0);
+
+      // loop to do the search
+      do
+      {
+         // read a bit and its complement
+         id_bit = read_bit();
+         cmp_id_bit = read_bit();
+
+         // check for no devices on 1-wire
+         if ((id_bit == 1) && (cmp_id_bit == 1))
+            break;
+         else
+         {
+            // all devices coupled have 0 or 1
+            if (id_bit != cmp_id_bit)
+               search_direction = id_bit;  // bit write value for search
+            else
+            {
+               // if this discrepancy if before the Last Discrepancy
+               // on a previous next then pick the same as last time
+               if (id_bit_number < LastDiscrepancy)
+                  search_direction = ((ROM_NO[rom_byte_number] & rom_byte_mask) > 0);
+               else
+                  // if equal to last pick 1, if not then pick 0
+                  search_direction = (id_bit_number == LastDiscrepancy);
+
+               // if 0 was picked then record its position in LastZero
+               if (search_direction == 0)
+               {
+                  last_zero = id_bit_number;
+
+                  // check for Last discrepancy in family
+                  if (last_zero < 9)
+                     LastFamilyDiscrepancy = last_zero;
+               }
+            }
+
+            // set or clear the bit in the ROM byte rom_byte_number
+            // with mask rom_byte_mask
+            if (search_direction == 1)
+              ROM_NO[rom_byte_number] |= rom_byte_mask;
+            else
+              ROM_NO[rom_byte_number] &= ~rom_byte_mask;
+
+            // serial number search direction write bit
+            write_bit(search_direction);
+
+            // increment the byte counter id_bit_number
+            // and shift the mask rom_byte_mask
+            id_bit_number++;
+            rom_byte_mask <<= 1;
+
+            // if the mask is 0 then go to new SerialNum byte rom_byte_number and reset mask
+            if (rom_byte_mask == 0)
+            {
+                rom_byte_number++;
+                rom_byte_mask = 1;
+            }
+         }
+      }
+      while(rom_byte_number < 8);  // loop until through all ROM bytes 0-7
+
+      // if the search was successful then
+      if (!(id_bit_number < 65))
+      {
+         // search successful so set LastDiscrepancy,LastDeviceFlag,search_result
+         LastDiscrepancy = last_zero;
+
+         // check for last device
+         if (LastDiscrepancy == 0)
+            LastDeviceFlag = true;
+
+         search_result = true;
+      }
+   }
+
+   // if no device found then reset counters so next 'search' will be like a first
+   if (!search_result || !ROM_NO[0])
+   {
+      LastDiscrepancy = 0;
+      LastDeviceFlag = false;
+      LastFamilyDiscrepancy = 0;
+      search_result = false;
+   }
+   for (int i = 0; i < 8; i++) newAddr[i] = ROM_NO[i];
+   return search_result;
+  }
+
+#endif
+
+#if ONEWIRE_CRC
+// The Dallas CRC-8 (x^8 + x^5 + x^4 + 1), computed a bit at a time
+uint8_t OneWire::crc8(const uint8_t *addr, uint8_t len)
+{
+  uint8_t crc = 0;
+
+  while (len--) {
+    uint8_t inbyte = *addr++;
+    for (uint8_t i = 8; i; i--) {
+      uint8_t mix = (crc ^ inbyte) & 0x01;
+      crc >>= 1;
+      if (mix) crc ^= 0x8C;
+      inbyte >>= 1;
+    }
+  }
+  return crc;
+}
+
+#if ONEWIRE_CRC16
+bool OneWire::check_crc16(const uint8_t* input, uint16_t len, const uint8_t* inverted_crc, uint16_t crc)
+{
+    crc = ~crc16(input, len, crc);
+    return (crc & 0xFF) == inverted_crc[0] && (crc >> 8) == inverted_crc[1];
+}
+
+uint16_t OneWire::crc16(const uint8_t* input, uint16_t len, uint16_t crc)
+{
+    static const uint8_t oddparity[16] =
+        { 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0 };
+
+    for (uint16_t i = 0 ; i < len ; i++) {
+      // Even though we're just copying a byte from the input,
+      // we'll be doing 16-bit computation with it.
+      uint16_t cdata = input[i];
+      cdata = (cdata ^ crc) & 0xff;
+      crc >>= 8;
+
+      if (oddparity[cdata & 0x0F] ^ oddparity[cdata >> 4])
+          crc ^= 0xC001;
+
+      cdata <<= 6;
+      crc ^= cdata;
+      cdata <<= 1;
+      crc ^= cdata;
+    }
+    return crc;
+}
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef OneWire_h
+#define OneWire_h
+
+#include <inttypes.h>
+
+// The OneWire library (2.x), on the simulated 1-Wire bus: each time slot takes as long
+// as the library's, with interrupts off for the same parts of it. The parts on the bus
+// are DS18S20 and DS18B20 temperature sensors (--onewire), modelled at the bit level,
+// so that searches, MATCH ROM and busy polling work as on the board. The parts are on
+// whichever pin the OneWire object is on.
+
+#define ONEWIRE_SEARCH 1
+#define ONEWIRE_CRC 1
+#define ONEWIRE_CRC8_TABLE 0
+#define ONEWIRE_CRC16 1
+
+class OneWire
+{
+  private:
+    uint8_t pin;
+
+    // The search state
+    unsigned char ROM_NO[8];
+    uint8_t LastDiscrepancy;
+    uint8_t LastFamilyDiscrepancy;
+    uint8_t LastDeviceFlag;
+
+  public:
+    OneWire(uint8_t pin);
+
+    // Perform a 1-Wire reset cycle. Returns 1 if a device responds
+    // with a presence pulse, 0 if there is no device or the bus is shorted.
+    uint8_t reset(void);
+
+    // Issue a 1-Wire rom select command; you do the reset first.
+    void select(const uint8_t rom[8]);
+
+    // Issue a 1-Wire rom skip command, to address all on bus.
+    void skip(void);
+
+    // Write a byte. If 'power' is one then the wire is held high at
+    // the end for parasitically powered devices.
+    void write(uint8_t v, uint8_t power = 0);
+
+    void write_bytes(const uint8_t *buf, uint16_t count, bool power = 0);
+
+    // Read a byte.
+    uint8_t read(void);
+
+    void read_bytes(uint8_t *buf, uint16_t count);
+
+    // Write a bit. The bus is always left powered at the end.
+    void write_bit(uint8_t v);
+
+    // Read a bit.
+    uint8_t read_bit(void);
+
+    // Stop forcing power onto the bus.
+    void depower(void);
+
+    // Clear the search state so that it will start from the beginning again.
+    void reset_search();
+
+    // Setup the search to find the device type 'family_code' on the next call
+    // to search(*newAddr) if it is present.
+    void target_search(uint8_t family_code);
+
+    // Look for the next device. Returns 1 if a new address has been
+    // returned. A zero might mean that the bus is shorted, there are
+    // no devices, or you have already retrieved all of them.
+    uint8_t search(uint8_t *newAddr);
+
+    // Compute a Dallas Semiconductor 8 bit CRC, these are used in the
+    // ROM and scratchpad registers.
+    static uint8_t crc8(const uint8_t *addr, uint8_t len);
+
+    // Compute the 1-Wire CRC16 and compare it against the received CRC.
+    static bool check_crc16(const uint8_t* input, uint16_t len, const uint8_t* inverted_crc, uint16_t crc = 0);
+
+    // Compute a Dallas Semiconductor 16 bit CRC.
+    static uint16_t crc16(const uint8_t* input, uint16_t len, uint16_t crc = 0);
+};
+
+#endif
@@ -0,0 +1,270 @@
+// Print and Stream, as in the Arduino core
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "Arduino.h"
+#include "Print.h"
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(const __FlashStringHelper *s)
+{
+  return write(reinterpret_cast<const char *>(s));
+}
+
+size_t Print::print(const char str[])
+{
+  return write(str);
+}
+
+size_t Print::print(char c)
+{
+  return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char b, int base)
+{
+  return print((unsigned long)b, base);
+}
+
+size_t Print::print(int n, int base)
+{
+  return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+  if (base == 0) {
+    return write((uint8_t)n);
+  }
+  else if (base == 10) {
+    if (n < 0) {
+      int t = print('-');
+      n = -n;
+      return printNumber(n, 10) + t;
+    }
+    return printNumber(n, 10);
+  }
+  // As on the AVR, negative numbers in other bases are printed as 32-bit two's complement
+  return printNumber((uint32_t)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  if (base == 0)
+    return write((uint8_t)n);
+  return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits)
+{
+  return printFloat(n, digits);
+}
+
+size_t Print::println(void)
+{
+  size_t n = print('\r');
+  n += print('\n');
+  return n;
+}
+
+#define PRINTLN(type, ...) \
+  { size_t n = print(__VA_ARGS__); n += println(); return n; }
+
+size_t Print::println(const __FlashStringHelper *s) PRINTLN(const __FlashStringHelper *, s)
+size_t Print::println(const char c[]) PRINTLN(const char *, c)
+size_t Print::println(char c) PRINTLN(char, c)
+size_t Print::println(unsigned char b, int base) PRINTLN(unsigned char, b, base)
+size_t Print::println(int num, int base) PRINTLN(int, num, base)
+size_t Print::println(unsigned int num, int base) PRINTLN(unsigned int, num, base)
+size_t Print::println(long num, int base) PRINTLN(long, num, base)
+size_t Print::println(unsigned long num, int base) PRINTLN(unsigned long, num, base)
+size_t Print::println(double num, int digits) PRINTLN(double, num, digits)
+
+size_t Print::printNumber(unsigned long n, uint8_t base)
+{
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+
+  *str = '\0';
+  if (base < 2)
+    base = 10;
+
+  do {
+    unsigned long m = n;
+    n /= base;
+    char c = m - base * n;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+
+  return write(str);
+}
+
+size_t Print::printFloat(double number, uint8_t digits)
+{
+  size_t n = 0;
+
+  if (number < 0.0) {
+    n += print('-');
+    number = -number;
+  }
+
+  // Round correctly so that print(1.999, 2) prints as "2.00"
+  double rounding = 0.5;
+  for (uint8_t i = 0; i < digits; ++i)
+    rounding /= 10.0;
+  number += rounding;
+
+  unsigned long int_part = (unsigned long)number;
+  double remainder = number - (double)int_part;
+  n += print(int_part);
+
+  if (digits > 0)
+    n += print('.');
+
+  while (digits-- > 0) {
+    remainder *= 10.0;
+    int toPrint = int(remainder);
+    n += print(toPrint);
+    remainder -= toPrint;
+  }
+
+  return n;
+}
+
+//
+// Stream
+//
+
+int Stream::timedRead()
+{
+  int c;
+  _startMillis = millis();
+  do {
+    c = read();
+    if (c >= 0)
+      return c;
+  } while (millis() - _startMillis < _timeout);
+  return -1;
+}
+
+int Stream::timedPeek()
+{
+  int c;
+  _startMillis = millis();
+  do {
+    c = peek();
+    if (c >= 0)
+      return c;
+  } while (millis() - _startMillis < _timeout);
+  return -1;
+}
+
+int Stream::peekNextDigit()
+{
+  int c;
+  while (1) {
+    c = timedPeek();
+    if (c < 0)
+      return c;
+    if (c == '-')
+      return c;
+    if (c >= '0' && c <= '9')
+      return c;
+    read();
+  }
+}
+
+void Stream::setTimeout(unsigned long timeout)
+{
+  _timeout = timeout;
+}
+
+bool Stream::find(char *target)
+{
+  return findUntil(target, NULL);
+}
+
+bool Stream::findUntil(char *target, char *terminator)
+{
+  size_t targetLen = strlen(target);
+  size_t termLen = terminator ? strlen(terminator) : 0;
+  size_t index = 0, termIndex = 0;
+  int c;
+
+  if (*target == 0)
+    return true;
+  while ((c = timedRead()) > 0) {
+    if (c == target[index]) {
+      if (++index >= targetLen)
+        return true;
+    }
+    else {
+      index = 0;
+    }
+    if (termLen > 0 && c == terminator[termIndex]) {
+      if (++termIndex >= termLen)
+        return false;
+    }
+    else {
+      termIndex = 0;
+    }
+  }
+  return false;
+}
+
+long Stream::parseInt()
+{
+  bool isNegative = false;
+  long value = 0;
+  int c = peekNextDigit();
+  if (c < 0)
+    return 0;
+  do {
+    if (c == '-')
+      isNegative = true;
+    else if (c >= '0' && c <= '9')
+      value = value * 10 + c - '0';
+    read();
+    c = timedPeek();
+  } while ((c >= '0' && c <= '9') || (c == '-' && value == 0 && !isNegative));
+  return isNegative ? -value : value;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length) {
+    int c = timedRead();
+    if (c < 0)
+      break;
+    *buffer++ = (char)c;
+    count++;
+  }
+  return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+  size_t index = 0;
+  while (index < length) {
+    int c = timedRead();
+    if (c < 0 || c == terminator)
+      break;
+    *buffer++ = (char)c;
+    index++;
+  }
+  return index;
+}
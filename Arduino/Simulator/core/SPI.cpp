@@ -0,0 +1,167 @@
+// The SPI library (as in Arduino 1.0), and the SPI peripheral under it: master mode
+// only, a byte at a time, at the clock SPCR/SPSR select. The parts on the bus are
+// SpiSlaves (see sim_bus.h).
+
+#include "sim.h"
+#include "sim_bus.h"
+#include "SPI.h"
+
+SPIClass SPI;
+
+void SPIClass::begin() {
+  // Set direction register for SCK and MOSI pin.
+  // MISO pin automatically overrides to INPUT.
+  // When the SS pin is set as OUTPUT, it can be used as
+  // a general purpose output port (it doesn't influence
+  // SPI operations).
+
+  pinMode(SCK, OUTPUT);
+  pinMode(MOSI, OUTPUT);
+  pinMode(SS, OUTPUT);
+
+  digitalWrite(SCK, LOW);
+  digitalWrite(MOSI, LOW);
+  digitalWrite(SS, HIGH);
+
+  // Warning: if the SS pin ever becomes a LOW INPUT then SPI
+  // automatically switches to Slave, so the data direction of
+  // the SS pin MUST be kept as OUTPUT.
+  SPCR |= _BV(MSTR);
+  SPCR |= _BV(SPE);
+}
+
+void SPIClass::end() {
+  SPCR &= ~_BV(SPE);
+}
+
+void SPIClass::setBitOrder(uint8_t bitOrder)
+{
+  if(bitOrder == LSBFIRST) {
+    SPCR |= _BV(DORD);
+  } else {
+    SPCR &= ~(_BV(DORD));
+  }
+}
+
+void SPIClass::setDataMode(uint8_t mode)
+{
+  SPCR = (SPCR & ~SPI_MODE_MASK) | mode;
+}
+
+void SPIClass::setClockDivider(uint8_t rate)
+{
+  SPCR = (SPCR & ~SPI_CLOCK_MASK) | (rate & SPI_CLOCK_MASK);
+  SPSR = (SPSR & ~SPI_2XCLOCK_MASK) | ((rate >> 2) & SPI_2XCLOCK_MASK);
+}
+
+namespace sim {
+
+static std::vector<SpiSlave *> &spiSlaves(void) {
+  static std::vector<SpiSlave *> list;
+  return list;
+}
+
+SpiSlave::SpiSlave() {
+  spiSlaves().push_back(this);
+}
+
+class Spi : public Device {
+  public:
+  Spi() : Device("SPI"), spcr(0), spsr(0), spdr(0), out(0), busy(false), doneAt(SIM_NEVER),
+    flagSeen(false), bytes(0) {
+    mapRegister(0x4C, this);
+    mapRegister(0x4D, this);
+    mapRegister(0x4E, this);
+  }
+
+  uint64_t nextEvent(void) {
+    return busy ? doneAt : SIM_NEVER;
+  }
+
+  void event(void) {
+    busy = false;
+    // MISO floats high if no part drives it
+    int in = 0xff;
+    for (size_t i = 0; i < spiSlaves().size(); i++) {
+      int b = spiSlaves()[i]->byte(out);
+      if (b >= 0)
+        in &= b;
+    }
+    spdr = in;
+    spsr |= _BV(SPIF);
+    flagSeen = false;
+    bytes++;
+  }
+
+  uint8_t read(uint16_t addr) {
+    switch (addr) {
+      case 0x4C:
+        return spcr;
+      case 0x4D:
+        // Busy-waiting for SPIF: skip to the end of the transfer
+        if (busy && polling(addr))
+          spendUntil(doneAt);
+        if (spsr & _BV(SPIF))
+          flagSeen = true;
+        return spsr;
+      default:
+        clearFlags();
+        return spdr;
+    }
+  }
+
+  void write(uint16_t addr, uint8_t value) {
+    switch (addr) {
+      case 0x4C:
+        spcr = value;
+        if (spcr & _BV(SPIE))
+          warn("the SPI interrupt isn't simulated");
+        if ((spcr & _BV(SPE)) && !(spcr & _BV(MSTR)))
+          warn("SPI slave mode isn't simulated");
+        break;
+      case 0x4D:
+        spsr = (spsr & ~_BV(SPI2X)) | (value & _BV(SPI2X));
+        break;
+      default:
+        clearFlags();
+        if (busy) {
+          spsr |= _BV(WCOL);
+          break;
+        }
+        if ((spcr & (_BV(SPE) | _BV(MSTR))) != (_BV(SPE) | _BV(MSTR)))
+          break;
+        out = value;
+        busy = true;
+        doneAt = now + 8 * divider();
+        reschedule();
+    }
+  }
+
+  void summary(FILE *f) {
+    if (bytes)
+      fprintf(f, "  SPI: %lu bytes\n", (unsigned long)bytes);
+  }
+
+  private:
+  uint8_t spcr, spsr, spdr, out;
+  bool busy;
+  uint64_t doneAt;
+  bool flagSeen; // SPSR was read with SPIF set, so accessing SPDR clears it
+  uint32_t bytes;
+
+  uint32_t divider(void) {
+    static const uint8_t dividers[4] = { 4, 16, 64, 128 };
+    uint32_t d = dividers[spcr & 3];
+    return (spsr & _BV(SPI2X)) ? d / 2 : d;
+  }
+
+  void clearFlags(void) {
+    if (flagSeen)
+      spsr &= ~(_BV(SPIF) | _BV(WCOL));
+    flagSeen = false;
+  }
+};
+
+static Spi spi SIM_EARLY;
+
+}
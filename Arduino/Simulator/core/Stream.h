@@ -0,0 +1,32 @@
+#ifndef Stream_h
+#define Stream_h
+
+#include <inttypes.h>
+#include "Print.h"
+
+class Stream : public Print
+{
+  protected:
+    unsigned long _timeout; // milliseconds to wait for input in the read functions below
+    unsigned long _startMillis;
+    int timedRead();
+    int timedPeek();
+    int peekNextDigit();
+
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+
+    Stream() { _timeout = 1000; _startMillis = 0; }
+
+    void setTimeout(unsigned long timeout);
+    bool find(char *target);
+    bool findUntil(char *target, char *terminator);
+    long parseInt();
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytesUntil(char terminator, char *buffer, size_t length);
+};
+
+#endif
@@ -0,0 +1,2 @@
+// Pre-1.0 sketches and libraries include this instead
+#include "Arduino.h"
@@ -0,0 +1,25 @@
+#ifndef _AVR_INTERRUPT_H_
+#define _AVR_INTERRUPT_H_
+
+#include <sim.h>
+
+// Interrupts. cli()/sei() set the simulated I flag, and an ISR is an ordinary function
+// that the simulator calls when its flag is set (see sim::mapVector()).
+
+static inline void cli(void) {
+  sim::spend(1);
+  sim::setInterrupts(false);
+}
+
+static inline void sei(void) {
+  sim::spend(1);
+  sim::setInterrupts(true);
+}
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR(vector, ...) extern "C" void vector(void); extern "C" void vector(void)
+#define EMPTY_INTERRUPT(vector) ISR(vector) { }
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+#include <stdint.h>
+#include <sim.h>
+
+// The ATmega328P's registers, as far as the sketches and libraries here use them.
+// Each register is a small object whose reads and writes go to the simulator (see
+// sim::ioRead()), so that e.g. TCCR1B |= (1 << CS10) starts the simulated Timer1.
+// The compound assignments take an int, as on the AVR, where e.g. PORTD &= ~(1 << 7)
+// is worked out as an int and truncated on the way into the register.
+
+namespace sim {
+
+class Reg8 {
+  public:
+  explicit Reg8(uint16_t _addr) : addr(_addr) { }
+  operator uint8_t() const { return ioRead(addr); }
+  Reg8 &operator=(uint8_t value) { ioWrite(addr, value); return *this; }
+  Reg8 &operator=(const Reg8 &other) { ioWrite(addr, (uint8_t)other); return *this; }
+  Reg8 &operator|=(int value) { ioModify(addr, 0xff, (uint8_t)value, 0); return *this; }
+  Reg8 &operator&=(int value) { ioModify(addr, (uint8_t)value, 0, 0); return *this; }
+  Reg8 &operator^=(int value) { ioModify(addr, 0xff, 0, (uint8_t)value); return *this; }
+  private:
+  uint16_t addr;
+};
+
+class Reg16 {
+  public:
+  explicit Reg16(uint16_t _addr) : addr(_addr) { }
+  operator uint16_t() const { return ioRead16(addr); }
+  Reg16 &operator=(uint16_t value) { ioWrite16(addr, value); return *this; }
+  Reg16 &operator=(const Reg16 &other) { ioWrite16(addr, (uint16_t)other); return *this; }
+  Reg16 &operator+=(uint16_t value) { ioWrite16(addr, ioRead16(addr) + value); return *this; }
+  Reg16 &operator-=(uint16_t value) { ioWrite16(addr, ioRead16(addr) - value); return *this; }
+  private:
+  uint16_t addr;
+};
+
+}
+
+#define _BV(bit) (1 << (bit))
+#define _SFR_MEM8(addr) sim::Reg8(addr)
+#define _SFR_MEM16(addr) sim::Reg16(addr)
+#define _SFR_IO8(addr) sim::Reg8((addr) + 0x20)
+#define _SFR_IO16(addr) sim::Reg16((addr) + 0x20)
+#define _SFR_BYTE(sfr) (sfr)
+#define _SFR_WORD(sfr) (sfr)
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit) do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do { } while (bit_is_set(sfr, bit))
+
+// Ports
+#define PINB _SFR_IO8(0x03)
+#define DDRB _SFR_IO8(0x04)
+#define PORTB _SFR_IO8(0x05)
+#define PINC _SFR_IO8(0x06)
+#define DDRC _SFR_IO8(0x07)
+#define PORTC _SFR_IO8(0x08)
+#define PIND _SFR_IO8(0x09)
+#define DDRD _SFR_IO8(0x0A)
+#define PORTD _SFR_IO8(0x0B)
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// Timer/Counter1
+#define TIFR1 _SFR_IO8(0x16)
+#define ICF1 5
+#define OCF1B 2
+#define OCF1A 1
+#define TOV1 0
+
+#define TIMSK1 _SFR_MEM8(0x6F)
+#define ICIE1 5
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1 0
+
+#define TCCR1A _SFR_MEM8(0x80)
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define WGM11 1
+#define WGM10 0
+
+#define TCCR1B _SFR_MEM8(0x81)
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+
+#define TCCR1C _SFR_MEM8(0x82)
+#define TCNT1 _SFR_MEM16(0x84)
+#define TCNT1L _SFR_MEM8(0x84)
+#define TCNT1H _SFR_MEM8(0x85)
+#define ICR1 _SFR_MEM16(0x86)
+#define OCR1A _SFR_MEM16(0x88)
+#define OCR1AL _SFR_MEM8(0x88)
+#define OCR1AH _SFR_MEM8(0x89)
+#define OCR1B _SFR_MEM16(0x8A)
+#define OCR1BL _SFR_MEM8(0x8A)
+#define OCR1BH _SFR_MEM8(0x8B)
+
+// SPI
+#define SPCR _SFR_IO8(0x2C)
+#define SPIE 7
+#define SPE 6
+#define DORD 5
+#define MSTR 4
+#define CPOL 3
+#define CPHA 2
+#define SPR1 1
+#define SPR0 0
+
+#define SPSR _SFR_IO8(0x2D)
+#define SPIF 7
+#define WCOL 6
+#define SPI2X 0
+
+#define SPDR _SFR_IO8(0x2E)
+
+// TWI
+#define TWBR _SFR_MEM8(0xB8)
+
+#define TWSR _SFR_MEM8(0xB9)
+#define TWS7 7
+#define TWS6 6
+#define TWS5 5
+#define TWS4 4
+#define TWS3 3
+#define TWPS1 1
+#define TWPS0 0
+
+#define TWAR _SFR_MEM8(0xBA)
+#define TWDR _SFR_MEM8(0xBB)
+
+#define TWCR _SFR_MEM8(0xBC)
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC 3
+#define TWEN 2
+#define TWIE 0
+
+#define TWAMR _SFR_MEM8(0xBD)
+
+// The status register; only the I flag is simulated
+#define SREG _SFR_IO8(0x3F)
+#define SREG_I 7
+
+#endif
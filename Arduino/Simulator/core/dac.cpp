@@ -0,0 +1,101 @@
+// The MCP49x1/MCP49x2 SPI DACs (--dac): frames of 16 bits, clocked in while the chip
+// select pin is low, and acted on as it goes high. LDAC is taken to be tied low, so
+// the output follows each frame; every update goes in the timeline, as
+// "dac <A|B> <value>" (in the DAC's own steps), and the summary has the spread of
+// the time between updates, which shows any jitter in the sample clock.
+
+#include <string.h>
+#include <string>
+#include "sim.h"
+#include "sim_bus.h"
+#include "Arduino.h"
+
+namespace sim {
+
+class Dac : public Device, public SpiSlave {
+  public:
+  Dac() : Device("DAC"), bits(0), cs(10), frame(0), frameBits(0), updates(0), badFrames(0),
+    last(0), minInterval(SIM_NEVER), maxInterval(0) {
+    value[0] = value[1] = 0;
+  }
+
+  uint8_t bits; // 8, 10 or 12; 0 if there's no DAC
+  uint8_t cs;
+
+  void begin(void) {
+    if (bits)
+      pins::watch(cs, this);
+  }
+
+  int byte(uint8_t mosi) {
+    if (bits == 0 || pins::level(cs))
+      return -1;
+    frame = (frame << 8) | mosi;
+    frameBits += 8;
+    return -1; // the DAC has no output
+  }
+
+  void pinChanged(uint8_t, bool level) {
+    if (!level) {
+      frame = 0;
+      frameBits = 0;
+      return;
+    }
+    if (frameBits == 0)
+      return;
+    if (frameBits != 16) {
+      badFrames++;
+      warn("DAC: a frame of %d bits; the DAC ignores it", frameBits);
+      return;
+    }
+    if (!(frame & 0x1000))
+      return; // shut down
+    uint8_t channel = frame >> 15;
+    value[channel] = (frame & 0xfff) >> (12 - bits);
+    trace("dac", "%c %u", 'A' + channel, value[channel]);
+    if (updates > 0) {
+      uint64_t interval = now - last;
+      if (interval < minInterval)
+        minInterval = interval;
+      if (interval > maxInterval)
+        maxInterval = interval;
+    }
+    last = now;
+    updates++;
+  }
+
+  void summary(FILE *f) {
+    if (updates > 1)
+      fprintf(f, "  DAC: %lu updates, %llu to %llu cycles apart\n", (unsigned long)updates,
+              (unsigned long long)minInterval, (unsigned long long)maxInterval);
+    else if (bits)
+      fprintf(f, "  DAC: %lu updates\n", (unsigned long)updates);
+    if (badFrames)
+      fprintf(f, "  DAC: %lu bad frames\n", (unsigned long)badFrames);
+  }
+
+  private:
+  uint32_t frame;
+  uint8_t frameBits;
+  uint16_t value[2];
+  uint32_t updates, badFrames;
+  uint64_t last, minInterval, maxInterval;
+};
+
+static Dac dac SIM_EARLY;
+
+static void setDac(const char *s) {
+  const char *at = strchr(s, '@');
+  std::string model(s, at ? at - s : strlen(s));
+  if (model.size() != 7 || model.compare(0, 5, "MCP49") != 0 || !strchr("012", model[5]) || !strchr("12", model[6]))
+    fail("--dac: not an MCP49x1 or MCP49x2: %s", model.c_str());
+  dac.bits = 8 + 2 * (model[5] - '0');
+  if (at)
+    dac.cs = parseNumber(at + 1, "--dac");
+  if (dac.cs >= NUM_DIGITAL_PINS)
+    fail("--dac: no pin %d", dac.cs);
+}
+
+static Option dacOption("dac", "MODEL[@CS]", "an MCP49x1/x2 DAC on the SPI bus, e.g. MCP4901@10 (the default CS pin)", setDac);
+
+}
@@ -0,0 +1,316 @@
+// DS18S20 and DS18B20 temperature sensors on the 1-Wire bus (--onewire), as their
+// datasheets describe them, at the bit level: the ROM commands (READ, MATCH, SKIP and
+// SEARCH ROM), CONVERT T (during which read slots return 0), and reading and writing
+// the scratchpad. A sensor powers up with 85 C in its scratchpad, and can be made to
+// appear and disappear, as if it were plugged in and out.
+
+#include <string.h>
+#include <math.h>
+#include <string>
+#include "sim.h"
+#include "sim_bus.h"
+#include "Arduino.h"
+#include "OneWire.h"
+
+#define FAMILY_DS18S20 0x10
+#define FAMILY_DS18B20 0x28
+#define CONVERSION_MS 750 // the most a (12-bit) conversion takes
+
+namespace sim {
+
+class Ds18x20 : public Device, public OneWireSlave {
+  public:
+  Ds18x20(const uint8_t *_rom, double _temperature, double _rate, uint64_t _from, uint64_t _to)
+    : Device(_rom[0] == FAMILY_DS18S20 ? "DS18S20" : "DS18B20"), temperature(_temperature),
+      rate(_rate), from(_from), to(_to), powered(false), state(IDLE), convertDone(0),
+      converting(false), conversions(0), reads(0) {
+    memcpy(rom, _rom, 8);
+    snprintf(id, sizeof(id), "%02x-%02x%02x%02x%02x%02x%02x", rom[0], rom[6], rom[5], rom[4],
+             rom[3], rom[2], rom[1]);
+  }
+
+  bool reset(void) {
+    if (!update())
+      return false;
+    state = ROM_COMMAND;
+    count = 0;
+    shift = 0;
+    return true;
+  }
+
+  void writeBit(bool bit) {
+    if (!update())
+      return;
+    switch (state) {
+      case ROM_COMMAND:
+      case FUNCTION_COMMAND:
+      case WRITE_SCRATCHPAD:
+        shift = (shift >> 1) | (bit ? 0x80 : 0);
+        if (++count == 8) {
+          count = 0;
+          byteReceived(shift);
+        }
+        break;
+      case MATCH_ROM:
+        if (bit != romBit(count)) {
+          state = IDLE;
+        }
+        else if (++count == 64) {
+          state = FUNCTION_COMMAND;
+          count = 0;
+        }
+        break;
+      case SEARCH_ROM:
+        // Each bit is sent, then its complement, then the master says which way it went;
+        // the parts that didn't go that way drop out until the next reset
+        if (phase != 2)
+          break;
+        if (bit != romBit(count)) {
+          state = IDLE;
+          break;
+        }
+        phase = 0;
+        if (++count == 64) {
+          state = FUNCTION_COMMAND;
+          count = 0;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  bool readBit(void) {
+    if (!update())
+      return true;
+    switch (state) {
+      case READ_ROM: {
+        bool bit = romBit(count);
+        if (++count == 64) {
+          state = FUNCTION_COMMAND;
+          count = 0;
+        }
+        return bit;
+      }
+      case SEARCH_ROM:
+        if (phase == 0) {
+          phase = 1;
+          return romBit(count);
+        }
+        if (phase == 1) {
+          phase = 2;
+          return !romBit(count);
+        }
+        return true;
+      case CONVERTING:
+        return !converting;
+      case READ_SCRATCHPAD:
+        if (count >= 72)
+          return true;
+        count++;
+        return (scratchpad[(count - 1) / 8] >> ((count - 1) % 8)) & 1;
+      case READ_POWER_SUPPLY:
+        return true; // not parasite powered
+      default:
+        return true;
+    }
+  }
+
+  void summary(FILE *f) {
+    fprintf(f, "  %s %s: %lu conversions, %lu scratchpad reads\n", name, id,
+            (unsigned long)conversions, (unsigned long)reads);
+  }
+
+  private:
+  enum State { IDLE, ROM_COMMAND, READ_ROM, MATCH_ROM, SEARCH_ROM, FUNCTION_COMMAND, CONVERTING,
+    READ_SCRATCHPAD, WRITE_SCRATCHPAD, READ_POWER_SUPPLY };
+
+  uint8_t rom[8];
+  char id[16]; // as Linux names them, e.g. 28-00000abcdef1
+  double temperature, rate; // C at time 0, and C per second from then on
+  uint64_t from, to; // when the sensor is plugged in
+  bool powered;
+  State state;
+  uint8_t count, shift, phase, written;
+  uint8_t scratchpad[9];
+  uint8_t config; // the DS18B20's configuration register, which sets the resolution
+  uint64_t convertDone;
+  bool converting;
+  uint32_t conversions, reads;
+
+  bool romBit(uint8_t n) {
+    return (rom[n / 8] >> (n % 8)) & 1;
+  }
+
+  bool isB20(void) {
+    return rom[0] == FAMILY_DS18B20;
+  }
+
+  // Powers the sensor up or down as it's plugged in or out, and finishes conversions;
+  // returns whether it's on the bus
+  bool update(void) {
+    if (now < from || now >= to) {
+      if (powered)
+        trace("onewire", "%s unplugged", id);
+      powered = false;
+      state = IDLE;
+      return false;
+    }
+    if (!powered) {
+      powered = true;
+      converting = false;
+      state = IDLE;
+      // The power-on values: 85 C, the alarm thresholds and 12 bits from the EEPROM
+      scratchpad[2] = 0x4B;
+      scratchpad[3] = 0x46;
+      config = 0x7F;
+      setTemperature(85.0);
+      trace("onewire", "%s plugged in", id);
+    }
+    if (converting && now >= convertDone) {
+      converting = false;
+      double t = temperature + rate * (convertDone / (double)F_CPU);
+      setTemperature(constrain(t, -55.0, 125.0));
+    }
+    return true;
+  }
+
+  uint64_t conversionTime(void) {
+    if (!isB20())
+      return SIM_MS(CONVERSION_MS);
+    return SIM_MS(CONVERSION_MS) >> (3 - ((config >> 5) & 3)); // 93.75 ms at 9 bits
+  }
+
+  void setTemperature(double t) {
+    int16_t raw = (int16_t)floor(t * 16 + 0.5); // in 1/16 C
+    if (isB20()) {
+      // The bits below the resolution are undefined; here they're left as they were
+      // measured, so the reader has to mask them off
+      scratchpad[0] = raw & 0xff;
+      scratchpad[1] = (raw >> 8) & 0xff;
+      scratchpad[4] = config;
+      scratchpad[5] = 0xff;
+      scratchpad[6] = 0x0c;
+      scratchpad[7] = 0x10;
+    }
+    else {
+      // The 9-bit value, and the counter values that give the extended resolution by
+      //   TEMP_READ - 0.25 + (COUNT_PER_C - COUNT_REMAIN) / COUNT_PER_C
+      // where TEMP_READ is the 9-bit value with its half degree bit truncated
+      uint8_t remain = (12 - raw) & 15;
+      int16_t whole = (raw - 12 + remain) / 16;
+      int16_t half = 2 * whole + ((raw - 16 * whole) >= 4 ? 1 : 0);
+      scratchpad[0] = half & 0xff;
+      scratchpad[1] = half < 0 ? 0xff : 0x00;
+      scratchpad[4] = 0xff;
+      scratchpad[5] = 0xff;
+      scratchpad[6] = remain;
+      scratchpad[7] = 0x10;
+    }
+    scratchpad[8] = OneWire::crc8(scratchpad, 8);
+  }
+
+  void byteReceived(uint8_t b) {
+    if (state == ROM_COMMAND) {
+      switch (b) {
+        case 0x33: state = READ_ROM; break;
+        case 0x55: state = MATCH_ROM; break;
+        case 0xCC: state = FUNCTION_COMMAND; break;
+        case 0xF0: state = SEARCH_ROM; phase = 0; break;
+        default: state = IDLE; break; // ALARM SEARCH (no alarms here), or nonsense
+      }
+      return;
+    }
+
+    if (state == WRITE_SCRATCHPAD) {
+      // TH, TL, and on the DS18B20, the configuration register
+      scratchpad[2 + written] = b;
+      if (written == 2)
+        config = (b & 0x60) | 0x1f;
+      if (++written == (isB20() ? 3 : 2)) {
+        if (isB20())
+          trace("onewire", "%s write %02x %02x %02x", id, scratchpad[2], scratchpad[3], config);
+        else
+          trace("onewire", "%s write %02x %02x", id, scratchpad[2], scratchpad[3]);
+        state = IDLE;
+      }
+      return;
+    }
+
+    // FUNCTION_COMMAND
+    switch (b) {
+      case 0x44: // CONVERT T
+        if (!converting) {
+          converting = true;
+          convertDone = now + conversionTime();
+          conversions++;
+          trace("onewire", "%s convert", id);
+        }
+        state = CONVERTING;
+        break;
+      case 0xBE: // READ SCRATCHPAD
+        scratchpad[4] = isB20() ? config : 0xff;
+        scratchpad[8] = OneWire::crc8(scratchpad, 8);
+        state = READ_SCRATCHPAD;
+        reads++;
+        trace("onewire", "%s read %02x%02x", id, scratchpad[1], scratchpad[0]);
+        break;
+      case 0x4E: // WRITE SCRATCHPAD
+        state = WRITE_SCRATCHPAD;
+        written = 0;
+        break;
+      case 0xB4: // READ POWER SUPPLY
+        state = READ_POWER_SUPPLY;
+        break;
+      default: // COPY SCRATCHPAD and RECALL E2 don't change anything that's simulated
+        state = IDLE;
+        break;
+    }
+  }
+};
+
+// ROM=TEMP[,RATE][@FROM-TO], e.g. 28-00000abcdef1=21.5,0.01@10-60: a DS18B20 at 21.5 C,
+// warming by 0.01 C/s, plugged in from 10 s to 60 s into the run
+static void addSensor(const char *s) {
+  const char *eq = strchr(s, '=');
+  unsigned family;
+  unsigned long long serial;
+  int n = 0;
+  if (eq == NULL || sscanf(s, "%2x-%12llx%n", &family, &serial, &n) != 2 || s + n != eq)
+    fail("--onewire: expected ROM=TEMP[,RATE][@FROM-TO], e.g. 28-00000abcdef1=21.5, not %s", s);
+  if (family != FAMILY_DS18S20 && family != FAMILY_DS18B20)
+    fail("--onewire: family %02x isn't simulated (10 is a DS18S20, 28 a DS18B20)", family);
+  uint8_t rom[8];
+  rom[0] = family;
+  for (int i = 1; i < 7; i++)
+    rom[i] = serial >> (8 * (i - 1));
+  rom[7] = OneWire::crc8(rom, 7);
+
+  std::string arg(eq + 1);
+  uint64_t from = 0, to = SIM_NEVER;
+  size_t at = arg.find('@');
+  if (at != std::string::npos) {
+    std::string range = arg.substr(at + 1);
+    size_t dash = range.find('-');
+    if (dash == std::string::npos)
+      fail("--onewire: expected @FROM-TO, e.g. @10-60, not @%s", range.c_str());
+    if (dash > 0)
+      from = parseTime(range.substr(0, dash).c_str(), "--onewire");
+    if (dash + 1 < range.size())
+      to = parseTime(range.substr(dash + 1).c_str(), "--onewire");
+    arg.erase(at);
+  }
+  double rate = 0;
+  size_t comma = arg.find(',');
+  if (comma != std::string::npos) {
+    rate = parseFloat(arg.substr(comma + 1).c_str(), "--onewire");
+    arg.erase(comma);
+  }
+  double temperature = parseFloat(arg.c_str(), "--onewire");
+  new Ds18x20(rom, temperature, rate, from, to);
+}
+
+static Option sensorOption("onewire", "ROM=TEMP[,RATE][@FROM-TO]",
+  "a DS18S20 (10-...) or DS18B20 (28-...) at TEMP C, changing by RATE C/s, on the bus from FROM to TO s", addSensor);
+
+}
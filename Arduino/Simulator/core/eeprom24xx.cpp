@@ -0,0 +1,190 @@
+// Microchip's 24XX I2C EEPROMs (--i2c-eeprom): 24LC1025, 24LC512, 24LC256 and 24LC128,
+// as the datasheets describe them: a 16-bit address pointer, writes that wrap around
+// within a page, a write cycle during which the chip doesn't acknowledge its address,
+// and sequential reads. The contents are loaded from an image file, if it exists, and
+// saved back to it at the end of the run, if they were written to.
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include "sim.h"
+#include "sim_bus.h"
+#include "Arduino.h"
+
+#define WRITE_CYCLE_MS 5
+
+namespace sim {
+
+struct EepromModel {
+  const char *name;
+  uint32_t capacity;
+  uint8_t pageSize;
+};
+
+static const EepromModel eepromModels[] = {
+  { "24LC1025", 131072, 128 },
+  { "24LC512", 65536, 128 },
+  { "24LC256", 32768, 64 },
+  { "24LC128", 16384, 64 },
+};
+
+class Eeprom24XX : public Device, public I2CSlave {
+  public:
+  Eeprom24XX(const EepromModel *_model, uint8_t _address, const std::string &_path)
+    : Device(_model->name), model(_model), address(_address), path(_path),
+      memory(_model->capacity, 0xff), pointer(0), busyUntil(0), state(IDLE), block(0),
+      dirty(false), pageWrites(0), bytesRead(0), nacks(0) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f) {
+      size_t n = fread(&memory[0], 1, memory.size(), f);
+      fgetc(f);
+      if (!feof(f))
+        warn("%s is larger than the %s; the rest is ignored", path.c_str(), model->name);
+      (void)n;
+      fclose(f);
+    }
+  }
+
+  bool start(uint8_t addressByte) {
+    uint8_t a = addressByte >> 1;
+    // The 24LC1025's block select bit is bit 2 of the address; its A2 pin must be high
+    if (model->capacity > 65536) {
+      if ((a & ~4) != address)
+        return false;
+    }
+    else if (a != address) {
+      return false;
+    }
+    if (now < busyUntil) {
+      nacks++;
+      return false; // still in the write cycle
+    }
+    block = (model->capacity > 65536 && (a & 4)) ? 1 : 0;
+    if (addressByte & 1) {
+      state = READING;
+    }
+    else {
+      state = ADDRESS_HIGH;
+      page.clear();
+    }
+    return true;
+  }
+
+  bool write(uint8_t data) {
+    switch (state) {
+      case ADDRESS_HIGH:
+        pointer = (pointer & 0xff) | (data << 8);
+        state = ADDRESS_LOW;
+        break;
+      case ADDRESS_LOW:
+        pointer = (pointer & 0xff00) | data;
+        state = WRITING;
+        pageStart = pointer;
+        break;
+      case WRITING:
+        // Bytes past the end of the page wrap around to its start, overwriting
+        // what was sent first
+        page.push_back(data);
+        break;
+      default:
+        return false;
+    }
+    return true;
+  }
+
+  uint8_t read(bool) {
+    uint8_t b = memory[fullAddress(pointer)];
+    // Sequential reads go on to the next byte, rolling over at the end of the block
+    pointer = (pointer + 1) & (blockSize() - 1);
+    bytesRead++;
+    return b;
+  }
+
+  void stop(void) {
+    if (state == WRITING && !page.empty()) {
+      uint16_t size = model->pageSize;
+      uint16_t base = pageStart & ~(size - 1);
+      for (size_t i = 0; i < page.size(); i++) {
+        uint16_t offset = (pageStart + i) & (size - 1);
+        memory[fullAddress(base + offset)] = page[i];
+      }
+      pointer = base + ((pageStart + page.size()) & (size - 1));
+      busyUntil = now + SIM_MS(WRITE_CYCLE_MS);
+      dirty = true;
+      pageWrites++;
+    }
+    page.clear();
+    state = IDLE;
+  }
+
+  void finish(void) {
+    if (!dirty)
+      return;
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == NULL || fwrite(&memory[0], 1, memory.size(), f) != memory.size())
+      warn("couldn't save the %s to %s", model->name, path.c_str());
+    if (f)
+      fclose(f);
+  }
+
+  void summary(FILE *f) {
+    fprintf(f, "  %s@0x%02x: %lu bytes read, %lu page writes, %lu NACKs while busy\n", model->name,
+            address, (unsigned long)bytesRead, (unsigned long)pageWrites, (unsigned long)nacks);
+  }
+
+  private:
+  enum State { IDLE, ADDRESS_HIGH, ADDRESS_LOW, WRITING, READING };
+
+  const EepromModel *model;
+  uint8_t address;
+  std::string path;
+  std::vector<uint8_t> memory;
+  uint16_t pointer, pageStart;
+  uint64_t busyUntil;
+  State state;
+  uint8_t block;
+  std::vector<uint8_t> page;
+  bool dirty;
+  uint32_t pageWrites, bytesRead, nacks;
+
+  uint32_t blockSize(void) {
+    return model->capacity > 65536 ? 65536 : model->capacity;
+  }
+
+  uint32_t fullAddress(uint16_t p) {
+    return ((uint32_t)block << 16 | p) & (model->capacity - 1);
+  }
+};
+
+// MODEL@[BUS:]ADDRESS=FILE, e.g. 24LC1025@0x50=clips.img; the bus is the TWI's unless
+// it names a --soft-i2c one
+static void addEeprom(const char *s) {
+  const char *at = strchr(s, '@'), *eq = strchr(s, '=');
+  if (at == NULL || eq == NULL || eq < at)
+    fail("--i2c-eeprom: expected MODEL@[BUS:]ADDRESS=FILE, not %s", s);
+  std::string name(s, at - s), addr(at + 1, eq - at - 1), busName("twi");
+  size_t colon = addr.find(':');
+  if (colon != std::string::npos) {
+    busName = addr.substr(0, colon);
+    addr = addr.substr(colon + 1);
+  }
+  I2CBus *bus = I2CBus::find(busName.c_str());
+  if (bus == NULL)
+    fail("--i2c-eeprom: no bus called %s (--soft-i2c must come first)", busName.c_str());
+  const EepromModel *model = NULL;
+  for (size_t i = 0; i < sizeof(eepromModels) / sizeof(eepromModels[0]); i++) {
+    if (name == eepromModels[i].name)
+      model = &eepromModels[i];
+  }
+  if (model == NULL)
+    fail("--i2c-eeprom: unknown model %s (24LC1025, 24LC512, 24LC256 or 24LC128)", name.c_str());
+  uint32_t a = parseNumber(addr.c_str(), "--i2c-eeprom");
+  if ((a & ~7) != 0x50)
+    fail("--i2c-eeprom: a 24XX is at 0x50-0x57, not 0x%x", a);
+  // Devices are usually static, but these are made as the options are parsed
+  bus->attach(new Eeprom24XX(model, a, eq + 1));
+}
+
+static Option eepromOption("i2c-eeprom", "MODEL@[BUS:]ADDR=FILE", "a 24XX EEPROM on the TWI (or a --soft-i2c bus), e.g. 24LC1025@0x50=clips.img", addEeprom);
+
+}
@@ -0,0 +1,439 @@
+// The simulator's clock, interrupts, registers, options and timeline, and main()
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include "sim.h"
+
+// The sketch
+void setup(void);
+void loop(void);
+
+// Roughly what entering and leaving an ISR costs: 4 cycles to respond, the jmp in the
+// vector table, and the prologue saving the registers a function call may clobber
+// (the ISRs we care about all call functions); then the epilogue and reti.
+#define ISR_ENTRY_CYCLES 40
+#define ISR_EXIT_CYCLES 40
+
+// Each pass through the main loop: the call to loop(), and the serialEvent check
+#define LOOP_CYCLES 10
+
+namespace sim {
+
+uint64_t now = 0;
+bool interruptsEnabled = false;
+
+static uint64_t endAt = SIM_MS(10000);
+static bool quiet = false;
+
+static std::vector<Device *> &devices(void) {
+  static std::vector<Device *> list;
+  return list;
+}
+
+static std::vector<Option *> &options(void) {
+  static std::vector<Option *> list;
+  return list;
+}
+
+Device::Device(const char *_name) : name(_name) {
+  devices().push_back(this);
+}
+
+Option::Option(const char *_name, const char *_arg, const char *_help, void (*_handler)(const char *value))
+  : name(_name), arg(_arg), help(_help), handler(_handler) {
+  options().push_back(this);
+}
+
+void fail(const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  fprintf(stderr, "sketchsim: ");
+  vfprintf(stderr, format, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  exit(2);
+}
+
+void warn(const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  fprintf(stderr, "sketchsim: warning at %.6f s: ", now / (double)F_CPU);
+  vfprintf(stderr, format, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+}
+
+//
+// The timeline
+//
+
+static FILE *timeline = NULL;
+static std::vector<std::string> traceKinds; // empty for all
+
+bool tracing(const char *kind) {
+  if (timeline == NULL)
+    return false;
+  if (traceKinds.empty())
+    return true;
+  for (size_t i = 0; i < traceKinds.size(); i++) {
+    if (traceKinds[i] == kind)
+      return true;
+  }
+  return false;
+}
+
+void trace(const char *kind, const char *format, ...) {
+  if (!tracing(kind))
+    return;
+  va_list ap;
+  va_start(ap, format);
+  fprintf(timeline, "%llu %s ", (unsigned long long)now, kind);
+  vfprintf(timeline, format, ap);
+  fputc('\n', timeline);
+  va_end(ap);
+}
+
+static void openTimeline(const char *path) {
+  timeline = strcmp(path, "-") ? fopen(path, "w") : stdout;
+  if (timeline == NULL)
+    fail("can't write %s", path);
+  setvbuf(timeline, NULL, _IOFBF, 1 << 16);
+  fprintf(timeline, "# sketchsim timeline; times in CPU cycles at %lu Hz\n", (unsigned long)F_CPU);
+}
+
+static void setTraceKinds(const char *list) {
+  std::string s(list);
+  size_t start = 0;
+  while (start <= s.size()) {
+    size_t end = s.find(',', start);
+    if (end == std::string::npos)
+      end = s.size();
+    if (end > start)
+      traceKinds.push_back(s.substr(start, end - start));
+    start = end + 1;
+  }
+}
+
+static void setEnd(const char *s) { endAt = parseTime(s, "--time"); }
+static void setQuiet(const char *) { quiet = true; }
+
+static Option timeOption("time", "T", "how long to run, in virtual seconds (or e.g. 20ms); default 10", setEnd);
+static Option timelineOption("timeline", "FILE", "write the timeline to FILE (- for stdout)", openTimeline);
+static Option traceOption("trace", "KINDS", "only put these kinds of events in the timeline, e.g. isr,dac", setTraceKinds);
+static Option quietOption("quiet", NULL, "don't print the summary at the end", setQuiet);
+
+//
+// The clock
+//
+
+static uint64_t nextDue = 0; // the earliest nextEvent() of any device, if !dirty
+static bool dirty = true;
+
+void reschedule(void) {
+  dirty = true;
+}
+
+void spend(uint32_t cycles) {
+  spendUntil(now + cycles);
+}
+
+void spendUntil(uint64_t when) {
+  if (when > endAt)
+    when = endAt;
+  while (now < when) {
+    if (dirty) {
+      nextDue = SIM_NEVER;
+      for (size_t i = 0; i < devices().size(); i++) {
+        uint64_t t = devices()[i]->nextEvent();
+        if (t < nextDue)
+          nextDue = t;
+      }
+      dirty = false;
+    }
+    if (nextDue > when) {
+      now = when;
+      break;
+    }
+    if (nextDue > now)
+      now = nextDue;
+    for (size_t i = 0; i < devices().size(); i++) {
+      if (devices()[i]->nextEvent() <= now)
+        devices()[i]->event();
+    }
+    dirty = true;
+    checkInterrupts();
+  }
+  if (now >= endAt)
+    finish(0);
+}
+
+//
+// Interrupts
+//
+
+struct Vector {
+  uint8_t number;
+  const char *name;
+  void (*handler)(void);
+  Device *source;
+  uint32_t runs;
+  uint64_t maxLatency, maxLength, totalLength;
+};
+
+static std::vector<Vector> vectors; // by priority
+
+void mapVector(uint8_t vector, const char *name, void (*handler)(void), Device *source) {
+  Vector v = { vector, name, handler, source, 0, 0, 0, 0 };
+  size_t i = 0;
+  while (i < vectors.size() && vectors[i].number < vector)
+    i++;
+  vectors.insert(vectors.begin() + i, v);
+}
+
+static void runISR(size_t index) {
+  uint64_t flagged = vectors[index].source->interruptTaken(vectors[index].number);
+  interruptsEnabled = false;
+  uint64_t start = now;
+  spend(ISR_ENTRY_CYCLES);
+  // The vector table may have grown meanwhile (it doesn't, but don't count on it)
+  Vector *v = &vectors[index];
+  uint64_t latency = now - flagged;
+  trace("isr", "%s %llu", v->name, (unsigned long long)latency);
+  if (v->handler)
+    v->handler();
+  else
+    warn("%s is enabled, but there is no ISR for it", v->name);
+  spend(ISR_EXIT_CYCLES);
+  v = &vectors[index];
+  trace("reti", "%s", v->name);
+  v->runs++;
+  if (latency > v->maxLatency)
+    v->maxLatency = latency;
+  if (now - start > v->maxLength)
+    v->maxLength = now - start;
+  v->totalLength += now - start;
+  interruptsEnabled = true;
+}
+
+void checkInterrupts(void) {
+  while (interruptsEnabled) {
+    size_t i = 0;
+    while (i < vectors.size() && !vectors[i].source->interruptPending(vectors[i].number))
+      i++;
+    if (i == vectors.size())
+      return;
+    runISR(i);
+  }
+}
+
+void setInterrupts(bool enabled) {
+  interruptsEnabled = enabled;
+  if (enabled)
+    checkInterrupts();
+}
+
+//
+// Registers
+//
+
+static Device *ioMap[0x100];
+static uint8_t ioMemory[0x100];
+static uint32_t lastAccess = 0, previousAccess = 0;
+#define ACCESS_READ 0x10000
+
+// lds/sts take 2 cycles; in/out (for the first 64 I/O registers) 1
+#define ACCESS_CYCLES(addr) ((addr) < 0x60 ? 1 : 2)
+
+void mapRegister(uint16_t addr, Device *dev) {
+  ioMap[addr & 0xff] = dev;
+}
+
+bool polling(uint16_t addr) {
+  return previousAccess == (addr | ACCESS_READ);
+}
+
+static uint8_t rawRead(uint16_t addr) {
+  previousAccess = lastAccess;
+  lastAccess = addr | ACCESS_READ;
+  Device *dev = ioMap[addr & 0xff];
+  return dev ? dev->read(addr) : ioMemory[addr & 0xff];
+}
+
+static void rawWrite(uint16_t addr, uint8_t value) {
+  previousAccess = lastAccess;
+  lastAccess = addr;
+  Device *dev = ioMap[addr & 0xff];
+  if (dev)
+    dev->write(addr, value);
+  else
+    ioMemory[addr & 0xff] = value;
+}
+
+uint8_t ioRead(uint16_t addr) {
+  spend(ACCESS_CYCLES(addr));
+  return rawRead(addr);
+}
+
+void ioWrite(uint16_t addr, uint8_t value) {
+  spend(ACCESS_CYCLES(addr));
+  rawWrite(addr, value);
+}
+
+uint16_t ioRead16(uint16_t addr) {
+  spend(2 * ACCESS_CYCLES(addr));
+  previousAccess = lastAccess;
+  lastAccess = addr | ACCESS_READ;
+  Device *dev = ioMap[addr & 0xff];
+  return dev ? dev->read16(addr) : (ioMemory[addr & 0xff] | (ioMemory[(addr + 1) & 0xff] << 8));
+}
+
+void ioWrite16(uint16_t addr, uint16_t value) {
+  spend(2 * ACCESS_CYCLES(addr));
+  previousAccess = lastAccess;
+  lastAccess = addr;
+  Device *dev = ioMap[addr & 0xff];
+  if (dev) {
+    dev->write16(addr, value);
+  }
+  else {
+    ioMemory[addr & 0xff] = value & 0xff;
+    ioMemory[(addr + 1) & 0xff] = value >> 8;
+  }
+}
+
+void ioModify(uint16_t addr, uint8_t andMask, uint8_t orMask, uint8_t xorMask) {
+  // sbi/cbi for the lowest 32 I/O registers; otherwise a load, an operation and a store
+  spend(addr < 0x40 ? 1 : 2 * ACCESS_CYCLES(addr));
+  uint8_t value = ((rawRead(addr) & andMask) | orMask) ^ xorMask;
+  spend(1);
+  rawWrite(addr, value);
+}
+
+//
+// Options
+//
+
+uint32_t parseNumber(const char *s, const char *what) {
+  char *end;
+  unsigned long n = strtoul(s, &end, 0);
+  if (*s == '\0' || *end != '\0')
+    fail("%s: not a number: %s", what, s);
+  return n;
+}
+
+double parseFloat(const char *s, const char *what) {
+  char *end;
+  double d = strtod(s, &end);
+  if (*s == '\0' || *end != '\0')
+    fail("%s: not a number: %s", what, s);
+  return d;
+}
+
+uint64_t parseTime(const char *s, const char *what) {
+  char *end;
+  double d = strtod(s, &end);
+  double unit = 1;
+  if (strcmp(end, "ms") == 0)
+    unit = 1e-3;
+  else if (strcmp(end, "us") == 0)
+    unit = 1e-6;
+  else if (*end != '\0' && strcmp(end, "s") != 0)
+    fail("%s: not a time: %s", what, s);
+  if (end == s || d < 0)
+    fail("%s: not a time: %s", what, s);
+  return (uint64_t)(d * unit * F_CPU + 0.5);
+}
+
+static void usage(void) {
+  fprintf(stderr, "Options (of the simulated board; see sketchsim.py -h for building):\n");
+  for (size_t i = 0; i < options().size(); i++) {
+    Option *o = options()[i];
+    std::string s = std::string("--") + o->name + (o->arg ? std::string(" ") + o->arg : "");
+    fprintf(stderr, "  %-26s %s\n", s.c_str(), o->help);
+  }
+}
+
+static void parseOptions(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+      usage();
+      exit(0);
+    }
+    if (strncmp(argv[i], "--", 2) != 0)
+      fail("unexpected argument: %s", argv[i]);
+    std::string name(argv[i] + 2);
+    const char *value = NULL;
+    size_t eq = name.find('=');
+    if (eq != std::string::npos) {
+      value = argv[i] + 2 + eq + 1;
+      name.resize(eq);
+    }
+    Option *option = NULL;
+    for (size_t j = 0; j < options().size(); j++) {
+      if (name == options()[j]->name)
+        option = options()[j];
+    }
+    if (option == NULL)
+      fail("unknown option --%s (see --help)", name.c_str());
+    if (option->arg && value == NULL) {
+      if (++i == argc)
+        fail("--%s needs an argument", name.c_str());
+      value = argv[i];
+    }
+    else if (!option->arg && value != NULL) {
+      fail("--%s takes no argument", name.c_str());
+    }
+    option->handler(value);
+  }
+}
+
+//
+// The end
+//
+
+void finish(int status) {
+  static bool finishing = false;
+  if (finishing)
+    return; // a device's finish() let time pass
+  finishing = true;
+  for (size_t i = 0; i < devices().size(); i++)
+    devices()[i]->finish();
+  fflush(stdout);
+  if (timeline) {
+    trace("end", "%d", status);
+    fclose(timeline);
+  }
+  if (!quiet) {
+    fprintf(stderr, "sketchsim: %.6f s simulated\n", now / (double)F_CPU);
+    for (size_t i = 0; i < vectors.size(); i++) {
+      Vector *v = &vectors[i];
+      if (v->runs == 0)
+        continue;
+      fprintf(stderr, "  %s: %u runs, latency up to %llu cycles, up to %llu cycles long, %.1f%% of the CPU\n",
+              v->name, v->runs, (unsigned long long)v->maxLatency, (unsigned long long)v->maxLength,
+              100.0 * v->totalLength / (now ? now : 1));
+    }
+    for (size_t i = 0; i < devices().size(); i++)
+      devices()[i]->summary(stderr);
+  }
+  exit(status);
+}
+
+}
+
+int main(int argc, char **argv) {
+  sim::parseOptions(argc, argv);
+  for (size_t i = 0; i < sim::devices().size(); i++)
+    sim::devices()[i]->begin();
+
+  // As the Arduino core's main(): init() enables interrupts before setup()
+  sim::interruptsEnabled = true;
+  setup();
+  for (;;) {
+    loop();
+    sim::spend(LOOP_CYCLES);
+  }
+}
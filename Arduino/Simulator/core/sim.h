@@ -0,0 +1,146 @@
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// The simulator behind the core: a virtual CPU clock, the interrupt logic, the
+// peripherals' registers and pins, and the timeline.
+//
+// Time only passes where the sketch touches the core or a peripheral: every register
+// access, core call (millis(), digitalWrite(), ...) and bus transfer spends the cycles
+// it would take on the ATmega328P, and ISRs run as soon as that takes the clock past
+// their due time. Plain computation between those calls takes no time at all.
+
+#define SIM_NEVER UINT64_MAX
+#define SIM_US(us) ((uint64_t)(us) * (F_CPU / 1000000))
+#define SIM_MS(ms) ((uint64_t)(ms) * (F_CPU / 1000))
+
+namespace sim {
+
+// CPU cycles since reset
+extern uint64_t now;
+
+// Lets time pass, firing device events, and running ISRs as they become due
+void spend(uint32_t cycles);
+void spendUntil(uint64_t when);
+
+// The I flag in SREG. Enabling it runs any pending ISRs.
+extern bool interruptsEnabled;
+void setInterrupts(bool enabled);
+
+// Runs pending ISRs, if interrupts are enabled; for devices that have just set a flag
+void checkInterrupts(void);
+
+// For devices whose nextEvent() has changed other than in event(), e.g. by a register
+// write; the clock only asks the devices again after an event, or after this
+void reschedule(void);
+
+// Ends the run: calls every device's finish(), prints the summary and exits
+void finish(int status);
+
+// Prints an error and exits, or just a warning
+void fail(const char *format, ...) __attribute__((format(printf, 1, 2), noreturn));
+void warn(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// A peripheral, or a device outside the chip. Devices are created statically (with
+// SIM_EARLY), and register themselves.
+class Device {
+  public:
+  Device(const char *name);
+  virtual ~Device() { }
+
+  const char *name;
+
+  // Called after the options are parsed, before setup(); devices that aren't used
+  // should stay out of the way
+  virtual void begin(void) { }
+
+  // Timed events: nextEvent() is the cycle at which event() is due
+  virtual uint64_t nextEvent(void) { return SIM_NEVER; }
+  virtual void event(void) { }
+
+  // Interrupts: whether vector is pending (its flag and enable bit are both set), and
+  // clearing the flag as the ISR is entered; that returns when the flag was set
+  virtual bool interruptPending(uint8_t) { return false; }
+  virtual uint64_t interruptTaken(uint8_t) { return now; }
+
+  // Registers (see mapRegister()); these cost no time, the caller has spent it already.
+  // 16-bit registers are accessed as a whole, as the AVR does through its TEMP register.
+  virtual uint8_t read(uint16_t) { return 0; }
+  virtual void write(uint16_t, uint8_t) { }
+  virtual uint16_t read16(uint16_t addr) { return read(addr) | (read(addr + 1) << 8); }
+  virtual void write16(uint16_t addr, uint16_t value) { write(addr + 1, value >> 8); write(addr, value & 0xff); }
+
+  // Pin levels (see pins::watch())
+  virtual void pinChanged(uint8_t, bool) { }
+
+  // At the end of the run: save state, and print a line or two of statistics
+  virtual void finish(void) { }
+  virtual void summary(FILE *) { }
+};
+
+// For the simulator's own static objects: they're constructed before the sketch's, so
+// that constructors in the sketch and its libraries (which often set up pins, or even
+// the SPI) find the peripherals there
+#define SIM_EARLY __attribute__((init_priority(200)))
+
+// Register access, as done by the Reg8/Reg16 classes in avr/io.h; addresses are in
+// the data space (I/O address + 0x20). Each access costs what lds/sts (or in/out, for
+// the low I/O space) would.
+uint8_t ioRead(uint16_t addr);
+void ioWrite(uint16_t addr, uint8_t value);
+uint16_t ioRead16(uint16_t addr);
+void ioWrite16(uint16_t addr, uint16_t value);
+void ioModify(uint16_t addr, uint8_t andMask, uint8_t orMask, uint8_t xorMask);
+
+// Routes accesses of addr to dev; unmapped registers are plain memory. Peripherals map
+// their registers in their constructors, as the sketch's constructors may use them.
+void mapRegister(uint16_t addr, Device *dev);
+
+// True if the previous register access was a read of addr too, i.e. the sketch is
+// busy-waiting on a status flag; the device may then skip ahead to when it changes
+bool polling(uint16_t addr);
+
+// Interrupt vectors (numbered as on the ATmega328P; lower is higher priority)
+#define SIM_TIMER1_COMPA 11
+#define SIM_TIMER1_COMPB 12
+#define SIM_TIMER1_OVF 13
+#define SIM_USART_RX 18
+#define SIM_USART_UDRE 19
+void mapVector(uint8_t vector, const char *name, void (*handler)(void), Device *source);
+
+// Pins, by Arduino number (0-19; A0 is 14). A pin's level is what the port drives it
+// to, or for an input, what the outside world does: a device pulling it low, a pullup
+// (the internal one, or a bus's), or else low.
+namespace pins {
+  bool level(uint8_t pin);
+  void watch(uint8_t pin, Device *dev);        // dev->pinChanged() on every change
+  void pullLow(uint8_t pin, Device *dev, bool low); // open drain, as an I2C device does
+  void pullup(uint8_t pin);                    // an external pullup resistor
+  void mode(uint8_t pin, bool output);         // as pinMode(), but free
+  void set(uint8_t pin, bool high);            // as digitalWrite(), but free
+}
+
+// The timeline: one line per event, "<cycle> <kind> <details>", in time order.
+// tracing() is cheap; check it before formatting anything expensive.
+bool tracing(const char *kind);
+void trace(const char *kind, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// Command line options. Each module declares its own, as static Option objects;
+// handler is called once per occurrence, with the argument (or NULL, for flags).
+class Option {
+  public:
+  Option(const char *name, const char *arg, const char *help, void (*handler)(const char *value));
+  const char *name, *arg, *help;
+  void (*handler)(const char *value);
+};
+
+// Helpers for option parsing; all fail() on bad input
+uint32_t parseNumber(const char *s, const char *what);
+double parseFloat(const char *s, const char *what);
+uint64_t parseTime(const char *s, const char *what); // "1.5" (seconds), "20ms", "500us"
+
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef _SIM_BUS_H
+#define _SIM_BUS_H
+
+#include <stdint.h>
+#include <vector>
+#include "sim.h"
+
+// The buses between the chip and the simulated parts on the board. Include this before
+// Arduino.h, whose min() and max() macros break <vector>.
+
+namespace sim {
+
+// A part on the SPI bus. Parts watch their own chip select pin; byte() is called for
+// every byte the SPI moves, whether or not the part is selected, and returns what the
+// part drives on MISO, or -1 if it doesn't.
+class SpiSlave {
+  public:
+  SpiSlave();
+  virtual ~SpiSlave() { }
+  virtual int byte(uint8_t mosi) = 0;
+};
+
+// A part on an I2C bus, at the byte level: start() is called with the address byte
+// after each (repeated) START, and returns whether the part acknowledges it; the
+// part that did then gets the rest of the transaction, up to the STOP.
+class I2CSlave {
+  public:
+  virtual ~I2CSlave() { }
+  virtual bool start(uint8_t addressByte) = 0;
+  virtual bool write(uint8_t data) = 0;   // returns the ACK
+  virtual uint8_t read(bool ack) = 0;     // ack is the master's, for this byte
+  virtual void stop(void) { }
+};
+
+// An I2C bus: routes each transaction to the part that acknowledges it, and puts
+// the transaction in the timeline when it's over, as
+// "i2c <bus> <address> <write|read|nack> <bytes in hex, or -> <cycle it started at>"
+class I2CBus {
+  public:
+  I2CBus(const char *name);
+  const char *name;
+  void attach(I2CSlave *slave) { slaves.push_back(slave); }
+  bool start(uint8_t addressByte);
+  bool write(uint8_t data);
+  uint8_t read(bool ack);
+  void stop(void);
+  uint32_t transactions;
+
+  static I2CBus *find(const char *name);
+
+  private:
+  std::vector<I2CSlave *> slaves;
+  I2CSlave *active;
+  bool open;
+  uint8_t address;
+  uint64_t started;
+  std::vector<uint8_t> data;
+  void traceTransaction(const char *kind);
+};
+
+// A part on the 1-Wire bus, at the bit level: reset() is the reset pulse, and returns
+// whether the part answers it with a presence pulse; after that, each time slot either
+// writes a bit to every part, or reads the bus, which is low if any part pulls it low
+// (readBit() returns false). Every part sees every slot, selected or not.
+class OneWireSlave {
+  public:
+  OneWireSlave();
+  virtual ~OneWireSlave() { }
+  virtual bool reset(void) = 0;
+  virtual void writeBit(bool bit) = 0;
+  virtual bool readBit(void) = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _SIM_VOLATILE_H
+#define _SIM_VOLATILE_H
+
+#include <stdint.h>
+#include "sim.h"
+
+// The sketch's volatile globals: sketchsim.py turns "volatile T name" into
+// "sim::Volatile<T> name". Plain computation takes no virtual time, so a sketch
+// busy-waiting for an ISR to change a flag, as in
+//   while (waitForSwap) { }
+// would never let the ISR run; each access to a Volatile spends what lds/sts would
+// (2 cycles per byte), so time passes, and the ISR gets to run, as on the board.
+
+namespace sim {
+
+template <typename T>
+class Volatile {
+  public:
+  Volatile() : value() { }
+  // Explicit, so that "flag ? x : 0" doesn't find two ways of converting
+  explicit Volatile(T v) : value(v) { }
+
+  operator T() const { access(); return value; }
+  Volatile &operator=(T v) { access(); value = v; return *this; }
+  Volatile &operator=(const Volatile &other) { T v = other; return *this = v; }
+
+  // Read-modify-write: a load and a store
+  Volatile &operator+=(T v) { return modify(get() + v); }
+  Volatile &operator-=(T v) { return modify(get() - v); }
+  Volatile &operator|=(T v) { return modify(get() | v); }
+  Volatile &operator&=(T v) { return modify(get() & v); }
+  Volatile &operator^=(T v) { return modify(get() ^ v); }
+  Volatile &operator++() { return modify(get() + 1); }
+  Volatile &operator--() { return modify(get() - 1); }
+  T operator++(int) { T old = get(); modify(old + 1); return old; }
+  T operator--(int) { T old = get(); modify(old - 1); return old; }
+
+  private:
+  T value;
+
+  static void access(void) { spend(2 * sizeof(T)); }
+  T get(void) const { access(); return value; }
+  Volatile &modify(T v) { access(); value = v; return *this; }
+};
+
+}
+
+#endif
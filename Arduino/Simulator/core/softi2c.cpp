@@ -0,0 +1,175 @@
+// Bit-banged I2C buses (--soft-i2c NAME=SDA,SCL), as SoftI2C16 drives: two pins with
+// pullups, and the parts on the bus (see sim_bus.h) behind a decoder that watches the
+// lines as a part's own I2C logic would. It sees START and STOP (SDA falling or rising
+// while SCL is high), takes each bit on SCL's rising edge, and puts its ACKs and read
+// data on SDA while SCL is low, by pulling it low (open drain). The parts never stretch
+// the clock. They're added with e.g. --i2c-eeprom 24LC1025@NAME:0x50=FILE.
+
+#include <string.h>
+#include <string>
+#include "sim.h"
+#include "sim_bus.h"
+#include "Arduino.h"
+
+namespace sim {
+
+class SoftI2C : public Device {
+  public:
+  SoftI2C(const std::string &_name, uint8_t _sda, uint8_t _scl)
+    : Device("soft-i2c"), busName(_name), bus(busName.c_str()), sda(_sda), scl(_scl),
+      state(IDLE), bits(0), shift(0), addressed(false), acked(false), reading(false), driving(false), starts(0) { }
+
+  void begin(void) {
+    pins::pullup(sda);
+    pins::pullup(scl);
+    pins::watch(sda, this);
+    pins::watch(scl, this);
+  }
+
+  void pinChanged(uint8_t pin, bool high) {
+    if (pin == sda) {
+      if (!pins::level(scl))
+        return; // data changing while the clock is low, as it should
+      if (!high)
+        startCondition();
+      else
+        stopCondition();
+    }
+    else if (high) {
+      clockRising();
+    }
+    else {
+      clockFalling();
+    }
+  }
+
+  void summary(FILE *f) {
+    fprintf(f, "  %s (SDA %u, SCL %u): %lu STARTs, %lu transactions\n", bus.name, sda, scl,
+            (unsigned long)starts, (unsigned long)bus.transactions);
+  }
+
+  private:
+  enum State {
+    IDLE,     // waiting for a START
+    RECEIVE,  // the master is sending a byte (the address, or data)
+    ACK_OUT,  // we're ACKing (or not) what it sent
+    SEND,     // we're sending a byte
+    ACK_IN    // the master is ACKing (or not) what we sent
+  };
+
+  std::string busName;
+  I2CBus bus;
+  uint8_t sda, scl;
+  State state;
+  uint8_t bits, shift;
+  bool addressed, acked, reading, driving;
+  uint32_t starts;
+
+  void drive(bool low) {
+    if (low != driving) {
+      driving = low;
+      pins::pullLow(sda, this, low);
+    }
+  }
+
+  void startCondition(void) {
+    starts++;
+    state = RECEIVE;
+    addressed = false;
+    bits = shift = 0;
+  }
+
+  void stopCondition(void) {
+    drive(false);
+    bus.stop();
+    state = IDLE;
+  }
+
+  void clockRising(void) {
+    bool bit = pins::level(sda);
+    if (state == RECEIVE && bits < 8) {
+      shift = (shift << 1) | bit;
+      bits++;
+    }
+    else if (state == ACK_IN) {
+      acked = !bit;
+    }
+  }
+
+  void clockFalling(void) {
+    switch (state) {
+      case RECEIVE:
+        if (bits < 8)
+          break;
+        if (!addressed) {
+          addressed = true;
+          reading = shift & 1;
+          acked = bus.start(shift);
+        }
+        else {
+          acked = bus.write(shift);
+        }
+        drive(acked);
+        state = ACK_OUT;
+        break;
+      case ACK_OUT:
+        drive(false);
+        if (!acked)
+          state = IDLE; // until the master's STOP, or a repeated START
+        else if (reading)
+          sendByte();
+        else {
+          state = RECEIVE;
+          bits = shift = 0;
+        }
+        break;
+      case SEND:
+        if (bits < 8) {
+          drive(!(shift & 0x80));
+          shift <<= 1;
+          bits++;
+        }
+        else {
+          drive(false); // the master's turn to ACK
+          state = ACK_IN;
+        }
+        break;
+      case ACK_IN:
+        if (acked)
+          sendByte();
+        else
+          state = IDLE;
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Fetches the next byte, and puts its first bit on SDA
+  void sendByte(void) {
+    shift = bus.read(true);
+    state = SEND;
+    bits = 1;
+    drive(!(shift & 0x80));
+    shift <<= 1;
+  }
+};
+
+// NAME=SDA,SCL, e.g. bank2=2,3
+static void addSoftI2C(const char *s) {
+  const char *eq = strchr(s, '='), *comma = strchr(s, ',');
+  if (eq == NULL || comma == NULL || comma < eq || eq == s)
+    fail("--soft-i2c: expected NAME=SDA,SCL, not %s", s);
+  std::string name(s, eq - s), sdaPin(eq + 1, comma - eq - 1);
+  uint32_t sda = parseNumber(sdaPin.c_str(), "--soft-i2c");
+  uint32_t scl = parseNumber(comma + 1, "--soft-i2c");
+  if (sda >= NUM_DIGITAL_PINS || scl >= NUM_DIGITAL_PINS || sda == scl)
+    fail("--soft-i2c: SDA and SCL must be two different pins, 0-%d", NUM_DIGITAL_PINS - 1);
+  if (I2CBus::find(name.c_str()))
+    fail("--soft-i2c: there's already a bus called %s", name.c_str());
+  new SoftI2C(name, sda, scl);
+}
+
+static Option softI2COption("soft-i2c", "NAME=SDA,SCL", "a bit-banged I2C bus on two pins, with pullups, e.g. bank2=2,3", addSoftI2C);
+
+}
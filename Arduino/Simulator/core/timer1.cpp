@@ -0,0 +1,233 @@
+// Timer/Counter1: normal and CTC modes, the three interrupts, and TCNT1 as a count of
+// the virtual clock. The PWM modes and the output pins aren't simulated.
+
+#include <stdint.h>
+#include "sim.h"
+#include "Arduino.h"
+
+// The ISRs, if the sketch has them
+extern "C" void TIMER1_COMPA_vect(void) __attribute__((weak));
+extern "C" void TIMER1_COMPB_vect(void) __attribute__((weak));
+extern "C" void TIMER1_OVF_vect(void) __attribute__((weak));
+
+namespace sim {
+
+class Timer1 : public Device {
+  public:
+  Timer1() : Device("Timer1"), tccr1a(0), tccr1b(0), tccr1c(0), timsk1(0), tifr1(0),
+    ocr1a(0), ocr1b(0), icr1(0), start(0), processed(0), frozen(0), overrun(false) {
+    flagged[0] = flagged[1] = flagged[2] = 0;
+    mapRegister(0x36, this); // TIFR1
+    mapRegister(0x6F, this); // TIMSK1
+    for (uint16_t addr = 0x80; addr <= 0x8B; addr++)
+      mapRegister(addr, this);
+  }
+
+  void begin(void) {
+    mapVector(SIM_TIMER1_COMPA, "TIMER1_COMPA", TIMER1_COMPA_vect, this);
+    mapVector(SIM_TIMER1_COMPB, "TIMER1_COMPB", TIMER1_COMPB_vect, this);
+    mapVector(SIM_TIMER1_OVF, "TIMER1_OVF", TIMER1_OVF_vect, this);
+  }
+
+  uint64_t nextEvent(void) {
+    uint32_t p = prescale();
+    if (p == 0)
+      return SIM_NEVER;
+    uint64_t t = start + (uint64_t)(top() + 1) * p; // back to 0
+    uint64_t a = compareTime(ocr1a), b = compareTime(ocr1b);
+    if (ocr1a <= top() && a > processed && a < t)
+      t = a;
+    if (ocr1b <= top() && b > processed && b < t)
+      t = b;
+    return t;
+  }
+
+  void event(void) {
+    uint32_t p = prescale();
+    uint64_t t = nextEvent();
+    processed = t;
+    if (ocr1a <= top() && t == compareTime(ocr1a))
+      flag(OCF1A);
+    if (ocr1b <= top() && t == compareTime(ocr1b))
+      flag(OCF1B);
+    if (t == start + (uint64_t)(top() + 1) * p) {
+      if (top() == 0xffff)
+        flag(TOV1);
+      start = t;
+      overrun = false;
+    }
+  }
+
+  bool interruptPending(uint8_t vector) {
+    uint8_t bit = flagBit(vector);
+    return (tifr1 & timsk1) & (1 << bit);
+  }
+
+  uint64_t interruptTaken(uint8_t vector) {
+    uint8_t bit = flagBit(vector);
+    tifr1 &= ~(1 << bit);
+    return flagged[bit];
+  }
+
+  uint8_t read(uint16_t addr) {
+    switch (addr) {
+      case 0x36: return tifr1;
+      case 0x6F: return timsk1;
+      case 0x80: return tccr1a;
+      case 0x81: return tccr1b;
+      case 0x82: return tccr1c;
+      case 0x84: return count() & 0xff;
+      case 0x85: return count() >> 8;
+      case 0x86: return icr1 & 0xff;
+      case 0x87: return icr1 >> 8;
+      case 0x88: return ocr1a & 0xff;
+      case 0x89: return ocr1a >> 8;
+      case 0x8A: return ocr1b & 0xff;
+      case 0x8B: return ocr1b >> 8;
+    }
+    return 0;
+  }
+
+  uint16_t read16(uint16_t addr) {
+    switch (addr) {
+      case 0x84: return count();
+      case 0x86: return icr1;
+      case 0x88: return ocr1a;
+      case 0x8A: return ocr1b;
+    }
+    return 0;
+  }
+
+  void write(uint16_t addr, uint8_t value) {
+    switch (addr) {
+      case 0x36:
+        tifr1 &= ~value; // flags are cleared by writing a 1
+        break;
+      case 0x6F:
+        timsk1 = value;
+        checkInterrupts();
+        break;
+      case 0x80:
+        tccr1a = value;
+        checkMode();
+        break;
+      case 0x81: {
+        uint16_t c = count();
+        tccr1b = value;
+        checkMode();
+        setCount(c);
+        break;
+      }
+      case 0x82:
+        tccr1c = value;
+        break;
+      default:
+        // The halves of the 16-bit registers
+        if (addr >= 0x84 && addr <= 0x8B) {
+          uint16_t base = addr & ~1;
+          uint16_t old = read16(base);
+          write16(base, (addr & 1) ? ((old & 0xff) | (value << 8)) : ((old & 0xff00) | value));
+        }
+    }
+    reschedule();
+  }
+
+  void write16(uint16_t addr, uint16_t value) {
+    switch (addr) {
+      case 0x84:
+        setCount(value);
+        break;
+      case 0x86:
+        icr1 = value;
+        break;
+      case 0x88:
+        ocr1a = value;
+        // Set below the count, the counter has to go all the way round first
+        if (ctcTop() && count() > value)
+          overrun = true;
+        break;
+      case 0x8A:
+        ocr1b = value;
+        break;
+    }
+    reschedule();
+  }
+
+  private:
+  uint8_t tccr1a, tccr1b, tccr1c, timsk1, tifr1;
+  uint16_t ocr1a, ocr1b, icr1;
+  uint64_t start;     // when the count was (or would have been) 0
+  uint64_t processed; // events up to here have been handled
+  uint16_t frozen;    // the count, while stopped
+  bool overrun;       // the count is above TOP, so it runs to 0xffff first
+  uint64_t flagged[3]; // when each flag was last set
+
+  static uint8_t flagBit(uint8_t vector) {
+    return vector == SIM_TIMER1_COMPA ? OCF1A : (vector == SIM_TIMER1_COMPB ? OCF1B : TOV1);
+  }
+
+  uint8_t mode(void) {
+    return ((tccr1b >> WGM12) & 3) << 2 | (tccr1a & 3);
+  }
+
+  bool ctcTop(void) {
+    return mode() == 4 || mode() == 12;
+  }
+
+  uint16_t top(void) {
+    if (overrun)
+      return 0xffff;
+    if (mode() == 4)
+      return ocr1a;
+    if (mode() == 12)
+      return icr1;
+    return 0xffff;
+  }
+
+  void checkMode(void) {
+    uint8_t m = mode();
+    if (m != 0 && m != 4 && m != 12)
+      warn("Timer1 mode %d (PWM) isn't simulated; it counts as in normal mode", m);
+  }
+
+  // A compare match sets the flag at the timer tick after the count equals the compare
+  // value; in CTC mode, that's when the counter is cleared
+  uint64_t compareTime(uint16_t value) {
+    return start + (uint64_t)(value + 1) * prescale();
+  }
+
+  uint32_t prescale(void) {
+    static const uint16_t prescales[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    uint8_t cs = tccr1b & 7;
+    if (cs >= 6)
+      warn("Timer1 is clocked from the T1 pin, which isn't simulated");
+    return prescales[cs];
+  }
+
+  uint16_t count(void) {
+    uint32_t p = prescale();
+    if (p == 0)
+      return frozen;
+    return (sim::now - start) / p;
+  }
+
+  void setCount(uint16_t value) {
+    uint32_t p = prescale();
+    frozen = value;
+    if (p) {
+      start = sim::now - (uint64_t)value * p;
+      // Writing TCNT1 blocks a compare match at the very next timer tick
+      processed = sim::now;
+    }
+    overrun = ctcTop() && value > (mode() == 4 ? ocr1a : icr1);
+  }
+
+  void flag(uint8_t bit) {
+    tifr1 |= 1 << bit;
+    flagged[bit] = sim::now;
+  }
+};
+
+static Timer1 timer1 SIM_EARLY;
+
+}
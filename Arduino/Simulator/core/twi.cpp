@@ -0,0 +1,274 @@
+// The TWI (the hardware I2C master), register by register: each START, address or
+// data byte and STOP takes the bus time TWBR and TWSR set, and the status codes are
+// the datasheet's. Slave mode and the TWI interrupt aren't simulated. The I2C buses
+// (see sim_bus.h) are here too.
+
+#include <string.h>
+#include <string>
+#include "sim.h"
+#include "sim_bus.h"
+#include "Arduino.h"
+
+namespace sim {
+
+//
+// I2C buses
+//
+
+static std::vector<I2CBus *> &buses(void) {
+  static std::vector<I2CBus *> list;
+  return list;
+}
+
+I2CBus::I2CBus(const char *_name) : name(_name), transactions(0), active(NULL), open(false),
+  address(0), started(0) {
+  buses().push_back(this);
+}
+
+I2CBus *I2CBus::find(const char *name) {
+  for (size_t i = 0; i < buses().size(); i++) {
+    if (strcmp(buses()[i]->name, name) == 0)
+      return buses()[i];
+  }
+  return NULL;
+}
+
+void I2CBus::traceTransaction(const char *kind) {
+  transactions++;
+  if (!tracing("i2c"))
+    return;
+  std::string hex;
+  char buf[4];
+  for (size_t i = 0; i < data.size(); i++) {
+    snprintf(buf, sizeof(buf), "%02x", data[i]);
+    hex += buf;
+  }
+  trace("i2c", "%s 0x%02x %s %s %llu", name, address >> 1, kind, hex.empty() ? "-" : hex.c_str(),
+        (unsigned long long)started);
+}
+
+bool I2CBus::start(uint8_t addressByte) {
+  // A repeated START ends the previous transaction, as far as the timeline goes
+  if (open)
+    traceTransaction((address & 1) ? "read" : "write");
+  if (active)
+    active->stop();
+  open = false;
+  active = NULL;
+  address = addressByte;
+  started = now;
+  data.clear();
+  for (size_t i = 0; i < slaves.size() && !active; i++) {
+    if (slaves[i]->start(addressByte))
+      active = slaves[i];
+  }
+  if (!active) {
+    traceTransaction("nack");
+    return false;
+  }
+  open = true;
+  return true;
+}
+
+bool I2CBus::write(uint8_t b) {
+  if (!active)
+    return false;
+  data.push_back(b);
+  return active->write(b);
+}
+
+uint8_t I2CBus::read(bool ack) {
+  if (!active)
+    return 0xff;
+  uint8_t b = active->read(ack);
+  data.push_back(b);
+  return b;
+}
+
+void I2CBus::stop(void) {
+  if (open)
+    traceTransaction((address & 1) ? "read" : "write");
+  if (active)
+    active->stop();
+  open = false;
+  active = NULL;
+}
+
+static I2CBus twiBus SIM_EARLY ("twi");
+
+//
+// The TWI
+//
+
+// Status codes
+#define TW_START 0x08
+#define TW_REP_START 0x10
+#define TW_MT_SLA_ACK 0x18
+#define TW_MT_SLA_NACK 0x20
+#define TW_MT_DATA_ACK 0x28
+#define TW_MT_DATA_NACK 0x30
+#define TW_MR_SLA_ACK 0x40
+#define TW_MR_SLA_NACK 0x48
+#define TW_MR_DATA_ACK 0x50
+#define TW_MR_DATA_NACK 0x58
+#define TW_NO_INFO 0xf8
+
+class Twi : public Device {
+  public:
+  Twi() : Device("TWI"), twbr(0), twsr(TW_NO_INFO), twdr(0xff), twcr(0), twar(0), twamr(0),
+    op(NONE), doneAt(SIM_NEVER), ownsBus(false) {
+    for (uint16_t addr = 0xB8; addr <= 0xBD; addr++)
+      mapRegister(addr, this);
+  }
+
+  uint64_t nextEvent(void) {
+    return op != NONE ? doneAt : SIM_NEVER;
+  }
+
+  void event(void) {
+    Op done = op;
+    op = NONE;
+    uint8_t status = TW_NO_INFO;
+    switch (done) {
+      case START:
+        status = ownsBus ? TW_REP_START : TW_START;
+        ownsBus = true;
+        break;
+      case ADDRESS:
+        if (twdr & 1)
+          status = twiBus.start(twdr) ? TW_MR_SLA_ACK : TW_MR_SLA_NACK;
+        else
+          status = twiBus.start(twdr) ? TW_MT_SLA_ACK : TW_MT_SLA_NACK;
+        break;
+      case SEND:
+        status = twiBus.write(twdr) ? TW_MT_DATA_ACK : TW_MT_DATA_NACK;
+        break;
+      case RECEIVE: {
+        bool ack = twcr & _BV(TWEA);
+        twdr = twiBus.read(ack);
+        status = ack ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+        break;
+      }
+      case STOP:
+        twiBus.stop();
+        ownsBus = false;
+        twcr &= ~_BV(TWSTO);
+        twsr = (twsr & 3) | TW_NO_INFO;
+        return; // no TWINT after a STOP
+      case NONE:
+        return;
+    }
+    twsr = (twsr & 3) | status;
+    twcr |= _BV(TWINT);
+  }
+
+  uint8_t read(uint16_t addr) {
+    switch (addr) {
+      case 0xB8: return twbr;
+      case 0xB9: return twsr;
+      case 0xBA: return twar;
+      case 0xBB: return twdr;
+      case 0xBC:
+        // Busy-waiting for TWINT (or for TWSTO to clear): skip ahead
+        if (op != NONE && polling(addr))
+          spendUntil(doneAt);
+        return twcr;
+      default: return twamr;
+    }
+  }
+
+  void write(uint16_t addr, uint8_t value) {
+    switch (addr) {
+      case 0xB8: twbr = value; break;
+      case 0xB9: twsr = (twsr & 0xf8) | (value & 3); break;
+      case 0xBA: twar = value; break;
+      case 0xBB:
+        if (twcr & _BV(TWINT) || op == NONE)
+          twdr = value;
+        else
+          twcr |= _BV(TWWC);
+        break;
+      case 0xBC: writeControl(value); break;
+      default: twamr = value; break;
+    }
+  }
+
+  void summary(FILE *f) {
+    if (twiBus.transactions)
+      fprintf(f, "  TWI: %lu transactions\n", (unsigned long)twiBus.transactions);
+  }
+
+  private:
+  enum Op { NONE, START, ADDRESS, SEND, RECEIVE, STOP };
+
+  uint8_t twbr, twsr, twdr, twcr, twar, twamr;
+  Op op;
+  uint64_t doneAt;
+  bool ownsBus;
+
+  // One SCL period
+  uint32_t bitCycles(void) {
+    static const uint8_t prescales[4] = { 1, 4, 16, 64 };
+    return 16 + 2 * (uint32_t)twbr * prescales[twsr & 3];
+  }
+
+  void schedule(Op o, uint32_t bits) {
+    op = o;
+    doneAt = now + bits * bitCycles();
+    reschedule();
+  }
+
+  void writeControl(uint8_t value) {
+    // TWINT and TWWC are cleared by writing a 1 (TWWC by writing TWDR, really)
+    uint8_t keep = twcr & (_BV(TWINT) | _BV(TWSTO));
+    if (value & _BV(TWINT))
+      keep &= ~_BV(TWINT);
+    twcr = keep | (value & (_BV(TWEA) | _BV(TWSTA) | _BV(TWSTO) | _BV(TWEN) | _BV(TWIE)));
+    if (value & _BV(TWIE))
+      warn("the TWI interrupt isn't simulated");
+
+    if (!(value & _BV(TWEN))) {
+      // Disabling the TWI lets go of the bus, whatever it was doing
+      if (ownsBus)
+        twiBus.stop();
+      ownsBus = false;
+      op = NONE;
+      twcr &= ~(_BV(TWSTO) | _BV(TWINT));
+      reschedule();
+      return;
+    }
+    if (!(value & _BV(TWINT)) || op != NONE)
+      return;
+
+    if (value & _BV(TWSTA)) {
+      // A repeated START needs a bit time more, for the setup
+      schedule(START, ownsBus ? 2 : 1);
+    }
+    else if (value & _BV(TWSTO)) {
+      schedule(STOP, 1);
+    }
+    else {
+      switch (twsr & 0xf8) {
+        case TW_START:
+        case TW_REP_START:
+          schedule(ADDRESS, 9);
+          break;
+        case TW_MT_SLA_ACK:
+        case TW_MT_DATA_ACK:
+          schedule(SEND, 9);
+          break;
+        case TW_MR_SLA_ACK:
+        case TW_MR_DATA_ACK:
+          schedule(RECEIVE, 9);
+          break;
+        default:
+          // After a NACK, only a STOP or a START makes sense; the TWI does nothing
+          warn("TWI: nothing to do in state 0x%02x", twsr & 0xf8);
+      }
+    }
+  }
+};
+
+static Twi twi SIM_EARLY;
+
+}
@@ -0,0 +1,15 @@
+#ifndef _UTIL_DELAY_H_
+#define _UTIL_DELAY_H_
+
+#include <sim.h>
+#include <util/delay_basic.h>
+
+static inline void _delay_us(double us) {
+  sim::spend((uint32_t)(us * (F_CPU / 1e6) + 0.5));
+}
+
+static inline void _delay_ms(double ms) {
+  sim::spendUntil(sim::now + (uint64_t)(ms * (F_CPU / 1e3) + 0.5));
+}
+
+#endif
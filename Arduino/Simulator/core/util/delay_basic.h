@@ -0,0 +1,17 @@
+#ifndef _UTIL_DELAY_BASIC_H_
+#define _UTIL_DELAY_BASIC_H_
+
+#include <stdint.h>
+#include <sim.h>
+
+// The busy loops of avr-libc: 3 cycles per count (256 for 0), or 4 for the 16-bit one
+
+static inline void _delay_loop_1(uint8_t count) {
+  sim::spend(3 * (count ? count : 256));
+}
+
+static inline void _delay_loop_2(uint16_t count) {
+  sim::spend(4 * (count ? count : 65536UL));
+}
+
+#endif
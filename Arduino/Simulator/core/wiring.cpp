@@ -0,0 +1,509 @@
+// The core functions: time, pins, analog input, random numbers and printf; and the
+// pin and SREG registers behind them
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "sim.h"
+#include "Arduino.h"
+
+#undef sprintf
+#undef snprintf
+#undef vsnprintf
+
+// What the core functions cost, in cycles; roughly what the Arduino 1.0 versions take
+#define MILLIS_CYCLES 20
+#define MICROS_CYCLES 40
+#define DIGITALWRITE_CYCLES 56
+#define DIGITALREAD_CYCLES 50
+#define PINMODE_CYCLES 50
+#define ANALOGREAD_CYCLES 1780 // 13 ADC clocks at 125 kHz, and the rest
+
+//
+// Pins and ports
+//
+
+namespace sim {
+
+class Ports : public Device {
+  public:
+  Ports() : Device("ports"), reported(0), externalPullups(0) {
+    memset(port, 0, sizeof(port));
+    memset(ddr, 0, sizeof(ddr));
+    for (uint16_t addr = 0x23; addr <= 0x2B; addr++)
+      mapRegister(addr, this);
+  }
+
+  void begin(void) {
+    reported = levels();
+  }
+
+  uint8_t read(uint16_t addr) {
+    int n = (addr - 0x23) / 3;
+    switch ((addr - 0x23) % 3) {
+      case 0: { // PINx
+        uint8_t value = 0;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+          int pin = pinOf(n, bit);
+          if (pin >= 0 && level(pin))
+            value |= 1 << bit;
+        }
+        return value;
+      }
+      case 1:
+        return ddr[n];
+      default:
+        return port[n];
+    }
+  }
+
+  void write(uint16_t addr, uint8_t value) {
+    int n = (addr - 0x23) / 3;
+    switch ((addr - 0x23) % 3) {
+      case 0:
+        port[n] ^= value; // writing a 1 to PINx toggles the bit in PORTx
+        break;
+      case 1:
+        ddr[n] = value;
+        break;
+      default:
+        port[n] = value;
+    }
+    update();
+  }
+
+  bool level(uint8_t pin) {
+    int n = portOf(pin), bit = bitOf(pin);
+    if (n < 0)
+      return false;
+    bool pulled = !pulling[pin].empty();
+    if (ddr[n] & (1 << bit))
+      return !pulled && (port[n] & (1 << bit));
+    if (pulled)
+      return false;
+    return (port[n] & (1 << bit)) || (externalPullups & (1UL << pin));
+  }
+
+  // Tells the watchers about the pins that have changed since the last time
+  void update(void) {
+    uint32_t current = levels();
+    uint32_t changed = current ^ reported;
+    reported = current;
+    for (uint8_t pin = 0; changed; pin++, changed >>= 1) {
+      if (!(changed & 1))
+        continue;
+      // A watcher may have changed this pin again already, and reported that
+      if (((reported ^ current) >> pin) & 1)
+        continue;
+      for (size_t i = 0; i < watchers[pin].size(); i++)
+        watchers[pin][i]->pinChanged(pin, (current >> pin) & 1);
+    }
+  }
+
+  void pullLow(uint8_t pin, Device *dev, bool low) {
+    if (pin >= NUM_DIGITAL_PINS)
+      return;
+    std::vector<Device *> &v = pulling[pin];
+    size_t i = 0;
+    while (i < v.size() && v[i] != dev)
+      i++;
+    if (low && i == v.size())
+      v.push_back(dev);
+    else if (!low && i < v.size())
+      v.erase(v.begin() + i);
+    update();
+  }
+
+  void mode(uint8_t pin, uint8_t mode) {
+    int n = portOf(pin), bit = bitOf(pin);
+    if (n < 0)
+      return;
+    if (mode == OUTPUT) {
+      ddr[n] |= 1 << bit;
+    }
+    else {
+      ddr[n] &= ~(1 << bit);
+      if (mode == INPUT_PULLUP)
+        port[n] |= 1 << bit;
+      else
+        port[n] &= ~(1 << bit);
+    }
+    update();
+  }
+
+  void set(uint8_t pin, bool high) {
+    int n = portOf(pin), bit = bitOf(pin);
+    if (n < 0)
+      return;
+    if (high)
+      port[n] |= 1 << bit;
+    else
+      port[n] &= ~(1 << bit);
+    update();
+  }
+
+  static int portOf(uint8_t pin) { return pin < 8 ? 2 : (pin < 14 ? 0 : (pin < 20 ? 1 : -1)); } // D, B, C
+  static int bitOf(uint8_t pin) { return pin < 8 ? pin : (pin < 14 ? pin - 8 : pin - 14); }
+  static int pinOf(int n, uint8_t bit) {
+    if (n == 0)
+      return bit < 6 ? bit + 8 : -1;
+    if (n == 1)
+      return bit < 6 ? bit + 14 : -1;
+    return bit;
+  }
+
+  uint8_t port[3], ddr[3]; // B, C, D, in register order
+  uint32_t reported, externalPullups;
+  std::vector<Device *> watchers[NUM_DIGITAL_PINS];
+  std::vector<Device *> pulling[NUM_DIGITAL_PINS];
+
+  private:
+  uint32_t levels(void) {
+    uint32_t mask = 0;
+    for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; pin++) {
+      if (level(pin))
+        mask |= 1UL << pin;
+    }
+    return mask;
+  }
+};
+
+static Ports ports SIM_EARLY;
+
+namespace pins {
+  bool level(uint8_t pin) { return ports.level(pin); }
+  void watch(uint8_t pin, Device *dev) {
+    if (pin < NUM_DIGITAL_PINS)
+      ports.watchers[pin].push_back(dev);
+  }
+  void pullLow(uint8_t pin, Device *dev, bool low) { ports.pullLow(pin, dev, low); }
+  void pullup(uint8_t pin) {
+    if (pin < NUM_DIGITAL_PINS) {
+      ports.externalPullups |= 1UL << pin;
+      ports.update();
+    }
+  }
+  void mode(uint8_t pin, bool output) { ports.mode(pin, output ? OUTPUT : INPUT); }
+  void set(uint8_t pin, bool high) { ports.set(pin, high); }
+}
+
+// SREG: only the I flag
+class StatusRegister : public Device {
+  public:
+  StatusRegister() : Device("SREG") { mapRegister(0x5F, this); }
+  uint8_t read(uint16_t) { return interruptsEnabled ? 0x80 : 0; }
+  void write(uint16_t, uint8_t value) { setInterrupts(value & 0x80); }
+};
+
+static StatusRegister statusRegister SIM_EARLY;
+
+}
+
+void init(void) {
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  sim::spend(PINMODE_CYCLES);
+  sim::ports.mode(pin, mode);
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  sim::spend(DIGITALWRITE_CYCLES);
+  sim::ports.set(pin, val != LOW);
+}
+
+int digitalRead(uint8_t pin) {
+  sim::spend(DIGITALREAD_CYCLES);
+  return sim::ports.level(pin) ? HIGH : LOW;
+}
+
+//
+// Time. Timer0 isn't simulated; millis() and micros() count as it would.
+//
+
+uint32_t millis(void) {
+  sim::spend(MILLIS_CYCLES);
+  // Timer0 overflows every 1024 us, and the ISR adds up the 24 us extra, so that
+  // millis() skips a number every 42 ms or so
+  uint64_t overflows = sim::now / (64 * 256);
+  return (uint32_t)(overflows + overflows * 3 / 125);
+}
+
+uint32_t micros(void) {
+  sim::spend(MICROS_CYCLES);
+  // In steps of 4 us: a Timer0 tick
+  return (uint32_t)((sim::now / 64) * 4);
+}
+
+void delay(uint32_t ms) {
+  sim::spendUntil(sim::now + SIM_MS(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+  sim::spend(us * (F_CPU / 1000000));
+}
+
+unsigned long pulseIn(uint8_t, uint8_t, unsigned long timeout) {
+  sim::warn("pulseIn() isn't simulated; it times out");
+  sim::spendUntil(sim::now + SIM_US(timeout));
+  return 0;
+}
+
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val) {
+  for (uint8_t i = 0; i < 8; i++) {
+    if (bitOrder == LSBFIRST)
+      digitalWrite(dataPin, !!(val & (1 << i)));
+    else
+      digitalWrite(dataPin, !!(val & (1 << (7 - i))));
+    digitalWrite(clockPin, HIGH);
+    digitalWrite(clockPin, LOW);
+  }
+}
+
+uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder) {
+  uint8_t value = 0;
+  for (uint8_t i = 0; i < 8; ++i) {
+    digitalWrite(clockPin, HIGH);
+    if (bitOrder == LSBFIRST)
+      value |= digitalRead(dataPin) << i;
+    else
+      value |= digitalRead(dataPin) << (7 - i);
+    digitalWrite(clockPin, LOW);
+  }
+  return value;
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*)(void), int) {
+  sim::warn("external interrupts aren't simulated; attachInterrupt(%d) does nothing", interruptNum);
+}
+
+void detachInterrupt(uint8_t) {
+}
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration) {
+  sim::trace("tone", "%d %u %lu", pin, frequency, duration);
+}
+
+void noTone(uint8_t pin) {
+  sim::trace("tone", "%d 0 0", pin);
+}
+
+//
+// Analog input: --analog sets the voltage on a pin
+//
+
+static uint16_t analogMillivolts[NUM_ANALOG_INPUTS];
+static uint16_t arefMillivolts = 5000;
+
+static void setAnalog(const char *s) {
+  std::string arg(s);
+  size_t eq = arg.find('=');
+  if (eq == std::string::npos)
+    sim::fail("--analog: expected PIN=MILLIVOLTS, e.g. A0=750");
+  std::string pin = arg.substr(0, eq);
+  int n = -1;
+  if ((pin[0] == 'A' || pin[0] == 'a') && pin.size() == 2)
+    n = pin[1] - '0';
+  else
+    n = sim::parseNumber(pin.c_str(), "--analog") - A0;
+  if (n < 0 || n >= NUM_ANALOG_INPUTS)
+    sim::fail("--analog: no such analog pin: %s", pin.c_str());
+  analogMillivolts[n] = sim::parseNumber(arg.c_str() + eq + 1, "--analog");
+}
+
+static void setAref(const char *s) {
+  arefMillivolts = sim::parseNumber(s, "--aref");
+  if (arefMillivolts == 0)
+    sim::fail("--aref: must be more than 0");
+}
+
+static sim::Option analogOption("analog", "PIN=MV", "the voltage on an analog input, in millivolts (e.g. A0=750)", setAnalog);
+static sim::Option arefOption("aref", "MV", "the ADC reference voltage, in millivolts; default 5000", setAref);
+
+int analogRead(uint8_t pin) {
+  sim::spend(ANALOGREAD_CYCLES);
+  if (pin >= A0)
+    pin -= A0;
+  if (pin >= NUM_ANALOG_INPUTS)
+    return 0;
+  uint32_t value = (uint32_t)analogMillivolts[pin] * 1024 / arefMillivolts;
+  return value > 1023 ? 1023 : value;
+}
+
+void analogReference(uint8_t) {
+}
+
+void analogWrite(uint8_t pin, int val) {
+  sim::spend(DIGITALWRITE_CYCLES);
+  sim::trace("pwm", "%d %d", pin, val);
+}
+
+//
+// WMath, with avr-libc's random(), so that a seed gives the same numbers as on the board
+//
+
+static int32_t randomState = 1;
+
+static int32_t nextRandom(void) {
+  int32_t x = randomState;
+  if (x == 0)
+    x = 123459876L;
+  int32_t hi = x / 127773L;
+  int32_t lo = x % 127773L;
+  x = 16807L * lo - 2836L * hi;
+  if (x < 0)
+    x += 0x7fffffffL;
+  randomState = x;
+  return x;
+}
+
+void randomSeed(unsigned int seed) {
+  // An unsigned int is 16 bits on the AVR
+  if ((uint16_t)seed != 0)
+    randomState = (uint16_t)seed;
+}
+
+long random(long howbig) {
+  if (howbig == 0)
+    return 0;
+  return nextRandom() % howbig;
+}
+
+long random(long howsmall, long howbig) {
+  if (howsmall >= howbig)
+    return howsmall;
+  return random(howbig - howsmall) + howsmall;
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+uint16_t makeWord(uint16_t w) {
+  return w;
+}
+
+uint16_t makeWord(byte h, byte l) {
+  return (h << 8) | l;
+}
+
+//
+// printf. avr-libc's long is 32 bits, so %ld and %lu take int32_t and uint32_t; and its
+// default printf has no floating point at all, printing a ? instead.
+//
+
+int sim_vsnprintf(char *buf, size_t size, const char *format, va_list ap) {
+  std::string out;
+  const char *p = format;
+  while (*p) {
+    if (*p != '%') {
+      out += *p++;
+      continue;
+    }
+    std::string spec("%");
+    p++;
+    while (*p && strchr("-+ #0", *p))
+      spec += *p++;
+    if (*p == '*') {
+      char n[16];
+      ::snprintf(n, sizeof(n), "%d", va_arg(ap, int));
+      spec += n;
+      p++;
+    }
+    while (*p >= '0' && *p <= '9')
+      spec += *p++;
+    if (*p == '.') {
+      spec += *p++;
+      if (*p == '*') {
+        char n[16];
+        ::snprintf(n, sizeof(n), "%d", va_arg(ap, int));
+        spec += n;
+        p++;
+      }
+      while (*p >= '0' && *p <= '9')
+        spec += *p++;
+    }
+    bool longLong = false;
+    while (*p && strchr("hlLqjzt", *p)) {
+      if (*p == 'l' && p[1] == 'l')
+        longLong = true, p++;
+      else if (*p == 'h')
+        spec += 'h';
+      p++;
+    }
+    char conversion = *p ? *p++ : '\0';
+    char piece[512];
+    piece[0] = '\0';
+    switch (conversion) {
+      case '%':
+        out += '%';
+        break;
+      case 'd':
+      case 'i':
+        if (longLong)
+          ::snprintf(piece, sizeof(piece), (spec + "ll" + conversion).c_str(), va_arg(ap, long long));
+        else
+          ::snprintf(piece, sizeof(piece), (spec + conversion).c_str(), va_arg(ap, int));
+        break;
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+        if (longLong)
+          ::snprintf(piece, sizeof(piece), (spec + "ll" + conversion).c_str(), va_arg(ap, unsigned long long));
+        else
+          ::snprintf(piece, sizeof(piece), (spec + conversion).c_str(), va_arg(ap, unsigned int));
+        break;
+      case 'c':
+        ::snprintf(piece, sizeof(piece), (spec + conversion).c_str(), va_arg(ap, int));
+        break;
+      case 's':
+        {
+          const char *s = va_arg(ap, const char *);
+          std::string f = spec + 's';
+          int n = ::snprintf(NULL, 0, f.c_str(), s);
+          std::vector<char> tmp(n + 1);
+          ::snprintf(&tmp[0], n + 1, f.c_str(), s);
+          out += &tmp[0];
+        }
+        break;
+      case 'p':
+        ::snprintf(piece, sizeof(piece), "%p", va_arg(ap, void *));
+        break;
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+        va_arg(ap, double);
+        out += '?';
+        break;
+      default:
+        break;
+    }
+    out += piece;
+  }
+  if (size > 0) {
+    size_t n = out.size() < size - 1 ? out.size() : size - 1;
+    memcpy(buf, out.data(), n);
+    buf[n] = '\0';
+  }
+  return out.size();
+}
+
+int sim_sprintf(char *buf, const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  int n = sim_vsnprintf(buf, SIZE_MAX, format, ap);
+  va_end(ap);
+  return n;
+}
+
+int sim_snprintf(char *buf, size_t size, const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  int n = sim_vsnprintf(buf, size, format, ap);
+  va_end(ap);
+  return n;
+}
@@ -0,0 +1,232 @@
+#!/usr/bin/env python3
+from __future__ import print_function
+import sys, os, re, subprocess, tempfile, hashlib
+from optparse import OptionParser
+
+# Builds a sketch, unmodified, against the simulator's Arduino core (core/), and runs it
+# on the simulated board. See README for the peripherals and the timeline.
+#
+#   sketchsim.py [-D NAME=VALUE]... SKETCH_DIR [board options...]
+#
+# Everything after the sketch goes to the simulated board; --help there lists the options.
+# As a module: exe = build(sketch_dir, defines); output = run(exe, args).
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CORE = os.path.join(HERE, 'core')
+LIBRARIES = os.path.join(HERE, '..', 'Libraries')
+CXX = os.environ.get('CXX', 'g++')
+CXXFLAGS = ['-std=gnu++11', '-O1', '-g', '-Wall', '-Wextra', '-D__AVR_ATmega328P__', '-DF_CPU=16000000L', '-DARDUINO=101']
+
+INCLUDE = re.compile(r'^\s*#\s*include\s*[<"]([^>"]+)[>"]', re.M)
+FUNCTION = re.compile(r'^([A-Za-z_][\w\s\*]*?[\s\*])([A-Za-z_]\w*)\s*\(([^;{}]*?)\)\s*\{', re.M)
+VOLATILE = re.compile(r'^((?:static\s+)?)volatile\s+([A-Za-z_][\w\s]*?)\s+([A-Za-z_]\w*)\s*(=[^;]*)?;', re.M)
+
+class BuildError(Exception):
+	pass
+
+def strip_comments(src):
+	# Blanks out comments and strings, keeping the line structure, so the regexps
+	# below only see code
+	def blank(m):
+		s = m.group(0)
+		if s.startswith('/') or s.startswith('"') or s.startswith("'"):
+			return re.sub(r'[^\n]', ' ', s)
+		return s
+	return re.sub(r'//[^\n]*|/\*.*?\*/|"(?:\\.|[^"\\\n])*"|\'(?:\\.|[^\'\\\n])*\'', blank, src, flags = re.S)
+
+def prototypes(src):
+	# As the Arduino IDE does: a prototype for every function defined in the sketch
+	code = strip_comments(src)
+	protos = []
+	depth = 0
+	pos = 0
+	for m in FUNCTION.finditer(code):
+		# Only top-level definitions (not methods inside a struct, say)
+		depth += code[pos:m.start()].count('{') - code[pos:m.start()].count('}')
+		pos = m.start()
+		ret, name, args = m.group(1).strip(), m.group(2), m.group(3)
+		if depth != 0 or ret in ('else', 'return', 'new') or name in ('if', 'while', 'for', 'switch', 'ISR'):
+			continue
+		if ret.startswith('template'):
+			continue
+		args = re.sub(r'\s*=\s*[^,]+', '', args) # default arguments go in the prototype only once
+		protos.append('{0} {1}({2});'.format(' '.join(ret.split()), name, ' '.join(args.split())))
+	first = FUNCTION.search(code)
+	return (protos, first.start() if first else len(src))
+
+def volatile(m):
+	# "volatile T name = x;" to "sim::Volatile<T> name(x);"
+	init = m.group(4)
+	init = '({0})'.format(init[1:].strip()) if init else ''
+	return '{0}sim::Volatile<{1}> {2}{3};'.format(m.group(1), ' '.join(m.group(2).split()), m.group(3), init)
+
+def preprocess(sketch_dir, defines):
+	# Concatenates the .ino files (the main one first, then the rest by name) into one
+	# .cpp, as the IDE does, with prototypes, #defines overridden, and volatile globals
+	# made visible to the simulator (see core/sim_volatile.h)
+	name = os.path.basename(os.path.normpath(sketch_dir))
+	files = sorted(f for f in os.listdir(sketch_dir) if f.endswith('.ino') or f.endswith('.pde'))
+	main = [f for f in files if os.path.splitext(f)[0] == name]
+	if not main:
+		raise BuildError('no {0}.ino in {1}'.format(name, sketch_dir))
+	files = main + [f for f in files if f not in main]
+
+	parts = []
+	for f in files:
+		path = os.path.abspath(os.path.join(sketch_dir, f))
+		src = open(path).read()
+		for (key, value) in defines.items():
+			(src, n) = re.subn(r'^(\s*#\s*define\s+{0})\b.*$'.format(re.escape(key)), r'\g<1> ' + value.replace('\\', r'\\'), src, flags = re.M)
+			if n:
+				defines[key] = None # done
+		src = VOLATILE.sub(volatile, src)
+		parts.append((path, src))
+
+	src = ''.join('#line 1 "{0}"\n{1}\n'.format(path, s) for (path, s) in parts)
+	(protos, first) = prototypes(src)
+	line = src[:first].count('\n') # the #line directives count, so find the file and line again
+	header = src[:first]
+	last = header.rfind('#line 1 "')
+	(path, offset) = (parts[0][0], 0)
+	if last >= 0:
+		path = header[last + 9:header.index('"', last + 9)]
+		offset = header[last:].count('\n') - 1
+	out = '#include <Arduino.h>\n' + header + '\n'.join(protos) + '\n#line {0} "{1}"\n'.format(offset + 1, path) + src[first:]
+	return (name, out, [s for (p, s) in parts])
+
+def find_libraries(sources):
+	# The library directories for the headers the sketch (and the libraries) include.
+	# The simulator's core has its own versions of SPI, EEPROM, Ethernet and OneWire.
+	headers = {}
+	for (root, dirs, files) in os.walk(LIBRARIES):
+		dirs[:] = [d for d in dirs if d not in ('examples', 'extras')]
+		for f in files:
+			if f.endswith('.h'):
+				headers.setdefault(f, root)
+	libs = []
+	seen = set()
+	todo = list(sources)
+	while todo:
+		for h in INCLUDE.findall(todo.pop()):
+			if os.path.exists(os.path.join(CORE, h)):
+				# The core's headers may include libraries too
+				if h not in seen:
+					seen.add(h)
+					todo.append(open(os.path.join(CORE, h)).read())
+				continue
+			if h not in headers or headers[h] in libs:
+				continue
+			libs.append(headers[h])
+			for f in os.listdir(headers[h]):
+				if f.endswith('.h') or f.endswith('.cpp'):
+					todo.append(open(os.path.join(headers[h], f)).read())
+	return libs
+
+def newest(dirs):
+	t = 0
+	for d in dirs:
+		for f in os.listdir(d):
+			if f.endswith('.h'):
+				t = max(t, os.path.getmtime(os.path.join(d, f)))
+	return t
+
+def compile_all(build_dir, sources, flags, verbose = False):
+	# Compiles what has changed since the last build; returns the object files
+	headers = newest([CORE, os.path.join(CORE, 'avr'), os.path.join(CORE, 'util')] + [f[2:] for f in flags if f.startswith('-I')])
+	objects = []
+	for src in sources:
+		key = hashlib.md5((os.path.abspath(src) + ' '.join(flags)).encode()).hexdigest()[:12]
+		obj = os.path.join(build_dir, '{0}-{1}.o'.format(os.path.splitext(os.path.basename(src))[0], key))
+		if not os.path.exists(obj) or os.path.getmtime(obj) < max(os.path.getmtime(src), headers):
+			cmd = [CXX] + CXXFLAGS + flags + ['-c', src, '-o', obj]
+			if verbose:
+				print(' '.join(cmd), file = sys.stderr)
+			if subprocess.call(cmd) != 0:
+				raise BuildError('compiling {0} failed'.format(src))
+		objects.append(obj)
+	return objects
+
+def build(sketch_dir, defines = {}, build_dir = None, verbose = False):
+	# Builds the sketch; returns the path of the executable
+	# The tag is taken before preprocess() marks the #defines it has overridden
+	tag = hashlib.md5(repr(sorted(defines.items())).encode()).hexdigest()[:8]
+	defines = dict(defines)
+	(name, src, sources) = preprocess(sketch_dir, defines)
+	if build_dir is None:
+		build_dir = os.path.join(tempfile.gettempdir(), 'sketchsim', '{0}-{1}'.format(name, tag))
+	if not os.path.isdir(build_dir):
+		os.makedirs(build_dir)
+
+	# Defines that weren't a #define in the sketch go on the command line
+	flags = ['-D{0}={1}'.format(k, v) for (k, v) in sorted(defines.items()) if v is not None]
+	libs = find_libraries(sources + [open(os.path.join(sketch_dir, f)).read() for f in os.listdir(sketch_dir) if f.endswith('.h') or f.endswith('.cpp')])
+	flags += ['-I' + os.path.abspath(sketch_dir), '-I' + CORE] + ['-I' + l for l in libs]
+
+	sketch_cpp = os.path.join(build_dir, name + '.cpp')
+	if not os.path.exists(sketch_cpp) or open(sketch_cpp).read() != src:
+		with open(sketch_cpp, 'w') as f:
+			f.write(src)
+
+	def cpps(d):
+		return [os.path.join(d, f) for f in sorted(os.listdir(d)) if f.endswith('.cpp')]
+	sources = [sketch_cpp] + cpps(sketch_dir) + cpps(CORE)
+	for l in libs:
+		sources += cpps(l)
+	objects = compile_all(build_dir, sources, flags, verbose)
+
+	exe = os.path.join(build_dir, name)
+	cmd = [CXX] + CXXFLAGS + objects + ['-o', exe, '-lm']
+	if verbose:
+		print(' '.join(cmd), file = sys.stderr)
+	if subprocess.call(cmd) != 0:
+		raise BuildError('linking failed')
+	return exe
+
+def run(exe, args = [], stdin = None, timeout = None):
+	# Runs the simulated board; returns (exit status, serial output, stderr)
+	p = subprocess.Popen([exe] + list(args), stdin = subprocess.PIPE if stdin is not None else None,
+		stdout = subprocess.PIPE, stderr = subprocess.PIPE)
+	(out, err) = p.communicate(stdin, timeout = timeout)
+	return (p.returncode, out, err.decode('utf-8', 'replace'))
+
+def read_timeline(path, kinds = None):
+	# Parses a timeline file into (cycle, kind, [fields]) tuples
+	events = []
+	for line in open(path):
+		if line.startswith('#'):
+			continue
+		fields = line.split()
+		if kinds is None or fields[1] in kinds:
+			events.append((int(fields[0]), fields[1], fields[2:]))
+	return events
+
+def main():
+	parser = OptionParser(usage = 'Usage: %prog [options] SKETCH_DIR [board options...]\n\n'
+		'Builds SKETCH_DIR against the simulated Arduino core, and runs it.\n'
+		'"%prog SKETCH_DIR --help" lists the board options.')
+	parser.disable_interspersed_args()
+	parser.add_option('-D', dest = 'defines', action = 'append', default = [], metavar = 'NAME=VALUE',
+		help = 'override a #define in the sketch (or add one)')
+	parser.add_option('-b', '--build-only', action = 'store_true', help = "build, but don't run")
+	parser.add_option('-v', '--verbose', action = 'store_true', help = 'show the compiler commands')
+	(options, args) = parser.parse_args()
+	if len(args) < 1:
+		parser.error('no sketch')
+
+	defines = {}
+	for d in options.defines:
+		(k, _, v) = d.partition('=')
+		defines[k] = v if v else '1'
+	try:
+		exe = build(args[0], defines, verbose = options.verbose)
+	except BuildError as e:
+		print('sketchsim: {0}'.format(e), file = sys.stderr)
+		sys.exit(2)
+	if options.build_only:
+		print(exe)
+		return
+	sys.stdout.flush()
+	os.execv(exe, [exe] + args[1:])
+
+if __name__ == '__main__':
+	main()